@@ -0,0 +1,35 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stdint.h>
+
+// One shot and periodic timers with microsecond resolution. Times
+// are in the same clock as timer_hal_now(). Callbacks run in a
+// dedicated task (ESP32) or thread (POSIX), so they should just hand
+// off the work (e.g. notify a task) and return.
+
+typedef struct timer_hal_s timer_hal_t;
+
+typedef void (*timer_hal_callback_f)(timer_hal_t *timer, void *user_data);
+
+typedef struct timer_hal_s
+{
+    timer_hal_callback_f callback;
+    void *user_data;
+    void *handle; // Platform specific
+} timer_hal_t;
+
+// Monotonic time in microseconds
+uint64_t timer_hal_now(void);
+
+void timer_hal_init(timer_hal_t *timer, const char *name, timer_hal_callback_f callback, void *user_data);
+// Fires the callback once at the given time, or as soon as possible
+// if it's in the past. Restarts the timer if it was already active.
+void timer_hal_start_once(timer_hal_t *timer, uint64_t at);
+// Fires the callback every period us, starting period us from now.
+// Restarts the timer if it was already active.
+void timer_hal_start_periodic(timer_hal_t *timer, uint64_t period);
+// Stops the timer if it was active. Note that the callback might
+// still be running or about to run when this returns.
+void timer_hal_stop(timer_hal_t *timer);
+void timer_hal_destroy(timer_hal_t *timer);
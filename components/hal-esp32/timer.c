@@ -0,0 +1,62 @@
+#if defined(ESP_PLATFORM)
+
+#include <stddef.h>
+
+#include <esp_err.h>
+#include <esp_timer.h>
+
+#include <hal/timer.h>
+
+static void timer_hal_esp_callback(void *arg)
+{
+    timer_hal_t *timer = arg;
+    timer->callback(timer, timer->user_data);
+}
+
+uint64_t timer_hal_now(void)
+{
+    return esp_timer_get_time();
+}
+
+void timer_hal_init(timer_hal_t *timer, const char *name, timer_hal_callback_f callback, void *user_data)
+{
+    timer->callback = callback;
+    timer->user_data = user_data;
+    esp_timer_create_args_t args = {
+        .callback = timer_hal_esp_callback,
+        .arg = timer,
+        .dispatch_method = ESP_TIMER_TASK,
+        .name = name,
+    };
+    esp_timer_handle_t handle;
+    ESP_ERROR_CHECK(esp_timer_create(&args, &handle));
+    timer->handle = handle;
+}
+
+void timer_hal_start_once(timer_hal_t *timer, uint64_t at)
+{
+    uint64_t now = timer_hal_now();
+    // Returns an error if the timer is not running, which is fine
+    esp_timer_stop(timer->handle);
+    ESP_ERROR_CHECK(esp_timer_start_once(timer->handle, at > now ? at - now : 0));
+}
+
+void timer_hal_start_periodic(timer_hal_t *timer, uint64_t period)
+{
+    esp_timer_stop(timer->handle);
+    ESP_ERROR_CHECK(esp_timer_start_periodic(timer->handle, period));
+}
+
+void timer_hal_stop(timer_hal_t *timer)
+{
+    esp_timer_stop(timer->handle);
+}
+
+void timer_hal_destroy(timer_hal_t *timer)
+{
+    esp_timer_stop(timer->handle);
+    ESP_ERROR_CHECK(esp_timer_delete(timer->handle));
+    timer->handle = NULL;
+}
+
+#endif
@@ -0,0 +1,132 @@
+#if !defined(ESP_PLATFORM)
+
+// POSIX implementation of hal/timer.h, used to run and benchmark the
+// timing code on a Linux host. Each timer has its own thread.
+
+#include <errno.h>
+#include <pthread.h>
+#include <stdlib.h>
+#include <time.h>
+
+#include <hal/timer.h>
+
+#define TIMER_HAL_STOPPED UINT64_MAX
+
+typedef struct timer_hal_posix_s
+{
+    pthread_t thread;
+    pthread_mutex_t mutex;
+    pthread_cond_t cond;
+    uint64_t deadline; // TIMER_HAL_STOPPED if not active
+    uint64_t period;   // 0 for one shot timers
+    bool quit;
+} timer_hal_posix_t;
+
+static void timer_hal_timespec(struct timespec *ts, uint64_t us)
+{
+    ts->tv_sec = us / 1000000;
+    ts->tv_nsec = (us % 1000000) * 1000;
+}
+
+static void *timer_hal_posix_thread(void *arg)
+{
+    timer_hal_t *timer = arg;
+    timer_hal_posix_t *p = timer->handle;
+    struct timespec ts;
+    pthread_mutex_lock(&p->mutex);
+    while (!p->quit)
+    {
+        if (p->deadline == TIMER_HAL_STOPPED)
+        {
+            pthread_cond_wait(&p->cond, &p->mutex);
+            continue;
+        }
+        uint64_t now = timer_hal_now();
+        if (now < p->deadline)
+        {
+            // Might return early if the timer is changed, so we
+            // always check the deadline again.
+            timer_hal_timespec(&ts, p->deadline);
+            pthread_cond_timedwait(&p->cond, &p->mutex, &ts);
+            continue;
+        }
+        if (p->period > 0)
+        {
+            p->deadline += p->period;
+        }
+        else
+        {
+            p->deadline = TIMER_HAL_STOPPED;
+        }
+        pthread_mutex_unlock(&p->mutex);
+        timer->callback(timer, timer->user_data);
+        pthread_mutex_lock(&p->mutex);
+    }
+    pthread_mutex_unlock(&p->mutex);
+    return NULL;
+}
+
+static void timer_hal_posix_set(timer_hal_t *timer, uint64_t deadline, uint64_t period)
+{
+    timer_hal_posix_t *p = timer->handle;
+    pthread_mutex_lock(&p->mutex);
+    p->deadline = deadline;
+    p->period = period;
+    pthread_cond_signal(&p->cond);
+    pthread_mutex_unlock(&p->mutex);
+}
+
+uint64_t timer_hal_now(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+void timer_hal_init(timer_hal_t *timer, const char *name, timer_hal_callback_f callback, void *user_data)
+{
+    timer->callback = callback;
+    timer->user_data = user_data;
+    timer_hal_posix_t *p = calloc(1, sizeof(*p));
+    pthread_condattr_t attr;
+    pthread_condattr_init(&attr);
+    // Deadlines use timer_hal_now(), which is monotonic
+    pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+    pthread_cond_init(&p->cond, &attr);
+    pthread_condattr_destroy(&attr);
+    pthread_mutex_init(&p->mutex, NULL);
+    p->deadline = TIMER_HAL_STOPPED;
+    timer->handle = p;
+    pthread_create(&p->thread, NULL, timer_hal_posix_thread, timer);
+}
+
+void timer_hal_start_once(timer_hal_t *timer, uint64_t at)
+{
+    timer_hal_posix_set(timer, at, 0);
+}
+
+void timer_hal_start_periodic(timer_hal_t *timer, uint64_t period)
+{
+    timer_hal_posix_set(timer, timer_hal_now() + period, period);
+}
+
+void timer_hal_stop(timer_hal_t *timer)
+{
+    timer_hal_posix_set(timer, TIMER_HAL_STOPPED, 0);
+}
+
+void timer_hal_destroy(timer_hal_t *timer)
+{
+    timer_hal_posix_t *p = timer->handle;
+    pthread_mutex_lock(&p->mutex);
+    p->quit = true;
+    pthread_cond_signal(&p->cond);
+    pthread_mutex_unlock(&p->mutex);
+    pthread_join(p->thread, NULL);
+    pthread_cond_destroy(&p->cond);
+    pthread_mutex_destroy(&p->mutex);
+    free(p);
+    timer->handle = NULL;
+}
+
+#endif
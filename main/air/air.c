@@ -12,6 +12,7 @@
 #include "rc/rc_data.h"
 
 #include "util/crc.h"
+#include "util/fec.h"
 
 #include "air.h"
 
@@ -58,6 +59,10 @@ void air_bind_packet_prepare(air_bind_packet_t *packet)
     packet->info.capabilities |= AIR_CAP_FREQUENCY_915MHZ;
 #endif
     packet->info.capabilities |= AIR_CAP_P2P_2_4GHZ_WIFI;
+    packet->info.capabilities |= AIR_CAP_FEC;
+    packet->info.capabilities |= AIR_CAP_CHANNEL_DELTA;
+    packet->info.capabilities |= AIR_CAP_FREQ_SUBSTITUTION;
+    packet->info.capabilities |= AIR_CAP_MSP_COMPRESSION;
     if (system_has_flag(SYSTEM_FLAG_BUTTON))
     {
         packet->info.capabilities |= AIR_CAP_BUTTON;
@@ -125,6 +130,54 @@ bool air_rx_packet_validate(air_rx_packet_t *packet, air_key_t key)
     return packet->crc == air_packet_crc(packet, sizeof(*packet), key);
 }
 
+_Static_assert(AIR_FEC_SIZE == FEC_RS_PARITY_SIZE, "AIR_FEC_SIZE != FEC_RS_PARITY_SIZE");
+
+size_t air_tx_fec_packet_prepare(air_tx_fec_packet_t *packet, air_key_t key, bool fec)
+{
+    air_tx_packet_prepare(&packet->packet, key);
+    if (fec)
+    {
+        fec_rs_encode(&packet->packet, sizeof(packet->packet), packet->fec);
+    }
+    return air_tx_packet_size(fec);
+}
+
+bool air_tx_fec_packet_validate(air_tx_fec_packet_t *packet, size_t size, air_key_t key, bool fec)
+{
+    if (size != air_tx_packet_size(fec))
+    {
+        return false;
+    }
+    if (fec && !fec_rs_decode(&packet->packet, sizeof(packet->packet), packet->fec))
+    {
+        return false;
+    }
+    return air_tx_packet_validate(&packet->packet, key);
+}
+
+size_t air_rx_fec_packet_prepare(air_rx_fec_packet_t *packet, air_key_t key, bool fec)
+{
+    air_rx_packet_prepare(&packet->packet, key);
+    if (fec)
+    {
+        fec_rs_encode(&packet->packet, sizeof(packet->packet), packet->fec);
+    }
+    return air_rx_packet_size(fec);
+}
+
+bool air_rx_fec_packet_validate(air_rx_fec_packet_t *packet, size_t size, air_key_t key, bool fec)
+{
+    if (size != air_rx_packet_size(fec))
+    {
+        return false;
+    }
+    if (fec && !fec_rs_decode(&packet->packet, sizeof(packet->packet), packet->fec))
+    {
+        return false;
+    }
+    return air_rx_packet_validate(&packet->packet, key);
+}
+
 uint8_t air_sync_word(air_key_t key)
 {
     return crc8_dvb_s2_bytes(&key, sizeof(key));
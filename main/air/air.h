@@ -34,6 +34,12 @@ typedef enum {
     AIR_CAP_P2P_2_4GHZ_WIFI = 1 << 10, // 2.4ghz but restricted to valid raw WiFi packets
     AIR_CAP_P2P_FLARM = 1 << 11,       // flarm support
 
+    // Air protocol
+    AIR_CAP_FEC = 1 << 16,               // Supports FEC protected air_tx_fec_packet_t/air_rx_fec_packet_t
+    AIR_CAP_CHANNEL_DELTA = 1 << 17,     // Supports variable resolution channels in air_tx_packet_t (see air_channels.h)
+    AIR_CAP_FREQ_SUBSTITUTION = 1 << 18, // Supports AIR_CMD_FREQ_SUBSTITUTE and AIR_CMD_FREQ_SUBSTITUTE_ACK
+    AIR_CAP_MSP_COMPRESSION = 1 << 19,   // Supports AIR_CMD_MSP_COMPRESSED (see msp_compress.h)
+
     // Hardware
     AIR_CAP_BATTERY = 1 << 24,           // Node has an on-board battery
     AIR_CAP_SCREEN = 1 << 25,            // Node has a screen
@@ -126,6 +132,38 @@ typedef struct air_rx_packet_s
 
 _Static_assert(sizeof(air_rx_packet_t) == 5, "invalid air_rx_packet_t size");
 
+// Used instead of the plain packets when both ends support AIR_CAP_FEC
+// and the packets fit in the current mode (see air_lora_mode_supports_fec()).
+// fec contains the parity bytes of a Reed-Solomon code over the packet
+// (including its CRC), so a single corrupted byte can be corrected.
+#define AIR_FEC_SIZE 2
+
+typedef struct air_tx_fec_packet_s
+{
+    air_tx_packet_t packet;
+    uint8_t fec[AIR_FEC_SIZE];
+} PACKED air_tx_fec_packet_t;
+
+_Static_assert(sizeof(air_tx_fec_packet_t) == 10, "invalid air_tx_fec_packet_t size");
+
+typedef struct air_rx_fec_packet_s
+{
+    air_rx_packet_t packet;
+    uint8_t fec[AIR_FEC_SIZE];
+} PACKED air_rx_fec_packet_t;
+
+_Static_assert(sizeof(air_rx_fec_packet_t) == 7, "invalid air_rx_fec_packet_t size");
+
+inline size_t air_tx_packet_size(bool fec)
+{
+    return fec ? sizeof(air_tx_fec_packet_t) : sizeof(air_tx_packet_t);
+}
+
+inline size_t air_rx_packet_size(bool fec)
+{
+    return fec ? sizeof(air_rx_fec_packet_t) : sizeof(air_rx_packet_t);
+}
+
 void air_addr_format(const air_addr_t *addr, char *buf, size_t bufsize);
 
 inline bool air_addr_equals(const air_addr_t *addr1, const air_addr_t *addr2)
@@ -177,5 +215,13 @@ void air_tx_packet_prepare(air_tx_packet_t *packet, air_key_t key);
 bool air_tx_packet_validate(air_tx_packet_t *packet, air_key_t key);
 void air_rx_packet_prepare(air_rx_packet_t *packet, air_key_t key);
 bool air_rx_packet_validate(air_rx_packet_t *packet, air_key_t key);
+// FEC variants. prepare() returns the number of bytes to send, while
+// validate() takes the number of received bytes and corrects the packet
+// in place if required. If fec is false, they behave like the non-FEC
+// versions and the fec field is not used.
+size_t air_tx_fec_packet_prepare(air_tx_fec_packet_t *packet, air_key_t key, bool fec);
+bool air_tx_fec_packet_validate(air_tx_fec_packet_t *packet, size_t size, air_key_t key, bool fec);
+size_t air_rx_fec_packet_prepare(air_rx_fec_packet_t *packet, air_key_t key, bool fec);
+bool air_rx_fec_packet_validate(air_rx_fec_packet_t *packet, size_t size, air_key_t key, bool fec);
 
 uint8_t air_sync_word(air_key_t key);
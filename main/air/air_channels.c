@@ -0,0 +1,327 @@
+#include <stdlib.h>
+#include <string.h>
+
+#include "util/macros.h"
+
+#include "air_channels.h"
+
+// Channel bits start after seq in air_tx_packet_t. Bitfields are allocated
+// starting from the least significant bit, so we use the same order.
+#define AIR_CHANNELS_BITS_START AIR_SEQ_BITS
+#define AIR_CHANNELS_BITS_END (AIR_SEQ_BITS + AIR_CHANNELS_STICK_COUNT * AIR_CHANNEL_BITS)
+
+#define AIR_CHANNELS_DELTA_BITS 5
+#define AIR_CHANNELS_DELTA_MIN (-(1 << (AIR_CHANNELS_DELTA_BITS - 1)))
+#define AIR_CHANNELS_DELTA_MAX ((1 << (AIR_CHANNELS_DELTA_BITS - 1)) - 1)
+
+#define AIR_CHANNELS_AUX_INDEX_BITS 4
+
+// Size of each code, including its prefix
+#define AIR_CHANNELS_STICK_UNCHANGED_SIZE 1
+#define AIR_CHANNELS_STICK_DELTA_SIZE (2 + AIR_CHANNELS_DELTA_BITS)
+#define AIR_CHANNELS_STICK_ABSOLUTE_SIZE (2 + AIR_CHANNEL_BITS)
+#define AIR_CHANNELS_AUX_2_BIT_SIZE (1 + AIR_CHANNELS_AUX_INDEX_BITS + 1 + 2)
+#define AIR_CHANNELS_AUX_ABSOLUTE_SIZE (1 + AIR_CHANNELS_AUX_INDEX_BITS + 1 + AIR_CHANNEL_BITS)
+
+_Static_assert(RC_CHANNELS_NUM - AIR_CHANNELS_STICK_COUNT <= (1 << AIR_CHANNELS_AUX_INDEX_BITS), "too many aux channels");
+_Static_assert(AIR_CHANNELS_STICK_COUNT * AIR_CHANNELS_STICK_ABSOLUTE_SIZE > AIR_CHANNELS_BITS_END - AIR_CHANNELS_BITS_START,
+               "review air_channels_encode() budget");
+
+typedef enum {
+    STICK_CODE_UNCHANGED,
+    STICK_CODE_DELTA,
+    STICK_CODE_ABSOLUTE,
+} stick_code_e;
+
+typedef struct air_channels_bits_s
+{
+    uint8_t *data;
+    unsigned pos;
+} air_channels_bits_t;
+
+static unsigned air_channels_bits_left(const air_channels_bits_t *b)
+{
+    return AIR_CHANNELS_BITS_END - b->pos;
+}
+
+static void air_channels_bits_write(air_channels_bits_t *b, unsigned value, unsigned nbits)
+{
+    for (unsigned ii = 0; ii < nbits; ii++, b->pos++)
+    {
+        uint8_t mask = 1 << (b->pos % 8);
+        if (value & (1 << ii))
+        {
+            b->data[b->pos / 8] |= mask;
+        }
+        else
+        {
+            b->data[b->pos / 8] &= ~mask;
+        }
+    }
+}
+
+static unsigned air_channels_bits_read(air_channels_bits_t *b, unsigned nbits)
+{
+    unsigned value = 0;
+    for (unsigned ii = 0; ii < nbits; ii++, b->pos++)
+    {
+        if (b->data[b->pos / 8] & (1 << (b->pos % 8)))
+        {
+            value |= 1 << ii;
+        }
+    }
+    return value;
+}
+
+static unsigned air_channels_stick_code_size(stick_code_e code)
+{
+    switch (code)
+    {
+    case STICK_CODE_UNCHANGED:
+        return AIR_CHANNELS_STICK_UNCHANGED_SIZE;
+    case STICK_CODE_DELTA:
+        return AIR_CHANNELS_STICK_DELTA_SIZE;
+    case STICK_CODE_ABSOLUTE:
+        return AIR_CHANNELS_STICK_ABSOLUTE_SIZE;
+    }
+    UNREACHABLE();
+    return 0;
+}
+
+void air_channels_encoder_reset(air_channels_encoder_t *enc)
+{
+    memset(enc->sent, 0, sizeof(enc->sent));
+    enc->unsynced = (1 << AIR_CHANNELS_STICK_COUNT) - 1;
+    enc->refresh = 0;
+}
+
+static unsigned air_channels_encode_sticks(air_channels_encoder_t *enc, stick_code_e *codes, const uint16_t *values)
+{
+    unsigned budget = AIR_CHANNELS_BITS_END - AIR_CHANNELS_BITS_START;
+    unsigned used = 0;
+    int diffs[AIR_CHANNELS_STICK_COUNT];
+    for (int ii = 0; ii < AIR_CHANNELS_STICK_COUNT; ii++)
+    {
+        // Sticks without a previous value can only be sent as absolute
+        diffs[ii] = (enc->unsynced & (1 << ii)) ? INT16_MAX : values[ii] - enc->sent[ii];
+        codes[ii] = STICK_CODE_UNCHANGED;
+        used += AIR_CHANNELS_STICK_UNCHANGED_SIZE;
+    }
+    // Allocate bits to the sticks which moved the most first. If they
+    // don't fit, they're sent in the next packet.
+    for (int ii = 0; ii < AIR_CHANNELS_STICK_COUNT; ii++)
+    {
+        int idx = -1;
+        for (int jj = 0; jj < AIR_CHANNELS_STICK_COUNT; jj++)
+        {
+            if (codes[jj] == STICK_CODE_UNCHANGED && diffs[jj] != 0 &&
+                (idx < 0 || abs(diffs[jj]) > abs(diffs[idx])))
+            {
+                idx = jj;
+            }
+        }
+        if (idx < 0)
+        {
+            break;
+        }
+        stick_code_e code = diffs[idx] >= AIR_CHANNELS_DELTA_MIN && diffs[idx] <= AIR_CHANNELS_DELTA_MAX ? STICK_CODE_DELTA : STICK_CODE_ABSOLUTE;
+        unsigned extra = air_channels_stick_code_size(code) - AIR_CHANNELS_STICK_UNCHANGED_SIZE;
+        if (used + extra <= budget)
+        {
+            codes[idx] = code;
+            used += extra;
+        }
+        // Don't consider this one again
+        diffs[idx] = 0;
+    }
+    // Refresh one stick if possible, so the RX can recover from lost packets
+    unsigned refresh = enc->refresh++ % AIR_CHANNELS_STICK_COUNT;
+    if (codes[refresh] != STICK_CODE_ABSOLUTE)
+    {
+        unsigned extra = AIR_CHANNELS_STICK_ABSOLUTE_SIZE - air_channels_stick_code_size(codes[refresh]);
+        if (used + extra <= budget)
+        {
+            codes[refresh] = STICK_CODE_ABSOLUTE;
+            used += extra;
+        }
+    }
+    return used;
+}
+
+void air_channels_encode(air_channels_encoder_t *enc, air_tx_packet_t *packet, rc_data_t *data, time_micros_t now)
+{
+    air_channels_bits_t b = {.data = (uint8_t *)packet, .pos = AIR_CHANNELS_BITS_START};
+    uint16_t values[AIR_CHANNELS_STICK_COUNT];
+    stick_code_e codes[AIR_CHANNELS_STICK_COUNT];
+    for (int ii = 0; ii < AIR_CHANNELS_STICK_COUNT; ii++)
+    {
+        values[ii] = RC_CHANNEL_ENCODE_TO_BITS(data->channels[ii].value, AIR_CHANNEL_BITS);
+    }
+    air_channels_encode_sticks(enc, codes, values);
+    for (int ii = 0; ii < AIR_CHANNELS_STICK_COUNT; ii++)
+    {
+        switch (codes[ii])
+        {
+        case STICK_CODE_UNCHANGED:
+            air_channels_bits_write(&b, 0, 1);
+            break;
+        case STICK_CODE_DELTA:
+            air_channels_bits_write(&b, 1, 2);
+            air_channels_bits_write(&b, values[ii] - enc->sent[ii], AIR_CHANNELS_DELTA_BITS);
+            enc->sent[ii] = values[ii];
+            break;
+        case STICK_CODE_ABSOLUTE:
+            air_channels_bits_write(&b, 3, 2);
+            air_channels_bits_write(&b, values[ii], AIR_CHANNEL_BITS);
+            enc->sent[ii] = values[ii];
+            enc->unsynced &= ~(1 << ii);
+            break;
+        }
+    }
+    // Fill the remaining bits with the aux channels with the highest
+    // scores, skipping the ones already acknowledged by the RX.
+    uint32_t included = 0;
+    while (air_channels_bits_left(&b) >= AIR_CHANNELS_AUX_2_BIT_SIZE)
+    {
+        control_channel_t *ch = NULL;
+        int chn = -1;
+        uint32_t max_score = 0;
+        for (int ii = AIR_CHANNELS_STICK_COUNT; ii < data->channels_num; ii++)
+        {
+            if ((included & (1 << ii)) || data_state_is_ack_received(&data->channels[ii].data_state))
+            {
+                continue;
+            }
+            uint32_t score = data_state_score(&data->channels[ii].data_state, now);
+            if (score > max_score)
+            {
+                ch = &data->channels[ii];
+                chn = ii;
+                max_score = score;
+            }
+        }
+        if (!ch)
+        {
+            break;
+        }
+        included |= 1 << chn;
+        unsigned two_bit_value;
+        switch (ch->value)
+        {
+        case RC_CHANNEL_MIN_VALUE:
+            two_bit_value = 0;
+            break;
+        case RC_CHANNEL_CENTER_VALUE:
+            two_bit_value = 1;
+            break;
+        case RC_CHANNEL_MAX_VALUE:
+            two_bit_value = 2;
+            break;
+        default:
+            if (air_channels_bits_left(&b) < AIR_CHANNELS_AUX_ABSOLUTE_SIZE)
+            {
+                // Doesn't fit, but a 2 bit channel might
+                continue;
+            }
+            air_channels_bits_write(&b, 1, 1);
+            air_channels_bits_write(&b, chn - AIR_CHANNELS_STICK_COUNT, AIR_CHANNELS_AUX_INDEX_BITS);
+            air_channels_bits_write(&b, 1, 1);
+            air_channels_bits_write(&b, RC_CHANNEL_ENCODE_TO_BITS(ch->value, AIR_CHANNEL_BITS), AIR_CHANNEL_BITS);
+            data_state_sent(&ch->data_state, packet->seq, now);
+            continue;
+        }
+        air_channels_bits_write(&b, 1, 1);
+        air_channels_bits_write(&b, chn - AIR_CHANNELS_STICK_COUNT, AIR_CHANNELS_AUX_INDEX_BITS);
+        air_channels_bits_write(&b, 0, 1);
+        air_channels_bits_write(&b, two_bit_value, 2);
+        data_state_sent(&ch->data_state, packet->seq, now);
+    }
+    // Terminate the aux channel list
+    air_channels_bits_write(&b, 0, air_channels_bits_left(&b));
+}
+
+void air_channels_decoder_reset(air_channels_decoder_t *dec)
+{
+    dec->synced = 0;
+    dec->last_seq = -1;
+    dec->last_decoded_at = 0;
+}
+
+void air_channels_decode(air_channels_decoder_t *dec, const air_tx_packet_t *packet, time_micros_t packet_interval,
+                         air_channels_channel_f channel, void *user, time_micros_t now)
+{
+    air_channels_bits_t b = {.data = (uint8_t *)packet, .pos = AIR_CHANNELS_BITS_START};
+    if (dec->last_seq < 0 || packet->seq != (dec->last_seq + 1) % AIR_SEQ_COUNT)
+    {
+        // We missed at least a packet, deltas can't be applied
+        dec->synced = 0;
+    }
+    else if (now - dec->last_decoded_at >= packet_interval * AIR_SEQ_COUNT)
+    {
+        // seq wrapped around while we weren't receiving, so it looks
+        // consecutive but we might have missed AIR_SEQ_COUNT packets.
+        dec->synced = 0;
+    }
+    dec->last_seq = packet->seq;
+    dec->last_decoded_at = now;
+    for (int ii = 0; ii < AIR_CHANNELS_STICK_COUNT; ii++)
+    {
+        if (air_channels_bits_read(&b, 1) == 0)
+        {
+            // Unchanged
+            continue;
+        }
+        if (air_channels_bits_read(&b, 1) == 0)
+        {
+            int delta = air_channels_bits_read(&b, AIR_CHANNELS_DELTA_BITS);
+            // Sign extend
+            delta -= (delta & (1 << (AIR_CHANNELS_DELTA_BITS - 1))) << 1;
+            if (!(dec->synced & (1 << ii)))
+            {
+                continue;
+            }
+            dec->values[ii] += delta;
+        }
+        else
+        {
+            dec->values[ii] = air_channels_bits_read(&b, AIR_CHANNEL_BITS);
+            dec->synced |= 1 << ii;
+        }
+        channel(user, ii, RC_CHANNEL_DECODE_FROM_BITS(dec->values[ii], AIR_CHANNEL_BITS), now);
+    }
+    while (air_channels_bits_left(&b) >= AIR_CHANNELS_AUX_2_BIT_SIZE && air_channels_bits_read(&b, 1))
+    {
+        unsigned chn = air_channels_bits_read(&b, AIR_CHANNELS_AUX_INDEX_BITS) + AIR_CHANNELS_STICK_COUNT;
+        unsigned value;
+        if (air_channels_bits_read(&b, 1))
+        {
+            if (air_channels_bits_left(&b) < AIR_CHANNEL_BITS)
+            {
+                break;
+            }
+            unsigned air_value = air_channels_bits_read(&b, AIR_CHANNEL_BITS);
+            value = RC_CHANNEL_DECODE_FROM_BITS(air_value, AIR_CHANNEL_BITS);
+        }
+        else
+        {
+            switch (air_channels_bits_read(&b, 2))
+            {
+            case 0:
+                value = RC_CHANNEL_MIN_VALUE;
+                break;
+            case 1:
+                value = RC_CHANNEL_CENTER_VALUE;
+                break;
+            case 2:
+                value = RC_CHANNEL_MAX_VALUE;
+                break;
+            default:
+                continue;
+            }
+        }
+        if (chn < RC_CHANNELS_NUM)
+        {
+            channel(user, chn, value, now);
+        }
+    }
+}
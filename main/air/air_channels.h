@@ -0,0 +1,58 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "air/air.h"
+
+#include "rc/rc_data.h"
+
+#include "util/time.h"
+
+// Alternative encoding for the channel bits of air_tx_packet_t (ch0-ch3),
+// used when both ends support AIR_CAP_CHANNEL_DELTA. Instead of 4 sticks
+// at fixed resolution, the 36 bits contain:
+//
+// - One code per stick: unchanged (1 bit), a delta from the value sent in
+// the previous packet (7 bits) or the absolute value (11 bits).
+// - As many aux channels as fit in the remaining bits, either as a 2 bit
+// min/center/max value (8 bits total) or as an absolute value (15 bits).
+//
+// Deltas are only applied by the RX if it received the previous packet,
+// otherwise the stick holds its value until its absolute value is received.
+// The TX sends an absolute value for one stick in each packet (round robin)
+// when there are bits left, so the RX recovers after a few packets.
+//
+// seq only has AIR_SEQ_BITS, so a gap of AIR_SEQ_COUNT lost packets looks
+// like no gap at all. The RX also drops the stick values after going
+// longer than AIR_SEQ_COUNT packet intervals without a packet.
+#define AIR_CHANNELS_STICK_COUNT 4
+
+typedef void (*air_channels_channel_f)(void *user, unsigned chn, unsigned value, time_micros_t now);
+
+typedef struct air_channels_encoder_s
+{
+    uint16_t sent[AIR_CHANNELS_STICK_COUNT]; // In air units
+    uint8_t unsynced;                        // Bitmask of sticks which need an absolute value
+    unsigned refresh;
+} air_channels_encoder_t;
+
+typedef struct air_channels_decoder_s
+{
+    uint16_t values[AIR_CHANNELS_STICK_COUNT]; // In air units
+    uint8_t synced;                            // Bitmask of sticks with a valid value
+    int last_seq;
+    time_micros_t last_decoded_at;
+} air_channels_decoder_t;
+
+void air_channels_encoder_reset(air_channels_encoder_t *enc);
+// Encodes the channels into packet, which must already have its seq set. Aux
+// channels included in the packet are marked as sent in their data_state_t.
+void air_channels_encode(air_channels_encoder_t *enc, air_tx_packet_t *packet, rc_data_t *data, time_micros_t now);
+
+void air_channels_decoder_reset(air_channels_decoder_t *dec);
+// Decodes the channels from packet, calling channel for each one of them.
+// packet_interval is the shortest time between two packets in the current
+// mode, used to detect gaps that seq can't tell apart.
+void air_channels_decode(air_channels_decoder_t *dec, const air_tx_packet_t *packet, time_micros_t packet_interval,
+                         air_channels_channel_f channel, void *user, time_micros_t now);
@@ -1,3 +1,5 @@
+#include "air/air_freq.h"
+
 #include "air_cmd.h"
 
 int air_cmd_size(air_cmd_e cmd)
@@ -11,9 +13,16 @@ int air_cmd_size(air_cmd_e cmd)
     case AIR_CMD_SWITCH_MODE_3:
     case AIR_CMD_SWITCH_MODE_4:
     case AIR_CMD_SWITCH_MODE_5:
+    case AIR_CMD_SWITCH_MODE_6:
+    case AIR_CMD_SWITCH_MODE_7:
         return 0;
+    case AIR_CMD_FREQ_SUBSTITUTE:
+        return sizeof(air_freq_substitution_t);
+    case AIR_CMD_FREQ_SUBSTITUTE_ACK:
+        return sizeof(air_freq_substitution_ack_t);
     case AIR_CMD_MSP:
     case AIR_CMD_RMP:
+    case AIR_CMD_MSP_COMPRESSED:
         return -1;
     }
     return INT_MAX;
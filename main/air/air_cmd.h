@@ -16,9 +16,15 @@ typedef enum {
     AIR_CMD_SWITCH_MODE_3 = 3,
     AIR_CMD_SWITCH_MODE_4 = 4,
     AIR_CMD_SWITCH_MODE_5 = 5,
+    AIR_CMD_SWITCH_MODE_6 = 6,
+    AIR_CMD_SWITCH_MODE_7 = 7,
+
+    AIR_CMD_FREQ_SUBSTITUTE = 8,     // air_freq_substitution_t, TX to RX
+    AIR_CMD_FREQ_SUBSTITUTE_ACK = 9, // air_freq_substitution_ack_t, RX to TX
 
     AIR_CMD_MSP = 32,
     AIR_CMD_RMP = 33,
+    AIR_CMD_MSP_COMPRESSED = 34, // Same as AIR_CMD_MSP with the payload compressed by msp_compress()
 } air_cmd_e;
 
 inline air_lora_mode_e air_lora_mode_from_cmd(air_cmd_e cmd)
@@ -28,6 +34,8 @@ inline air_lora_mode_e air_lora_mode_from_cmd(air_cmd_e cmd)
     _Static_assert(AIR_CMD_SWITCH_MODE_3 == (air_cmd_e)AIR_LORA_MODE_3, "AIR_CMD_SWITCH_MODE_3 != AIR_LORA_MODE_3");
     _Static_assert(AIR_CMD_SWITCH_MODE_4 == (air_cmd_e)AIR_LORA_MODE_4, "AIR_CMD_SWITCH_MODE_4 != AIR_LORA_MODE_4");
     _Static_assert(AIR_CMD_SWITCH_MODE_5 == (air_cmd_e)AIR_LORA_MODE_5, "AIR_CMD_SWITCH_MODE_5 != AIR_LORA_MODE_5");
+    _Static_assert(AIR_CMD_SWITCH_MODE_6 == (air_cmd_e)AIR_LORA_MODE_6, "AIR_CMD_SWITCH_MODE_6 != AIR_LORA_MODE_6");
+    _Static_assert(AIR_CMD_SWITCH_MODE_7 == (air_cmd_e)AIR_LORA_MODE_7, "AIR_CMD_SWITCH_MODE_7 != AIR_LORA_MODE_7");
 
     // XXX: This assumes modes have the same number as the commands
     return (air_lora_mode_e)cmd;
@@ -1,3 +1,5 @@
+#include <string.h>
+
 #include <hal/log.h>
 
 #include "air/air_freq.h"
@@ -8,18 +10,152 @@
 
 #define MAX_OFFSET (23 * 2) // in 0.125mhz steps, so 64/8 = 8Mhz up/down
 
+// Slots need at least this number of samples before their loss rate
+// is considered. Note that each slot is visited once every 16 packets.
+#define STATS_MIN_SAMPLES 16
+#define STATS_MAX_SAMPLES 64
+// A slot is bad when it loses at least BAD_SLOT_MIN_LOSS_RATE % of
+// the packets and BAD_SLOT_MARGIN % more than the average of the rest.
+#define BAD_SLOT_MIN_LOSS_RATE 40
+#define BAD_SLOT_MARGIN 25
+
 static const char *TAG = "Air.Freq";
 
+static unsigned long air_freq_next(uint32_t *lfsr, unsigned long base_freq)
+{
+    uint32_t b = ((*lfsr >> 0) ^ (*lfsr >> 2) ^ (*lfsr >> 3) ^ (*lfsr >> 5)) & 1;
+    *lfsr = (*lfsr >> 1) | (b << 15);
+    return base_freq + (((int64_t)*lfsr % (MAX_OFFSET * 2) - MAX_OFFSET)) * 1e6 / 8;
+}
+
 void air_freq_table_init(air_freq_table_t *tbl, air_key_t key, unsigned long base_freq)
 {
     LOG_D(TAG, "Calculating freq table with key %u, base %lu", key, base_freq);
     uint32_t lfsr = key;
-    uint32_t b;
+    for (int ii = 0; ii < ARRAY_COUNT(tbl->base_freqs); ii++)
+    {
+        tbl->base_freqs[ii] = air_freq_next(&lfsr, base_freq);
+        lora_frf_from_frequency(&tbl->base_frfs[ii], tbl->base_freqs[ii]);
+        LOG_D(TAG, "Freq %d = %lu", ii, tbl->base_freqs[ii]);
+    }
+    // Keep using the same sequence for the spares
+    for (int ii = 0; ii < ARRAY_COUNT(tbl->spares); ii++)
+    {
+        tbl->spares[ii] = air_freq_next(&lfsr, base_freq);
+        lora_frf_from_frequency(&tbl->spare_frfs[ii], tbl->spares[ii]);
+    }
+    air_freq_table_reset(tbl);
+}
+
+void air_freq_table_reset(air_freq_table_t *tbl)
+{
+    memcpy(tbl->freqs, tbl->base_freqs, sizeof(tbl->freqs));
+    memcpy(tbl->frfs, tbl->base_frfs, sizeof(tbl->frfs));
+    tbl->next_spare = 0;
+}
+
+static bool air_freq_table_contains(const air_freq_table_t *tbl, unsigned long freq)
+{
     for (int ii = 0; ii < ARRAY_COUNT(tbl->freqs); ii++)
     {
-        b = ((lfsr >> 0) ^ (lfsr >> 2) ^ (lfsr >> 3) ^ (lfsr >> 5)) & 1;
-        lfsr = (lfsr >> 1) | (b << 15);
-        tbl->freqs[ii] = base_freq + (((int64_t)lfsr % (MAX_OFFSET * 2) - MAX_OFFSET)) * 1e6 / 8;
-        LOG_D(TAG, "Freq %d = %lu", ii, tbl->freqs[ii]);
+        if (tbl->freqs[ii] == freq)
+        {
+            return true;
+        }
+    }
+    return false;
+}
+
+int air_freq_table_next_spare(const air_freq_table_t *tbl)
+{
+    for (int ii = 0; ii < AIR_FREQ_SPARE_COUNT; ii++)
+    {
+        unsigned spare = (tbl->next_spare + ii) % AIR_FREQ_SPARE_COUNT;
+        if (!air_freq_table_contains(tbl, tbl->spares[spare]))
+        {
+            return spare;
+        }
+    }
+    return -1;
+}
+
+void air_freq_table_substitute(air_freq_table_t *tbl, unsigned slot, unsigned spare)
+{
+    LOG_I(TAG, "Substitute freq %lu in slot %u with %lu", tbl->freqs[slot], slot, tbl->spares[spare]);
+    tbl->freqs[slot] = tbl->spares[spare];
+    tbl->frfs[slot] = tbl->spare_frfs[spare];
+    tbl->next_spare = (spare + 1) % AIR_FREQ_SPARE_COUNT;
+}
+
+void air_freq_stats_reset(air_freq_stats_t *stats)
+{
+    memset(stats, 0, sizeof(*stats));
+}
+
+void air_freq_stats_reset_slot(air_freq_stats_t *stats, unsigned slot)
+{
+    stats->success[slot] = 0;
+    stats->lost[slot] = 0;
+}
+
+void air_freq_stats_update(air_freq_stats_t *stats, unsigned slot, bool success)
+{
+    if (success)
+    {
+        stats->success[slot]++;
+    }
+    else
+    {
+        stats->lost[slot]++;
+    }
+    if (stats->success[slot] + stats->lost[slot] >= STATS_MAX_SAMPLES)
+    {
+        stats->success[slot] /= 2;
+        stats->lost[slot] /= 2;
+    }
+}
+
+int air_freq_stats_loss_rate(const air_freq_stats_t *stats, unsigned slot)
+{
+    unsigned total = stats->success[slot] + stats->lost[slot];
+    if (total < STATS_MIN_SAMPLES)
+    {
+        return -1;
+    }
+    return (stats->lost[slot] * 100) / total;
+}
+
+int air_freq_stats_bad_slot(const air_freq_stats_t *stats)
+{
+    int worst = -1;
+    int worst_rate = -1;
+    int sum = 0;
+    int count = 0;
+    for (int ii = 0; ii < AIR_NUM_HOPPING_FREQS; ii++)
+    {
+        int rate = air_freq_stats_loss_rate(stats, ii);
+        if (rate < 0)
+        {
+            continue;
+        }
+        sum += rate;
+        count++;
+        if (rate > worst_rate)
+        {
+            worst = ii;
+            worst_rate = rate;
+        }
+    }
+    if (worst < 0 || count < 2 || worst_rate < BAD_SLOT_MIN_LOSS_RATE)
+    {
+        return -1;
+    }
+    // If all slots are similarly bad, it's not interference in
+    // a narrow band (e.g. we're just too far).
+    int avg_others = (sum - worst_rate) / (count - 1);
+    if (worst_rate < avg_others + BAD_SLOT_MARGIN)
+    {
+        return -1;
     }
-}
\ No newline at end of file
+    return worst;
+}
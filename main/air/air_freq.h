@@ -1,12 +1,100 @@
 #pragma once
 
+#include <stdbool.h>
 #include <stdint.h>
 
 #include "air/air.h"
 
+#include "io/lora.h"
+
+// Spare frequencies used to replace the ones in the hopping table
+// with too much interference. Both ends generate them from the key,
+// so a substitution just needs the slot and the spare index.
+#define AIR_FREQ_SPARE_COUNT 16
+
+// frfs contains the precalculated register values for each entry in
+// freqs, so hopping just needs to copy them. Use air_freq_table_set()
+// rather than setting the frequency directly.
 typedef struct air_freq_table_s
 {
     unsigned long freqs[1 << AIR_SEQ_BITS];
+    unsigned long base_freqs[1 << AIR_SEQ_BITS]; // Before any substitutions
+    unsigned long spares[AIR_FREQ_SPARE_COUNT];
+    lora_frf_t frfs[1 << AIR_SEQ_BITS];
+    lora_frf_t base_frfs[1 << AIR_SEQ_BITS];
+    lora_frf_t spare_frfs[AIR_FREQ_SPARE_COUNT];
+    unsigned next_spare;
 } air_freq_table_t;
 
 void air_freq_table_init(air_freq_table_t *tbl, air_key_t key, unsigned long base_freq);
+// Undoes all the substitutions
+void air_freq_table_reset(air_freq_table_t *tbl);
+// Returns the index of the next spare not in use in the table or -1 if
+// all the spares are in use.
+int air_freq_table_next_spare(const air_freq_table_t *tbl);
+void air_freq_table_substitute(air_freq_table_t *tbl, unsigned slot, unsigned spare);
+// Returns true iff the slot doesn't use its base frequency
+inline bool air_freq_table_is_substituted(const air_freq_table_t *tbl, unsigned slot)
+{
+    return tbl->freqs[slot] != tbl->base_freqs[slot];
+}
+// Sets the frequency for the given slot in the LoRa modem
+inline void air_freq_table_set(const air_freq_table_t *tbl, lora_t *lora, unsigned slot)
+{
+    lora_set_frequency_frf(lora, tbl->freqs[slot], &tbl->frfs[slot]);
+}
+
+// Per slot reception statistics. Counters are halved once they
+// reach a number of samples, so older samples weight less.
+typedef struct air_freq_stats_s
+{
+    uint8_t success[AIR_NUM_HOPPING_FREQS];
+    uint8_t lost[AIR_NUM_HOPPING_FREQS];
+} air_freq_stats_t;
+
+void air_freq_stats_reset(air_freq_stats_t *stats);
+void air_freq_stats_reset_slot(air_freq_stats_t *stats, unsigned slot);
+void air_freq_stats_update(air_freq_stats_t *stats, unsigned slot, bool success);
+// Returns the loss rate in the slot in [0, 100] or -1 if there
+// are not enough samples.
+int air_freq_stats_loss_rate(const air_freq_stats_t *stats, unsigned slot);
+// Returns the slot which loses notably more packets than the rest
+// or -1 if there's none.
+int air_freq_stats_bad_slot(const air_freq_stats_t *stats);
+
+// Payload for AIR_CMD_FREQ_SUBSTITUTE, sent by the TX. The RX responds
+// with AIR_CMD_FREQ_SUBSTITUTE_ACK and both ends perform the
+// substitution before at_tx_seq.
+typedef struct air_freq_substitution_s
+{
+    unsigned slot : AIR_SEQ_BITS;
+    unsigned spare : 4;
+} PACKED air_freq_substitution_t;
+
+_Static_assert(sizeof(air_freq_substitution_t) == 1, "invalid air_freq_substitution_t size");
+
+typedef struct air_freq_substitution_ack_s
+{
+    air_freq_substitution_t sub;
+    unsigned at_tx_seq : AIR_SEQ_BITS;
+    unsigned in_progress : 1;
+    unsigned reserved : 3;
+} PACKED air_freq_substitution_ack_t;
+
+_Static_assert(sizeof(air_freq_substitution_ack_t) == 2, "invalid air_freq_substitution_ack_t size");
+
+inline bool air_freq_substitution_ack_in_progress(const air_freq_substitution_ack_t *ack)
+{
+    return ack->in_progress;
+}
+
+inline void air_freq_substitution_ack_reset(air_freq_substitution_ack_t *ack)
+{
+    memset(ack, 0, sizeof(*ack));
+}
+
+// Returns true iff the substitution should be now performed
+inline bool air_freq_substitution_ack_proceed(const air_freq_substitution_ack_t *ack, unsigned tx_seq)
+{
+    return air_freq_substitution_ack_in_progress(ack) && ack->at_tx_seq == tx_seq;
+}
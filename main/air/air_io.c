@@ -24,6 +24,7 @@ void air_io_init(air_io_t *io, air_addr_t addr, air_io_bind_t *bind, rmp_air_t *
     lpf_init(&io->snr, 0.1);
     lpf_init(&io->lq, 0.5);
     lpf_init(&io->average_frame_interval, 1);
+    air_link_stats_reset(&io->link_stats);
 }
 
 bool air_io_has_bind_request(air_io_t *io, air_bind_packet_t *packet, bool *needs_confirmation)
@@ -72,6 +73,26 @@ bool air_io_is_bound(air_io_t *io)
     return air_addr_is_valid(&io->pairing.addr);
 }
 
+bool air_io_uses_fec(const air_io_t *io, air_lora_mode_e mode)
+{
+    return (io->pairing_info.capabilities & AIR_CAP_FEC) && air_lora_mode_supports_fec(mode);
+}
+
+bool air_io_uses_channel_delta(const air_io_t *io)
+{
+    return io->pairing_info.capabilities & AIR_CAP_CHANNEL_DELTA;
+}
+
+bool air_io_uses_freq_substitution(const air_io_t *io)
+{
+    return io->pairing_info.capabilities & AIR_CAP_FREQ_SUBSTITUTION;
+}
+
+bool air_io_uses_msp_compression(const air_io_t *io)
+{
+    return io->pairing_info.capabilities & AIR_CAP_MSP_COMPRESSION;
+}
+
 bool air_io_get_bound_addr(air_io_t *io, air_addr_t *addr)
 {
     if (air_io_is_bound(io))
@@ -96,6 +117,7 @@ void air_io_update_rssi(air_io_t *io, int rssi, int snr, int lq, time_micros_t n
     lpf_update(&io->rssi, rssi, now);
     lpf_update(&io->snr, snr, now);
     lpf_update(&io->lq, lq, now);
+    air_link_stats_update_signal(&io->link_stats, rssi, snr);
 }
 
 void air_io_update_reset_rssi(air_io_t *io)
@@ -3,6 +3,8 @@
 #include <stdbool.h>
 
 #include "air/air.h"
+#include "air/air_link_stats.h"
+#include "air/air_lora.h"
 
 #include "util/lpf.h"
 #include "util/time.h"
@@ -31,6 +33,7 @@ typedef struct air_io_s
     lpf_t lq;
     lpf_t average_frame_interval;
     time_micros_t last_frame_received;
+    air_link_stats_t link_stats;
 } air_io_t;
 
 void air_io_init(air_io_t *io, air_addr_t addr, air_io_bind_t *bind, rmp_air_t *rmp);
@@ -39,6 +42,16 @@ bool air_io_has_bind_request(air_io_t *io, air_bind_packet_t *packet, bool *need
 bool air_io_accept_bind_request(air_io_t *io);
 void air_io_bind(air_io_t *io, air_pairing_t *pairing);
 bool air_io_is_bound(air_io_t *io);
+// Returns true iff the bound peer supports AIR_CAP_FEC and FEC packets
+// fit in the cycles of the given mode (see air_lora_mode_supports_fec()).
+// Since we always support it, FEC packets must be used in that case.
+bool air_io_uses_fec(const air_io_t *io, air_lora_mode_e mode);
+// Returns true iff the bound peer supports AIR_CAP_CHANNEL_DELTA.
+bool air_io_uses_channel_delta(const air_io_t *io);
+// Returns true iff the bound peer supports AIR_CAP_FREQ_SUBSTITUTION.
+bool air_io_uses_freq_substitution(const air_io_t *io);
+// Returns true iff the bound peer supports AIR_CAP_MSP_COMPRESSION.
+bool air_io_uses_msp_compression(const air_io_t *io);
 bool air_io_get_bound_addr(air_io_t *io, air_addr_t *addr);
 void air_io_on_frame(air_io_t *io, time_micros_t now);
 void air_io_update_rssi(air_io_t *io, int rssi, int snr, int lq, time_micros_t now);
@@ -0,0 +1,138 @@
+#include <string.h>
+
+#include "air/air_link_stats.h"
+
+#include "util/macros.h"
+
+static void air_link_stats_halve(uint16_t *counters, size_t count)
+{
+    for (int ii = 0; ii < count; ii++)
+    {
+        counters[ii] /= 2;
+    }
+}
+
+// Increments counters[index], halving all the counters first if
+// it would overflow.
+static void air_link_stats_increment(uint16_t *counters, size_t count, unsigned index)
+{
+    if (counters[index] == UINT16_MAX)
+    {
+        air_link_stats_halve(counters, count);
+    }
+    counters[index]++;
+}
+
+static unsigned air_link_stats_bucket(int value, int min, int width, unsigned count)
+{
+    if (value < min)
+    {
+        return 0;
+    }
+    return MIN((unsigned)((value - min) / width), count - 1);
+}
+
+// Clears all the counters, keeping the current mode
+static void air_link_stats_clear(air_link_stats_data_t *data)
+{
+    uint8_t mode = data->mode;
+    memset(data, 0, sizeof(*data));
+    data->mode = mode;
+}
+
+void air_link_stats_reset(air_link_stats_t *stats)
+{
+    memset(stats, 0, sizeof(*stats));
+}
+
+void air_link_stats_request_clear(air_link_stats_t *stats)
+{
+    __atomic_store_n(&stats->clear_requested, true, __ATOMIC_RELEASE);
+}
+
+void air_link_stats_update(air_link_stats_t *stats, time_micros_t now)
+{
+    if (__atomic_load_n(&stats->clear_requested, __ATOMIC_ACQUIRE))
+    {
+        air_link_stats_clear(&stats->data);
+        // Time in the current mode starts counting again
+        stats->mode_since = now;
+        __atomic_store_n(&stats->clear_requested, false, __ATOMIC_RELEASE);
+    }
+}
+
+void air_link_stats_update_freq(air_link_stats_t *stats, unsigned slot, bool success)
+{
+    if (slot >= AIR_NUM_HOPPING_FREQS)
+    {
+        return;
+    }
+    uint16_t *counter = success ? &stats->data.freq_success[slot] : &stats->data.freq_lost[slot];
+    if (*counter == UINT16_MAX)
+    {
+        // Halve both arrays, so success/lost ratios are kept
+        air_link_stats_halve(stats->data.freq_success, ARRAY_COUNT(stats->data.freq_success));
+        air_link_stats_halve(stats->data.freq_lost, ARRAY_COUNT(stats->data.freq_lost));
+    }
+    (*counter)++;
+}
+
+void air_link_stats_reset_freq(air_link_stats_t *stats, unsigned slot)
+{
+    if (slot < AIR_NUM_HOPPING_FREQS)
+    {
+        stats->data.freq_success[slot] = 0;
+        stats->data.freq_lost[slot] = 0;
+    }
+}
+
+void air_link_stats_update_signal(air_link_stats_t *stats, int rssi, int snr)
+{
+    unsigned rssi_bucket = air_link_stats_bucket(rssi, AIR_LINK_STATS_RSSI_MIN,
+                                                 AIR_LINK_STATS_RSSI_BUCKET_WIDTH, AIR_LINK_STATS_RSSI_BUCKETS);
+    // snr is in 1/4 dB units
+    unsigned snr_bucket = air_link_stats_bucket(snr, AIR_LINK_STATS_SNR_MIN * 4,
+                                                AIR_LINK_STATS_SNR_BUCKET_WIDTH * 4, AIR_LINK_STATS_SNR_BUCKETS);
+    air_link_stats_increment(stats->data.rssi, ARRAY_COUNT(stats->data.rssi), rssi_bucket);
+    air_link_stats_increment(stats->data.snr, ARRAY_COUNT(stats->data.snr), snr_bucket);
+}
+
+static void air_link_stats_account_mode_time(const air_link_stats_t *stats, air_link_stats_data_t *data, time_micros_t now)
+{
+    if (data->mode > 0 && data->mode <= AIR_LORA_MODE_COUNT && now > stats->mode_since)
+    {
+        unsigned index = data->mode - 1;
+        time_micros_t elapsed = (now - stats->mode_since) / MILLIS_TO_MICROS(1);
+        data->mode_time[index] += MIN(elapsed, (time_micros_t)(UINT32_MAX - data->mode_time[index]));
+    }
+}
+
+void air_link_stats_set_mode(air_link_stats_t *stats, air_lora_mode_e mode, time_micros_t now)
+{
+    if (stats->data.mode == 0 || now < stats->mode_since)
+    {
+        stats->mode_since = now;
+    }
+    else
+    {
+        air_link_stats_account_mode_time(stats, &stats->data, now);
+        // Only whole ms are accounted, keep the remainder for the next mode
+        stats->mode_since = now - ((now - stats->mode_since) % MILLIS_TO_MICROS(1));
+    }
+    if (mode != stats->data.mode && mode > 0 && mode <= AIR_LORA_MODE_COUNT)
+    {
+        air_link_stats_increment(stats->data.mode_switches, ARRAY_COUNT(stats->data.mode_switches), mode - 1);
+    }
+    stats->data.mode = mode;
+}
+
+void air_link_stats_get(const air_link_stats_t *stats, air_link_stats_data_t *data, time_micros_t now)
+{
+    memcpy(data, &stats->data, sizeof(*data));
+    if (__atomic_load_n(&stats->clear_requested, __ATOMIC_ACQUIRE))
+    {
+        air_link_stats_clear(data);
+        return;
+    }
+    air_link_stats_account_mode_time(stats, data, now);
+}
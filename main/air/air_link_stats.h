@@ -0,0 +1,92 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "air/air.h"
+#include "air/air_lora.h"
+
+#include "util/time.h"
+
+// RSSI histogram covers [-150, -22) dBm in 8 dB buckets, while
+// the SNR one covers [-20, 12) dB in 2 dB buckets. Samples outside
+// the range are counted in the first or last bucket.
+#define AIR_LINK_STATS_RSSI_BUCKETS 16
+#define AIR_LINK_STATS_RSSI_MIN -150
+#define AIR_LINK_STATS_RSSI_BUCKET_WIDTH 8
+#define AIR_LINK_STATS_SNR_BUCKETS 16
+#define AIR_LINK_STATS_SNR_MIN -20
+#define AIR_LINK_STATS_SNR_BUCKET_WIDTH 2
+
+// Link statistics since the air input/output was opened. Counters in
+// each group are halved together when one of them would overflow, so
+// memory stays bounded while the ratios are preserved. Frequency
+// counters are indexed by hopping slot, which is also what gets
+// substituted (see air_freq_table_substitute()). Mode counters are
+// indexed by mode - 1. This is also the wire format used by
+// RMP_PORT_LINK_STATS and the Bluetooth link stats characteristic.
+// Fields are sorted by size, so there's no padding.
+typedef struct air_link_stats_data_s
+{
+    uint32_t mode_time[AIR_LORA_MODE_COUNT];      // Time spent in each mode in ms
+    uint16_t freq_success[AIR_NUM_HOPPING_FREQS]; // Received packets per hopping slot
+    uint16_t freq_lost[AIR_NUM_HOPPING_FREQS];    // Lost packets per hopping slot
+    uint16_t rssi[AIR_LINK_STATS_RSSI_BUCKETS];   // RSSI histogram
+    uint16_t snr[AIR_LINK_STATS_SNR_BUCKETS];     // SNR histogram
+    uint16_t mode_switches[AIR_LORA_MODE_COUNT];  // Number of times each mode was entered
+    uint8_t mode;                                 // Current air_lora_mode_e, 0 if none
+    uint8_t reserved;                             // Must be zero
+} air_link_stats_data_t;
+
+_Static_assert(sizeof(air_link_stats_data_t) == 172, "invalid air_link_stats_data_t size");
+
+// Messages for RMP_PORT_LINK_STATS. Requests only contain the code.
+// AIR_LINK_STATS_RMP_RESET_REQ requires authentication and it's also
+// answered with AIR_LINK_STATS_RMP_READ. AIR_LINK_STATS_RMP_MSP_CACHE_READ
+// contains the code, 3 reserved bytes and a msp_cache_stats_t for the
+// FC output of the RX (see msp/msp_cache.h).
+typedef enum {
+    AIR_LINK_STATS_RMP_READ_REQ = 0,
+    AIR_LINK_STATS_RMP_READ,
+    AIR_LINK_STATS_RMP_RESET_REQ,
+    AIR_LINK_STATS_RMP_MSP_CACHE_READ_REQ,
+    AIR_LINK_STATS_RMP_MSP_CACHE_READ,
+} air_link_stats_rmp_code_e;
+
+typedef struct air_link_stats_rmp_msg_s
+{
+    uint8_t code; // from air_link_stats_rmp_code_e
+    uint8_t reserved[3];
+    air_link_stats_data_t data;
+} air_link_stats_rmp_msg_t;
+
+_Static_assert(sizeof(air_link_stats_rmp_msg_t) == 4 + sizeof(air_link_stats_data_t), "invalid air_link_stats_rmp_msg_t size");
+
+// Stats are only updated from the RC task. Other tasks can read them,
+// possibly mixing samples from 2 cycles, and request clearing them
+// with air_link_stats_request_clear().
+typedef struct air_link_stats_s
+{
+    air_link_stats_data_t data;
+    time_micros_t mode_since;
+    bool clear_requested;
+} air_link_stats_t;
+
+void air_link_stats_reset(air_link_stats_t *stats);
+// Can be called from any task. Counters are cleared on the next
+// air_link_stats_update(), while the current mode is kept. Until then,
+// air_link_stats_get() returns them cleared.
+void air_link_stats_request_clear(air_link_stats_t *stats);
+// Must be called periodically from the RC task
+void air_link_stats_update(air_link_stats_t *stats, time_micros_t now);
+void air_link_stats_update_freq(air_link_stats_t *stats, unsigned slot, bool success);
+// Should be called when the frequency for the slot is substituted
+void air_link_stats_reset_freq(air_link_stats_t *stats, unsigned slot);
+// snr is in the same units as returned by lora_rssi() (1/4 dB)
+void air_link_stats_update_signal(air_link_stats_t *stats, int rssi, int snr);
+// Accounts the time spent in the previous mode and counts a switch
+// if the mode changed.
+void air_link_stats_set_mode(air_link_stats_t *stats, air_lora_mode_e mode, time_micros_t now);
+// Copies the stats to data, including the time spent in the current
+// mode up to now.
+void air_link_stats_get(const air_link_stats_t *stats, air_link_stats_data_t *data, time_micros_t now);
@@ -5,45 +5,132 @@
 
 #include "air_lora.h"
 
-void air_lora_set_parameters(struct lora_s *lora, air_lora_mode_e mode)
-{
-    lora_idle(lora);
+// Time reserved around each packet in a cycle for switching the modem
+// between TX and RX, the SPI transfers and the RC task wakeup jitter.
+#define AIR_LORA_PACKET_GUARD_TIME 300
 
-    lora_set_signal_bw(lora, LORA_SIGNAL_BW_500);
-    lora_set_header_mode(lora, LORA_HEADER_IMPLICIT);
-    lora_set_crc(lora, false);
+// External definitions for the inline functions in air_lora.h, used
+// when the compiler decides not to inline them.
+extern inline int air_lora_mode_rank(air_lora_mode_e mode);
+extern inline air_lora_mode_e air_lora_mode_from_rank(int rank);
+extern inline air_lora_mode_e air_lora_mode_faster(air_lora_mode_e mode);
+extern inline air_lora_mode_e air_lora_mode_longer(air_lora_mode_e mode);
+extern inline uint8_t air_lora_modes_pack(void);
+extern inline bool air_lora_modes_unpack(uint8_t modes, air_lora_mode_e *fastest, air_lora_mode_e *longest);
+extern inline unsigned long air_lora_band_frequency(air_lora_band_e band);
 
-    switch (mode)
-    {
-    case AIR_LORA_MODE_1:
-        // We reduce coding rate in this mode to be as fast
+typedef struct air_lora_mode_config_s
+{
+    int sf;
+    lora_coding_rate_e cr;
+    long preamble_length;
+} air_lora_mode_config_t;
+
+static const air_lora_mode_config_t *air_lora_mode_get_config(air_lora_mode_e mode)
+{
+    static const air_lora_mode_config_t configs[] = {
+        // We reduce coding rate in MODE_1 to be as fast
         // as possible. Intended for short range and fast
         // update rate.
-        lora_set_preamble_length(lora, 8);
-        lora_set_spreading_factor(lora, 6);
-        lora_set_coding_rate(lora, LORA_CODING_RATE_4_5);
-        break;
-    case AIR_LORA_MODE_2:
-        lora_set_preamble_length(lora, 6);
-        lora_set_spreading_factor(lora, 7);
-        lora_set_coding_rate(lora, LORA_CODING_RATE_4_6);
-        break;
-    case AIR_LORA_MODE_3:
-        lora_set_preamble_length(lora, 6);
-        lora_set_spreading_factor(lora, 8);
-        lora_set_coding_rate(lora, LORA_CODING_RATE_4_6);
-        break;
-    case AIR_LORA_MODE_4:
-        lora_set_preamble_length(lora, 6);
-        lora_set_spreading_factor(lora, 9);
-        lora_set_coding_rate(lora, LORA_CODING_RATE_4_6);
-        break;
-    case AIR_LORA_MODE_5:
-        lora_set_preamble_length(lora, 6);
-        lora_set_spreading_factor(lora, 10);
-        lora_set_coding_rate(lora, LORA_CODING_RATE_4_8);
-        break;
+        [AIR_LORA_MODE_1] = {.sf = 6, .cr = LORA_CODING_RATE_4_5, .preamble_length = 8},
+        [AIR_LORA_MODE_2] = {.sf = 7, .cr = LORA_CODING_RATE_4_6, .preamble_length = 6},
+        [AIR_LORA_MODE_3] = {.sf = 8, .cr = LORA_CODING_RATE_4_6, .preamble_length = 6},
+        [AIR_LORA_MODE_4] = {.sf = 9, .cr = LORA_CODING_RATE_4_6, .preamble_length = 6},
+        [AIR_LORA_MODE_5] = {.sf = 10, .cr = LORA_CODING_RATE_4_8, .preamble_length = 6},
+        // Fastest modes, only possible by skipping the downlink stage
+        // in most cycles.
+        [AIR_LORA_MODE_6] = {.sf = 6, .cr = LORA_CODING_RATE_4_5, .preamble_length = 6},
+        [AIR_LORA_MODE_7] = {.sf = 6, .cr = LORA_CODING_RATE_4_5, .preamble_length = 6},
+    };
+    _Static_assert(ARRAY_COUNT(configs) == AIR_LORA_MODE_COUNT + 1, "AIR_LORA_MODE_LAST is out of date");
+    if (mode >= AIR_LORA_MODE_1 && mode < ARRAY_COUNT(configs))
+    {
+        return &configs[mode];
+    }
+    UNREACHABLE();
+    return NULL;
+}
+
+static unsigned air_lora_full_cycle_period(air_lora_mode_e mode);
+static bool air_lora_cycles_fit(air_lora_mode_e mode, size_t uplink_size, size_t downlink_size);
+
+static const lora_reg_program_t *air_lora_mode_get_program(air_lora_mode_e mode)
+{
+    // Built the first time each mode is used. Only accessed
+    // from the RC task.
+    static lora_reg_program_t programs[AIR_LORA_MODE_COUNT + 1];
+    lora_reg_program_t *prog = &programs[mode];
+    if (prog->count == 0)
+    {
+        const air_lora_mode_config_t *config = air_lora_mode_get_config(mode);
+        lora_modem_config_t modem_config = {
+            .signal_bw = LORA_SIGNAL_BW_500,
+            .coding_rate = config->cr,
+            .sf = config->sf,
+            .header = LORA_HEADER_IMPLICIT,
+            .crc = false,
+            .preamble_length = config->preamble_length,
+        };
+        lora_reg_program_init(prog);
+        lora_reg_program_modem_config(prog, &modem_config);
+        // Catch cycle times that are too short for the modem
+        // parameters the first time each mode is used.
+        ASSERT(air_lora_cycles_fit(mode, sizeof(air_tx_packet_t), sizeof(air_rx_packet_t)));
     }
+    return prog;
+}
+
+void air_lora_set_parameters(struct lora_s *lora, air_lora_mode_e mode)
+{
+    const lora_reg_program_t *prog = air_lora_mode_get_program(mode);
+
+    lora_idle(lora);
+    lora_run_reg_program(lora, prog);
+}
+
+time_micros_t air_lora_time_on_air(air_lora_mode_e mode, size_t payload_size)
+{
+    // See SX1276/77/78/79 datasheet, 4.1.1.7. All air modes use
+    // BW500, implicit header and no CRC. Low data rate optimization
+    // is never required at BW500 (symbol time is always < 16ms).
+    const air_lora_mode_config_t *config = air_lora_mode_get_config(mode);
+    const int sf = config->sf;
+    const int implicit_header = 1;
+    const int crc = 0;
+    // Symbol time in us at BW500 is 2^SF / 500kHz
+    time_micros_t symbol_time = (1 << sf) * 2;
+    int num = 8 * (int)payload_size - 4 * sf + 28 + 16 * crc - 20 * implicit_header;
+    int den = 4 * sf;
+    int payload_symbols = 8 + MAX((num + den - 1) / den, 0) * (config->cr + 4);
+    // Preamble is config->preamble_length + 4.25 symbols
+    time_micros_t preamble_time = ((config->preamble_length * 4 + 17) * symbol_time) / 4;
+    return preamble_time + payload_symbols * symbol_time;
+}
+
+// Returns true iff an uplink packet of uplink_size bytes followed by
+// a downlink one of downlink_size bytes fit in a full cycle, and the
+// uplink packet fits in an uplink only cycle.
+static bool air_lora_cycles_fit(air_lora_mode_e mode, size_t uplink_size, size_t downlink_size)
+{
+    time_micros_t uplink = air_lora_time_on_air(mode, uplink_size) + AIR_LORA_PACKET_GUARD_TIME;
+    time_micros_t downlink = air_lora_time_on_air(mode, downlink_size) + AIR_LORA_PACKET_GUARD_TIME;
+    return uplink + downlink <= air_lora_full_cycle_time(mode) &&
+           uplink <= air_lora_uplink_cycle_time(mode);
+}
+
+bool air_lora_mode_supports_fec(air_lora_mode_e mode)
+{
+    // The extra parity bytes don't fit in the MODE_1 uplink only
+    // cycle nor in the MODE_5 full cycle.
+    return air_lora_cycles_fit(mode, sizeof(air_tx_fec_packet_t), sizeof(air_rx_fec_packet_t));
+}
+
+int air_lora_mode_min_snr(air_lora_mode_e mode)
+{
+    // See SX1276/77/78/79 datasheet, 4.1.1.2. Demodulation works down
+    // to -5dB at SF6, then each SF step adds another 2.5dB.
+    const air_lora_mode_config_t *config = air_lora_mode_get_config(mode);
+    return (-5 * 4) - (config->sf - 6) * (2.5 * 4);
 }
 
 time_micros_t air_lora_full_cycle_time(air_lora_mode_e mode)
@@ -60,6 +147,9 @@ time_micros_t air_lora_full_cycle_time(air_lora_mode_e mode)
         return MILLIS_TO_MICROS(75);
     case AIR_LORA_MODE_5:
         return MILLIS_TO_MICROS(115);
+    case AIR_LORA_MODE_6:
+    case AIR_LORA_MODE_7:
+        return MILLIS_TO_MICROS(10);
     }
     UNREACHABLE();
     return 0;
@@ -79,26 +169,53 @@ time_micros_t air_lora_uplink_cycle_time(air_lora_mode_e mode)
         return MILLIS_TO_MICROS(75);
     case AIR_LORA_MODE_5:
         return MILLIS_TO_MICROS(115);
+    case AIR_LORA_MODE_6:
+        // 3 * 5.5 + 10 = 26.5ms every 4 packets, ~151Hz
+        return MILLIS_TO_MICROS(5.5f);
+    case AIR_LORA_MODE_7:
+        // 7 * 4.75 + 10 = 43.25ms every 8 packets, ~185Hz
+        return MILLIS_TO_MICROS(4.75f);
     }
     UNREACHABLE();
     return 0;
 }
 
-bool air_lora_cycle_is_full(air_lora_mode_e mode, unsigned seq)
+// Number of cycles between cycles with a downlink stage. Must be a
+// divisor of AIR_SEQ_COUNT and no bigger than AIR_SEQ_COUNT / 2, otherwise
+// mode switches can't be confirmed before they happen (see input_air.c).
+static unsigned air_lora_full_cycle_period(air_lora_mode_e mode)
 {
-#if 0
-    // TODO
-    if (mode == AIR_LORA_MODE_1)
+    switch (mode)
     {
-        return seq % 6 == 0;
+    case AIR_LORA_MODE_6:
+        return 4;
+    case AIR_LORA_MODE_7:
+        return 8;
+    default:
+        break;
     }
-#endif
-    return true;
+    return 1;
+}
+
+bool air_lora_cycle_is_full(air_lora_mode_e mode, unsigned seq)
+{
+    return seq % air_lora_full_cycle_period(mode) == 0;
+}
+
+unsigned air_lora_cycles_until_full(air_lora_mode_e mode, unsigned seq)
+{
+    unsigned period = air_lora_full_cycle_period(mode);
+    return period - (seq % period);
 }
 
 time_micros_t air_lora_tx_failsafe_interval(air_lora_mode_e mode)
 {
-    return air_lora_rx_failsafe_interval(mode);
+    // The TX only resets its failsafe when it gets a downlink packet. Make
+    // sure we can lose at least 4 of them in modes without telemetry in
+    // every cycle.
+    time_micros_t downlink_interval = air_lora_full_cycle_time(mode) +
+                                      (air_lora_full_cycle_period(mode) - 1) * air_lora_uplink_cycle_time(mode);
+    return MAX(air_lora_rx_failsafe_interval(mode), downlink_interval * 5);
 }
 
 time_micros_t air_lora_rx_failsafe_interval(air_lora_mode_e mode)
@@ -115,6 +232,9 @@ time_micros_t air_lora_rx_failsafe_interval(air_lora_mode_e mode)
         return MILLIS_TO_MICROS(500);
     case AIR_LORA_MODE_5:
         return MILLIS_TO_MICROS(700);
+    case AIR_LORA_MODE_6:
+    case AIR_LORA_MODE_7:
+        return MILLIS_TO_MICROS(250);
     }
     UNREACHABLE();
     return 0;
@@ -126,7 +246,9 @@ void air_lora_set_parameters_bind(lora_t *lora, air_lora_band_e band)
 
     lora_set_frequency(lora, air_lora_band_frequency(band));
     lora_set_sync_word(lora, LORA_DEFAULT_SYNC_WORD);
-    // Same as fast parameters as short range mode
-    air_lora_set_parameters(lora, AIR_LORA_MODE_FASTEST);
+    // Same as fast parameters as short range mode. Don't use
+    // AIR_LORA_MODE_FASTEST, since nodes with older firmware
+    // need to see our bind packets.
+    air_lora_set_parameters(lora, AIR_LORA_MODE_BIND);
     lora_set_payload_size(lora, sizeof(air_bind_packet_t));
 }
\ No newline at end of file
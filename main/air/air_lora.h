@@ -1,5 +1,7 @@
 #pragma once
 
+#include <stddef.h>
+
 #include "platform.h"
 
 #include "util/macros.h"
@@ -7,14 +9,21 @@
 
 typedef struct lora_s lora_t;
 
+// Mode numbers are sent over the air (see air_cmd_e and air_info_t.modes),
+// so modes added later can't be renumbered to keep them sorted by speed.
+// Use air_lora_mode_rank() to compare modes.
 typedef enum {
     AIR_LORA_MODE_1 = 1,                     // SF6, BW500 - 10ms cycle
     AIR_LORA_MODE_2,                         // SF7, BW500 - 17ms cycle
     AIR_LORA_MODE_3,                         // SF8, BW500 - 31ms cycle
     AIR_LORA_MODE_4,                         // SF9, BW500 - 55ms cycle
     AIR_LORA_MODE_5,                         // SF10, BW500 - 110ms cycle
-    AIR_LORA_MODE_FASTEST = AIR_LORA_MODE_2, // TODO
+    AIR_LORA_MODE_6,                         // SF6, BW500 - ~150Hz, downlink every 4 cycles
+    AIR_LORA_MODE_7,                         // SF6, BW500 - ~185Hz, downlink every 8 cycles
+    AIR_LORA_MODE_LAST = AIR_LORA_MODE_7,    // Must be updated when adding modes
+    AIR_LORA_MODE_FASTEST = AIR_LORA_MODE_7,
     AIR_LORA_MODE_LONGEST = AIR_LORA_MODE_5,
+    AIR_LORA_MODE_BIND = AIR_LORA_MODE_2,
 } air_lora_mode_e;
 
 typedef enum {
@@ -30,22 +39,71 @@ typedef enum {
     AIR_LORA_BAND_DEFAULT = 0,
 } air_lora_band_e;
 
-#define AIR_LORA_MODE_COUNT (AIR_LORA_MODE_LONGEST - AIR_LORA_MODE_FASTEST + 1)
+#define AIR_LORA_MODE_COUNT (AIR_LORA_MODE_LAST - AIR_LORA_MODE_1 + 1)
+
+// Returns the position of the mode when sorted by speed, with
+// 0 being the fastest one. MODE_1 has no rank, so it's never
+// advertised nor switched to: it has the same SF as MODE_6 and
+// MODE_7 but a lower rate, and it was never enabled before them.
+inline int air_lora_mode_rank(air_lora_mode_e mode)
+{
+    switch (mode)
+    {
+    case AIR_LORA_MODE_7:
+        return 0;
+    case AIR_LORA_MODE_6:
+        return 1;
+    case AIR_LORA_MODE_2:
+        return 2;
+    case AIR_LORA_MODE_3:
+        return 3;
+    case AIR_LORA_MODE_4:
+        return 4;
+    case AIR_LORA_MODE_5:
+        return 5;
+    case AIR_LORA_MODE_1:
+        break;
+    }
+    return -1;
+}
+
+inline air_lora_mode_e air_lora_mode_from_rank(int rank)
+{
+    switch (rank)
+    {
+    case 0:
+        return AIR_LORA_MODE_7;
+    case 1:
+        return AIR_LORA_MODE_6;
+    case 2:
+        return AIR_LORA_MODE_2;
+    case 3:
+        return AIR_LORA_MODE_3;
+    case 4:
+        return AIR_LORA_MODE_4;
+    case 5:
+        return AIR_LORA_MODE_5;
+    }
+    UNREACHABLE();
+    return AIR_LORA_MODE_LONGEST;
+}
 
 inline air_lora_mode_e air_lora_mode_faster(air_lora_mode_e mode)
 {
-    if (mode > AIR_LORA_MODE_FASTEST)
+    int rank = air_lora_mode_rank(mode);
+    if (rank > air_lora_mode_rank(AIR_LORA_MODE_FASTEST))
     {
-        return mode - 1;
+        return air_lora_mode_from_rank(rank - 1);
     }
     return mode;
 }
 
 inline air_lora_mode_e air_lora_mode_longer(air_lora_mode_e mode)
 {
-    if (mode < AIR_LORA_MODE_LONGEST)
+    int rank = air_lora_mode_rank(mode);
+    if (rank < air_lora_mode_rank(AIR_LORA_MODE_LONGEST))
     {
-        return mode + 1;
+        return air_lora_mode_from_rank(rank + 1);
     }
     return mode;
 }
@@ -53,9 +111,9 @@ inline air_lora_mode_e air_lora_mode_longer(air_lora_mode_e mode)
 inline uint8_t air_lora_modes_pack(void)
 {
     uint8_t modes = 0;
-    for (int ii = AIR_LORA_MODE_FASTEST; ii <= AIR_LORA_MODE_LONGEST; ii++)
+    for (int ii = air_lora_mode_rank(AIR_LORA_MODE_FASTEST); ii <= air_lora_mode_rank(AIR_LORA_MODE_LONGEST); ii++)
     {
-        modes |= (1 << ii);
+        modes |= (1 << air_lora_mode_from_rank(ii));
     }
     return modes;
 }
@@ -64,20 +122,20 @@ inline bool air_lora_modes_unpack(uint8_t modes, air_lora_mode_e *fastest, air_l
 {
     bool fastest_ok = false;
     bool longest_ok = false;
-    for (int ii = AIR_LORA_MODE_FASTEST; ii <= AIR_LORA_MODE_LONGEST; ii++)
+    for (int ii = air_lora_mode_rank(AIR_LORA_MODE_FASTEST); ii <= air_lora_mode_rank(AIR_LORA_MODE_LONGEST); ii++)
     {
-        if (modes & (1 << ii))
+        if (modes & (1 << air_lora_mode_from_rank(ii)))
         {
-            *fastest = ii;
+            *fastest = air_lora_mode_from_rank(ii);
             fastest_ok = true;
             break;
         }
     }
-    for (int ii = AIR_LORA_MODE_LONGEST; ii >= AIR_LORA_MODE_FASTEST; ii--)
+    for (int ii = air_lora_mode_rank(AIR_LORA_MODE_LONGEST); ii >= air_lora_mode_rank(AIR_LORA_MODE_FASTEST); ii--)
     {
-        if (modes & (1 << ii))
+        if (modes & (1 << air_lora_mode_from_rank(ii)))
         {
-            *longest = ii;
+            *longest = air_lora_mode_from_rank(ii);
             longest_ok = true;
             break;
         }
@@ -107,9 +165,23 @@ inline unsigned long air_lora_band_frequency(air_lora_band_e band)
 }
 
 void air_lora_set_parameters(lora_t *lora, air_lora_mode_e mode);
+// Returns the time required to transmit a packet of payload_size
+// bytes using the given mode, as calculated from the modem parameters.
+time_micros_t air_lora_time_on_air(air_lora_mode_e mode, size_t payload_size);
+// Returns true iff FEC packets (air_tx_fec_packet_t and air_rx_fec_packet_t)
+// fit in all the cycles of the given mode. Otherwise, the mode always
+// uses plain packets, even if both ends support AIR_CAP_FEC.
+bool air_lora_mode_supports_fec(air_lora_mode_e mode);
+// Returns the minimum SNR required to demodulate a packet using the
+// given mode, in dB*4 (the same units reported by the modem).
+int air_lora_mode_min_snr(air_lora_mode_e mode);
 time_micros_t air_lora_full_cycle_time(air_lora_mode_e mode);
 time_micros_t air_lora_uplink_cycle_time(air_lora_mode_e mode);
+// Returns true iff the cycle for the given seq has a downlink stage
 bool air_lora_cycle_is_full(air_lora_mode_e mode, unsigned seq);
+// Returns the number of cycles after seq until the next one with
+// a downlink stage.
+unsigned air_lora_cycles_until_full(air_lora_mode_e mode, unsigned seq);
 time_micros_t air_lora_tx_failsafe_interval(air_lora_mode_e mode);
 time_micros_t air_lora_rx_failsafe_interval(air_lora_mode_e mode);
 
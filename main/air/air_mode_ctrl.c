@@ -0,0 +1,111 @@
+#include "util/macros.h"
+
+#include "air_mode_ctrl.h"
+
+// Required SNR margin over the mode minimum (in dB*4) to switch to a
+// faster mode and to stay in the current one. The difference between
+// them provides hysteresis. For MODE_2 this results in switching to it
+// at 4dB and leaving it at 1.5dB.
+#define AIR_MODE_CTRL_FASTER_MARGIN (11.5 * 4)
+#define AIR_MODE_CTRL_STAY_MARGIN (9 * 4)
+// How far ahead we look when the link is getting worse. This should
+// cover the time it takes to negotiate a mode switch.
+#define AIR_MODE_CTRL_LOOKAHEAD_SECS 1.0f
+// How long a decision must be held before acting on it. Switching to
+// a longer mode is more urgent than switching to a faster one.
+#define AIR_MODE_CTRL_FASTER_WAIT_INTERVAL_US MILLIS_TO_MICROS(500)
+#define AIR_MODE_CTRL_LONGER_WAIT_INTERVAL_US MILLIS_TO_MICROS(200)
+#define AIR_MODE_CTRL_TREND_CUTOFF 0.5f
+
+void air_mode_ctrl_init(air_mode_ctrl_t *ctrl, air_lora_mode_e fastest, air_lora_mode_e longest)
+{
+    ctrl->fastest = fastest;
+    ctrl->longest = longest;
+    lpf_init(&ctrl->snr_trend, AIR_MODE_CTRL_TREND_CUTOFF);
+    air_mode_ctrl_reset(ctrl);
+}
+
+void air_mode_ctrl_reset(air_mode_ctrl_t *ctrl)
+{
+    ctrl->snr = 0;
+    lpf_reset(&ctrl->snr_trend, 0);
+    ctrl->last_update = 0;
+    ctrl->candidate = 0;
+    ctrl->candidate_since = 0;
+}
+
+void air_mode_ctrl_update(air_mode_ctrl_t *ctrl, int snr, time_micros_t now)
+{
+    if (ctrl->last_update == 0)
+    {
+        // First sample after a reset, there's no derivative yet. Seed
+        // the trend at 0, so the next one gets filtered instead of
+        // becoming the trend as is.
+        lpf_update(&ctrl->snr_trend, 0, now);
+    }
+    else if (now > ctrl->last_update)
+    {
+        float dt = (now - ctrl->last_update) * 1e-6f;
+        lpf_update(&ctrl->snr_trend, (snr - ctrl->snr) / dt, now);
+    }
+    ctrl->snr = snr;
+    ctrl->last_update = now;
+}
+
+static float air_mode_ctrl_predict(float value, const lpf_t *trend)
+{
+    // Only look ahead when the link is getting worse, we don't want
+    // to switch to a faster mode based on a prediction.
+    return value + MIN(lpf_value(trend), 0) * AIR_MODE_CTRL_LOOKAHEAD_SECS;
+}
+
+static air_lora_mode_e air_mode_ctrl_target(air_mode_ctrl_t *ctrl, air_lora_mode_e current)
+{
+    float snr = air_mode_ctrl_predict(ctrl->snr, &ctrl->snr_trend);
+
+    int current_rank = air_lora_mode_rank(current);
+    int fastest_rank = air_lora_mode_rank(ctrl->fastest);
+    int longest_rank = air_lora_mode_rank(ctrl->longest);
+    int target_rank = longest_rank;
+    for (int ii = fastest_rank; ii <= longest_rank; ii++)
+    {
+        int margin = ii < current_rank ? AIR_MODE_CTRL_FASTER_MARGIN : AIR_MODE_CTRL_STAY_MARGIN;
+        if (snr >= air_lora_mode_min_snr(air_lora_mode_from_rank(ii)) + margin)
+        {
+            target_rank = ii;
+            break;
+        }
+    }
+    if (target_rank < current_rank)
+    {
+        // Only go faster one mode at a time
+        target_rank = current_rank - 1;
+    }
+    return air_lora_mode_from_rank(MAX(MIN(target_rank, longest_rank), fastest_rank));
+}
+
+air_lora_mode_e air_mode_ctrl_select(air_mode_ctrl_t *ctrl, air_lora_mode_e current, time_micros_t now)
+{
+    if (ctrl->last_update == 0)
+    {
+        // No data yet
+        return current;
+    }
+    air_lora_mode_e target = air_mode_ctrl_target(ctrl, current);
+    if (target == current)
+    {
+        ctrl->candidate = 0;
+        return current;
+    }
+    if (target != ctrl->candidate)
+    {
+        ctrl->candidate = target;
+        ctrl->candidate_since = now;
+    }
+    time_micros_t wait = air_lora_mode_rank(target) < air_lora_mode_rank(current) ? AIR_MODE_CTRL_FASTER_WAIT_INTERVAL_US : AIR_MODE_CTRL_LONGER_WAIT_INTERVAL_US;
+    if (now - ctrl->candidate_since >= wait)
+    {
+        return target;
+    }
+    return current;
+}
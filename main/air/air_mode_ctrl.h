@@ -0,0 +1,36 @@
+#pragma once
+
+#include <stdbool.h>
+
+#include "air/air_lora.h"
+
+#include "util/lpf.h"
+#include "util/time.h"
+
+// Selects the fastest air_lora_mode_e which is expected to keep the link
+// working, based on the SNR margin over the minimum required by each
+// mode. The RSSI derived LQ isn't used, since it's still low when the
+// margin already allows faster modes. The SNR trend is used to predict
+// the link state in the near future, so switching to a longer mode
+// happens before the link is lost when the distance increases fast.
+typedef struct air_mode_ctrl_s
+{
+    air_lora_mode_e fastest;
+    air_lora_mode_e longest;
+    float snr;       // dB*4
+    lpf_t snr_trend; // dB*4/s
+    time_micros_t last_update;
+    air_lora_mode_e candidate;
+    time_micros_t candidate_since;
+} air_mode_ctrl_t;
+
+void air_mode_ctrl_init(air_mode_ctrl_t *ctrl, air_lora_mode_e fastest, air_lora_mode_e longest);
+// Must be called after switching modes, since the samples taken
+// with the previous mode are no longer valid.
+void air_mode_ctrl_reset(air_mode_ctrl_t *ctrl);
+// Feed a new sample of the link state. snr is in dB*4 and should be
+// the worst value from uplink and downlink.
+void air_mode_ctrl_update(air_mode_ctrl_t *ctrl, int snr, time_micros_t now);
+// Returns the mode that should be used. If it's different than
+// current a mode switch should be started.
+air_lora_mode_e air_mode_ctrl_select(air_mode_ctrl_t *ctrl, air_lora_mode_e current, time_micros_t now);
@@ -64,31 +64,10 @@ static bool air_stream_cmd_decode(air_cmd_e cmd, const void *data, size_t size,
 
 static void air_stream_decode(air_stream_t *s, time_micros_t now)
 {
-    uint8_t buf[AIR_STREAM_MAX_PAYLOAD_SIZE];
-    unsigned p = 0;
-    uint8_t c;
-    ring_buffer_t *rb = &s->input_buf;
-    while (ring_buffer_pop(rb, &c))
-    {
-        if (c == AIR_DATA_BYTE_STUFF)
-        {
-            if (!ring_buffer_pop(rb, &c))
-            {
-                // We missed a byte. Ignore this payload.
-                ring_buffer_empty(rb);
-                return;
-            }
-            c ^= AIR_DATA_XOR;
-        }
-        buf[p++] = c;
-        if (p >= sizeof(buf))
-        {
-            // We got more data than expected. Maybe a newer protocol
-            // which we don't understand yet?
-            ring_buffer_empty(rb);
-            return;
-        }
-    }
+    // Payloads are unstuffed as they're received, so we can
+    // decode them in place.
+    const uint8_t *buf = s->input_buf;
+    unsigned p = s->input_size;
     // Now we got some decoding to do
     if (p > 0)
     {
@@ -186,6 +165,13 @@ static void air_stream_decode(air_stream_t *s, time_micros_t now)
     }
 }
 
+static void air_stream_reset_input(air_stream_t *s)
+{
+    s->input_escaped = false;
+    s->input_overflow = false;
+    s->input_size = 0;
+}
+
 void air_stream_init(air_stream_t *s, air_stream_channel_f channel, air_stream_telemetry_f telemetry, air_stream_cmd_f cmd, void *user)
 {
     s->channel = channel;
@@ -194,7 +180,7 @@ void air_stream_init(air_stream_t *s, air_stream_channel_f channel, air_stream_t
     s->user = user;
     s->input_in_sync = false;
     s->input_seq = 0;
-    RING_BUFFER_INIT(&s->input_buf, uint8_t, AIR_STREAM_INPUT_BUFFER_CAPACITY);
+    air_stream_reset_input(s);
     RING_BUFFER_INIT(&s->output_buf, uint8_t, AIR_STREAM_OUTPUT_BUFFER_CAPACITY);
 }
 
@@ -205,7 +191,7 @@ void air_stream_feed_input(air_stream_t *s, unsigned seq, const void *data, size
         LOG_D(TAG, "Resetting air stream sequency at %u", seq);
         s->input_in_sync = false;
         s->input_seq = seq;
-        ring_buffer_empty(&s->input_buf);
+        air_stream_reset_input(s);
     }
 
     const uint8_t *buf = data;
@@ -219,33 +205,94 @@ void air_stream_feed_input(air_stream_t *s, unsigned seq, const void *data, size
         }
         if (c == AIR_DATA_START_STOP)
         {
-            if (ring_buffer_count(&s->input_buf) > 0)
+            // If the last byte was a stuffing one, we missed a byte. If we
+            // got more data than expected, maybe it's a newer protocol which
+            // we don't understand yet. Ignore the payload in both cases.
+            if (s->input_size > 0 && !s->input_escaped && !s->input_overflow)
             {
                 air_stream_decode(s, now);
             }
+            air_stream_reset_input(s);
+            continue;
+        }
+        if (c == AIR_DATA_BYTE_STUFF && !s->input_escaped)
+        {
+            s->input_escaped = true;
             continue;
         }
-        ring_buffer_push(&s->input_buf, &c);
+        if (s->input_escaped)
+        {
+            c ^= AIR_DATA_XOR;
+            s->input_escaped = false;
+        }
+        if (s->input_size >= sizeof(s->input_buf))
+        {
+            s->input_overflow = true;
+            continue;
+        }
+        s->input_buf[s->input_size++] = c;
+    }
+}
+
+static bool air_stream_needs_stuffing(uint8_t c)
+{
+    return c == AIR_DATA_START_STOP || c == AIR_DATA_BYTE_STUFF;
+}
+
+static size_t air_stream_stuffed_size(const void *data, size_t size)
+{
+    const uint8_t *p = data;
+    size_t n = size;
+    for (size_t ii = 0; ii < size; ii++)
+    {
+        n += air_stream_needs_stuffing(p[ii]);
     }
+    return n;
 }
 
-static size_t air_stream_feed_output(air_stream_t *s, const void *data, size_t size)
+static void air_stream_feed_output(air_stream_t *s, const void *data, size_t size)
 {
-    size_t n = 0;
+    // Bytes which don't need stuffing are pushed in runs, so a
+    // typical payload requires just a single ring buffer push.
+    // Callers check that there's enough space beforehand.
     const uint8_t *p = data;
-    for (unsigned ii = 0; ii < size; ii++, p++)
+    const uint8_t *end = p + size;
+    while (p < end)
     {
-        uint8_t c = *p;
-        if (c == AIR_DATA_START_STOP || c == AIR_DATA_BYTE_STUFF)
+        const uint8_t *run = p;
+        while (p < end && !air_stream_needs_stuffing(*p))
         {
-            n++;
-            c ^= AIR_DATA_XOR;
-            uint8_t bs = AIR_DATA_BYTE_STUFF;
-            ring_buffer_push(&s->output_buf, &bs);
+            p++;
         }
-        ring_buffer_push(&s->output_buf, &c);
-        n++;
+        if (p > run)
+        {
+            ring_buffer_push_n(&s->output_buf, run, p - run);
+        }
+        if (p < end)
+        {
+            uint8_t stuffed[2] = {AIR_DATA_BYTE_STUFF, *p ^ AIR_DATA_XOR};
+            ring_buffer_push_n(&s->output_buf, stuffed, sizeof(stuffed));
+            p++;
+        }
+    }
+}
+
+// Feeds a whole frame: start-stop byte, header and data. The frame
+// is either pushed completely or not at all, so a full output buffer
+// never leaves partial frames behind. Returns the number of bytes
+// pushed, 0 if the frame didn't fit.
+static size_t air_stream_feed_output_frame(air_stream_t *s, const void *hdr, size_t hdr_size, const void *data, size_t size)
+{
+    size_t n = 1 + air_stream_stuffed_size(hdr, hdr_size) + air_stream_stuffed_size(data, size);
+    if (ring_buffer_available(&s->output_buf) < n)
+    {
+        LOG_D(TAG, "No space for %u bytes in output", n);
+        return 0;
     }
+    uint8_t ss = AIR_DATA_START_STOP;
+    ring_buffer_push(&s->output_buf, &ss);
+    air_stream_feed_output(s, hdr, hdr_size);
+    air_stream_feed_output(s, data, size);
     return n;
 }
 
@@ -255,8 +302,6 @@ size_t air_stream_feed_output_channel(air_stream_t *s, unsigned chn, unsigned va
     // as much as 4 bits for 2-bit channel representation.
     assert(chn < 20);
 
-    uint8_t ss = AIR_DATA_START_STOP;
-    ring_buffer_push(&s->output_buf, &ss);
     uint8_t buf[2];
     size_t bs;
     unsigned n = (chn - 4);
@@ -282,7 +327,7 @@ size_t air_stream_feed_output_channel(air_stream_t *s, unsigned chn, unsigned va
         bs = 2;
         break;
     }
-    return 1 + air_stream_feed_output(s, buf, bs);
+    return air_stream_feed_output_frame(s, NULL, 0, buf, bs);
 }
 
 static size_t air_stream_feed_output_telemetry(air_stream_t *s, telemetry_t *t, int id, uint8_t tid)
@@ -293,10 +338,7 @@ static size_t air_stream_feed_output_telemetry(air_stream_t *s, telemetry_t *t,
         assert(telemetry_get_type(id) == TELEMETRY_TYPE_STRING);
         data_size = strlen(t->val.s) + 1;
     }
-    uint8_t ss = AIR_DATA_START_STOP;
-    ring_buffer_push(&s->output_buf, &ss);
-    size_t n = air_stream_feed_output(s, &tid, sizeof(tid));
-    return 1 + n + air_stream_feed_output(s, &t->val, data_size);
+    return air_stream_feed_output_frame(s, &tid, sizeof(tid), &t->val, data_size);
 }
 
 size_t air_stream_feed_output_uplink_telemetry(air_stream_t *s, telemetry_t *t, telemetry_uplink_id_e id)
@@ -319,18 +361,15 @@ size_t air_stream_feed_output_cmd(air_stream_t *s, uint8_t cmd, const void *data
 {
     // We only have 6 bits for CMD encoding
     assert(cmd < 64);
-    uint8_t ss = AIR_DATA_START_STOP;
-    ring_buffer_push(&s->output_buf, &ss);
-    uint8_t cid = cmd | AIR_STREAM_CMD_MASK;
-    size_t n = air_stream_feed_output(s, &cid, sizeof(cid));
+    uint8_t hdr[1 + 9];
+    size_t hdr_size = 0;
+    hdr[hdr_size++] = cmd | AIR_STREAM_CMD_MASK;
     // Check if the command needs explicit size
     if (air_cmd_size(cmd) < 0)
     {
-        uint8_t size_buf[9];
-        int used = uvarint_encode32(size_buf, sizeof(size_buf), size);
-        n += air_stream_feed_output(s, size_buf, used);
+        hdr_size += uvarint_encode32(&hdr[hdr_size], sizeof(hdr) - hdr_size, size);
     }
-    return 1 + n + air_stream_feed_output(s, data, size);
+    return air_stream_feed_output_frame(s, hdr, hdr_size, data, size);
 }
 
 size_t air_stream_output_count(const air_stream_t *s)
@@ -346,4 +385,9 @@ void air_stream_reset_output(air_stream_t *s)
 bool air_stream_pop_output(air_stream_t *s, uint8_t *c)
 {
     return ring_buffer_pop(&s->output_buf, c);
+}
+
+size_t air_stream_pop_output_n(air_stream_t *s, void *buf, size_t size)
+{
+    return ring_buffer_pop_n(&s->output_buf, buf, size);
 }
\ No newline at end of file
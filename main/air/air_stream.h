@@ -15,8 +15,6 @@
 // MSP_MAX_PAYLOAD_SIZE, 1 byte for direction, 3 bytes for variable sized cmd and
 // 3 bytes for the variable sized cmd size
 #define AIR_STREAM_BUFFER_CAPACITY (MSP_MAX_PAYLOAD_SIZE + 1 + 3 + 3)
-// Worst case scenario: All bytes stuffed since we don't put start-stop here
-#define AIR_STREAM_INPUT_BUFFER_CAPACITY (AIR_STREAM_BUFFER_CAPACITY * 2)
 // Worst case scenario: All bytes stuffed plus start-stop starting with just one byte left in the packet
 #define AIR_STREAM_OUTPUT_BUFFER_CAPACITY (AIR_STREAM_BUFFER_CAPACITY * 2 + 1 + 1)
 #define AIR_STREAM_MAX_PAYLOAD_SIZE AIR_STREAM_BUFFER_CAPACITY
@@ -33,8 +31,11 @@ typedef struct air_stream_s
     air_stream_cmd_f cmd;
     void *user;
     bool input_in_sync;                // Wether the input data stream is synchronized
+    bool input_escaped;                // Wether the last input byte was AIR_DATA_BYTE_STUFF
+    bool input_overflow;               // Wether the current input payload didn't fit in input_buf
     unsigned input_seq : AIR_SEQ_BITS; // Input sequence number
-    RING_BUFFER_DECLARE(input_buf, uint8_t, AIR_STREAM_INPUT_BUFFER_CAPACITY);
+    size_t input_size;                 // Number of unstuffed bytes in input_buf
+    uint8_t input_buf[AIR_STREAM_BUFFER_CAPACITY];
     RING_BUFFER_DECLARE(output_buf, uint8_t, AIR_STREAM_OUTPUT_BUFFER_CAPACITY);
 } air_stream_t;
 
@@ -44,7 +45,9 @@ void air_stream_init(air_stream_t *s, air_stream_channel_f channel, air_stream_t
 // in the stream.
 void air_stream_feed_input(air_stream_t *s, unsigned seq, const void *data, size_t size, time_micros_t now);
 
-// Add data to be stream to the air
+// Add data to be stream to the air. Each function returns the number
+// of bytes added to the output, or 0 if the data didn't fit. Data is
+// never partially added.
 size_t air_stream_feed_output_channel(air_stream_t *s, unsigned ch, unsigned val);
 size_t air_stream_feed_output_uplink_telemetry(air_stream_t *s, telemetry_t *t, telemetry_uplink_id_e id);
 size_t air_stream_feed_output_downlink_telemetry(air_stream_t *s, telemetry_t *t, telemetry_downlink_id_e id);
@@ -55,3 +58,5 @@ size_t air_stream_output_count(const air_stream_t *s);
 // sending urgent data.
 void air_stream_reset_output(air_stream_t *s);
 bool air_stream_pop_output(air_stream_t *s, uint8_t *c);
+// Pops up to size bytes into buf, returns the number of popped bytes.
+size_t air_stream_pop_output_n(air_stream_t *s, void *buf, size_t size);
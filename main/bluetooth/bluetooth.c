@@ -1,19 +1,19 @@
 #include <stdio.h>
 
+#include <freertos/FreeRTOS.h>
+#include <freertos/semphr.h>
+
 #include <esp_system.h>
 #include <esp_log.h>
 #include <nvs_flash.h>
 
 #include "bluetooth/bluetooth_hal.h"
-
-#include "io/io.h"
+#include "bluetooth/hm_serial.h"
+#include "bluetooth/telemetry_stream.h"
 
 #include "rc/rc.h"
 #include "rc/telemetry.h"
 
-#include "msp/msp.h"
-#include "msp/msp_serial.h"
-
 #include "util/macros.h"
 #include "util/version.h"
 
@@ -24,6 +24,8 @@ static const char *TAG = "Bluetooth";
 #define RAVEN_UUID(n) BT_UUID_16_FROM(n, 0x01, 0x02, 0x03, 0x04, 0x05, 0x06, 0x07, 0x08, 0x09, 0x0a, 0x0b, 0x0c)
 #define RAVEN_SERVICE_UUID(n) RAVEN_UUID((n + 1) << 8)
 #define TELEMETRY_UUID_OFFSET 0x8000
+#define LINK_STATS_UUID 0x0003
+#define TELEMETRY_STREAM_UUID 0x0004
 
 static esp_gatt_status_t hm_serial_read(gatt_server_t *server, gatt_server_char_t *chr, struct gatts_read_evt_param *r, esp_gatt_rsp_t *rsp, void *user_data);
 static esp_gatt_status_t hm_serial_write(gatt_server_t *server, gatt_server_char_t *chr, gatt_server_write_info_t *write_info, void *user_data);
@@ -39,7 +41,9 @@ static gatt_server_char_t msp_characteristic = {
 };
 #endif
 
-static gatt_server_char_t telemetry_chars[TELEMETRY_COUNT];
+// Telemetry values followed by the link stats and the telemetry stream
+static gatt_server_char_t telemetry_chars[TELEMETRY_COUNT + 2];
+#define TELEMETRY_STREAM_CHAR (&telemetry_chars[TELEMETRY_COUNT + 1])
 
 static esp_attr_value_t manufacturer_attribute_value = ATTR_VALUE_STR("Alberto GH");
 static esp_attr_value_t model_attribute_value = ATTR_VALUE_STR("Raven RC");
@@ -126,40 +130,37 @@ static gatt_server_t server = {
 GAP_EVENT_HANDLER_FUNC(server, gap_event_handler);
 GATT_EVENT_HANDLER_FUNC(server, gatts_event_handler);
 
-#define HM_SERIAL_RB_CAPACITY MSP_MAX_PAYLOAD_SIZE
-#define HM_SERIAL_MAX_READ_SIZE 20
+_Static_assert(HM_SERIAL_MAX_NOTIFY_SIZE >= GATT_SERVER_MAX_NOTIFY_SIZE, "HM_SERIAL_MAX_NOTIFY_SIZE too small");
 
-typedef struct hm_serial_data_s
-{
-    msp_conn_t msp; // Used to decode incoming raw MSP via BT
-    msp_serial_t msp_serial;
-    RING_BUFFER_DECLARE(rb, uint8_t, HM_SERIAL_RB_CAPACITY);
-} hm_serial_data_t;
+#define BLUETOOTH_NAME_UPDATE_INTERVAL SECS_TO_TICKS(1)
+#define TELEMETRY_STREAM_UPDATE_INTERVAL MILLIS_TO_TICKS(20)
+// Used until the client writes its subscriptions: every value,
+// at most every 100ms.
+#define TELEMETRY_STREAM_DEFAULT_INTERVAL 10
 
-static hm_serial_data_t hm_serial_data;
+static hm_serial_t hm_serial;
 
-static int hm_serial_msp_io_read(void *data, void *buf, size_t size, time_ticks_t timeout)
+typedef struct telemetry_stream_data_s
 {
-    hm_serial_data_t *serial_data = data;
-    uint8_t *ptr = buf;
-    uint8_t c;
-    int n = 0;
-    while (n < size && ring_buffer_pop(&serial_data->rb, &c))
-    {
-        ptr[n++] = c;
-    }
-    return n;
+    rc_t *rc;
+    // Subscriptions are written from the BT stack task, while
+    // the stream is updated by the BT task.
+    SemaphoreHandle_t lock;
+    telemetry_stream_t stream;
+    bool notifying;
+    uint8_t buf[GATT_SERVER_MAX_NOTIFY_SIZE];
+} telemetry_stream_data_t;
+
+static telemetry_stream_data_t telemetry_stream_data;
+
+static void hm_serial_notify(void *data, const void *buf, size_t size)
+{
+    ESP_ERROR_CHECK(gatt_server_notify_char(&server, &hm10_serial_characteristic, buf, size));
 }
 
-static int hm_serial_msp_io_write(void *data, const void *buf, size_t size)
+static size_t hm_serial_notify_size(void *data)
 {
-    const uint8_t *ptr = buf;
-    for (int ii = 0; ii < size; ii += HM_SERIAL_MAX_READ_SIZE)
-    {
-        size_t rem = MIN(HM_SERIAL_MAX_READ_SIZE, size - ii);
-        ESP_ERROR_CHECK(gatt_server_notify_char(&server, &hm10_serial_characteristic, &ptr[ii], rem));
-    }
-    return size;
+    return gatt_server_get_notify_size(&server, &hm10_serial_characteristic);
 }
 
 static esp_gatt_status_t hm_serial_read(gatt_server_t *server, gatt_server_char_t *chr, struct gatts_read_evt_param *r, esp_gatt_rsp_t *rsp, void *user_data)
@@ -170,12 +171,7 @@ static esp_gatt_status_t hm_serial_read(gatt_server_t *server, gatt_server_char_
 
 static esp_gatt_status_t hm_serial_write(gatt_server_t *server, gatt_server_char_t *chr, gatt_server_write_info_t *write_info, void *user_data)
 {
-    hm_serial_data_t *serial_data = user_data;
-    for (int ii = 0; ii < write_info->data_len; ii++)
-    {
-        ring_buffer_push(&serial_data->rb, &write_info->data[ii]);
-    }
-    msp_conn_update(&serial_data->msp);
+    hm_serial_received(user_data, write_info->data, write_info->data_len);
     return ESP_GATT_OK;
 }
 
@@ -219,6 +215,72 @@ static esp_gatt_status_t telemetry_read(gatt_server_t *server, gatt_server_char_
     return ESP_GATT_OK;
 }
 
+static esp_gatt_status_t link_stats_read(gatt_server_t *server, gatt_server_char_t *chr, struct gatts_read_evt_param *r, esp_gatt_rsp_t *rsp, void *user_data)
+{
+    // air_link_stats_data_t is bigger than the MTU, so clients will
+    // use long reads. Note that each chunk comes from a new snapshot.
+    rc_t *rc = user_data;
+    air_link_stats_data_t data;
+    if (!rc_get_link_stats(rc, &data))
+    {
+        memset(&data, 0, sizeof(data));
+    }
+    if (r->offset > sizeof(data))
+    {
+        return ESP_GATT_INVALID_OFFSET;
+    }
+    rsp->attr_value.offset = r->offset;
+    rsp->attr_value.len = sizeof(data) - r->offset;
+    memcpy(rsp->attr_value.value, ((const uint8_t *)&data) + r->offset, rsp->attr_value.len);
+    return ESP_GATT_OK;
+}
+
+static esp_gatt_status_t telemetry_stream_write(gatt_server_t *server, gatt_server_char_t *chr, gatt_server_write_info_t *write_info, void *user_data)
+{
+    telemetry_stream_data_t *stream_data = user_data;
+    xSemaphoreTake(stream_data->lock, portMAX_DELAY);
+    bool ok = telemetry_stream_configure(&stream_data->stream, write_info->data, write_info->data_len);
+    xSemaphoreGive(stream_data->lock);
+    return ok ? ESP_GATT_OK : ESP_GATT_OUT_OF_RANGE;
+}
+
+static void telemetry_stream_update(telemetry_stream_data_t *stream_data)
+{
+    bool notifying = gatt_server_char_is_subscribed(TELEMETRY_STREAM_CHAR);
+    if (!notifying)
+    {
+        stream_data->notifying = false;
+        return;
+    }
+    xSemaphoreTake(stream_data->lock, portMAX_DELAY);
+    if (!stream_data->notifying)
+    {
+        // Send every value to the new client
+        telemetry_stream_reset(&stream_data->stream);
+        stream_data->notifying = true;
+    }
+    if (!telemetry_stream_has_subscriptions(&stream_data->stream))
+    {
+        xSemaphoreGive(stream_data->lock);
+        return;
+    }
+    time_micros_t now = time_micros_now();
+    size_t notify_size = MIN(gatt_server_get_notify_size(&server, TELEMETRY_STREAM_CHAR), sizeof(stream_data->buf));
+    size_t n;
+    while ((n = telemetry_stream_encode(&stream_data->stream, &stream_data->rc->data, stream_data->buf, notify_size, now)) > 0)
+    {
+        esp_err_t err = gatt_server_notify_char(&server, TELEMETRY_STREAM_CHAR, stream_data->buf, n);
+        if (err != ESP_OK)
+        {
+            // Values were marked as sent, send them all again later
+            ESP_LOGW(TAG, "Error sending telemetry stream: %x", err);
+            stream_data->notifying = false;
+            break;
+        }
+    }
+    xSemaphoreGive(stream_data->lock);
+}
+
 static void bluetooth_update_device_name(rc_t *rc)
 {
     const char *name = "";
@@ -266,20 +328,12 @@ static esp_err_t bluetooth_init(rc_t *rc)
     gatt_server_init(&server);
     bluetooth_update_device_name(rc);
 
-    io_t msp_io = {
-        .read = hm_serial_msp_io_read,
-        .write = hm_serial_msp_io_write,
-        .data = &hm_serial_data,
-    };
-
-    msp_serial_init(&hm_serial_data.msp_serial, &msp_io);
-    msp_conn_init(&hm_serial_data.msp, MSP_TRANSPORT(&hm_serial_data.msp_serial));
-    rc_connect_msp_input(rc, &hm_serial_data.msp);
-    RING_BUFFER_INIT(&hm_serial_data.rb, uint8_t, HM_SERIAL_RB_CAPACITY);
-    hm10_serial_characteristic.read_data = &hm_serial_data;
-    hm10_serial_characteristic.write_data = &hm_serial_data;
+    hm_serial_init(&hm_serial, hm_serial_notify, hm_serial_notify_size, NULL);
+    rc_connect_msp_input(rc, &hm_serial.msp);
+    hm10_serial_characteristic.read_data = &hm_serial;
+    hm10_serial_characteristic.write_data = &hm_serial;
 
-    for (int ii = 0; ii < ARRAY_COUNT(telemetry_chars); ii++)
+    for (int ii = 0; ii < TELEMETRY_COUNT; ii++)
     {
         gatt_server_char_t *chr = &telemetry_chars[ii];
         int telemetry_id = telemetry_get_id_at(ii);
@@ -316,6 +370,33 @@ static esp_err_t bluetooth_init(rc_t *rc)
         }
     }
 
+    gatt_server_char_t *link_stats_chr = &telemetry_chars[TELEMETRY_COUNT];
+    link_stats_chr->uuid = RAVEN_UUID(LINK_STATS_UUID);
+    link_stats_chr->value = NULL;
+    link_stats_chr->read = link_stats_read;
+    link_stats_chr->read_data = rc;
+    link_stats_chr->description = "Link Stats";
+    link_stats_chr->prop = ESP_GATT_CHAR_PROP_BIT_READ;
+    link_stats_chr->perm = ESP_GATT_PERM_READ;
+    link_stats_chr->format = BT_PRESENTATION_FORMAT(BT_FORMAT_OPAQUE_STRUCT, 0, BT_UNIT_UNITLESS);
+
+    // See telemetry_stream.h for the format
+    static const uint8_t default_subscriptions[] = {TELEMETRY_STREAM_ALL_IDS, TELEMETRY_STREAM_DEFAULT_INTERVAL};
+    telemetry_stream_data.rc = rc;
+    telemetry_stream_data.lock = xSemaphoreCreateMutex();
+    telemetry_stream_init(&telemetry_stream_data.stream);
+    telemetry_stream_configure(&telemetry_stream_data.stream, default_subscriptions, sizeof(default_subscriptions));
+    telemetry_stream_data.notifying = false;
+    gatt_server_char_t *stream_chr = TELEMETRY_STREAM_CHAR;
+    stream_chr->uuid = RAVEN_UUID(TELEMETRY_STREAM_UUID);
+    stream_chr->value = NULL;
+    stream_chr->write = telemetry_stream_write;
+    stream_chr->write_data = &telemetry_stream_data;
+    stream_chr->description = "Telemetry Stream";
+    stream_chr->prop = ESP_GATT_CHAR_PROP_BIT_WRITE | ESP_GATT_CHAR_PROP_BIT_NOTIFY;
+    stream_chr->perm = ESP_GATT_PERM_WRITE;
+    stream_chr->format = BT_PRESENTATION_FORMAT(BT_FORMAT_OPAQUE_STRUCT, 0, BT_UNIT_UNITLESS);
+
     return gatt_server_start(&server, gap_event_handler, gatts_event_handler);
 }
 
@@ -324,9 +405,34 @@ void task_bluetooh(void *arg)
     rc_t *rc = arg;
     ESP_ERROR_CHECK(bluetooth_init(rc));
 
+    time_ticks_t next_name_update = 0;
+    time_ticks_t next_stream_update = 0;
     for (;;)
     {
-        bluetooth_update_device_name(rc);
-        vTaskDelay(1000 / portTICK_PERIOD_MS);
+        time_ticks_t now = time_ticks_now();
+        if (now >= next_name_update)
+        {
+            bluetooth_update_device_name(rc);
+            next_name_update = now + BLUETOOTH_NAME_UPDATE_INTERVAL;
+        }
+        if (now >= next_stream_update)
+        {
+            telemetry_stream_update(&telemetry_stream_data);
+            next_stream_update = now + TELEMETRY_STREAM_UPDATE_INTERVAL;
+        }
+        time_ticks_t flush_at = hm_serial_flush_at(&hm_serial);
+        if (flush_at != 0 && now >= flush_at)
+        {
+            hm_serial_flush(&hm_serial);
+            flush_at = 0;
+        }
+        time_ticks_t wake_at = MIN(next_name_update, next_stream_update);
+        if (flush_at != 0 && flush_at < wake_at)
+        {
+            wake_at = flush_at;
+        }
+        // Woken up by hm_serial when it leaves bytes
+        // waiting for a flush
+        ulTaskNotifyTake(pdTRUE, wake_at - now);
     }
 }
@@ -116,6 +116,7 @@ esp_err_t gatt_server_start(gatt_server_t *server, esp_gap_ble_cb_t gap_event_ha
         {
             gatt_server_char_t *chr = &service->chars[jj];
             chr->state.client_conf_handle = GATT_SERVER_HANDLE_INVALID;
+            memset(chr->state.client_conf, 0, sizeof(chr->state.client_conf));
             chr->state.description_handle = GATT_SERVER_HANDLE_INVALID;
             chr->state.presentation_handle = GATT_SERVER_HANDLE_INVALID;
         }
@@ -150,7 +151,7 @@ esp_err_t gatt_server_start(gatt_server_t *server, esp_gap_ble_cb_t gap_event_ha
         return ret;
     }
 
-    if ((ret = esp_ble_gatt_set_local_mtu(500)))
+    if ((ret = esp_ble_gatt_set_local_mtu(GATT_SERVER_LOCAL_MTU)))
     {
         ESP_LOGE(TAG, "set local  MTU failed, error code = %x", ret);
         return ret;
@@ -238,7 +239,7 @@ static void gatt_server_start_advertising(gatt_server_t *server)
 static bool gatt_server_register_conn(gatt_server_t *server, struct gatts_connect_evt_param *param, bool *is_full)
 {
     *is_full = false;
-    for (int ii = 0; ii < server->state.num_conns; ii++)
+    for (int ii = 0; ii < GATT_SERVER_MAX_CONNECTIONS; ii++)
     {
         gatt_server_conn_t *conn = &server->state.conns[ii];
         if (memcmp(conn->addr, param->remote_bda, sizeof(conn->addr)) == 0 && conn->conn_id == param->conn_id)
@@ -255,6 +256,7 @@ static bool gatt_server_register_conn(gatt_server_t *server, struct gatts_connec
         {
             // Found an empty slot
             conn->conn_id = param->conn_id;
+            conn->mtu = GATT_SERVER_DEFAULT_MTU;
             conn->write_buf.pos = 0;
             conn->write_buf.handle = GATT_SERVER_HANDLE_INVALID;
             memcpy(conn->addr, param->remote_bda, sizeof(conn->addr));
@@ -267,28 +269,48 @@ static bool gatt_server_register_conn(gatt_server_t *server, struct gatts_connec
     return false;
 }
 
+// Slots in server->state.conns are reused, so they might not be
+// contiguous. Returns -1 if there's no connection with conn_id.
+static int gatt_server_get_conn_index(gatt_server_t *server, uint16_t conn_id)
+{
+    for (int ii = 0; ii < GATT_SERVER_MAX_CONNECTIONS; ii++)
+    {
+        if (server->state.conns[ii].conn_id == conn_id)
+        {
+            return ii;
+        }
+    }
+    return -1;
+}
+
 static gatt_server_conn_t *gatt_server_get_conn(gatt_server_t *server, uint16_t conn_id)
 {
-    for (int ii = 0; ii < server->state.num_conns; ii++)
+    int idx = gatt_server_get_conn_index(server, conn_id);
+    return idx >= 0 ? &server->state.conns[idx] : NULL;
+}
+
+static void gatt_server_clear_subscriptions(gatt_server_t *server, int conn_index)
+{
+    for (int ii = 0; ii < server->services_len; ii++)
     {
-        gatt_server_conn_t *conn = &server->state.conns[ii];
-        if (conn->conn_id == conn_id)
+        gatt_server_service_t *service = &server->services[ii];
+        for (int jj = 0; jj < service->chars_len; jj++)
         {
-            return conn;
+            service->chars[jj].state.client_conf[conn_index] = 0;
         }
     }
-    return NULL;
 }
 
 static void gatt_server_remove_conn(gatt_server_t *server, struct gatts_disconnect_evt_param *param)
 {
-    for (int ii = 0; ii < server->state.num_conns; ii++)
+    for (int ii = 0; ii < GATT_SERVER_MAX_CONNECTIONS; ii++)
     {
         gatt_server_conn_t *conn = &server->state.conns[ii];
         if (memcmp(conn->addr, param->remote_bda, sizeof(conn->addr)) == 0 && conn->conn_id == param->conn_id)
         {
             conn->conn_id = GATT_SERVER_CONN_INVALID;
             server->state.num_conns--;
+            gatt_server_clear_subscriptions(server, ii);
             break;
         }
     }
@@ -298,11 +320,10 @@ static void gatt_server_get_subscribers(gatt_server_t *server, gatt_server_servi
                                         gatt_server_char_t *chr,
                                         uint16_t *subscribers, size_t *size)
 {
-    // TODO: Returning all active connections, fix this
     *size = 0;
-    for (int ii = 0; ii < server->state.num_conns; ii++)
+    for (int ii = 0; ii < GATT_SERVER_MAX_CONNECTIONS; ii++)
     {
-        if (server->state.conns[ii].conn_id != GATT_SERVER_CONN_INVALID)
+        if (server->state.conns[ii].conn_id != GATT_SERVER_CONN_INVALID && chr->state.client_conf[ii] != 0)
         {
             subscribers[*size] = server->state.conns[ii].conn_id;
             (*size)++;
@@ -477,8 +498,10 @@ static esp_err_t gatt_server_service_read_handler(gatt_server_t *server, gatt_se
         }
         if (chr->state.client_conf_handle == param->handle)
         {
-            rsp.attr_value.len = sizeof(chr->state.client_conf);
-            memcpy(rsp.attr_value.value, &chr->state.client_conf, sizeof(chr->state.client_conf));
+            int conn_index = gatt_server_get_conn_index(server, param->conn_id);
+            uint16_t conf = conn_index >= 0 ? chr->state.client_conf[conn_index] : 0;
+            rsp.attr_value.len = sizeof(conf);
+            memcpy(rsp.attr_value.value, &conf, sizeof(conf));
             status = ESP_GATT_OK;
             break;
         }
@@ -607,7 +630,6 @@ static esp_err_t gatt_server_service_write_data_handler(gatt_server_t *server, g
                     break;
                 }
                 status = ESP_GATT_OK;
-                // TODO: Subscribe
                 break;
             case 0x0002:
                 if (!(chr->prop & ESP_GATT_CHAR_PROP_BIT_INDICATE))
@@ -616,15 +638,18 @@ static esp_err_t gatt_server_service_write_data_handler(gatt_server_t *server, g
                     break;
                 }
                 status = ESP_GATT_OK;
-                // TODO: Subscribe
                 break;
             case 0x0000:
                 status = ESP_GATT_OK;
-                // TODO: Unsubscribe
                 break;
             default:
                 status = ESP_GATT_INVALID_HANDLE;
             }
+            int conn_index = gatt_server_get_conn_index(server, info->conn_id);
+            if (status == ESP_GATT_OK && conn_index >= 0)
+            {
+                chr->state.client_conf[conn_index] = conf;
+            }
             break;
         }
     }
@@ -933,8 +958,15 @@ static bool gatt_server_gatts_event_server_handler(gatt_server_t *server, esp_ga
         gatt_server_start_advertising(server);
         break;
     case ESP_GATTS_MTU_EVT:
-        ESP_LOGD(TAG, "ESP_GATTS_MTU_EVT, MTU %d", param->mtu.mtu);
+    {
+        ESP_LOGD(TAG, "ESP_GATTS_MTU_EVT, conn_id %u, MTU %d", param->mtu.conn_id, param->mtu.mtu);
+        gatt_server_conn_t *conn = gatt_server_get_conn(server, param->mtu.conn_id);
+        if (conn)
+        {
+            conn->mtu = param->mtu.mtu;
+        }
         break;
+    }
     default:
         return false;
     }
@@ -976,10 +1008,8 @@ void gatt_server_gatts_event_handler(gatt_server_t *server, esp_gatts_cb_event_t
     }
 }
 
-esp_err_t gatt_server_notify_char(gatt_server_t *server, gatt_server_char_t *chr, const void *data, size_t size)
+static gatt_server_service_t *gatt_server_get_char_service(gatt_server_t *server, gatt_server_char_t *chr)
 {
-    // Find the service for this characteristic
-    gatt_server_service_t *service = NULL;
     for (int ii = 0; ii < server->services_len; ii++)
     {
         gatt_server_service_t *srv = &server->services[ii];
@@ -987,11 +1017,16 @@ esp_err_t gatt_server_notify_char(gatt_server_t *server, gatt_server_char_t *chr
         {
             if (&srv->chars[jj] == chr)
             {
-                service = srv;
-                break;
+                return srv;
             }
         }
     }
+    return NULL;
+}
+
+esp_err_t gatt_server_notify_char(gatt_server_t *server, gatt_server_char_t *chr, const void *data, size_t size)
+{
+    gatt_server_service_t *service = gatt_server_get_char_service(server, chr);
     if (!service)
     {
         return ESP_ERR_NOT_FOUND;
@@ -1009,3 +1044,37 @@ esp_err_t gatt_server_notify_char(gatt_server_t *server, gatt_server_char_t *chr
     }
     return ESP_OK;
 }
+
+size_t gatt_server_get_notify_size(gatt_server_t *server, gatt_server_char_t *chr)
+{
+    uint16_t mtu = GATT_SERVER_LOCAL_MTU;
+    gatt_server_service_t *service = gatt_server_get_char_service(server, chr);
+    if (service)
+    {
+        uint16_t subscribers[GATT_SERVER_MAX_CONNECTIONS];
+        size_t count;
+        gatt_server_get_subscribers(server, service, chr, subscribers, &count);
+        for (int ii = 0; ii < count; ii++)
+        {
+            gatt_server_conn_t *conn = gatt_server_get_conn(server, subscribers[ii]);
+            if (conn && conn->mtu < mtu)
+            {
+                mtu = conn->mtu;
+            }
+        }
+    }
+    return mtu - GATT_SERVER_NOTIFY_OVERHEAD;
+}
+
+bool gatt_server_char_is_subscribed(gatt_server_char_t *chr)
+{
+    // Subscriptions are cleared when their connection goes away
+    for (int ii = 0; ii < GATT_SERVER_MAX_CONNECTIONS; ii++)
+    {
+        if (chr->state.client_conf[ii] != 0)
+        {
+            return true;
+        }
+    }
+    return false;
+}
@@ -8,6 +8,14 @@
 #include <esp_gatt_common_api.h>
 
 #define GATT_SERVER_PREPARE_WRITE_BUFSIZE 1024
+// MTU requested from the peers. Connections start with the default
+// one until the peer does an MTU exchange.
+#define GATT_SERVER_LOCAL_MTU 517
+#define GATT_SERVER_DEFAULT_MTU 23
+// Opcode + handle
+#define GATT_SERVER_NOTIFY_OVERHEAD 3
+#define GATT_SERVER_MAX_NOTIFY_SIZE (GATT_SERVER_LOCAL_MTU - GATT_SERVER_NOTIFY_OVERHEAD)
+#define GATT_SERVER_MAX_CONNECTIONS 8
 
 struct gatt_server_s;
 struct gatt_server_char_s;
@@ -92,7 +100,7 @@ typedef struct gatt_server_char_s
     {
         uint16_t handle;
         uint16_t client_conf_handle;
-        uint16_t client_conf;
+        uint16_t client_conf[GATT_SERVER_MAX_CONNECTIONS]; // Indexed like gatt_server_t.state.conns
         uint16_t description_handle;
         uint16_t presentation_handle;
     } state;
@@ -116,6 +124,7 @@ typedef struct gatt_server_conn_s
 {
     esp_bd_addr_t addr;
     uint16_t conn_id;
+    uint16_t mtu;
     struct
     {
         uint8_t data[GATT_SERVER_PREPARE_WRITE_BUFSIZE];
@@ -124,7 +133,6 @@ typedef struct gatt_server_conn_s
     } write_buf;
 } gatt_server_conn_t;
 
-#define GATT_SERVER_MAX_CONNECTIONS 8
 #define GATT_SERVER_MAX_NAME_LENGTH 128
 
 typedef struct gatt_server_s
@@ -148,6 +156,11 @@ esp_err_t gatt_server_start(gatt_server_t *server, esp_gap_ble_cb_t gap_event_ha
 void gatt_server_gap_event_handler(gatt_server_t *server, esp_gap_ble_cb_event_t event, esp_ble_gap_cb_param_t *param);
 void gatt_server_gatts_event_handler(gatt_server_t *server, esp_gatts_cb_event_t event, esp_gatt_if_t gatt_if, esp_ble_gatts_cb_param_t *param);
 esp_err_t gatt_server_notify_char(gatt_server_t *server, gatt_server_char_t *chr, const void *data, size_t size);
+// Returns true if a client enabled notifications or indications for chr
+bool gatt_server_char_is_subscribed(gatt_server_char_t *chr);
+// Returns the maximum payload size for a notification of chr that all
+// its subscribers can receive, according to their negotiated MTUs.
+size_t gatt_server_get_notify_size(gatt_server_t *server, gatt_server_char_t *chr);
 
 #define BT_UUID_16(n) ((esp_bt_uuid_t){ \
     .len = ESP_UUID_LEN_16,             \
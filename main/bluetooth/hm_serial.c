@@ -0,0 +1,129 @@
+#include <string.h>
+
+#include <hal/log.h>
+
+#include "io/io.h"
+
+#include "util/macros.h"
+
+#include "hm_serial.h"
+
+static const char *TAG = "HM.Serial";
+
+static int hm_serial_msp_io_read(void *data, void *buf, size_t size, time_ticks_t timeout)
+{
+    hm_serial_t *serial = data;
+    return ring_buffer_pop_n(&serial->rb, buf, size);
+}
+
+static size_t hm_serial_get_notify_size(hm_serial_t *serial)
+{
+    return MIN(serial->notify_size(serial->notify_data), HM_SERIAL_MAX_NOTIFY_SIZE);
+}
+
+// Must be called with tx_lock held. The MTU might have shrunk (e.g. a new
+// subscriber) while bytes were waiting, so respect notify_size.
+static void hm_serial_tx_send(hm_serial_t *serial, size_t notify_size)
+{
+    for (size_t ii = 0; ii < serial->tx_size; ii += notify_size)
+    {
+        size_t n = MIN(notify_size, serial->tx_size - ii);
+        serial->notify(serial->notify_data, &serial->tx[ii], n);
+    }
+    serial->tx_size = 0;
+    serial->tx_flush_at = 0;
+}
+
+static int hm_serial_msp_io_write(void *data, const void *buf, size_t size)
+{
+    hm_serial_t *serial = data;
+    const uint8_t *ptr = buf;
+    xSemaphoreTake(serial->tx_lock, portMAX_DELAY);
+    size_t notify_size = hm_serial_get_notify_size(serial);
+    if (serial->tx_size >= notify_size)
+    {
+        hm_serial_tx_send(serial, notify_size);
+    }
+    for (size_t ii = 0; ii < size;)
+    {
+        size_t n = MIN(notify_size - serial->tx_size, size - ii);
+        memcpy(&serial->tx[serial->tx_size], &ptr[ii], n);
+        serial->tx_size += n;
+        ii += n;
+        if (serial->tx_size == notify_size)
+        {
+            hm_serial_tx_send(serial, notify_size);
+        }
+    }
+    bool schedule_flush = serial->tx_size > 0 && serial->tx_flush_at == 0;
+    if (schedule_flush)
+    {
+        serial->tx_flush_at = time_ticks_now() + HM_SERIAL_TX_COALESCE_INTERVAL;
+    }
+    xSemaphoreGive(serial->tx_lock);
+    if (schedule_flush)
+    {
+        xTaskNotifyGive(serial->tx_flush_task);
+    }
+    return size;
+}
+
+void hm_serial_init(hm_serial_t *serial, hm_serial_notify_f notify, hm_serial_notify_size_f notify_size, void *notify_data)
+{
+    io_t msp_io = {
+        .read = hm_serial_msp_io_read,
+        .write = hm_serial_msp_io_write,
+        .data = serial,
+    };
+
+    msp_serial_init(&serial->msp_serial, &msp_io);
+    msp_conn_init(&serial->msp, MSP_TRANSPORT(&serial->msp_serial));
+    RING_BUFFER_INIT(&serial->rb, uint8_t, HM_SERIAL_RB_CAPACITY);
+    serial->notify = notify;
+    serial->notify_size = notify_size;
+    serial->notify_data = notify_data;
+    serial->tx_lock = xSemaphoreCreateMutex();
+    serial->tx_flush_task = xTaskGetCurrentTaskHandle();
+    serial->tx_flush_at = 0;
+    serial->tx_size = 0;
+}
+
+void hm_serial_received(hm_serial_t *serial, const void *data, size_t size)
+{
+    // Clients should use write without response for throughput, since
+    // several writes can then be sent in the same connection event.
+    // Each one might be up to MTU - 3 bytes, so decode the buffered
+    // data when it doesn't fit.
+    const uint8_t *ptr = data;
+    size_t rem = size;
+    while (rem > 0)
+    {
+        size_t n = MIN(rem, serial->rb.capacity - ring_buffer_count(&serial->rb));
+        if (n == 0)
+        {
+            msp_conn_update(&serial->msp);
+            if (ring_buffer_count(&serial->rb) == serial->rb.capacity)
+            {
+                LOG_W(TAG, "Dropping %u bytes of MSP input", (unsigned)rem);
+                break;
+            }
+            continue;
+        }
+        ring_buffer_push_n(&serial->rb, ptr, n);
+        ptr += n;
+        rem -= n;
+    }
+    msp_conn_update(&serial->msp);
+    // Don't delay responses generated while handling the input
+    hm_serial_flush(serial);
+}
+
+void hm_serial_flush(hm_serial_t *serial)
+{
+    xSemaphoreTake(serial->tx_lock, portMAX_DELAY);
+    if (serial->tx_size > 0)
+    {
+        hm_serial_tx_send(serial, hm_serial_get_notify_size(serial));
+    }
+    xSemaphoreGive(serial->tx_lock);
+}
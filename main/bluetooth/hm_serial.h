@@ -0,0 +1,66 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <freertos/FreeRTOS.h>
+#include <freertos/semphr.h>
+#include <freertos/task.h>
+
+#include "msp/msp.h"
+#include "msp/msp_serial.h"
+
+#include "util/ringbuffer.h"
+#include "util/time.h"
+
+// Bridges raw MSP over an HM-10 style serial characteristic, which
+// clients write to and get notifications from. The GATT side is
+// provided by the caller, so it can be replaced in host benchmarks.
+//
+// Outgoing MSP bytes are coalesced into notifications as big as the MTU
+// allows. Bytes which don't fill a whole notification are kept for up
+// to HM_SERIAL_TX_COALESCE_INTERVAL, so responses arriving together
+// share notifications. Incoming writes are pushed in bulk, decoding
+// the buffered MSP when it doesn't fit.
+
+#define HM_SERIAL_RB_CAPACITY MSP_MAX_PAYLOAD_SIZE
+#define HM_SERIAL_TX_COALESCE_INTERVAL MILLIS_TO_TICKS(3)
+// Must be at least GATT_SERVER_MAX_NOTIFY_SIZE
+#define HM_SERIAL_MAX_NOTIFY_SIZE 514
+
+typedef void (*hm_serial_notify_f)(void *data, const void *buf, size_t size);
+// Returns the maximum notification payload the subscribers accept
+typedef size_t (*hm_serial_notify_size_f)(void *data);
+
+typedef struct hm_serial_s
+{
+    msp_conn_t msp; // Used to decode incoming raw MSP via BT
+    msp_serial_t msp_serial;
+    RING_BUFFER_DECLARE(rb, uint8_t, HM_SERIAL_RB_CAPACITY);
+    hm_serial_notify_f notify;
+    hm_serial_notify_size_f notify_size;
+    void *notify_data;
+    // MSP responses are written from the RC task, while the incoming
+    // data and the flushes are handled by the BT tasks.
+    SemaphoreHandle_t tx_lock;
+    TaskHandle_t tx_flush_task;
+    time_ticks_t tx_flush_at; // 0 if tx is empty
+    uint8_t tx[HM_SERIAL_MAX_NOTIFY_SIZE];
+    size_t tx_size;
+} hm_serial_t;
+
+// The calling task gets notified when bytes are left waiting for
+// hm_serial_flush(), see hm_serial_flush_at().
+void hm_serial_init(hm_serial_t *serial, hm_serial_notify_f notify, hm_serial_notify_size_f notify_size, void *notify_data);
+// Handles a write from a client, with or without response. MSP
+// responses generated while handling it are notified right away.
+void hm_serial_received(hm_serial_t *serial, const void *data, size_t size);
+// Notifies the bytes waiting to be coalesced, if any
+void hm_serial_flush(hm_serial_t *serial);
+
+// Returns when hm_serial_flush() should be called, 0 if there's
+// nothing waiting.
+inline time_ticks_t hm_serial_flush_at(const hm_serial_t *serial)
+{
+    return serial->tx_flush_at;
+}
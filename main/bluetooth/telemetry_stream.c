@@ -0,0 +1,150 @@
+#include <string.h>
+
+#include "util/macros.h"
+
+#include "telemetry_stream.h"
+
+static int telemetry_stream_index(uint8_t telemetry_id)
+{
+    if (TELEMETRY_IS_UPLINK(telemetry_id))
+    {
+        int idx = TELEMETRY_UPLINK_GET_IDX(telemetry_id);
+        return idx < TELEMETRY_UPLINK_COUNT ? idx : -1;
+    }
+    int idx = TELEMETRY_DOWNLINK_GET_IDX(telemetry_id);
+    return idx < TELEMETRY_DOWNLINK_COUNT ? TELEMETRY_UPLINK_COUNT + idx : -1;
+}
+
+static void telemetry_stream_subscribe(telemetry_stream_entry_t *entry, uint8_t interval)
+{
+    entry->subscribed = true;
+    entry->interval = interval * TELEMETRY_STREAM_INTERVAL_UNIT;
+    entry->sent_at = 0;
+}
+
+void telemetry_stream_init(telemetry_stream_t *stream)
+{
+    memset(stream, 0, sizeof(*stream));
+}
+
+bool telemetry_stream_configure(telemetry_stream_t *stream, const void *data, size_t size)
+{
+    const uint8_t *ptr = data;
+    if (size % TELEMETRY_STREAM_ENTRY_SIZE != 0)
+    {
+        return false;
+    }
+    for (int ii = 0; ii < size; ii += TELEMETRY_STREAM_ENTRY_SIZE)
+    {
+        if (ptr[ii] != TELEMETRY_STREAM_ALL_IDS && telemetry_stream_index(ptr[ii]) < 0)
+        {
+            return false;
+        }
+    }
+    for (int ii = 0; ii < ARRAY_COUNT(stream->entries); ii++)
+    {
+        stream->entries[ii].subscribed = false;
+    }
+    for (int ii = 0; ii < size; ii += TELEMETRY_STREAM_ENTRY_SIZE)
+    {
+        if (ptr[ii] == TELEMETRY_STREAM_ALL_IDS)
+        {
+            for (int jj = 0; jj < ARRAY_COUNT(stream->entries); jj++)
+            {
+                telemetry_stream_subscribe(&stream->entries[jj], ptr[ii + 1]);
+            }
+        }
+        else
+        {
+            telemetry_stream_subscribe(&stream->entries[telemetry_stream_index(ptr[ii])], ptr[ii + 1]);
+        }
+    }
+    stream->next = 0;
+    stream->has_subscriptions = size > 0;
+    return true;
+}
+
+bool telemetry_stream_has_subscriptions(const telemetry_stream_t *stream)
+{
+    return stream->has_subscriptions;
+}
+
+void telemetry_stream_reset(telemetry_stream_t *stream)
+{
+    for (int ii = 0; ii < ARRAY_COUNT(stream->entries); ii++)
+    {
+        stream->entries[ii].sent_at = 0;
+    }
+    stream->next = 0;
+}
+
+// Returns the record size or 0 if it doesn't fit in size. Strings are
+// truncated if truncate is true.
+static size_t telemetry_stream_encode_record(int id, const telemetry_t *val, uint8_t *buf, size_t size, bool truncate)
+{
+    size_t data_size = telemetry_get_data_size(id);
+    bool is_string = data_size == 0;
+    size_t header_size = is_string ? 2 : 1;
+    if (is_string)
+    {
+        data_size = strnlen(val->val.s, TELEMETRY_STRING_MAX_SIZE);
+        if (truncate && size > header_size && header_size + data_size > size)
+        {
+            data_size = size - header_size;
+        }
+    }
+    if (header_size + data_size > size)
+    {
+        return 0;
+    }
+    *buf++ = id;
+    if (is_string)
+    {
+        *buf++ = data_size;
+    }
+    memcpy(buf, &val->val, data_size);
+    return header_size + data_size;
+}
+
+size_t telemetry_stream_encode(telemetry_stream_t *stream, rc_data_t *data, void *buf, size_t size, time_micros_t now)
+{
+    uint8_t *ptr = buf;
+    size_t pos = 0;
+    unsigned count = ARRAY_COUNT(stream->entries);
+    unsigned start = stream->next;
+    for (unsigned ii = 0; ii < count; ii++)
+    {
+        unsigned idx = (start + ii) % count;
+        telemetry_stream_entry_t *entry = &stream->entries[idx];
+        if (!entry->subscribed || (entry->sent_at > 0 && now < entry->sent_at + entry->interval))
+        {
+            continue;
+        }
+        int id = telemetry_get_id_at(idx);
+        const telemetry_t *val = rc_data_get_telemetry(data, id);
+        if (!telemetry_has_value(val))
+        {
+            continue;
+        }
+        // Values are written by another task, read the change time
+        // before the value so a concurrent change is sent next time.
+        time_micros_t last_change = data_state_get_last_change(&val->data_state);
+        if (entry->sent_at > 0 && last_change == entry->sent_change)
+        {
+            continue;
+        }
+        // Truncate strings only when they don't fit in a whole buffer
+        size_t n = telemetry_stream_encode_record(id, val, &ptr[pos], size - pos, pos == 0);
+        if (n == 0)
+        {
+            // Full, continue from here on the next call
+            stream->next = idx;
+            return pos;
+        }
+        pos += n;
+        entry->sent_at = now;
+        entry->sent_change = last_change;
+    }
+    stream->next = 0;
+    return pos;
+}
@@ -0,0 +1,65 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "rc/rc_data.h"
+#include "rc/telemetry.h"
+
+#include "util/time.h"
+
+// Encodes the telemetry values which changed since they were last sent
+// as a stream of records, so clients can get notified of the changes
+// instead of polling every value.
+//
+// Each record is the telemetry id (1 byte) followed by its value in
+// little endian, with the size given by its type. Strings are sent as
+// a length byte followed by the characters, without the terminator.
+// Records are never split between buffers, strings which don't fit
+// in a whole buffer are truncated.
+//
+// Clients select the values to receive by writing a list of 2 byte
+// entries: the telemetry id and the minimum interval between records
+// for it in TELEMETRY_STREAM_INTERVAL_UNIT (0 to send every change).
+// TELEMETRY_STREAM_ALL_IDS applies the entry to every id. Ids not in
+// the list are not sent, so an empty list stops the stream. Values
+// in the list are sent once right away, then only when they change.
+
+#define TELEMETRY_STREAM_ALL_IDS 0xFF
+#define TELEMETRY_STREAM_INTERVAL_UNIT MILLIS_TO_MICROS(10)
+#define TELEMETRY_STREAM_ENTRY_SIZE 2
+// Biggest record, a string using all its space
+#define TELEMETRY_STREAM_MAX_RECORD_SIZE (2 + TELEMETRY_STRING_MAX_SIZE)
+
+typedef struct telemetry_stream_entry_s
+{
+    bool subscribed;
+    time_micros_t interval;
+    time_micros_t sent_at;     // 0 if not sent since it was subscribed
+    time_micros_t sent_change; // data_state_t last_change of the sent value
+} telemetry_stream_entry_t;
+
+typedef struct telemetry_stream_s
+{
+    telemetry_stream_entry_t entries[TELEMETRY_COUNT]; // Indexed like telemetry_get_id_at()
+    // Position to start encoding at, so ids at the end get their turn
+    // when there are more changes than space.
+    unsigned next;
+    bool has_subscriptions;
+} telemetry_stream_t;
+
+void telemetry_stream_init(telemetry_stream_t *stream);
+// Replaces the subscriptions with the ones in data, in the format
+// described above. Returns false without changing them if data is
+// not valid.
+bool telemetry_stream_configure(telemetry_stream_t *stream, const void *data, size_t size);
+// Streams with no subscriptions never encode anything, so callers can
+// skip telemetry_stream_encode() and the buffer setup for it.
+bool telemetry_stream_has_subscriptions(const telemetry_stream_t *stream);
+// Makes the subscribed values be sent again, even if they haven't
+// changed. Should be called when a new client starts receiving.
+void telemetry_stream_reset(telemetry_stream_t *stream);
+// Encodes the records due at now into buf. Returns the number of
+// bytes written, 0 if there's nothing to send.
+size_t telemetry_stream_encode(telemetry_stream_t *stream, rc_data_t *data, void *buf, size_t size, time_micros_t now);
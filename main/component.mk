@@ -24,6 +24,10 @@ ifdef CONFIG_RAVEN_RX_SUPPORT
     RC_MODE := $(RC_MODE)RX
 endif
 
+ifdef CONFIG_RAVEN_TRACE
+    CPPFLAGS += -DUSE_TRACE
+endif
+
 ifdef CONFIG_RAVEN_SCREEN_SUPPORT
     CPPFLAGS += -DUSE_SCREEN
 endif
@@ -1,5 +1,7 @@
 #include "rc/rc_data.h"
 
+#include "util/macros.h"
+
 #include "input.h"
 
 bool input_open(rc_data_t *data, input_t *input, void *config)
@@ -32,6 +34,20 @@ bool input_update(input_t *input, time_micros_t now)
     return updated;
 }
 
+time_micros_t input_next_update(input_t *input, time_micros_t now)
+{
+    if (!input || !input->is_open || !input->vtable.update)
+    {
+        return TIME_MICROS_MAX;
+    }
+    time_micros_t next = now + INPUT_POLL_INTERVAL;
+    if (input->vtable.next_update)
+    {
+        next = input->vtable.next_update(input, now);
+    }
+    return MIN(next, failsafe_next_update(&input->failsafe));
+}
+
 void input_close(input_t *input, void *config)
 {
     if (input && input->is_open && input->vtable.close)
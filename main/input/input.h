@@ -10,6 +10,8 @@
 
 #define INPUT_UPDATE_CHANNEL(input, channel, value)
 #define INPUT_SET_MSP_TRANSPORT(input_impl, tr) msp_io_set_transport(&input_impl->input.msp, tr)
+// Inputs without a next_update function are polled at this interval
+#define INPUT_POLL_INTERVAL MILLIS_TO_MICROS(1)
 
 typedef struct rc_data_s rc_data_t;
 
@@ -19,6 +21,10 @@ typedef struct input_vtable_s
     // Returns true iff new data was acquired
     bool (*update)(void *input, rc_data_t *data, time_micros_t now);
     void (*close)(void *input, void *config);
+    // Optional. Returns the time at which update needs to be called
+    // again. Inputs waiting for a LoRa interrupt don't need to account
+    // for it, since those wake up the RC task.
+    time_micros_t (*next_update)(void *input, time_micros_t now);
 } input_vtable_t;
 
 typedef struct msp_transport_s msp_transport_t;
@@ -36,4 +42,6 @@ typedef struct input_s
 bool input_open(rc_data_t *data, input_t *input, void *config);
 // Returns true iff new data was acquired
 bool input_update(input_t *input, time_micros_t now);
+// Returns the time at which input_update() needs to be called again
+time_micros_t input_next_update(input_t *input, time_micros_t now);
 void input_close(input_t *input, void *config);
\ No newline at end of file
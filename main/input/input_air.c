@@ -1,5 +1,8 @@
+#include <string.h>
+
 #include <hal/log.h>
 
+#include "air/air_channels.h"
 #include "air/air_lora.h"
 
 #include "config/config.h"
@@ -7,10 +10,11 @@
 
 #include "rc/rc_data.h"
 
+#include "util/trace.h"
+
 #include "input_air.h"
 
 #define AIR_TO_CHANNEL_INPUT(val) RC_CHANNEL_DECODE_FROM_BITS(val, AIR_CHANNEL_BITS)
-#define FULL_CYCLE_TIME_WAIT_FACTOR 1.10f // Wait 110% of the cycle time to decide we've lost a packet
 // Maximum number of lost packets to continue jumping forward
 #define MAX_LOST_PACKETS_JUMPING_FORWARD (AIR_SEQ_COUNT / 2)
 
@@ -33,16 +37,41 @@ typedef enum {
 static void input_air_update_lora_frequency(input_air_t *input_air, unsigned freq_index)
 {
     input_air->freq_index = freq_index;
-    lora_set_frequency(input_air->lora, input_air->freq_table.freqs[freq_index]);
+    air_freq_table_set(&input_air->freq_table, input_air->lora, freq_index);
     lora_enable_continous_rx(input_air->lora);
 }
 
+// Undoes the frequency substitutions, like the TX does on failsafe.
+// Either end might have been restarted with the base table.
+static void input_air_reset_freq_table(input_air_t *input_air)
+{
+    bool listening_on_spare = false;
+    for (unsigned ii = 0; ii < AIR_NUM_HOPPING_FREQS; ii++)
+    {
+        if (air_freq_table_is_substituted(&input_air->freq_table, ii))
+        {
+            air_freq_stats_reset_slot(&input_air->freq_stats, ii);
+            air_link_stats_reset_freq(&input_air->air.link_stats, ii);
+            listening_on_spare |= ii == input_air->freq_index;
+        }
+    }
+    air_freq_table_reset(&input_air->freq_table);
+    if (listening_on_spare)
+    {
+        input_air_update_lora_frequency(input_air, input_air->freq_index);
+    }
+}
+
 static void input_air_update_lora_mode(input_air_t *input_air)
 {
     air_lora_set_parameters(input_air->lora, input_air->air_mode);
+    // FEC depends on the mode, so the expected size might change
+    lora_set_payload_size(input_air->lora, air_tx_packet_size(air_io_uses_fec(&input_air->air, input_air->air_mode)));
+    air_link_stats_set_mode(&input_air->air.link_stats, input_air->air_mode, time_micros_now());
     air_cmd_switch_mode_ack_reset(&input_air->switch_air_mode);
     input_air->full_cycle_time = air_lora_full_cycle_time(input_air->air_mode);
     input_air->uplink_cycle_time = air_lora_uplink_cycle_time(input_air->air_mode);
+    input_air->uplink_time_on_air = air_lora_time_on_air(input_air->air_mode, air_tx_packet_size(air_io_uses_fec(&input_air->air, input_air->air_mode)));
     failsafe_set_max_interval(&input_air->input.failsafe, air_lora_rx_failsafe_interval(input_air->air_mode));
 }
 
@@ -50,16 +79,20 @@ static void input_air_lora_start(input_air_t *input_air)
 {
     lora_set_sync_word(input_air->lora, air_sync_word(input_air->air.pairing.key));
     air_freq_table_init(&input_air->freq_table, input_air->air.pairing.key, air_lora_band_frequency(input_air->band));
+    air_freq_stats_reset(&input_air->freq_stats);
+    air_link_stats_reset(&input_air->air.link_stats);
+    air_freq_substitution_ack_reset(&input_air->freq_sub_ack);
     lora_set_tx_power(input_air->lora, 17);
     input_air_update_lora_mode(input_air);
     lora_sleep(input_air->lora);
-    lora_set_payload_size(input_air->lora, sizeof(air_tx_packet_t));
     input_air_update_lora_frequency(input_air, 0);
     lora_enable_continous_rx(input_air->lora);
     input_air->rx_errors = 0;
     input_air->rx_success = 0;
     input_air->air_state = AIR_INPUT_STATE_RX;
     input_air->tx_seq = 0;
+    input_air->ack_gap = true;
+    input_air->ack_synced = false;
     input_air->next_packet_deadline = TIME_MICROS_MAX;
 }
 
@@ -73,7 +106,7 @@ static void input_air_stream_telemetry_decoded(void *user, int telemetry_id, con
 {
     input_air_t *input_air = user;
     telemetry_t *t = &input_air->input.rc_data->telemetry_uplink[TELEMETRY_UPLINK_GET_IDX(telemetry_id)];
-    bool changed = telemetry_set_bytes(t, data, size, now);
+    bool changed = rc_data_telemetry_did_set(input_air->input.rc_data, telemetry_id, telemetry_set_bytes(t, data, size, now), now);
     if (telemetry_id == TELEMETRY_ID_PILOT_NAME && changed)
     {
         air_addr_t bound_addr;
@@ -84,6 +117,43 @@ static void input_air_stream_telemetry_decoded(void *user, int telemetry_id, con
     }
 }
 
+static void input_air_telemetry_changed(void *user_data, int telemetry_id, bool changed, time_micros_t now)
+{
+    input_air_t *input_air = user_data;
+    if (TELEMETRY_IS_DOWNLINK(telemetry_id))
+    {
+        telemetry_sched_value_set(&input_air->telemetry_sched, TELEMETRY_DOWNLINK_GET_IDX(telemetry_id), changed, now);
+    }
+}
+
+static void input_air_init_telemetry_sched(input_air_t *input_air, rc_data_t *data, time_micros_t now)
+{
+    telemetry_sched_init(&input_air->telemetry_sched, TELEMETRY_DOWNLINK_COUNT);
+    for (int ii = 0; ii < TELEMETRY_DOWNLINK_COUNT; ii++)
+    {
+        telemetry_sched_set_class(&input_air->telemetry_sched, ii, telemetry_sched_class_for_id(TELEMETRY_DOWNLINK_ID(ii)));
+        if (telemetry_has_value(&data->telemetry_downlink[ii]))
+        {
+            telemetry_sched_add(&input_air->telemetry_sched, ii, now);
+        }
+    }
+    rc_data_add_telemetry_listener(data, input_air_telemetry_changed, input_air);
+}
+
+// Returns the number of TX seqs to wait before performing a change
+// requested by the TX (mode switch or freq substitution), so we can
+// send enough confirmations to it.
+static unsigned input_air_confirmation_count(input_air_t *input_air)
+{
+    // Use 3 for MODE_5, 6 for MODE_4, ... up to a maximum of 15
+    unsigned count = MIN(15, 3 * (air_lora_mode_rank(AIR_LORA_MODE_LONGEST) + 1 - air_lora_mode_rank(input_air->air_mode)));
+    // The confirmation is sent in the next cycle with a downlink stage, so the
+    // change must happen after it. Since seq wraps around, this requires
+    // air_lora_cycles_until_full() to be < AIR_SEQ_COUNT / 2.
+    unsigned until_full = air_lora_cycles_until_full(input_air->air_mode, input_air->tx_seq);
+    return MIN(count + until_full - 1, AIR_SEQ_COUNT - 1);
+}
+
 static void input_air_stream_cmd_decoded(void *user, air_cmd_e cmd, const void *data, size_t size, time_micros_t now)
 {
     input_air_t *input_air = user;
@@ -97,23 +167,44 @@ static void input_air_stream_cmd_decoded(void *user, air_cmd_e cmd, const void *
     case AIR_CMD_SWITCH_MODE_3:
     case AIR_CMD_SWITCH_MODE_4:
     case AIR_CMD_SWITCH_MODE_5:
+    case AIR_CMD_SWITCH_MODE_6:
+    case AIR_CMD_SWITCH_MODE_7:
     {
         air_lora_mode_e mode = air_lora_mode_from_cmd(cmd);
         // Make sure we support this mode, reject it otherwise
-        if (mode < input_air->air_mode_fastest || mode > input_air->air_mode_longest)
+        if (air_lora_mode_rank(mode) < air_lora_mode_rank(input_air->air_mode_fastest) ||
+            air_lora_mode_rank(mode) > air_lora_mode_rank(input_air->air_mode_longest))
         {
             break;
         }
-        if (mode != input_air->air_mode && mode != input_air->switch_air_mode.mode)
+        if (mode != input_air->air_mode && mode != input_air->switch_air_mode.mode &&
+            !air_freq_substitution_ack_in_progress(&input_air->freq_sub_ack))
         {
-            unsigned count = MIN(15, 3 * ((AIR_LORA_MODE_LONGEST + 1) - input_air->air_mode));
+            unsigned count = input_air_confirmation_count(input_air);
             LOG_I(TAG, "Got request for switch to mode %d, %u confirmations", mode, count);
-            // Use 3 for MODE_5, 6 for MODE_4, ... up to a maximum of 15
             input_air->switch_air_mode.mode = mode;
             input_air->switch_air_mode.at_tx_seq = (input_air->tx_seq + count + input_air->consecutive_lost_packets) % AIR_SEQ_COUNT;
         }
         break;
     }
+    case AIR_CMD_FREQ_SUBSTITUTE:
+        if (size == sizeof(air_freq_substitution_t) &&
+            !air_cmd_switch_mode_ack_in_progress(&input_air->switch_air_mode) &&
+            !air_freq_substitution_ack_in_progress(&input_air->freq_sub_ack))
+        {
+            // If we already performed this substitution the TX didn't get
+            // our ACK, so we just ACK it again.
+            const air_freq_substitution_t *sub = data;
+            unsigned count = input_air_confirmation_count(input_air);
+            LOG_I(TAG, "Got request for freq substitution in slot %u, %u confirmations", sub->slot, count);
+            memcpy(&input_air->freq_sub_ack.sub, sub, sizeof(*sub));
+            input_air->freq_sub_ack.at_tx_seq = (input_air->tx_seq + count + input_air->consecutive_lost_packets) % AIR_SEQ_COUNT;
+            input_air->freq_sub_ack.in_progress = 1;
+        }
+        break;
+    case AIR_CMD_FREQ_SUBSTITUTE_ACK:
+        // Only sent downstream
+        break;
     case AIR_CMD_MSP:
     {
         msp_conn_t *conn = msp_io_get_conn(&input_air->input.msp);
@@ -123,6 +214,15 @@ static void input_air_stream_cmd_decoded(void *user, air_cmd_e cmd, const void *
         }
         break;
     }
+    case AIR_CMD_MSP_COMPRESSED:
+    {
+        msp_conn_t *conn = msp_io_get_conn(&input_air->input.msp);
+        if (conn)
+        {
+            msp_air_dispatch_compressed(&input_air->msp_air, conn, data, size);
+        }
+        break;
+    }
     case AIR_CMD_RMP:
         rmp_air_decode(&input_air->rmp_air, data, size);
         break;
@@ -141,6 +241,13 @@ static size_t input_air_feed_stream_ack(input_air_t *input_air)
                                           AIR_CMD_SWITCH_MODE_ACK, &input_air->switch_air_mode,
                                           sizeof(input_air->switch_air_mode));
     }
+    if (air_freq_substitution_ack_in_progress(&input_air->freq_sub_ack))
+    {
+        air_stream_reset_output(&input_air->air_stream);
+        return air_stream_feed_output_cmd(&input_air->air_stream,
+                                          AIR_CMD_FREQ_SUBSTITUTE_ACK, &input_air->freq_sub_ack,
+                                          sizeof(input_air->freq_sub_ack));
+    }
     return 0;
 }
 
@@ -161,46 +268,79 @@ static void input_air_msp_before_feed(msp_air_t *msp_air, size_t size, void *use
 
 static size_t input_air_feed_stream(input_air_t *input_air, rc_data_t *data, time_micros_t now)
 {
-    telemetry_t *dt = NULL;
-    int dtidx = -1;
-    uint32_t max_score = 0;
-    for (int ii = 0; ii < TELEMETRY_DOWNLINK_COUNT; ii++)
+    int idx;
+    while ((idx = telemetry_sched_peek(&input_air->telemetry_sched)) >= 0)
     {
-        telemetry_t *t = &data->telemetry_downlink[ii];
+        telemetry_t *t = &data->telemetry_downlink[idx];
         if (!telemetry_has_value(t))
         {
+            // Value was reset by the output
+            telemetry_sched_remove(&input_air->telemetry_sched, idx);
             continue;
         }
-        uint32_t score = data_state_score(&t->data_state, now);
-        if (score > max_score)
+        size_t n = air_stream_feed_output_downlink_telemetry(&input_air->air_stream, t, TELEMETRY_DOWNLINK_ID(idx));
+        if (n > 0)
         {
-            dt = t;
-            dtidx = ii;
-            max_score = score;
+            // Otherwise it didn't fit, keep it at the head for the next packet
+            data_state_sent(&t->data_state, -1, now);
+            telemetry_sched_sent(&input_air->telemetry_sched, idx, now);
         }
-    }
-    if (dt)
-    {
-        data_state_sent(&dt->data_state, -1, now);
-        return air_stream_feed_output_downlink_telemetry(&input_air->air_stream, dt, TELEMETRY_DOWNLINK_ID(dtidx));
+        return n;
     }
     // No telemetry data to send
     return 0;
 }
 
+static void input_air_update_ack_seq(input_air_t *input_air, unsigned tx_seq, bool received)
+{
+    if (received && !input_air->ack_gap && tx_seq == (input_air->ack_seq + 1) % AIR_SEQ_COUNT)
+    {
+        input_air->ack_seq = tx_seq;
+    }
+    else
+    {
+        input_air->ack_gap = true;
+    }
+}
+
+static unsigned input_air_response_ack_seq(input_air_t *input_air, unsigned tx_seq)
+{
+    if (!input_air->ack_synced)
+    {
+        // We don't know where the TX range starts. tx_seq + 1 is
+        // never within it, so nothing gets acknowledged.
+        return (tx_seq + 1) % AIR_SEQ_COUNT;
+    }
+    return input_air->ack_seq;
+}
+
+// Must be called after every cycle with a downlink stage, once the
+// response has been sent (or the uplink packet was lost). synced must
+// be false if we're not sure tx_seq is right.
+static void input_air_restart_ack_seq(input_air_t *input_air, unsigned tx_seq, bool synced)
+{
+    // TX starts the next range right after tx_seq
+    input_air->ack_seq = tx_seq;
+    input_air->ack_gap = false;
+    input_air->ack_synced = synced;
+}
+
 static void input_air_send_response(input_air_t *input_air, rc_data_t *data, time_micros_t now)
 {
-    air_rx_packet_t out_pkt = {
-        .seq = input_air->seq++,
-        .tx_seq = input_air->tx_seq,
-        .data = {AIR_DATA_START_STOP, AIR_DATA_START_STOP, AIR_DATA_START_STOP},
+    air_rx_fec_packet_t out_fec_pkt = {
+        .packet = {
+            .seq = input_air->seq++,
+            .tx_seq = input_air_response_ack_seq(input_air, input_air->tx_seq),
+            .data = {AIR_DATA_START_STOP, AIR_DATA_START_STOP, AIR_DATA_START_STOP},
+        },
     };
+    air_rx_packet_t *out_pkt = &out_fec_pkt.packet;
 
     if (input_air_feed_stream_ack(input_air) == 0)
     {
         // Only send non-ACK data if we have no ACK to send
         size_t count = air_stream_output_count(&input_air->air_stream);
-        while (count < sizeof(out_pkt.data))
+        while (count < sizeof(out_pkt->data))
         {
             size_t n = input_air_feed_stream(input_air, data, now);
             if (n == 0)
@@ -210,20 +350,15 @@ static void input_air_send_response(input_air_t *input_air, rc_data_t *data, tim
             count += n;
         }
     }
-    int p = 0;
-    uint8_t c;
     // Check if we have buffered data to send
-    while (p < sizeof(out_pkt.data) && air_stream_pop_output(&input_air->air_stream, &c))
-    {
-        out_pkt.data[p++] = c;
-    }
+    air_stream_pop_output_n(&input_air->air_stream, out_pkt->data, sizeof(out_pkt->data));
     // XXX: Reset the LoRa modem before sending. Otherwise sometimes we don't
     // get the TX done interrupt.
     lora_sleep(input_air->lora);
-    air_rx_packet_prepare(&out_pkt, input_air->air.pairing.key);
-    //LOG_BUFFER_I("LORAOUT", &out_pkt, sizeof(out_pkt));
+    size_t size = air_rx_fec_packet_prepare(&out_fec_pkt, input_air->air.pairing.key, air_io_uses_fec(&input_air->air, input_air->air_mode));
+    //LOG_BUFFER_I("LORAOUT", &out_fec_pkt, size);
     input_air->air_state = AIR_INPUT_STATE_TX;
-    lora_send(input_air->lora, &out_pkt, sizeof(out_pkt));
+    lora_send(input_air->lora, &out_fec_pkt, size);
 }
 
 static unsigned input_air_next_expected_tx_seq(input_air_t *input_air)
@@ -232,6 +367,24 @@ static unsigned input_air_next_expected_tx_seq(input_air_t *input_air)
 }
 
 // Returns wether a frequency change happened
+static time_micros_t input_air_cycle_time(input_air_t *input_air, unsigned seq)
+{
+    return air_lora_cycle_is_full(input_air->air_mode, seq) ? input_air->full_cycle_time : input_air->uplink_cycle_time;
+}
+
+// Expects the packet after seq one cycle after the given arrival time of
+// seq. The TX starts the following packet one cycle minus the time on air
+// after that, and we must be listening on its frequency by then, so the
+// packet is declared lost halfway in between. Deadlines after a loss are
+// anchored on the expected arrival, so they don't drift.
+static void input_air_expect_next_packet(input_air_t *input_air, unsigned seq, time_micros_t at)
+{
+    unsigned next_seq = (seq + 1) % AIR_SEQ_COUNT;
+    input_air->next_packet_at = at + input_air_cycle_time(input_air, seq);
+    time_micros_t gap = input_air_cycle_time(input_air, next_seq) - input_air->uplink_time_on_air;
+    input_air->next_packet_deadline = input_air->next_packet_at + gap / 2;
+}
+
 static bool input_air_prepare_next_receive(input_air_t *input_air)
 {
     if (air_cmd_switch_mode_ack_in_progress(&input_air->switch_air_mode) &&
@@ -242,6 +395,13 @@ static bool input_air_prepare_next_receive(input_air_t *input_air)
         input_air->air_mode = input_air->switch_air_mode.mode;
         input_air_update_lora_mode(input_air);
     }
+    if (air_freq_substitution_ack_proceed(&input_air->freq_sub_ack, input_air_next_expected_tx_seq(input_air)))
+    {
+        air_freq_table_substitute(&input_air->freq_table, input_air->freq_sub_ack.sub.slot, input_air->freq_sub_ack.sub.spare);
+        air_freq_stats_reset_slot(&input_air->freq_stats, input_air->freq_sub_ack.sub.slot);
+        air_link_stats_reset_freq(&input_air->air.link_stats, input_air->freq_sub_ack.sub.slot);
+        air_freq_substitution_ack_reset(&input_air->freq_sub_ack);
+    }
 
     // Start hopping on reverse if the FS becomes too long. The TX might
     // have been restarted.
@@ -272,9 +432,11 @@ static inline bool input_air_receive(input_air_t *input_air, air_tx_packet_t *pk
 {
     if (lora_is_rx_done(input_air->lora))
     {
-        size_t read_size = lora_read(input_air->lora, pkt, sizeof(*pkt));
-        //LOG_BUFFER_I("LORAIN", pkt, read_size);
-        if (read_size != sizeof(*pkt) || !air_tx_packet_validate(pkt, input_air->air.pairing.key))
+        air_tx_fec_packet_t fec_pkt;
+        bool fec = air_io_uses_fec(&input_air->air, input_air->air_mode);
+        size_t read_size = lora_read(input_air->lora, &fec_pkt, air_tx_packet_size(fec));
+        //LOG_BUFFER_I("LORAIN", &fec_pkt, read_size);
+        if (!air_tx_fec_packet_validate(&fec_pkt, read_size, input_air->air.pairing.key, fec))
         {
             LOG_W(TAG, "Got invalid frame");
             // Reading the FIFO puts the module in IDLE state because we need
@@ -283,6 +445,7 @@ static inline bool input_air_receive(input_air_t *input_air, air_tx_packet_t *pk
             lora_enable_continous_rx(input_air->lora);
             return false;
         }
+        *pkt = fec_pkt.packet;
         return true;
     }
     return false;
@@ -306,9 +469,12 @@ static bool input_air_open(void *input, void *config)
     input_air->seq = 0;
     input_air->consecutive_lost_packets = 0;
     input_air->telemetry_fed_index = 0;
+    air_channels_decoder_reset(&input_air->channels_dec);
+    input_air_init_telemetry_sched(input_air, input_air->input.rc_data, time_micros_now());
     air_stream_init(&input_air->air_stream, input_air_stream_channel_decoded,
                     input_air_stream_telemetry_decoded, input_air_stream_cmd_decoded, input);
     msp_air_init(&input_air->msp_air, &input_air->air_stream, input_air_msp_before_feed, input_air);
+    msp_air_set_compression(&input_air->msp_air, air_io_uses_msp_compression(&input_air->air));
     INPUT_SET_MSP_TRANSPORT(input_air, MSP_TRANSPORT(&input_air->msp_air));
     return true;
 }
@@ -320,24 +486,21 @@ static bool input_air_update(void *input, rc_data_t *data, time_micros_t now)
     int rssi, snr, lq;
     bool updated = false;
 
+    air_link_stats_update(&input_air->air.link_stats, now);
     switch ((air_input_state_e)input_air->air_state)
     {
     case AIR_INPUT_STATE_RX:
         if (input_air_receive(input_air, &in_pkt))
         {
-            input_air->last_packet_at = now;
+            TRACE(TRACE_POINT_AIR_DECODED);
             bool cycle_is_full = air_lora_cycle_is_full(input_air->air_mode, in_pkt.seq);
-            if (cycle_is_full)
-            {
-                input_air->next_packet_deadline = now + input_air->full_cycle_time * FULL_CYCLE_TIME_WAIT_FACTOR;
-            }
-            else
-            {
-                input_air->next_packet_deadline = now + input_air->uplink_cycle_time * FULL_CYCLE_TIME_WAIT_FACTOR;
-            }
+            input_air_expect_next_packet(input_air, in_pkt.seq, now);
             input_air->consecutive_lost_packets = 0;
             input_air->rx_success++;
             input_air->tx_seq = in_pkt.seq;
+            input_air_update_ack_seq(input_air, in_pkt.seq, true);
+            air_freq_stats_update(&input_air->freq_stats, in_pkt.seq, true);
+            air_link_stats_update_freq(&input_air->air.link_stats, in_pkt.seq, true);
 
             rssi = lora_rssi(input_air->lora, &snr, &lq);
             air_io_update_rssi(&input_air->air, rssi, snr, lq, now);
@@ -347,6 +510,7 @@ static bool input_air_update(void *input, rc_data_t *data, time_micros_t now)
             if (cycle_is_full)
             {
                 input_air_send_response(input_air, data, now);
+                input_air_restart_ack_seq(input_air, in_pkt.seq, true);
             }
             else
             {
@@ -356,10 +520,19 @@ static bool input_air_update(void *input, rc_data_t *data, time_micros_t now)
             updated = true;
             // Do this after the response packet has been sent, otherwise the processing
             // could delay the response too much resulting on a lost cycle.
-            rc_data_update_channel(data, 0, AIR_TO_CHANNEL_INPUT(in_pkt.ch0), now);
-            rc_data_update_channel(data, 1, AIR_TO_CHANNEL_INPUT(in_pkt.ch1), now);
-            rc_data_update_channel(data, 2, AIR_TO_CHANNEL_INPUT(in_pkt.ch2), now);
-            rc_data_update_channel(data, 3, AIR_TO_CHANNEL_INPUT(in_pkt.ch3), now);
+            if (air_io_uses_channel_delta(&input_air->air))
+            {
+                air_channels_decode(&input_air->channels_dec, &in_pkt, MIN(input_air->uplink_cycle_time, input_air->full_cycle_time),
+                                    input_air_stream_channel_decoded, input_air, now);
+            }
+            else
+            {
+                rc_data_update_channel(data, 0, AIR_TO_CHANNEL_INPUT(in_pkt.ch0), now);
+                rc_data_update_channel(data, 1, AIR_TO_CHANNEL_INPUT(in_pkt.ch1), now);
+                rc_data_update_channel(data, 2, AIR_TO_CHANNEL_INPUT(in_pkt.ch2), now);
+                rc_data_update_channel(data, 3, AIR_TO_CHANNEL_INPUT(in_pkt.ch3), now);
+            }
+            TRACE(TRACE_POINT_CHANNELS_UPDATED);
 
             air_stream_feed_input(&input_air->air_stream, in_pkt.seq, in_pkt.data, sizeof(in_pkt.data), now);
         }
@@ -369,14 +542,19 @@ static bool input_air_update(void *input, rc_data_t *data, time_micros_t now)
             unsigned lost_tx_seq = input_air_next_expected_tx_seq(input_air);
             input_air->rx_errors++;
             input_air->consecutive_lost_packets++;
-            if (air_lora_cycle_is_full(input_air->air_mode, lost_tx_seq))
+            if (input_air->consecutive_lost_packets <= MAX_LOST_PACKETS_JUMPING_FORWARD)
             {
-                input_air->next_packet_deadline = now + input_air->full_cycle_time * FULL_CYCLE_TIME_WAIT_FACTOR;
+                air_freq_stats_update(&input_air->freq_stats, lost_tx_seq, false);
+                air_link_stats_update_freq(&input_air->air.link_stats, lost_tx_seq, false);
             }
-            else
+            input_air_update_ack_seq(input_air, lost_tx_seq, false);
+            if (air_lora_cycle_is_full(input_air->air_mode, lost_tx_seq))
             {
-                input_air->next_packet_deadline = now + input_air->uplink_cycle_time * FULL_CYCLE_TIME_WAIT_FACTOR;
+                // After too many lost packets we can't tell which seq was lost
+                bool synced = input_air->consecutive_lost_packets <= MAX_LOST_PACKETS_JUMPING_FORWARD;
+                input_air_restart_ack_seq(input_air, lost_tx_seq, synced);
             }
+            input_air_expect_next_packet(input_air, lost_tx_seq, input_air->next_packet_at);
             LOG_W(TAG, "invalid or lost frame, %u consecutive, %f%% error rate",
                   input_air->consecutive_lost_packets,
                   (input_air->rx_errors * 100.0) / (input_air->rx_errors + input_air->rx_success));
@@ -393,6 +571,8 @@ static bool input_air_update(void *input, rc_data_t *data, time_micros_t now)
         else if (failsafe_is_active(data->failsafe.input))
         {
             air_cmd_switch_mode_ack_reset(&input_air->switch_air_mode);
+            air_freq_substitution_ack_reset(&input_air->freq_sub_ack);
+            input_air_reset_freq_table(input_air);
             if (input_air->air_mode != input_air->air_mode_longest)
             {
                 input_air->air_mode = input_air->air_mode_longest;
@@ -404,7 +584,7 @@ static bool input_air_update(void *input, rc_data_t *data, time_micros_t now)
     case AIR_INPUT_STATE_TX:
         if (lora_is_tx_done(input_air->lora))
         {
-            lora_set_payload_size(input_air->lora, sizeof(air_tx_packet_t));
+            lora_set_payload_size(input_air->lora, air_tx_packet_size(air_io_uses_fec(&input_air->air, input_air->air_mode)));
             input_air_prepare_next_receive(input_air);
             input_air->air_state = AIR_INPUT_STATE_RX;
         }
@@ -413,10 +593,37 @@ static bool input_air_update(void *input, rc_data_t *data, time_micros_t now)
     return updated;
 }
 
+static time_micros_t input_air_next_update(void *input, time_micros_t now)
+{
+    input_air_t *input_air = input;
+    switch ((air_input_state_e)input_air->air_state)
+    {
+    case AIR_INPUT_STATE_RX:
+        if (lora_is_rx_done(input_air->lora))
+        {
+            return now;
+        }
+        if (input_air->next_packet_deadline == TIME_MICROS_MAX)
+        {
+            break;
+        }
+        return input_air->next_packet_deadline + 1;
+    case AIR_INPUT_STATE_TX:
+        if (lora_is_tx_done(input_air->lora))
+        {
+            return now;
+        }
+        break;
+    }
+    // Waiting for the LoRa interrupt
+    return TIME_MICROS_MAX;
+}
+
 static void input_air_close(void *input, void *config)
 {
     LOG_I(TAG, "Close");
     input_air_t *input_air = input;
+    rc_data_remove_telemetry_listener(input_air->input.rc_data, input_air_telemetry_changed, input_air);
     lora_sleep(input_air->lora);
 }
 
@@ -428,6 +635,7 @@ void input_air_init(input_air_t *input, air_addr_t addr, lora_t *lora, air_lora_
         .open = input_air_open,
         .update = input_air_update,
         .close = input_air_close,
+        .next_update = input_air_next_update,
     };
     // Note that the air_stream is not initialized yet, but we won't
     // send anything until it's bound.
@@ -1,5 +1,6 @@
 #pragma once
 
+#include "air/air_channels.h"
 #include "air/air_cmd.h"
 #include "air/air_io.h"
 #include "air/air_freq.h"
@@ -10,6 +11,8 @@
 
 #include "msp/msp_air.h"
 
+#include "rc/telemetry_sched.h"
+
 #include "rmp/rmp_air.h"
 
 #include "util/time.h"
@@ -26,7 +29,14 @@ typedef struct input_air_s
     int rx_success;
     unsigned seq : AIR_SEQ_BITS;
     unsigned tx_seq : AIR_SEQ_BITS;
+    // Last TX seq received with no gaps since the previous cycle with
+    // a downlink stage. It's echoed in air_rx_packet_t.tx_seq, so the
+    // TX can acknowledge data sent in uplink only cycles too.
+    unsigned ack_seq : AIR_SEQ_BITS;
+    bool ack_gap;
+    bool ack_synced; // False until we've seen a cycle with a downlink stage
     air_stream_t air_stream;
+    air_channels_decoder_t channels_dec;
     air_lora_mode_e air_mode;
     air_lora_mode_e air_mode_fastest;
     air_lora_mode_e air_mode_longest;
@@ -34,11 +44,15 @@ typedef struct input_air_s
     unsigned air_state;
     unsigned consecutive_lost_packets;
     unsigned telemetry_fed_index;
+    telemetry_sched_t telemetry_sched; // Downlink telemetry
     time_micros_t full_cycle_time;
     time_micros_t uplink_cycle_time;
-    time_micros_t last_packet_at;
+    time_micros_t uplink_time_on_air;
+    time_micros_t next_packet_at; // Expected arrival
     time_micros_t next_packet_deadline;
     air_freq_table_t freq_table;
+    air_freq_stats_t freq_stats; // Uplink
+    air_freq_substitution_ack_t freq_sub_ack;
     unsigned freq_index;
 
     msp_air_t msp_air;
@@ -31,7 +31,8 @@ static const char *TAG = "CRSF.Input";
 #define CRSF_INPUT_CMD_PING 48 // Sent by CRSF to "ping" a CMD setting that's being manipulated
 
 // These are the CRSF telemetry frames understood by OpenTX. We send
-// a frame every cycle after the radio has finished transmitting.
+// a frame every cycle after the radio has finished transmitting,
+// choosing it with telemetry_sched.
 static const crsf_frame_type_e radio_telemetry_frames[] = {
     CRSF_FRAMETYPE_GPS,
     CRSF_FRAMETYPE_BATTERY_SENSOR,
@@ -50,19 +51,26 @@ static void input_crsf_isr(void *arg)
     {
         // Received byte in RX mode
         time_micros_t now = time_micros_now();
+        BaseType_t xHigherPriorityTaskWoken = pdFALSE;
+        if (input->last_isr == 0)
+        {
+            // Start of a frame, wake up the task so it can wait
+            // for its end.
+            vTaskNotifyGiveFromISR(input->task, &xHigherPriorityTaskWoken);
+        }
         input->last_isr = now;
-        uint32_t cnt = CRSF_UART.status.rxfifo_cnt;
-        while (cnt--)
+        uint8_t buf[CRSF_INPUT_ISR_BUFFER_SIZE];
+        uint32_t cnt = MIN(CRSF_UART.status.rxfifo_cnt, sizeof(buf));
+        for (uint32_t ii = 0; ii < cnt; ii++)
         {
-            uint8_t c = CRSF_UART.fifo.rw_byte;
-            // OpenTX will always send the frames starting with CRSF_ADDRESS_CRSF_TRANSMITTER
-            // so we can use that to synchronize frames in case of some input error.
-            if (crsf_port_has_buffered_data(&input->crsf) || c == CRSF_ADDRESS_CRSF_TRANSMITTER)
-            {
-                crsf_port_push(&input->crsf, c);
-            }
+            buf[ii] = CRSF_UART.fifo.rw_byte;
         }
+        spsc_ring_buffer_push_n(&input->isr_buf, buf, cnt);
         CRSF_UART.int_clr.rxfifo_full = 1;
+        if (xHigherPriorityTaskWoken)
+        {
+            portYIELD_FROM_ISR();
+        }
     }
     else if (CRSF_UART.int_st.tx_done)
     {
@@ -71,6 +79,20 @@ static void input_crsf_isr(void *arg)
     }
 }
 
+// Returns true iff at least one valid frame was decoded
+static bool input_crsf_drain_isr_buf(input_crsf_t *input)
+{
+    const uint8_t *data;
+    size_t size;
+    bool found = false;
+    while ((data = spsc_ring_buffer_peek_contiguous(&input->isr_buf, &size)))
+    {
+        found |= crsf_port_feed(&input->crsf, data, size);
+        spsc_ring_buffer_discard_n(&input->isr_buf, size);
+    }
+    return found;
+}
+
 static unsigned input_crsf_tx_done_timeout_us(input_crsf_t *input)
 {
     switch (input->baud_rate)
@@ -321,6 +343,87 @@ static crsf_rf_power_e input_crsf_get_tx_power(input_crsf_t *input)
     return CRSF_RF_POWER_0_mW;
 }
 
+static telemetry_sched_class_e input_crsf_telemetry_frame_class(crsf_frame_type_e frame_type)
+{
+    switch (frame_type)
+    {
+    case CRSF_FRAMETYPE_BATTERY_SENSOR:
+    case CRSF_FRAMETYPE_LINK_STATISTICS:
+        return TELEMETRY_SCHED_CLASS_CRITICAL;
+    case CRSF_FRAMETYPE_FLIGHT_MODE:
+        return TELEMETRY_SCHED_CLASS_SLOW;
+    default:
+        break;
+    }
+    return TELEMETRY_SCHED_CLASS_NORMAL;
+}
+
+// Returns the index in radio_telemetry_frames of the frame which
+// includes the given telemetry id or -1 if there's none.
+static int input_crsf_telemetry_frame_pos(int telemetry_id)
+{
+    crsf_frame_type_e frame_type;
+    switch (telemetry_id)
+    {
+    case TELEMETRY_ID_GPS_LAT:
+    case TELEMETRY_ID_GPS_LON:
+    case TELEMETRY_ID_GPS_SPEED:
+    case TELEMETRY_ID_GPS_HEADING:
+    case TELEMETRY_ID_GPS_ALT:
+    case TELEMETRY_ID_GPS_NUM_SATS:
+        frame_type = CRSF_FRAMETYPE_GPS;
+        break;
+    case TELEMETRY_ID_BAT_VOLTAGE:
+    case TELEMETRY_ID_CURRENT:
+    case TELEMETRY_ID_CURRENT_DRAWN:
+    case TELEMETRY_ID_BAT_REMAINING_P:
+        frame_type = CRSF_FRAMETYPE_BATTERY_SENSOR;
+        break;
+    case TELEMETRY_ID_RX_RSSI_ANT1:
+    case TELEMETRY_ID_RX_RSSI_ANT2:
+    case TELEMETRY_ID_RX_LINK_QUALITY:
+    case TELEMETRY_ID_RX_SNR:
+    case TELEMETRY_ID_RX_ACTIVE_ANT:
+    case TELEMETRY_ID_TX_RSSI_ANT1:
+    case TELEMETRY_ID_TX_LINK_QUALITY:
+    case TELEMETRY_ID_TX_SNR:
+    case TELEMETRY_ID_TX_RF_POWER:
+        frame_type = CRSF_FRAMETYPE_LINK_STATISTICS;
+        break;
+    case TELEMETRY_ID_ATTITUDE_X:
+    case TELEMETRY_ID_ATTITUDE_Y:
+    case TELEMETRY_ID_ATTITUDE_Z:
+        frame_type = CRSF_FRAMETYPE_ATTITUDE;
+        break;
+    case TELEMETRY_ID_FLIGHT_MODE_NAME:
+        frame_type = CRSF_FRAMETYPE_FLIGHT_MODE;
+        break;
+    default:
+        return -1;
+    }
+    for (int ii = 0; ii < ARRAY_COUNT(radio_telemetry_frames); ii++)
+    {
+        if (radio_telemetry_frames[ii] == frame_type)
+        {
+            return ii;
+        }
+    }
+    return -1;
+}
+
+static void input_crsf_telemetry_changed(void *user_data, int telemetry_id, bool changed, time_micros_t now)
+{
+    input_crsf_t *input = user_data;
+    if (changed)
+    {
+        int pos = input_crsf_telemetry_frame_pos(telemetry_id);
+        if (pos >= 0)
+        {
+            telemetry_sched_mark_dirty(&input->telemetry_sched, pos, now);
+        }
+    }
+}
+
 static void input_crsf_send_telemetry_frame(input_crsf_t *input, crsf_frame_type_e frame_type)
 {
     rc_data_t *rc_data = input->input.rc_data;
@@ -332,7 +435,7 @@ static void input_crsf_send_telemetry_frame(input_crsf_t *input, crsf_frame_type
             .type = frame_type,
         },
     };
-    //LOG_I(TAG, "Will send frame type 0x%02x at index %d", frame_type, input->telemetry_pos);
+    //LOG_I(TAG, "Will send frame type 0x%02x", frame_type);
     switch (frame_type)
     {
     case CRSF_FRAMETYPE_GPS:
@@ -386,7 +489,7 @@ static void input_crsf_send_telemetry_frame(input_crsf_t *input, crsf_frame_type
         break;
     default:
         // Not a telemetry frame, should't reach this
-        LOG_E(TAG, "Unhandled telemetry frame 0x%02x at pos %d", frame_type, input->telemetry_pos);
+        LOG_E(TAG, "Unhandled telemetry frame 0x%02x", frame_type);
         ASSERT(0 && "Unhandled telemetry frame!");
     }
     crsf_port_write(&input->crsf, &frame);
@@ -429,21 +532,28 @@ static bool input_crsf_send_pending_resp_frame(input_crsf_t *input)
     return input_crsf_send_scheduled_frame(input) || input_crsf_send_msp(input);
 }
 
-static void input_crsf_send_response(input_crsf_t *input)
+static void input_crsf_send_response(input_crsf_t *input, time_micros_t now)
 {
     // Enable TX mode now, since it takes a bit for it to be effectively active
     input_crsf_enable_tx(input);
 
-    crsf_frame_type_e frame_type = radio_telemetry_frames[input->telemetry_pos];
+    int pos = telemetry_sched_peek(&input->telemetry_sched);
+    // Pending responses take the place of any other frame, so that one
+    // stays at the head during settings or MSP bursts. Send the link
+    // stats once they're due even if they're not the head, otherwise
+    // they would be starved.
+    int link_stats_pos = input_crsf_telemetry_frame_pos(TELEMETRY_ID_RX_LINK_QUALITY);
+    if (telemetry_sched_deadline(&input->telemetry_sched, link_stats_pos) <= now)
+    {
+        pos = link_stats_pos;
+    }
+    crsf_frame_type_e frame_type = radio_telemetry_frames[pos];
     // If we're not sending the link stats, check if we have a pending response data to send
     if (frame_type == CRSF_FRAMETYPE_LINK_STATISTICS || !input_crsf_send_pending_resp_frame(input))
     {
         // Write one telemetry frame
         input_crsf_send_telemetry_frame(input, frame_type);
-    }
-    if (++input->telemetry_pos >= ARRAY_COUNT(radio_telemetry_frames))
-    {
-        input->telemetry_pos = 0;
+        telemetry_sched_sent(&input->telemetry_sched, pos, now);
     }
 
     // Enable interrupt when TX is done
@@ -812,6 +922,10 @@ static bool input_crsf_open(void *input, void *config)
     };
 
     crsf_port_init(&input_crsf->crsf, &crsf_io, input_crsf_frame_callback, input);
+    // OpenTX will always send the frames starting with CRSF_ADDRESS_CRSF_TRANSMITTER
+    // so we can use that to synchronize frames in case of some input error.
+    crsf_port_set_sync_addr(&input_crsf->crsf, CRSF_ADDRESS_CRSF_TRANSMITTER);
+    SPSC_RING_BUFFER_INIT(&input_crsf->isr_buf, uint8_t, CRSF_INPUT_ISR_BUFFER_SIZE);
 
     uart_config_t uart_config = {
         .baud_rate = CRSF_OPENTX_BAUDRATE,
@@ -835,7 +949,16 @@ static bool input_crsf_open(void *input, void *config)
     UART2.conf0.txd_inv = 1;           // intert TX
 #endif
     time_micros_t now = time_micros_now();
-    input_crsf->telemetry_pos = 0;
+    // All frames are always sent, since OpenTX expects them
+    telemetry_sched_init(&input_crsf->telemetry_sched, ARRAY_COUNT(radio_telemetry_frames));
+    for (int ii = 0; ii < ARRAY_COUNT(radio_telemetry_frames); ii++)
+    {
+        telemetry_sched_set_class(&input_crsf->telemetry_sched, ii, input_crsf_telemetry_frame_class(radio_telemetry_frames[ii]));
+        telemetry_sched_add(&input_crsf->telemetry_sched, ii, now);
+    }
+    rc_data_add_telemetry_listener(input_crsf->input.rc_data, input_crsf_telemetry_changed, input_crsf);
+    // open() is called from the RC task
+    input_crsf->task = xTaskGetCurrentTaskHandle();
     input_crsf->last_isr = 0;
     input_crsf->last_frame_recv = now;
     input_crsf->next_resp_frame = TIME_MICROS_MAX;
@@ -869,7 +992,7 @@ static bool input_crsf_update(void *input, rc_data_t *data, time_micros_t now)
     {
         // Transmission from radio has ended. We either got a frame
         // or corrupted data.
-        if (crsf_port_decode(&input_crsf->crsf))
+        if (input_crsf_drain_isr_buf(input_crsf))
         {
             failsafe_reset_interval(&input_crsf->input.failsafe, now);
             updated = true;
@@ -918,14 +1041,17 @@ static bool input_crsf_update(void *input, rc_data_t *data, time_micros_t now)
     {
         input_crsf->enable_rx_deadline = now + input_crsf_max_tx_time_us(input_crsf);
         input_crsf->next_resp_frame = TIME_MICROS_MAX;
-        input_crsf_send_response(input_crsf);
+        input_crsf_send_response(input_crsf, now);
     }
     // The TX_DONE interrupt won't fire if there's a collision, so we use a timer
     // as a fallback to avoid leaving the pin in the TX state.
-    if (now > input_crsf->enable_rx_deadline && CRSF_UART.int_ena.rxfifo_full == 0)
+    if (now > input_crsf->enable_rx_deadline)
     {
         input_crsf->enable_rx_deadline = TIME_MICROS_MAX;
-        input_crsf_enable_rx(input_crsf);
+        if (CRSF_UART.int_ena.rxfifo_full == 0)
+        {
+            input_crsf_enable_rx(input_crsf);
+        }
     }
     if (input_crsf->bps == CRSF_INPUT_BPS_DETECT && input_crsf->bps_detect_switched + BPS_DETECT_SWITCH_INTERVAL_US < now)
     {
@@ -941,15 +1067,39 @@ static bool input_crsf_update(void *input, rc_data_t *data, time_micros_t now)
             LOG_E(TAG, "Invalid baud rate %u", input_crsf->baud_rate);
             UNREACHABLE();
         }
+        spsc_ring_buffer_empty(&input_crsf->isr_buf);
         crsf_port_reset(&input_crsf->crsf);
         input_crsf->bps_detect_switched = now;
     }
     return updated;
 }
 
+static time_micros_t input_crsf_next_update(void *input, time_micros_t now)
+{
+    input_crsf_t *input_crsf = input;
+    time_micros_t next = MIN(input_crsf->next_resp_frame, input_crsf->enable_rx_deadline);
+    time_micros_t last_isr = input_crsf->last_isr;
+    if (last_isr > 0)
+    {
+        // Receiving a frame, wait until the radio stops transmitting
+        next = MIN(next, last_isr + input_crsf_tx_done_timeout_us(input_crsf));
+    }
+    if (input_crsf->bps == CRSF_INPUT_BPS_DETECT)
+    {
+        next = MIN(next, input_crsf->bps_detect_switched + BPS_DETECT_SWITCH_INTERVAL_US);
+    }
+    else
+    {
+        next = MIN(next, input_crsf->last_frame_recv + BPS_FALLBACK_INTERVAL);
+    }
+    // All the checks in input_crsf_update() use now > deadline
+    return next == TIME_MICROS_MAX ? next : next + 1;
+}
+
 static void input_crsf_close(void *input, void *config)
 {
     input_crsf_t *input_crsf = input;
+    rc_data_remove_telemetry_listener(input_crsf->input.rc_data, input_crsf_telemetry_changed, input_crsf);
     ESP_ERROR_CHECK(esp_intr_free(input_crsf->isr_handle));
     serial_port_destroy(&input_crsf->serial_port);
     if (input_crsf->rmp_port)
@@ -966,6 +1116,7 @@ void input_crsf_init(input_crsf_t *input)
         .open = input_crsf_open,
         .update = input_crsf_update,
         .close = input_crsf_close,
+        .next_update = input_crsf_next_update,
     };
     RING_BUFFER_INIT(&input->scheduled, crsf_frame_t, CRSF_INPUT_FRAME_QUEUE_SIZE);
 }
\ No newline at end of file
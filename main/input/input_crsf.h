@@ -2,6 +2,9 @@
 
 #include <stdint.h>
 
+#include <freertos/FreeRTOS.h>
+#include <freertos/task.h>
+
 #include <driver/uart.h>
 
 #include "config/settings.h"
@@ -14,6 +17,9 @@
 
 #include "protocols/crsf.h"
 
+#include "rc/telemetry_sched.h"
+
+#include "util/spsc_ringbuffer.h"
 #include "util/time.h"
 
 typedef struct rmp_port_s rmp_port_t;
@@ -41,6 +47,7 @@ typedef struct input_crsf_addr_s
 
 #define CRSF_INPUT_FRAME_QUEUE_SIZE 4
 #define CRSF_INPUT_ADDR_LIST_SIZE 8
+#define CRSF_INPUT_ISR_BUFFER_SIZE 128 // Must be a power of 2
 
 typedef struct input_crsf_s
 {
@@ -54,9 +61,12 @@ typedef struct input_crsf_s
     time_micros_t bps_detect_switched;
     unsigned baud_rate;
     crsf_port_t crsf;
+    // Raw bytes received by the ISR, moved to crsf by the task
+    SPSC_RING_BUFFER_DECLARE(isr_buf, uint8_t, CRSF_INPUT_ISR_BUFFER_SIZE);
     uart_isr_handle_t isr_handle;
+    TaskHandle_t task; // Notified by the ISR when a frame starts
     int pin_num;
-    unsigned telemetry_pos;
+    telemetry_sched_t telemetry_sched; // Indexes into radio_telemetry_frames
     const rmp_port_t *rmp_port;
     input_crsf_addr_t rmp_addresses[CRSF_INPUT_ADDR_LIST_SIZE];
     uint8_t ping_filter;
@@ -1,3 +1,4 @@
+#include <assert.h>
 #include <math.h>
 #include <stdint.h>
 #include <string.h>
@@ -15,6 +16,7 @@
 
 #include "util/macros.h"
 #include "util/time.h"
+#include "util/trace.h"
 
 #include "lora.h"
 
@@ -82,21 +84,92 @@ enum
 
 static const char *TAG = "LoRa";
 
-static esp_err_t spi_device_transmit_sync(spi_device_handle_t handle, spi_transaction_t *trans_desc)
+static esp_err_t lora_spi_transmit(lora_t *lora, spi_transaction_t *trans_desc)
 {
-    // Just a wrapper for now
-    return spi_device_transmit(handle, trans_desc);
+    // Account the command+address byte too
+    lora->state.spi_transactions++;
+    lora->state.spi_bytes += 1 + trans_desc->length / 8;
+    return spi_device_transmit(lora->state.spi, trans_desc);
+}
+
+// Registers which only change when we write them, so they can be
+// served from the shadow copy in lora->state. REG_OP_MODE is not
+// included because the chip changes it on its own (e.g. after TX),
+// see lora->state.mode instead.
+static bool lora_reg_is_cacheable(uint8_t addr)
+{
+    switch (addr)
+    {
+    case REG_FRF_MSB:
+    case REG_FRF_MID:
+    case REG_FRF_LSB:
+    case REG_PA_CONFIG:
+    case REG_LNA:
+    case REG_FIFO_TX_BASE_ADDR:
+    case REG_FIFO_RX_BASE_ADDR:
+    case REG_MODEM_CONFIG_1:
+    case REG_MODEM_CONFIG_2:
+    case REG_PREAMBLE_MSB:
+    case REG_PREAMBLE_LSB:
+    case REG_PAYLOAD_LENGTH:
+    case REG_MODEM_CONFIG_3:
+    case REG_DETECTION_OPTIMIZE:
+    case REG_DETECTION_THRESHOLD:
+    case REG_SYNC_WORD:
+    case REG_DIO_MAPPING_1:
+    case REG_PA_DAC:
+        _Static_assert(REG_PA_DAC < LORA_SHADOW_REGS, "LORA_SHADOW_REGS too small");
+        return true;
+    }
+    return false;
+}
+
+static bool lora_shadow_get(lora_t *lora, uint8_t addr, uint8_t *value)
+{
+    if (lora_reg_is_cacheable(addr) && (lora->state.shadow_valid[addr / 32] & (1u << (addr % 32))))
+    {
+        *value = lora->state.shadow[addr];
+        return true;
+    }
+    return false;
+}
+
+static void lora_shadow_set(lora_t *lora, uint8_t addr, uint8_t value)
+{
+    if (lora_reg_is_cacheable(addr))
+    {
+        lora->state.shadow[addr] = value;
+        lora->state.shadow_valid[addr / 32] |= 1u << (addr % 32);
+    }
+}
+
+static void lora_shadow_invalidate(lora_t *lora)
+{
+    memset(lora->state.shadow_valid, 0, sizeof(lora->state.shadow_valid));
+}
+
+// Returns true iff writing value to addr would change it
+static bool lora_reg_needs_write(lora_t *lora, uint8_t addr, uint8_t value)
+{
+    uint8_t current;
+    return !lora_shadow_get(lora, addr, &current) || current != value;
 }
 
 static uint8_t lora_read_reg(lora_t *lora, uint8_t addr)
 {
+    uint8_t value;
+    if (lora_shadow_get(lora, addr, &value))
+    {
+        return value;
+    }
     spi_transaction_t t;
     t.cmd = 0;
     t.addr = addr;
     t.length = 8; // Send 8 arbitrary bits to get one byte back in full duplex
     t.rxlength = 0;
     t.flags = SPI_TRANS_USE_TXDATA | SPI_TRANS_USE_RXDATA;
-    ESP_ERROR_CHECK(spi_device_transmit_sync(lora->state.spi, &t));
+    ESP_ERROR_CHECK(lora_spi_transmit(lora, &t));
+    lora_shadow_set(lora, addr, t.rx_data[0]);
     return t.rx_data[0];
 }
 
@@ -113,9 +186,68 @@ static inline void lora_write_prepare_spi_transaction(spi_transaction_t *t, uint
 
 static void lora_write_reg(lora_t *lora, uint8_t addr, uint8_t value)
 {
+    if (!lora_reg_needs_write(lora, addr, value))
+    {
+        return;
+    }
     spi_transaction_t t;
     lora_write_prepare_spi_transaction(&t, addr, value);
-    ESP_ERROR_CHECK(spi_device_transmit_sync(lora->state.spi, &t));
+    ESP_ERROR_CHECK(lora_spi_transmit(lora, &t));
+    lora_shadow_set(lora, addr, value);
+}
+
+// Writes count consecutive registers starting at addr using a single
+// burst transaction. The address is automatically incremented by the
+// chip after each byte (see 4.3, SPI interface).
+static void lora_write_regs(lora_t *lora, uint8_t addr, const uint8_t *values, size_t count)
+{
+    // Skip the registers at both ends which already have the right value
+    while (count > 0 && !lora_reg_needs_write(lora, addr, values[0]))
+    {
+        addr++;
+        values++;
+        count--;
+    }
+    // The chip only applies a new RegFrf when RegFrfLsb is written (see
+    // RegFrfMsb, 6.4), so it can't be skipped if RegFrfMsb or RegFrfMid
+    // change, even if it already has the right value.
+    size_t min_count = 0;
+    for (int ii = 0; ii < count; ii++)
+    {
+        if ((addr + ii == REG_FRF_MSB || addr + ii == REG_FRF_MID) && lora_reg_needs_write(lora, addr + ii, values[ii]))
+        {
+            min_count = MIN((size_t)(REG_FRF_LSB - addr + 1), count);
+        }
+    }
+    while (count > min_count && !lora_reg_needs_write(lora, addr + count - 1, values[count - 1]))
+    {
+        count--;
+    }
+    if (count == 0)
+    {
+        return;
+    }
+    spi_transaction_t t;
+    t.cmd = 1;
+    t.addr = addr;
+    t.length = count * 8;
+    t.rxlength = 0;
+    t.rx_buffer = NULL;
+    if (count <= sizeof(t.tx_data))
+    {
+        t.flags = SPI_TRANS_USE_TXDATA;
+        memcpy(t.tx_data, values, count);
+    }
+    else
+    {
+        t.flags = 0;
+        t.tx_buffer = values;
+    }
+    ESP_ERROR_CHECK(lora_spi_transmit(lora, &t));
+    for (int ii = 0; ii < count; ii++)
+    {
+        lora_shadow_set(lora, addr + ii, values[ii]);
+    }
 }
 
 static void lora_set_mode(lora_t *lora, uint8_t mode)
@@ -195,6 +327,7 @@ static void lora_callback_task(void *arg)
         switch (lora->state.dio0_trigger)
         {
         case DIO0_TRIGGER_RX_DONE:
+            TRACE(TRACE_POINT_LORA_CALLBACK);
             lora->state.rx_done = true;
             if (lora->state.callback)
             {
@@ -211,12 +344,17 @@ static void lora_callback_task(void *arg)
             }
             break;
         }
+        if (lora->state.notify_task)
+        {
+            xTaskNotifyGive(lora->state.notify_task);
+        }
     }
 }
 
 static void IRAM_ATTR lora_handle_isr(void *arg)
 {
     BaseType_t xHigherPriorityTaskWoken = pdFALSE;
+    TRACE(TRACE_POINT_LORA_DIO0);
     vTaskNotifyGiveFromISR(callback_task_handle, &xHigherPriorityTaskWoken);
     if (xHigherPriorityTaskWoken)
     {
@@ -224,18 +362,33 @@ static void IRAM_ATTR lora_handle_isr(void *arg)
     }
 }
 
+void lora_frf_from_frequency(lora_frf_t *frf, unsigned long freq)
+{
+    // Page 109, RegFrf: Frf = Fstep * Frf(23;0) with Fstep = 32MHz / 2^19
+    uint64_t val = ((uint64_t)freq << 19) / 32000000;
+    frf->bytes[0] = (uint8_t)(val >> 16);
+    frf->bytes[1] = (uint8_t)(val >> 8);
+    frf->bytes[2] = (uint8_t)(val >> 0);
+}
+
 // freq is in Hz
 void lora_set_frequency(lora_t *lora, unsigned long freq)
 {
     if (freq != lora->state.freq)
     {
-        lora_prepare_write(lora);
-
-        uint64_t frf = ((uint64_t)freq << 19) / 32000000;
+        lora_frf_t frf;
+        lora_frf_from_frequency(&frf, freq);
+        lora_set_frequency_frf(lora, freq, &frf);
+    }
+}
 
-        lora_write_reg(lora, REG_FRF_MSB, (uint8_t)(frf >> 16));
-        lora_write_reg(lora, REG_FRF_MID, (uint8_t)(frf >> 8));
-        lora_write_reg(lora, REG_FRF_LSB, (uint8_t)(frf >> 0));
+void lora_set_frequency_frf(lora_t *lora, unsigned long freq, const lora_frf_t *frf)
+{
+    if (freq != lora->state.freq)
+    {
+        lora_prepare_write(lora);
+        _Static_assert(REG_FRF_MSB + 1 == REG_FRF_MID && REG_FRF_MID + 1 == REG_FRF_LSB, "REG_FRF_* not contiguous");
+        lora_write_regs(lora, REG_FRF_MSB, frf->bytes, sizeof(frf->bytes));
         lora->state.freq = freq;
         // Wait up to 50us for PLL lock (page 15, table 7)
         time_micros_t now = time_micros_now();
@@ -328,6 +481,10 @@ void lora_init(lora_t *lora)
     lora->state.tx_done = false;
     lora->state.rx_done = false;
     lora->state.freq = 0;
+    lora->state.spi_transactions = 0;
+    lora->state.spi_bytes = 0;
+    // Registers are back to their defaults after the reset
+    lora_shadow_invalidate(lora);
 
     xTaskCreatePinnedToCore(lora_callback_task, "LORA-CALLBACK", 4096, lora, 1000, &callback_task_handle, 1);
 
@@ -459,6 +616,106 @@ void lora_set_crc(lora_t *lora, bool crc)
     lora_write_reg(lora, REG_MODEM_CONFIG_2, reg);
 }
 
+void lora_reg_program_init(lora_reg_program_t *prog)
+{
+    prog->count = 0;
+}
+
+void lora_reg_program_write(lora_reg_program_t *prog, uint8_t addr, uint8_t value)
+{
+    // Keep writes sorted by address, so consecutive registers
+    // can be merged into a single burst.
+    int pos = 0;
+    while (pos < prog->count && prog->writes[pos].addr < addr)
+    {
+        pos++;
+    }
+    if (pos < prog->count && prog->writes[pos].addr == addr)
+    {
+        prog->writes[pos].value = value;
+        return;
+    }
+    assert(prog->count < LORA_REG_PROGRAM_MAX_WRITES);
+    memmove(&prog->writes[pos + 1], &prog->writes[pos], (prog->count - pos) * sizeof(prog->writes[0]));
+    prog->writes[pos].addr = addr;
+    prog->writes[pos].value = value;
+    prog->count++;
+}
+
+void lora_reg_program_modem_config(lora_reg_program_t *prog, const lora_modem_config_t *config)
+{
+    int sf = MIN(MAX(config->sf, 6), 12);
+    lora_signal_bw_e sbw = MIN(MAX(config->signal_bw, LORA_SIGNAL_BW_7_8), LORA_SIGNAL_BW_500);
+    lora_coding_rate_e rate = MIN(MAX(config->coding_rate, LORA_CODING_RATE_4_5), LORA_CODING_RATE_4_8);
+
+    // Both SymbTimeout MSBs and TxContinuousMode are left at zero,
+    // which are their reset values and are never changed.
+    uint8_t modem_config_1 = (sbw << 4) | (rate << 1);
+    if (config->header == LORA_HEADER_IMPLICIT)
+    {
+        modem_config_1 |= 0x01;
+    }
+    uint8_t modem_config_2 = (sf << 4) & 0xf0;
+    if (config->crc)
+    {
+        modem_config_2 |= 0x04;
+    }
+    lora_reg_program_write(prog, REG_MODEM_CONFIG_1, modem_config_1);
+    lora_reg_program_write(prog, REG_MODEM_CONFIG_2, modem_config_2);
+    lora_reg_program_write(prog, REG_PREAMBLE_MSB, (uint8_t)(config->preamble_length >> 8));
+    lora_reg_program_write(prog, REG_PREAMBLE_LSB, (uint8_t)(config->preamble_length >> 0));
+    lora_reg_program_write(prog, REG_DETECTION_OPTIMIZE, sf == 6 ? 0xc5 : 0xc3);
+    lora_reg_program_write(prog, REG_DETECTION_THRESHOLD, sf == 6 ? 0x0c : 0x0a);
+}
+
+void lora_run_reg_program(lora_t *lora, const lora_reg_program_t *prog)
+{
+    uint8_t values[LORA_REG_PROGRAM_MAX_WRITES];
+
+    // Avoid changing the mode if all the registers already have
+    // the right values (e.g. switching between modes which share
+    // the same parameters).
+    bool needs_write = false;
+    for (int ii = 0; ii < prog->count && !needs_write; ii++)
+    {
+        needs_write = lora_reg_needs_write(lora, prog->writes[ii].addr, prog->writes[ii].value);
+    }
+    if (!needs_write)
+    {
+        return;
+    }
+
+    lora_prepare_write(lora);
+
+    int start = 0;
+    while (start < prog->count)
+    {
+        int end = start;
+        values[0] = prog->writes[start].value;
+        while (end + 1 < prog->count && prog->writes[end + 1].addr == prog->writes[end].addr + 1)
+        {
+            end++;
+            values[end - start] = prog->writes[end].value;
+        }
+        lora_write_regs(lora, prog->writes[start].addr, values, end - start + 1);
+        start = end + 1;
+    }
+
+    // Keep the state in sync with the registers we track
+    for (int ii = 0; ii < prog->count; ii++)
+    {
+        switch (prog->writes[ii].addr)
+        {
+        case REG_MODEM_CONFIG_1:
+            lora->state.signal_bw = prog->writes[ii].value >> 4;
+            break;
+        case REG_MODEM_CONFIG_2:
+            lora->state.sf = prog->writes[ii].value >> 4;
+            break;
+        }
+    }
+}
+
 void lora_send(lora_t *lora, const void *buf, size_t size)
 {
     // We need to be in IDLE rather, SLEEP won't work because
@@ -477,7 +734,7 @@ void lora_send(lora_t *lora, const void *buf, size_t size)
     t.rx_buffer = NULL;
     t.tx_buffer = buf;
     t.flags = 0;
-    ESP_ERROR_CHECK(spi_device_transmit_sync(lora->state.spi, &t));
+    ESP_ERROR_CHECK(lora_spi_transmit(lora, &t));
 
     // Update length
     lora_set_payload_size(lora, size);
@@ -544,7 +801,7 @@ size_t lora_read(lora_t *lora, void *buf, size_t size)
     t.rxlength = 0;
     t.tx_buffer = NULL;
     t.rx_buffer = buf;
-    ESP_ERROR_CHECK(spi_device_transmit_sync(lora->state.spi, &t));
+    ESP_ERROR_CHECK(lora_spi_transmit(lora, &t));
     lora->state.rx_done = false;
     lora_write_reg(lora, REG_IRQ_FLAGS, IRQ_RX_DONE_MASK);
     return size;
@@ -577,6 +834,17 @@ void lora_set_callback(lora_t *lora, lora_callback_t callback, void *callback_da
     lora->state.callback_data = callback_data;
 }
 
+void lora_set_notify_task(lora_t *lora, TaskHandle_t task)
+{
+    lora->state.notify_task = task;
+}
+
+void lora_get_spi_stats(lora_t *lora, unsigned *transactions, unsigned *bytes)
+{
+    *transactions = lora->state.spi_transactions;
+    *bytes = lora->state.spi_bytes;
+}
+
 int lora_min_rssi(lora_t *lora)
 {
     // Page 87, 5.5.5.
@@ -630,7 +898,7 @@ int lora_rssi(lora_t *lora, int *snr, int *lq)
     t.rxlength = 0;
     t.tx_buffer = NULL;
     t.flags = SPI_TRANS_USE_RXDATA;
-    ESP_ERROR_CHECK(spi_device_transmit_sync(lora->state.spi, &t));
+    ESP_ERROR_CHECK(lora_spi_transmit(lora, &t));
     int8_t raw_snr = (int8_t)t.rx_data[0];
     uint8_t raw_rssi = t.rx_data[1];
     int rssi;
@@ -1,8 +1,12 @@
 #pragma once
 
+#include <stdbool.h>
 #include <stddef.h>
 #include <stdint.h>
 
+#include <freertos/FreeRTOS.h>
+#include <freertos/task.h>
+
 #include <driver/gpio.h>
 #include <driver/spi_master.h>
 
@@ -12,6 +16,8 @@
 
 #define LORA_DEFAULT_SYNC_WORD 0x12 // 6.4 LoRa register mode map, RegSyncWord
 
+#define LORA_SHADOW_REGS 0x50 // Registers 0x00-0x4f can be shadowed
+
 typedef enum {
     LORA_HEADER_IMPLICIT,
     LORA_HEADER_EXPLICIT,
@@ -50,6 +56,38 @@ typedef enum {
 } lora_band_e;
 #endif
 
+// Contents of RegFrfMsb, RegFrfMid and RegFrfLsb for a given
+// frequency, so they can be calculated in advance.
+typedef struct lora_frf_s
+{
+    uint8_t bytes[3];
+} lora_frf_t;
+
+typedef struct lora_modem_config_s
+{
+    lora_signal_bw_e signal_bw;
+    lora_coding_rate_e coding_rate;
+    int sf;
+    lora_header_e header;
+    bool crc;
+    long preamble_length;
+} lora_modem_config_t;
+
+// Register programs batch register writes, so runs of consecutive
+// registers are written with a single burst SPI transaction. They
+// can be prepared in advance and run multiple times.
+#define LORA_REG_PROGRAM_MAX_WRITES 16
+
+typedef struct lora_reg_program_s
+{
+    struct
+    {
+        uint8_t addr;
+        uint8_t value;
+    } writes[LORA_REG_PROGRAM_MAX_WRITES]; // Sorted by addr
+    uint8_t count;
+} lora_reg_program_t;
+
 typedef enum {
     LORA_CALLBACK_REASON_TX_DONE,
     LORA_CALLBACK_REASON_RX_DONE,
@@ -75,10 +113,15 @@ typedef struct lora_s
         int dio0_trigger;
         void *callback;
         void *callback_data;
+        TaskHandle_t notify_task;
         unsigned tx_start;
         unsigned tx_end;
         lora_signal_bw_e signal_bw;
         int sf;
+        unsigned spi_transactions;
+        unsigned spi_bytes;
+        uint8_t shadow[LORA_SHADOW_REGS];                    // Copy of the registers we've read or written
+        uint32_t shadow_valid[(LORA_SHADOW_REGS + 31) / 32]; // Bitmap of valid entries in shadow
     } state;
 } lora_t;
 
@@ -86,7 +129,10 @@ void lora_init(lora_t *lora);
 
 void lora_set_tx_power(lora_t *lora, int dBm);
 // freq is in Hz
+void lora_frf_from_frequency(lora_frf_t *frf, unsigned long freq);
 void lora_set_frequency(lora_t *lora, unsigned long freq);
+// frf must have been calculated from freq with lora_frf_from_frequency()
+void lora_set_frequency_frf(lora_t *lora, unsigned long freq, const lora_frf_t *frf);
 void lora_set_spreading_factor(lora_t *lora, int sf);
 void lora_set_signal_bw(lora_t *lora, lora_signal_bw_e sbw);
 void lora_set_coding_rate(lora_t *lora, lora_coding_rate_e rate);
@@ -96,6 +142,12 @@ void lora_set_header_mode(lora_t *lora, lora_header_e mode);
 void lora_set_sync_word(lora_t *lora, uint8_t sw);
 void lora_set_payload_size(lora_t *lora, uint8_t size);
 
+void lora_reg_program_init(lora_reg_program_t *prog);
+void lora_reg_program_write(lora_reg_program_t *prog, uint8_t addr, uint8_t value);
+// Adds the writes for bandwidth, coding rate, SF, header mode, CRC and preamble
+void lora_reg_program_modem_config(lora_reg_program_t *prog, const lora_modem_config_t *config);
+void lora_run_reg_program(lora_t *lora, const lora_reg_program_t *prog);
+
 void lora_send(lora_t *lora, const void *buf, size_t size);
 size_t lora_wait(lora_t *lora, size_t size);
 size_t lora_read(lora_t *lora, void *buf, size_t size);
@@ -105,6 +157,14 @@ bool lora_is_rx_done(lora_t *lora);
 
 typedef void (*lora_callback_t)(lora_t *lora, lora_callback_reason_e reason, void *data);
 void lora_set_callback(lora_t *lora, lora_callback_t callback, void *data);
+// Sets a task to be notified with xTaskNotifyGive() after each RX or
+// TX done interrupt has been handled (including the callback), so it
+// can block while waiting for the radio. Pass NULL to disable it.
+void lora_set_notify_task(lora_t *lora, TaskHandle_t task);
+
+// Number of SPI transactions and bytes (including the address) since
+// lora_init(), used to measure the cost of each operation.
+void lora_get_spi_stats(lora_t *lora, unsigned *transactions, unsigned *bytes);
 
 int lora_min_rssi(lora_t *lora);
 // SNR is multiplied by 4
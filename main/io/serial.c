@@ -1,14 +1,16 @@
 #include <assert.h>
-#include <string.h>
 
 #include <driver/uart.h>
 
 #include "platform/pins.h"
 
 #include "util/macros.h"
+#include "util/spsc_ringbuffer.h"
 
 #include "serial.h"
 
+#define SERIAL_HALF_DUPLEX_BUFFER_SIZE 128
+
 typedef struct serial_port_s
 {
     const uart_port_t port_num;
@@ -21,8 +23,9 @@ typedef struct serial_port_s
     bool in_write;
     bool uses_driver;
     uart_isr_handle_t isr_handle;
-    uint8_t buf[128];
-    unsigned buf_pos;
+    // Written by serial_isr() and read by serial_port_read()
+    // in half duplex mode
+    SPSC_RING_BUFFER_DECLARE(rx_buf, uint8_t, SERIAL_HALF_DUPLEX_BUFFER_SIZE);
 } serial_port_t;
 
 // We support 2 UART ports at maximum, ignoring UART0 since
@@ -78,22 +81,24 @@ static void serial_isr(void *arg)
     }
     else if (port->dev->int_st.rxfifo_full)
     {
-        uint32_t cnt = port->dev->status.rxfifo_cnt;
-        while (cnt--)
+        uint8_t buf[SERIAL_HALF_DUPLEX_BUFFER_SIZE];
+        uint32_t cnt = MIN(port->dev->status.rxfifo_cnt, sizeof(buf));
+        for (uint32_t ii = 0; ii < cnt; ii++)
         {
-            uint8_t c = port->dev->fifo.rw_byte;
-            if (port->config.byte_callback)
-            {
-                port->config.byte_callback(port, c, port->config.byte_callback_data);
-            }
-            else
+            buf[ii] = port->dev->fifo.rw_byte;
+        }
+        if (port->config.byte_callback)
+        {
+            for (uint32_t ii = 0; ii < cnt; ii++)
             {
-                if (port->buf_pos < sizeof(port->buf))
-                {
-                    port->buf[port->buf_pos++] = c;
-                }
+                port->config.byte_callback(port, buf[ii], port->config.byte_callback_data);
             }
         }
+        else
+        {
+            // Bytes that don't fit are dropped
+            spsc_ring_buffer_push_n(&port->rx_buf, buf, cnt);
+        }
         port->dev->int_clr.rxfifo_full = 1;
     }
 }
@@ -168,7 +173,7 @@ void serial_port_do_open(serial_port_t *port)
     else
     {
         port->uses_driver = false;
-        port->buf_pos = 0;
+        SPSC_RING_BUFFER_INIT(&port->rx_buf, uint8_t, SERIAL_HALF_DUPLEX_BUFFER_SIZE);
         // Half duplex, start as RX
         ESP_ERROR_CHECK(gpio_set_pull_mode(port->config.rx_pin, port->config.inverted ? GPIO_PULLDOWN_ONLY : GPIO_PULLUP_ONLY));
         ESP_ERROR_CHECK(uart_isr_register(port->port_num, serial_isr, port, 0, &port->isr_handle));
@@ -205,11 +210,7 @@ int serial_port_read(serial_port_t *port, void *buf, size_t size, time_ticks_t t
     {
         return uart_read_bytes(port->port_num, buf, size, timeout);
     }
-    int cpy_size = MIN(size, port->buf_pos);
-    memcpy(buf, port->buf, cpy_size);
-    memmove(&port->buf[0], &port->buf[cpy_size], port->buf_pos - cpy_size);
-    port->buf_pos -= cpy_size;
-    return cpy_size;
+    return spsc_ring_buffer_pop_n(&port->rx_buf, buf, size);
 }
 
 bool serial_port_begin_write(serial_port_t *port)
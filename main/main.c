@@ -8,8 +8,6 @@
 #include <esp_task_wdt.h>
 #include "tcpip_adapter.h"
 #include "nvs_flash.h"
-#include <soc/timer_group_struct.h>
-#include <soc/timer_group_reg.h>
 
 #include "platform.h"
 
@@ -27,12 +25,14 @@
 
 #include "rc/rc.h"
 #include "rc/rc_data.h"
+#include "rc/rc_sched.h"
 
 #include "rmp/rmp.h"
 
 #include "ui/ui.h"
 
 #include "util/time.h"
+#include "util/trace.h"
 
 static lora_t lora = {
     .mosi = LORA_MOSI,
@@ -45,6 +45,7 @@ static lora_t lora = {
 };
 
 static rc_t rc;
+static rc_sched_t rc_sched;
 static rmp_t rmp;
 static p2p_t p2p;
 static ui_t ui;
@@ -99,6 +100,10 @@ void task_rmp(void *arg)
     for (;;)
     {
         rmp_update(&rmp);
+        TRACE_UPDATE();
+#if defined(USE_TRACE)
+        rc_sched_log_stats(&rc_sched, time_micros_now());
+#endif
         vTaskDelay(10 / portTICK_PERIOD_MS);
     }
 }
@@ -108,16 +113,15 @@ void task_rc_update(void *arg)
     // Initialize LoRa here so its interrupts
     // are fired in the same CPU as this task.
     lora_init(&lora);
+    rc_sched_init(&rc_sched);
+    lora_set_notify_task(&lora, rc_sched.task);
     // Enable the WDT for this task
     ESP_ERROR_CHECK(esp_task_wdt_add(NULL));
     for (;;)
     {
         rc_update(&rc);
-        // Feed the WTD using the registers directly. Otherwise
-        // we take too long here.
-        TIMERG0.wdt_wprotect = TIMG_WDT_WKEY_VALUE;
-        TIMERG0.wdt_feed = 1;
-        TIMERG0.wdt_wprotect = 0;
+        esp_task_wdt_reset();
+        rc_sched_wait(&rc_sched, rc_next_update(&rc, time_micros_now()));
     }
 }
 
@@ -1,9 +1,16 @@
 #include <string.h>
 
+#include <freertos/FreeRTOS.h>
+#include <freertos/semphr.h>
+
 #include <hal/log.h>
 
+#include "msp_cache.h"
 #include "msp_transport.h"
 
+#include "util/macros.h"
+#include "util/time.h"
+
 #include "msp.h"
 
 static const char *TAG = "MSP";
@@ -11,11 +18,97 @@ static const char *TAG = "MSP";
 void msp_conn_init(msp_conn_t *conn, msp_transport_t *transport)
 {
     assert(transport);
-    RING_BUFFER_INIT(&conn->rb, msp_callback_req_t, MSP_QUEUE_MAX_SIZE);
+    // Connections are initialized again each time their transport
+    // changes, keep the same mutex.
+    if (!conn->pending_lock)
+    {
+        conn->pending_lock = xSemaphoreCreateMutex();
+    }
+    conn->pending_count = 0;
+    conn->window = MSP_CONN_DEFAULT_WINDOW;
+    conn->timeout = MSP_CONN_DEFAULT_TIMEOUT;
     conn->transport = transport;
+    conn->cache = NULL;
     msp_conn_set_global_callback(conn, NULL, NULL);
 }
 
+// Must be called with pending_lock held
+static void msp_conn_remove_pending(msp_conn_t *conn, unsigned idx)
+{
+    conn->pending_count--;
+    memmove(&conn->pending[idx], &conn->pending[idx + 1], (conn->pending_count - idx) * sizeof(conn->pending[0]));
+}
+
+// Removes the oldest request past its deadline, copying it to cb_req.
+// Returns false if there's none.
+static bool msp_conn_pop_expired(msp_conn_t *conn, time_micros_t now, msp_callback_req_t *cb_req)
+{
+    bool found = false;
+    xSemaphoreTake(conn->pending_lock, portMAX_DELAY);
+    for (unsigned ii = 0; ii < conn->pending_count; ii++)
+    {
+        if (conn->pending[ii].deadline < now)
+        {
+            *cb_req = conn->pending[ii];
+            msp_conn_remove_pending(conn, ii);
+            found = true;
+            break;
+        }
+    }
+    xSemaphoreGive(conn->pending_lock);
+    return found;
+}
+
+static void msp_conn_expire(msp_conn_t *conn, time_micros_t now)
+{
+    msp_callback_req_t cb_req;
+    while (msp_conn_pop_expired(conn, now, &cb_req))
+    {
+        LOG_D(TAG, "MSP request %u timed out", cb_req.code);
+        // Removed before calling the callback, since it
+        // might send another request
+        cb_req.callback(conn, cb_req.code, NULL, -1, cb_req.data);
+    }
+}
+
+// Removes the oldest request to be answered from the cache, copying
+// it to cb_req. Returns false if there's none.
+static bool msp_conn_pop_cached(msp_conn_t *conn, msp_callback_req_t *cb_req)
+{
+    bool found = false;
+    xSemaphoreTake(conn->pending_lock, portMAX_DELAY);
+    for (unsigned ii = 0; ii < conn->pending_count; ii++)
+    {
+        if (conn->pending[ii].cached)
+        {
+            *cb_req = conn->pending[ii];
+            msp_conn_remove_pending(conn, ii);
+            found = true;
+            break;
+        }
+    }
+    xSemaphoreGive(conn->pending_lock);
+    return found;
+}
+
+static void msp_conn_dispatch_cached(msp_conn_t *conn, time_micros_t now)
+{
+    msp_callback_req_t cb_req;
+    uint8_t buf[MSP_CACHE_MAX_PAYLOAD_SIZE];
+    // Bounded, since callbacks might request the same cmd again
+    for (unsigned ii = 0; ii < conn->window && msp_conn_pop_cached(conn, &cb_req); ii++)
+    {
+        int n = conn->cache ? msp_cache_lookup(conn->cache, cb_req.code, buf, sizeof(buf), now) : -1;
+        if (n >= 0)
+        {
+            cb_req.callback(conn, cb_req.code, n > 0 ? buf : NULL, n, cb_req.data);
+            continue;
+        }
+        // Expired since the request was made, ask the FC
+        msp_conn_send(conn, cb_req.code, NULL, 0, cb_req.callback, cb_req.data);
+    }
+}
+
 void msp_conn_update(msp_conn_t *conn)
 {
     int n;
@@ -29,6 +122,9 @@ void msp_conn_update(msp_conn_t *conn)
         uint8_t *data = n > 0 ? buf : NULL;
         msp_conn_dispatch_message(conn, direction, cmd, data, n);
     }
+    time_micros_t now = time_micros_now();
+    msp_conn_dispatch_cached(conn, now);
+    msp_conn_expire(conn, now);
 }
 
 int msp_conn_write(msp_conn_t *conn, msp_direction_e direction, uint16_t cmd, const void *payload, size_t size)
@@ -38,26 +134,65 @@ int msp_conn_write(msp_conn_t *conn, msp_direction_e direction, uint16_t cmd, co
 
 int msp_conn_send(msp_conn_t *conn, uint16_t cmd, const void *payload, size_t size, msp_cmd_callback_f callback, void *callback_data)
 {
-    msp_callback_req_t cb = {
+    return msp_conn_send_timeout(conn, cmd, payload, size, conn->timeout, callback, callback_data);
+}
+
+// Adds a request to pending and sends it, unless cached is true
+static int msp_conn_send_tracked(msp_conn_t *conn, uint16_t cmd, const void *payload, size_t size, time_micros_t timeout,
+                                 bool cached, msp_cmd_callback_f callback, void *callback_data)
+{
+    time_micros_t now = time_micros_now();
+    msp_conn_expire(conn, now);
+    xSemaphoreTake(conn->pending_lock, portMAX_DELAY);
+    if (conn->pending_count >= conn->window)
+    {
+        xSemaphoreGive(conn->pending_lock);
+        LOG_D(TAG, "MSP window is full, dropping request %u", cmd);
+        callback(conn, cmd, NULL, -1, callback_data);
+        return -1;
+    }
+    unsigned idx = conn->pending_count++;
+    conn->pending[idx] = (msp_callback_req_t){
         .code = cmd,
         .callback = callback,
         .data = callback_data,
+        .sent_at = now,
+        .deadline = now + timeout,
+        .cached = cached,
     };
+    if (cached)
+    {
+        xSemaphoreGive(conn->pending_lock);
+        return 0;
+    }
+    // Keep the lock while writing, so the request can't be answered
+    // nor expired by another task before we know it was sent. Writing
+    // never dispatches responses, so the request is still at idx.
+    int n = msp_conn_write(conn, MSP_DIRECTION_TO_MWC, cmd, payload, size);
+    if (n < 0)
+    {
+        msp_conn_remove_pending(conn, idx);
+    }
+    xSemaphoreGive(conn->pending_lock);
+    if (n < 0)
+    {
+        callback(conn, cmd, NULL, -1, callback_data);
+    }
+    return n;
+}
 
-    // We need to force push here because we don't support callback
-    // expiration yet.
-    // TODO: Support callback expiration
-    if (!conn->global_callback && !ring_buffer_force_push(&conn->rb, &cb))
+int msp_conn_send_timeout(msp_conn_t *conn, uint16_t cmd, const void *payload, size_t size, time_micros_t timeout, msp_cmd_callback_f callback, void *callback_data)
+{
+    if (conn->cache)
     {
-        LOG_I(TAG, "MSP callback buffer is full");
-        // Buffer is full
-        if (callback)
-        {
-            callback(conn, cmd, NULL, -1, callback_data);
-        }
-        return -1;
+        msp_cache_request_sent(conn->cache, cmd, time_micros_now());
     }
-    return msp_conn_write(conn, MSP_DIRECTION_TO_MWC, cmd, payload, size);
+    if (!callback || conn->global_callback)
+    {
+        // Nothing to track
+        return msp_conn_write(conn, MSP_DIRECTION_TO_MWC, cmd, payload, size);
+    }
+    return msp_conn_send_tracked(conn, cmd, payload, size, timeout, false, callback, callback_data);
 }
 
 void msp_conn_dispatch_message(msp_conn_t *conn, msp_direction_e direction, uint16_t cmd, const void *data, size_t size)
@@ -70,19 +205,35 @@ void msp_conn_dispatch_message(msp_conn_t *conn, msp_direction_e direction, uint
     }
 
     msp_callback_req_t cb_req;
-    // TODO: Find a better strategy than discarding all callbacks
-    // if we miss a packet
-    while (ring_buffer_pop(&conn->rb, &cb_req))
+    bool found = false;
+    xSemaphoreTake(conn->pending_lock, portMAX_DELAY);
+    for (unsigned ii = 0; ii < conn->pending_count; ii++)
     {
-        if (cb_req.code == cmd)
+        if (conn->pending[ii].code == cmd && !conn->pending[ii].cached)
         {
-            if (cb_req.callback)
-            {
-                cb_req.callback(conn, cmd, data, size, cb_req.data);
-            }
+            cb_req = conn->pending[ii];
+            msp_conn_remove_pending(conn, ii);
+            found = true;
             break;
         }
     }
+    xSemaphoreGive(conn->pending_lock);
+    if (!found)
+    {
+        LOG_D(TAG, "Unexpected MSP response %u", cmd);
+        return;
+    }
+    if (conn->cache && direction == MSP_DIRECTION_FROM_MWC)
+    {
+        msp_cache_store(conn->cache, cmd, data, size, cb_req.sent_at, time_micros_now());
+    }
+    cb_req.callback(conn, cmd, data, size, cb_req.data);
+}
+
+void msp_conn_set_window(msp_conn_t *conn, unsigned window, time_micros_t timeout)
+{
+    conn->window = MIN(MAX(window, 1), MSP_CONN_MAX_WINDOW);
+    conn->timeout = timeout;
 }
 
 void msp_conn_set_global_callback(msp_conn_t *conn, msp_cmd_callback_f callback, void *data)
@@ -90,3 +241,18 @@ void msp_conn_set_global_callback(msp_conn_t *conn, msp_cmd_callback_f callback,
     conn->global_callback = callback;
     conn->global_callback_data = data;
 }
+
+int msp_conn_send_cached(msp_conn_t *conn, uint16_t cmd, const void *payload, size_t size, msp_cmd_callback_f callback, void *callback_data)
+{
+    if (conn->cache && size == 0 && callback && !conn->global_callback && msp_cache_is_cacheable(cmd))
+    {
+        // Answered by msp_conn_update(), on the task owning conn
+        return msp_conn_send_tracked(conn, cmd, NULL, 0, conn->timeout, true, callback, callback_data);
+    }
+    return msp_conn_send(conn, cmd, payload, size, callback, callback_data);
+}
+
+void msp_conn_set_cache(msp_conn_t *conn, msp_cache_t *cache)
+{
+    conn->cache = cache;
+}
@@ -4,17 +4,24 @@
 #include <stdbool.h>
 #include <stdint.h>
 
-#include "util/ringbuffer.h"
+#include <freertos/FreeRTOS.h>
+#include <freertos/semphr.h>
+
+#include "util/time.h"
 
 // Required space for the protocol in addition to the data we want to send
 #define MSP_V1_PROTOCOL_BYTES 6
+#define MSP_V2_PROTOCOL_BYTES 9
 
 // MSP codes we use
 #define MSP_FC_VARIANT 2
 #define MSP_FC_VERSION 3
 #define MSP_NAME 10
+#define MSP_SET_NAME 11
 #define MSP_CURRENT_METER_CONFIG 40
 #define MSP_RSSI_CONFIG 50
+#define MSP_SET_RSSI_CONFIG 51
+#define MSP_REBOOT 68
 #define MSP_RAW_IMU 102
 #define MSP_RAW_GPS 106
 #define MSP_ATTITUDE 108
@@ -27,6 +34,18 @@
 // an upper boundary on payload sizes.
 #define MSP_MAX_PAYLOAD_SIZE 512
 
+typedef enum {
+    MSP_VERSION_1 = 1, // 8 bit cmd and size, XOR checksum
+    MSP_VERSION_2 = 2, // 16 bit cmd and size, CRC8 DVB-S2
+} msp_version_e;
+
+// Returns the minimum MSP version able to encode the given message.
+// Transports use MSPv1 when possible, since it's supported by all FCs.
+inline msp_version_e msp_version_required(uint16_t cmd, size_t size)
+{
+    return cmd > UINT8_MAX || size > UINT8_MAX ? MSP_VERSION_2 : MSP_VERSION_1;
+}
+
 typedef enum {
     MSP_DIRECTION_TO_MWC,
     MSP_DIRECTION_FROM_MWC,
@@ -48,24 +67,67 @@ typedef struct msp_callback_req_s
     uint16_t code;
     msp_cmd_callback_f callback;
     void *data;
+    time_micros_t sent_at;
+    time_micros_t deadline;
+    bool cached; // Not sent, msp_conn_update() answers it from the cache
 } msp_callback_req_t;
 
-#define MSP_QUEUE_MAX_SIZE 10
+// MSP has no request ids, so responses are matched with the oldest
+// pending request for the same cmd. Requests which don't get a response
+// before their deadline are expired, calling their callback with
+// size = -1, so a lost response doesn't affect the rest. Up to window
+// requests with a callback might be in flight at the same time.
+#define MSP_CONN_MAX_WINDOW 24
+#define MSP_CONN_DEFAULT_WINDOW 12
+#define MSP_CONN_DEFAULT_TIMEOUT MILLIS_TO_MICROS(500)
 
 typedef struct msp_transport_s msp_transport_t;
+typedef struct msp_cache_s msp_cache_t;
 
 typedef struct msp_conn_s
 {
-    RING_BUFFER_DECLARE(rb, msp_callback_req_t, MSP_QUEUE_MAX_SIZE);
+    // Requests are sent from any task (e.g. RMP requests from the FC
+    // are sent by the RMP task), while responses are dispatched and
+    // requests expired by the task calling msp_conn_update(). This
+    // protects pending and pending_count. Callbacks are called without
+    // holding it, so they can send other requests.
+    SemaphoreHandle_t pending_lock;
+    msp_callback_req_t pending[MSP_CONN_MAX_WINDOW]; // In the order they were sent
+    unsigned pending_count;
+    unsigned window;
+    time_micros_t timeout;
     msp_transport_t *transport;
+    msp_cache_t *cache;
     msp_cmd_callback_f global_callback;
     void *global_callback_data;
 } msp_conn_t;
 
+// conn must be zeroed before it's initialized for the first time
 void msp_conn_init(msp_conn_t *conn, msp_transport_t *transport);
 void msp_conn_update(msp_conn_t *conn);
 int msp_conn_write(msp_conn_t *conn, msp_direction_e direction, uint16_t cmd, const void *payload, size_t size);
+// Sends a request to the FC. callback is called exactly once, either with
+// the response or with size = -1 if the request couldn't be sent, the
+// window is full or it timed out. Requests without a callback are not
+// tracked and don't use space in the window.
 int msp_conn_send(msp_conn_t *conn, uint16_t cmd, const void *payload, size_t size, msp_cmd_callback_f callback, void *callback_data);
+// Same as msp_conn_send(), with a timeout for this request rather than the
+// default for the connection.
+int msp_conn_send_timeout(msp_conn_t *conn, uint16_t cmd, const void *payload, size_t size, time_micros_t timeout, msp_cmd_callback_f callback, void *callback_data);
+// Sets the maximum number of requests in flight (up to MSP_CONN_MAX_WINDOW)
+// and the default timeout for them. Slow links (e.g. over air) should use
+// a bigger window, so requests can be pipelined.
+void msp_conn_set_window(msp_conn_t *conn, unsigned window, time_micros_t timeout);
+// Same as msp_conn_send(), but queries for cacheable cmds are answered
+// from the cache if it has a fresh response. Like any other response,
+// this happens from msp_conn_update(), so callback is never called from
+// the task sending the request. If the response is not in the cache by
+// then, the request is sent to the FC.
+int msp_conn_send_cached(msp_conn_t *conn, uint16_t cmd, const void *payload, size_t size, msp_cmd_callback_f callback, void *callback_data);
+// Sets a cache to store the responses to requests sent via this connection
+// and to invalidate when requests which might change them are sent. Set
+// to NULL to disable.
+void msp_conn_set_cache(msp_conn_t *conn, msp_cache_t *cache);
 
 // Used by transports that push data rather than being polled
 void msp_conn_dispatch_message(msp_conn_t *conn, msp_direction_e direction, uint16_t cmd, const void *data, size_t size);
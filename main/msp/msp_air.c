@@ -1,9 +1,14 @@
 #include <string.h>
 
+#include <freertos/FreeRTOS.h>
+#include <freertos/semphr.h>
+
 #include <hal/log.h>
 
 #include "air/air_stream.h"
 
+#include "msp/msp_compress.h"
+
 #include "util/macros.h"
 #include "util/uvarint.h"
 
@@ -11,6 +16,15 @@
 
 static const char *TAG = "MSP.Transport.Air";
 
+// The compressor scratch space and the decompression buffer are shared
+// by every msp_air_t, since they're about 3.3KB. Writes might come from
+// other tasks (e.g. requests forwarded from Bluetooth), so compression
+// happens with the lock held. Decompression only happens while
+// dispatching from the air input or output, both on the RC task.
+static msp_compress_t compress;
+static SemaphoreHandle_t compress_lock;
+static uint8_t decompress_buf[MSP_MAX_PAYLOAD_SIZE];
+
 static int msp_air_read(void *transport, msp_direction_e *direction, uint16_t *cmd, void *payload, size_t size)
 {
     // No read support, the air transport is implemeted by pushing
@@ -18,6 +32,11 @@ static int msp_air_read(void *transport, msp_direction_e *direction, uint16_t *c
     return MSP_EOF;
 }
 
+// Messages are encoded as the direction character, the cmd as an uvarint
+// and the payload. Since the size is given by the stream, the encoding
+// is the same for MSPv1 and MSPv2 messages, each end of the link selects
+// the version to use with its FC or configurator. If the peer supports
+// it, the payload is compressed when that makes the message smaller.
 static int msp_air_write(void *transport, msp_direction_e direction, uint16_t cmd, const void *payload, size_t size)
 {
     msp_air_t *tr = transport;
@@ -33,16 +52,35 @@ static int msp_air_write(void *transport, msp_direction_e direction, uint16_t cm
         break;
     }
     int used = uvarint_encode16(&buf[1], sizeof(buf) - 1, cmd);
+    air_cmd_e air_cmd = AIR_CMD_MSP;
+    size_t payload_size = size;
     if (payload && size > 0)
     {
-        memcpy(buf + 1 + used, payload, size);
+        // Compressed payload must save at least 1 byte
+        int n = -1;
+        if (tr->compression)
+        {
+            xSemaphoreTake(compress_lock, portMAX_DELAY);
+            n = msp_compress(&compress, payload, size, buf + 1 + used, size - 1);
+            xSemaphoreGive(compress_lock);
+        }
+        if (n > 0)
+        {
+            LOG_D(TAG, "Compressed cmd %u from %u to %d bytes", cmd, size, n);
+            air_cmd = AIR_CMD_MSP_COMPRESSED;
+            payload_size = n;
+        }
+        else
+        {
+            memcpy(buf + 1 + used, payload, size);
+        }
     }
-    size_t feed_size = 1 + used + size;
+    size_t feed_size = 1 + used + payload_size;
     if (tr->before_feed)
     {
         tr->before_feed(tr, feed_size, tr->user_data);
     }
-    return air_stream_feed_output_cmd(tr->air_stream, AIR_CMD_MSP, buf, feed_size);
+    return air_stream_feed_output_cmd(tr->air_stream, air_cmd, buf, feed_size);
 }
 
 static bool msp_air_decode(const void *payload, size_t size, msp_direction_e *direction, uint16_t *cmd, const void **data, size_t *data_size)
@@ -80,6 +118,13 @@ void msp_air_init(msp_air_t *tr, air_stream_t *stream, msp_air_before_feed_f bef
     tr->air_stream = stream;
     tr->before_feed = before_feed;
     tr->user_data = user_data;
+    tr->compression = false;
+    compress_lock = compress_lock ?: xSemaphoreCreateMutex();
+}
+
+void msp_air_set_compression(msp_air_t *tr, bool enabled)
+{
+    tr->compression = enabled;
 }
 
 void msp_air_dispatch(msp_air_t *tr, msp_conn_t *conn, const void *payload, size_t size)
@@ -98,4 +143,28 @@ void msp_air_dispatch(msp_air_t *tr, msp_conn_t *conn, const void *payload, size
         }
         msp_conn_dispatch_message(conn, direction, cmd, data, data_size);
     }
-}
\ No newline at end of file
+}
+
+void msp_air_dispatch_compressed(msp_air_t *tr, msp_conn_t *conn, const void *payload, size_t size)
+{
+    msp_direction_e direction = 0;
+    uint16_t cmd = 0;
+    const void *data = NULL;
+    size_t data_size = 0;
+    if (conn)
+    {
+        if (!msp_air_decode(payload, size, &direction, &cmd, &data, &data_size))
+        {
+            LOG_W(TAG, "Invalid compressed MSP payload");
+            LOG_BUFFER_W(TAG, payload, size);
+            return;
+        }
+        int n = msp_decompress(data, data_size, decompress_buf, sizeof(decompress_buf));
+        if (n < 0)
+        {
+            LOG_W(TAG, "Could not decompress MSP payload for cmd %u", cmd);
+            return;
+        }
+        msp_conn_dispatch_message(conn, direction, cmd, n > 0 ? decompress_buf : NULL, n);
+    }
+}
@@ -1,5 +1,6 @@
 #pragma once
 
+#include <stdbool.h>
 #include <stddef.h>
 
 #include "msp/msp_transport.h"
@@ -15,7 +16,13 @@ typedef struct msp_air_s
     air_stream_t *air_stream;
     msp_air_before_feed_f before_feed;
     void *user_data;
+    bool compression; // Wether the peer supports AIR_CMD_MSP_COMPRESSED
 } msp_air_t;
 
 void msp_air_init(msp_air_t *tr, air_stream_t *stream, msp_air_before_feed_f before_feed, void *user_data);
-void msp_air_dispatch(msp_air_t *tr, msp_conn_t *conn, const void *payload, size_t size);
\ No newline at end of file
+// Enables compression for outgoing messages. Compressed messages are
+// always accepted.
+void msp_air_set_compression(msp_air_t *tr, bool enabled);
+void msp_air_dispatch(msp_air_t *tr, msp_conn_t *conn, const void *payload, size_t size);
+// Same as msp_air_dispatch(), for AIR_CMD_MSP_COMPRESSED
+void msp_air_dispatch_compressed(msp_air_t *tr, msp_conn_t *conn, const void *payload, size_t size);
\ No newline at end of file
@@ -0,0 +1,136 @@
+#include <string.h>
+
+#include <hal/log.h>
+
+#include "msp/msp.h"
+
+#include "util/macros.h"
+
+#include "msp_cache.h"
+
+static const char *TAG = "MSP.Cache";
+
+typedef struct msp_cache_cmd_s
+{
+    uint16_t cmd;
+    uint16_t set_cmd; // Request which invalidates the entry, 0 if none
+    time_micros_t ttl;
+} msp_cache_cmd_t;
+
+// TTLs are longer than the poll intervals in output.c, so the polls
+// keep the entries fresh.
+static const msp_cache_cmd_t msp_cache_cmds[] = {
+    {.cmd = MSP_FC_VARIANT, .ttl = SECS_TO_MICROS(30)},
+    {.cmd = MSP_FC_VERSION, .ttl = SECS_TO_MICROS(30)},
+    {.cmd = MSP_NAME, .set_cmd = MSP_SET_NAME, .ttl = SECS_TO_MICROS(15)},
+    {.cmd = MSP_RSSI_CONFIG, .set_cmd = MSP_SET_RSSI_CONFIG, .ttl = SECS_TO_MICROS(15)},
+};
+
+ARRAY_ASSERT_COUNT(msp_cache_cmds, MSP_CACHE_NUM_CMDS, "invalid MSP_CACHE_NUM_CMDS");
+
+static int msp_cache_index(uint16_t cmd)
+{
+    for (int ii = 0; ii < ARRAY_COUNT(msp_cache_cmds); ii++)
+    {
+        if (msp_cache_cmds[ii].cmd == cmd)
+        {
+            return ii;
+        }
+    }
+    return -1;
+}
+
+static void msp_cache_invalidate_entry(msp_cache_t *cache, int idx, time_micros_t now)
+{
+    msp_cache_entry_t *entry = &cache->entries[idx];
+    if (entry->stored_at > 0)
+    {
+        cache->stats.invalidations++;
+    }
+    entry->stored_at = 0;
+    entry->invalidated_at = now;
+}
+
+void msp_cache_init(msp_cache_t *cache)
+{
+    // Caches are initialized again each time their output is
+    // opened, keep the same mutex.
+    SemaphoreHandle_t lock = cache->lock;
+    memset(cache, 0, sizeof(*cache));
+    cache->lock = lock ?: xSemaphoreCreateMutex();
+}
+
+bool msp_cache_is_cacheable(uint16_t cmd)
+{
+    return msp_cache_index(cmd) >= 0;
+}
+
+int msp_cache_lookup(msp_cache_t *cache, uint16_t cmd, void *payload, size_t size, time_micros_t now)
+{
+    int idx = msp_cache_index(cmd);
+    if (idx < 0)
+    {
+        return -1;
+    }
+    int n = -1;
+    xSemaphoreTake(cache->lock, portMAX_DELAY);
+    const msp_cache_entry_t *entry = &cache->entries[idx];
+    if (entry->stored_at == 0 || entry->stored_at + msp_cache_cmds[idx].ttl < now || entry->size > size)
+    {
+        cache->stats.misses++;
+    }
+    else
+    {
+        memcpy(payload, entry->payload, entry->size);
+        cache->stats.hits++;
+        cache->stats.bytes_saved += MSP_V1_PROTOCOL_BYTES * 2 + entry->size;
+        n = entry->size;
+    }
+    xSemaphoreGive(cache->lock);
+    if (n >= 0)
+    {
+        LOG_D(TAG, "Hit for cmd %u", cmd);
+    }
+    return n;
+}
+
+void msp_cache_store(msp_cache_t *cache, uint16_t cmd, const void *payload, size_t size, time_micros_t requested_at, time_micros_t now)
+{
+    int idx = msp_cache_index(cmd);
+    if (idx < 0 || size > MSP_CACHE_MAX_PAYLOAD_SIZE)
+    {
+        return;
+    }
+    xSemaphoreTake(cache->lock, portMAX_DELAY);
+    msp_cache_entry_t *entry = &cache->entries[idx];
+    // Otherwise the response might predate the change
+    if (requested_at > entry->invalidated_at)
+    {
+        memcpy(entry->payload, payload, size);
+        entry->size = size;
+        entry->stored_at = now;
+        cache->stats.stores++;
+    }
+    xSemaphoreGive(cache->lock);
+}
+
+void msp_cache_request_sent(msp_cache_t *cache, uint16_t cmd, time_micros_t now)
+{
+    xSemaphoreTake(cache->lock, portMAX_DELAY);
+    for (int ii = 0; ii < ARRAY_COUNT(msp_cache_cmds); ii++)
+    {
+        // MSP_REBOOT might change the FC firmware
+        if (cmd == MSP_REBOOT || msp_cache_cmds[ii].set_cmd == cmd)
+        {
+            msp_cache_invalidate_entry(cache, ii, now);
+        }
+    }
+    xSemaphoreGive(cache->lock);
+}
+
+void msp_cache_get_stats(msp_cache_t *cache, msp_cache_stats_t *stats)
+{
+    xSemaphoreTake(cache->lock, portMAX_DELAY);
+    *stats = cache->stats;
+    xSemaphoreGive(cache->lock);
+}
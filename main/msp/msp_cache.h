@@ -0,0 +1,67 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include <freertos/FreeRTOS.h>
+#include <freertos/semphr.h>
+
+#include "util/time.h"
+
+// Cache for responses to MSP queries which rarely change (e.g. the FC
+// variant or the craft name), so requests forwarded to the FC from
+// the other end of the link can be answered without waiting for the
+// FC. Each cmd has its own TTL and it's invalidated when a request
+// that might change it (e.g. MSP_SET_NAME) is sent to the FC.
+// Responses are stored by msp_conn_t (see msp_conn_set_cache()).
+
+#define MSP_CACHE_MAX_PAYLOAD_SIZE 32
+#define MSP_CACHE_NUM_CMDS 4
+
+typedef struct msp_cache_entry_s
+{
+    time_micros_t stored_at; // 0 if empty
+    time_micros_t invalidated_at;
+    uint16_t size;
+    uint8_t payload[MSP_CACHE_MAX_PAYLOAD_SIZE];
+} msp_cache_entry_t;
+
+// Wire format for AIR_LINK_STATS_RMP_MSP_CACHE_READ. Fields are little
+// endian. Bytes saved include the MSPv1 framing of the request and
+// the response which didn't need to be exchanged with the FC.
+typedef struct msp_cache_stats_s
+{
+    uint32_t hits;
+    uint32_t misses;
+    uint32_t stores;
+    uint32_t invalidations;
+    uint32_t bytes_saved;
+} msp_cache_stats_t;
+
+// Requests are sent from any task, while responses are stored by the
+// task owning the connection and the stats are read via RMP. All the
+// functions take the lock.
+typedef struct msp_cache_s
+{
+    SemaphoreHandle_t lock;
+    msp_cache_entry_t entries[MSP_CACHE_NUM_CMDS]; // Indexed like msp_cache_cmds in msp_cache.c
+    msp_cache_stats_t stats;
+} msp_cache_t;
+
+// cache must be zeroed before it's initialized for the first time
+void msp_cache_init(msp_cache_t *cache);
+// Returns true iff responses to cmd might be stored
+bool msp_cache_is_cacheable(uint16_t cmd);
+// Copies the cached response for cmd to payload and returns its size,
+// or returns -1 if cmd is not cacheable or the response is missing,
+// expired or doesn't fit in payload.
+int msp_cache_lookup(msp_cache_t *cache, uint16_t cmd, void *payload, size_t size, time_micros_t now);
+// Stores a response from the FC. requested_at is the time the request
+// was sent, so responses for requests sent before an invalidation are
+// discarded.
+void msp_cache_store(msp_cache_t *cache, uint16_t cmd, const void *payload, size_t size, time_micros_t requested_at, time_micros_t now);
+// Must be called for every request sent to the FC, invalidates the
+// entries it might change.
+void msp_cache_request_sent(msp_cache_t *cache, uint16_t cmd, time_micros_t now);
+void msp_cache_get_stats(msp_cache_t *cache, msp_cache_stats_t *stats);
@@ -0,0 +1,187 @@
+#include <string.h>
+
+#include "util/macros.h"
+
+#include "msp_compress.h"
+
+#define MSP_COMPRESS_NIL 0xFFFF
+
+_Static_assert(MSP_COMPRESS_DICT_SIZE + MSP_MAX_PAYLOAD_SIZE < MSP_COMPRESS_NIL, "MSP_COMPRESS_NIL is a valid position");
+
+// Part of the air protocol, so it can't be changed without adding a new
+// capability. Contents which appear most frequently should go at the end,
+// to increase the chances of finding them in the hash chains.
+static const uint8_t msp_compress_dict[MSP_COMPRESS_DICT_SIZE] =
+    // Box names, as sent by MSP_BOXNAMES
+    "ARM;ANGLE;HORIZON;HEADFREE;HEADADJ;CAMSTAB;PASSTHRU;BEEPER;"
+    "LEDLOW;CALIB;OSD DISABLE SW;TELEMETRY;SERVO1;SERVO2;SERVO3;"
+    "BLACKBOX;FAILSAFE;AIR MODE;ANTI GRAVITY;DISABLE 3D;"
+    "FPV ANGLE MIX;BLACKBOX ERASE;CAMERA CONTROL 1;CAMERA CONTROL 2;"
+    "CAMERA CONTROL 3;FLIP OVER AFTER CRASH;PREARM;"
+    "BEEP GPS SATELLITE COUNT;VTX PIT MODE;USER1;USER2;PARALYZE;"
+    "GPS RESCUE;ACRO TRAINER;NAV ALTHOLD;NAV POSHOLD;NAV RTH;NAV WP;"
+    "NAV LAUNCH;NAV CRUISE;MANUAL;TURN ASSIST;SURFACE;AUTO TUNE;"
+    "HOME RESET;GCS NAV;LOITER CHANGE;FLAPERON;"
+    // MSP_FC_VARIANT
+    "BTFLINAV"
+    // Common channel and motor values as uint16_t LE: 1500, 1000, 2000
+    "\xdc\x05\xdc\x05\xdc\x05\xdc\x05\xdc\x05\xdc\x05\xdc\x05\xdc\x05"
+    "\xdc\x05\xdc\x05\xdc\x05\xdc\x05\xdc\x05\xdc\x05\xdc\x05\xdc\x05"
+    "\xe8\x03\xe8\x03\xe8\x03\xe8\x03\xe8\x03\xe8\x03\xe8\x03\xe8\x03"
+    "\xd0\x07\xd0\x07\xd0\x07\xd0\x07"
+    "\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff"
+    // The rest is zero
+;
+
+// Positions below MSP_COMPRESS_DICT_SIZE are in the dictionary,
+// the rest in data.
+static inline uint8_t msp_compress_byte_at(const uint8_t *data, unsigned pos)
+{
+    return pos < MSP_COMPRESS_DICT_SIZE ? msp_compress_dict[pos] : data[pos - MSP_COMPRESS_DICT_SIZE];
+}
+
+static inline unsigned msp_compress_hash(const uint8_t *data, unsigned pos)
+{
+    uint32_t v = msp_compress_byte_at(data, pos) << 16 |
+                 msp_compress_byte_at(data, pos + 1) << 8 |
+                 msp_compress_byte_at(data, pos + 2);
+    return (v * 2654435761u) >> (32 - MSP_COMPRESS_HASH_BITS);
+}
+
+static void msp_compress_insert(msp_compress_t *c, const uint8_t *data, unsigned pos, unsigned end)
+{
+    if (pos + MSP_COMPRESS_MIN_MATCH <= end)
+    {
+        unsigned h = msp_compress_hash(data, pos);
+        c->prev[pos] = c->head[h];
+        c->head[h] = pos;
+    }
+}
+
+static int msp_compress_flush_literals(const uint8_t *src, size_t count, uint8_t *dst, size_t pos, size_t dst_size)
+{
+    while (count > 0)
+    {
+        size_t n = MIN(count, MSP_COMPRESS_MAX_LITERALS);
+        if (pos + 1 + n > dst_size)
+        {
+            return -1;
+        }
+        dst[pos++] = n - 1;
+        memcpy(&dst[pos], src, n);
+        pos += n;
+        src += n;
+        count -= n;
+    }
+    return pos;
+}
+
+int msp_compress(msp_compress_t *c, const void *src, size_t size, void *dst, size_t dst_size)
+{
+    const uint8_t *in = src;
+    uint8_t *out = dst;
+    int out_pos = 0;
+    unsigned end = MSP_COMPRESS_DICT_SIZE + size;
+    if (size > MSP_MAX_PAYLOAD_SIZE)
+    {
+        return -1;
+    }
+    memset(c->head, 0xFF, sizeof(c->head));
+    for (unsigned ii = 0; ii < MSP_COMPRESS_DICT_SIZE; ii++)
+    {
+        msp_compress_insert(c, in, ii, end);
+    }
+    size_t literals = 0;
+    size_t ii = 0;
+    while (ii < size)
+    {
+        unsigned pos = MSP_COMPRESS_DICT_SIZE + ii;
+        unsigned best_len = 0;
+        unsigned best_offset = 0;
+        if (pos + MSP_COMPRESS_MIN_MATCH <= end)
+        {
+            unsigned max_len = MIN(MSP_COMPRESS_MAX_MATCH, size - ii);
+            unsigned candidate = c->head[msp_compress_hash(in, pos)];
+            for (int jj = 0; candidate != MSP_COMPRESS_NIL && jj < MSP_COMPRESS_MAX_CHAIN; jj++)
+            {
+                unsigned len = 0;
+                while (len < max_len && msp_compress_byte_at(in, candidate + len) == in[ii + len])
+                {
+                    len++;
+                }
+                if (len > best_len)
+                {
+                    best_len = len;
+                    best_offset = pos - candidate;
+                    if (len == max_len)
+                    {
+                        break;
+                    }
+                }
+                candidate = c->prev[candidate];
+            }
+        }
+        if (best_len < MSP_COMPRESS_MIN_MATCH)
+        {
+            msp_compress_insert(c, in, pos, end);
+            literals++;
+            ii++;
+            continue;
+        }
+        if ((out_pos = msp_compress_flush_literals(&in[ii - literals], literals, out, out_pos, dst_size)) < 0 ||
+            out_pos + 2 > dst_size)
+        {
+            return -1;
+        }
+        literals = 0;
+        out[out_pos++] = 0x80 | (best_len - MSP_COMPRESS_MIN_MATCH) << 3 | best_offset >> 8;
+        out[out_pos++] = best_offset & 0xFF;
+        for (unsigned jj = 0; jj < best_len; jj++)
+        {
+            msp_compress_insert(c, in, pos + jj, end);
+        }
+        ii += best_len;
+    }
+    return msp_compress_flush_literals(&in[size - literals], literals, out, out_pos, dst_size);
+}
+
+int msp_decompress(const void *src, size_t size, void *dst, size_t dst_size)
+{
+    const uint8_t *in = src;
+    uint8_t *out = dst;
+    size_t in_pos = 0;
+    size_t out_pos = 0;
+    while (in_pos < size)
+    {
+        uint8_t token = in[in_pos++];
+        if (!(token & 0x80))
+        {
+            size_t n = token + 1;
+            if (in_pos + n > size || out_pos + n > dst_size)
+            {
+                return -1;
+            }
+            memcpy(&out[out_pos], &in[in_pos], n);
+            in_pos += n;
+            out_pos += n;
+            continue;
+        }
+        if (in_pos >= size)
+        {
+            return -1;
+        }
+        unsigned len = ((token >> 3) & 0x0F) + MSP_COMPRESS_MIN_MATCH;
+        unsigned offset = (token & 0x07) << 8 | in[in_pos++];
+        unsigned pos = MSP_COMPRESS_DICT_SIZE + out_pos;
+        if (offset == 0 || offset > pos || out_pos + len > dst_size)
+        {
+            return -1;
+        }
+        // Copy byte by byte, since the match might overlap the output
+        for (unsigned ii = pos - offset; ii < pos - offset + len; ii++)
+        {
+            out[out_pos++] = msp_compress_byte_at(out, ii);
+        }
+    }
+    return out_pos;
+}
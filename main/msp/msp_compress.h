@@ -0,0 +1,40 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "msp/msp.h"
+
+// LZ77 codec for MSP payloads sent over the air stream. Matches can
+// reference a static dictionary with common MSP payload contents (box
+// names, RC channel values, zero runs...) placed before the data, so
+// even short payloads compress well.
+//
+// Compressed data is a sequence of tokens:
+//  - 0LLLLLLL: L + 1 literal bytes follow.
+//  - 1LLLLOOO OOOOOOOO: copy L + MSP_COMPRESS_MIN_MATCH bytes starting
+//    O bytes back (counting the dictionary). Might overlap the output.
+
+#define MSP_COMPRESS_MIN_MATCH 3
+#define MSP_COMPRESS_MAX_MATCH (MSP_COMPRESS_MIN_MATCH + 15)
+#define MSP_COMPRESS_MAX_LITERALS 128
+#define MSP_COMPRESS_MAX_OFFSET 2047
+#define MSP_COMPRESS_HASH_BITS 8
+#define MSP_COMPRESS_DICT_SIZE 640
+// Candidates checked for each position, bounds the time spent per byte
+#define MSP_COMPRESS_MAX_CHAIN 16
+
+_Static_assert(MSP_COMPRESS_DICT_SIZE + MSP_MAX_PAYLOAD_SIZE <= MSP_COMPRESS_MAX_OFFSET + 1, "MSP_COMPRESS_MAX_OFFSET too small");
+
+// Scratch space for msp_compress(). Large, so it shouldn't go on the stack.
+typedef struct msp_compress_s
+{
+    uint16_t head[1 << MSP_COMPRESS_HASH_BITS];
+    uint16_t prev[MSP_COMPRESS_DICT_SIZE + MSP_MAX_PAYLOAD_SIZE];
+} msp_compress_t;
+
+// Returns the compressed size or -1 if the result wouldn't fit in dst_size.
+int msp_compress(msp_compress_t *c, const void *src, size_t size, void *dst, size_t dst_size);
+// Returns the decompressed size or -1 if src is invalid or the result
+// wouldn't fit in dst_size.
+int msp_decompress(const void *src, size_t size, void *dst, size_t dst_size);
@@ -27,6 +27,19 @@ int msp_serial_baudrate_get(msp_serial_baudrate_e br)
     return -1;
 }
 
+static uint8_t msp_serial_direction_char(msp_direction_e direction)
+{
+    switch (direction)
+    {
+    case MSP_DIRECTION_TO_MWC:
+        return '<';
+    case MSP_DIRECTION_FROM_MWC:
+        return '>';
+    }
+    assert(0 && "unreachable");
+    return 0;
+}
+
 static int msp_serial_v1_pack(msp_direction_e direction, uint16_t code, const void *data, size_t size, void *buf, size_t bufsize)
 {
     if (bufsize < size + MSP_V1_PROTOCOL_BYTES)
@@ -38,17 +51,7 @@ static int msp_serial_v1_pack(msp_direction_e direction, uint16_t code, const vo
     // Preamble
     *ptr++ = '$';
     *ptr++ = 'M';
-    switch (direction)
-    {
-    case MSP_DIRECTION_TO_MWC:
-        *ptr++ = '<';
-        break;
-    case MSP_DIRECTION_FROM_MWC:
-        *ptr++ = '>';
-        break;
-    default:
-        assert(0 && "unreachable");
-    }
+    *ptr++ = msp_serial_direction_char(direction);
     // Payload size
     *ptr++ = (uint8_t)size;
     // Command
@@ -66,6 +69,38 @@ static int msp_serial_v1_pack(msp_direction_e direction, uint16_t code, const vo
     return data_size + 1;
 }
 
+static int msp_serial_v2_pack(msp_direction_e direction, uint16_t code, const void *data, size_t size, void *buf, size_t bufsize)
+{
+    if (bufsize < size + MSP_V2_PROTOCOL_BYTES)
+    {
+        return -1;
+    }
+    uint8_t *start = buf;
+    uint8_t *ptr = start;
+    // Preamble
+    *ptr++ = '$';
+    *ptr++ = 'X';
+    *ptr++ = msp_serial_direction_char(direction);
+    // Flags
+    *ptr++ = 0;
+    // Command and payload size, little endian
+    *ptr++ = code & 0xff;
+    *ptr++ = code >> 8;
+    *ptr++ = size & 0xff;
+    *ptr++ = size >> 8;
+    // Payload
+    if (size > 0)
+    {
+        memcpy(ptr, data, size);
+        ptr += size;
+    }
+    // CRC
+    unsigned data_size = ptr - start;
+    unsigned crc_size = data_size - 3; // Preamble is not used in CRC
+    *ptr = crc8_dvb_s2_bytes(start + 3, crc_size);
+    return data_size + 1;
+}
+
 static int msp_serial_read(void *transport, msp_direction_e *direction, uint16_t *cmd, void *payload, size_t size)
 {
     msp_serial_t *serial = transport;
@@ -81,31 +116,59 @@ static int msp_serial_read(void *transport, msp_direction_e *direction, uint16_t
         serial->buf_pos += n;
         //LOG_I(TAG, "Read %d bytes, buf at %u", n, serial->buf_pos);
     }
-    // Discard invalid data
     int start = 0;
     int end = serial->buf_pos;
+    msp_version_e version = 0;
+    uint16_t packet_code = 0;
+    uint16_t payload_size = 0;
+    int header_size = 0;
+    int packet_size = 0;
+    int ret = MSP_EOF;
     while (end - start >= 2)
     {
         if (serial->buf[start] == '$' && serial->buf[start + 1] == 'M')
         {
-            // Got packet start
+            version = MSP_VERSION_1;
+            if (end - start >= MSP_V1_PROTOCOL_BYTES)
+            {
+                // Size and cmd are after $M>
+                payload_size = serial->buf[start + 3];
+                packet_code = serial->buf[start + 4];
+                header_size = 5;
+                packet_size = MSP_V1_PROTOCOL_BYTES + payload_size;
+            }
+            break;
+        }
+        if (serial->buf[start] == '$' && serial->buf[start + 1] == 'X')
+        {
+            version = MSP_VERSION_2;
+            if (end - start >= MSP_V2_PROTOCOL_BYTES)
+            {
+                // Flags, cmd and size are after $X>
+                packet_code = serial->buf[start + 4] | (serial->buf[start + 5] << 8);
+                payload_size = serial->buf[start + 6] | (serial->buf[start + 7] << 8);
+                header_size = 8;
+                packet_size = MSP_V2_PROTOCOL_BYTES + payload_size;
+                if (payload_size > MSP_MAX_PAYLOAD_SIZE)
+                {
+                    // Can't fit in our buffer, must be garbage
+                    start++;
+                    version = 0;
+                    continue;
+                }
+            }
             break;
         }
-        // Ignore one byte
+        // Discard invalid data, one byte at a time
         start++;
     }
 
-    if (end - start >= MSP_V1_PROTOCOL_BYTES)
+    if (packet_size > 0)
     {
-        // Size is after $M>
-        uint8_t payload_size = serial->buf[start + 3];
-        int packet_size = MSP_V1_PROTOCOL_BYTES + payload_size;
         LOG_D(TAG, "Expecting packet of size %d, got %d", (int)packet_size, (int)end - start);
-        if (end - start < packet_size)
-        {
-            // Incomplete packet, must wait until next update
-            return MSP_EOF;
-        }
+    }
+    if (packet_size > 0 && end - start >= packet_size)
+    {
         switch (serial->buf[start + 2])
         {
         case '<':
@@ -123,14 +186,21 @@ static int msp_serial_read(void *transport, msp_direction_e *direction, uint16_t
             // TODO: ! as direction for error signaling
         }
         // We got a full packet
-        uint16_t packet_code = serial->buf[start + 4];
         uint8_t crc = serial->buf[start + packet_size - 1];
-        uint8_t ccrc = crc_xor_bytes(&serial->buf[start + 3], packet_size - 3 - 1);
-        LOG_D(TAG, "Got serial code %d (payload size %d)", (int)packet_code, (int)payload_size);
+        uint8_t ccrc;
+        if (version == MSP_VERSION_2)
+        {
+            ccrc = crc8_dvb_s2_bytes(&serial->buf[start + 3], packet_size - 3 - 1);
+        }
+        else
+        {
+            ccrc = crc_xor_bytes(&serial->buf[start + 3], packet_size - 3 - 1);
+        }
+        LOG_D(TAG, "Got serial v%d code %d (payload size %d)", version, (int)packet_code, (int)payload_size);
         uint8_t *packet_data = NULL;
         if (payload_size > 0)
         {
-            packet_data = &serial->buf[start + 5];
+            packet_data = &serial->buf[start + header_size];
         }
         if (cmd)
         {
@@ -147,45 +217,82 @@ static int msp_serial_read(void *transport, msp_direction_e *direction, uint16_t
             LOG_W(TAG, "Invalid CRC 0x%02x, expecting 0x%02x", crc, ccrc);
             LOG_BUFFER_W(TAG, &serial->buf[start], packet_size);
         }
-
-        // Packet was consumed
-        start += packet_size;
-
-        // start contains the number of bytes consumed
-        if (start > 0)
+        else
         {
-            LOG_D(TAG, "Consumed %d bytes", start);
-            if (start != serial->buf_pos)
+            serial->last_version = version;
+            if (version > serial->peer_version)
             {
-                // Got some data at the end that we need to copy
-                memmove(serial->buf, &serial->buf[start], end - start);
+                LOG_I(TAG, "Peer supports MSPv%d", version);
+                serial->peer_version = version;
             }
-            serial->buf_pos -= start;
         }
-        // Data has been consumed, we can now return
+
+        // Packet was consumed
+        start += packet_size;
+
         if (invalid_crc)
         {
-            return MSP_INVALID_CHECKSUM;
+            ret = MSP_INVALID_CHECKSUM;
         }
-        if (size < payload_size)
+        else if (size < payload_size)
         {
             // Return an error, so the caller knows the buffer was not big enough
-            return MSP_BUF_TOO_SMALL;
+            ret = MSP_BUF_TOO_SMALL;
+        }
+        else
+        {
+            ret = payload_size;
         }
-        return payload_size;
     }
-    return MSP_EOF;
+
+    // start contains the number of bytes consumed
+    if (start > 0)
+    {
+        LOG_D(TAG, "Consumed %d bytes", start);
+        if (start != serial->buf_pos)
+        {
+            // Got some data at the end that we need to copy
+            memmove(serial->buf, &serial->buf[start], end - start);
+        }
+        serial->buf_pos -= start;
+    }
+
+    return ret;
+}
+
+static msp_version_e msp_serial_write_version(msp_serial_t *serial, msp_direction_e direction, uint16_t cmd, size_t size)
+{
+    msp_version_e version = msp_version_required(cmd, size);
+    switch (direction)
+    {
+    case MSP_DIRECTION_TO_MWC:
+        // Requests use MSPv1 unless the FC has already replied with
+        // MSPv2, which has a stronger CRC.
+        return MAX(version, serial->peer_version);
+    case MSP_DIRECTION_FROM_MWC:
+        // Responses mirror the version of the request
+        return MAX(version, serial->last_version);
+    }
+    return version;
 }
 
 static int msp_serial_write(void *transport, msp_direction_e direction, uint16_t cmd, const void *payload, size_t size)
 {
-    uint8_t buf[MSP_MAX_PAYLOAD_SIZE];
-    int packet_size = msp_serial_v1_pack(direction, cmd, payload, size, buf, sizeof(buf));
+    msp_serial_t *serial = transport;
+    uint8_t buf[MSP_MAX_PAYLOAD_SIZE + MSP_V2_PROTOCOL_BYTES];
+    int packet_size;
+    if (msp_serial_write_version(serial, direction, cmd, size) == MSP_VERSION_2)
+    {
+        packet_size = msp_serial_v2_pack(direction, cmd, payload, size, buf, sizeof(buf));
+    }
+    else
+    {
+        packet_size = msp_serial_v1_pack(direction, cmd, payload, size, buf, sizeof(buf));
+    }
     if (packet_size < 0)
     {
         return packet_size;
     }
-    msp_serial_t *serial = transport;
     return io_write(&serial->io, buf, packet_size);
 }
 
@@ -195,4 +302,6 @@ void msp_serial_init(msp_serial_t *tr, io_t *io)
     tr->transport.vtable.write = msp_serial_write;
     tr->io = *io;
     tr->buf_pos = 0;
+    tr->last_version = MSP_VERSION_1;
+    tr->peer_version = MSP_VERSION_1;
 }
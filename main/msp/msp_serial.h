@@ -21,9 +21,11 @@ int msp_serial_baudrate_get(msp_serial_baudrate_e br);
 typedef struct msp_serial_s
 {
     msp_transport_t transport;
-    uint8_t buf[MSP_MAX_PAYLOAD_SIZE];
+    uint8_t buf[MSP_MAX_PAYLOAD_SIZE + MSP_V2_PROTOCOL_BYTES];
     int buf_pos;
     io_t io;
+    msp_version_e last_version; // Version of the last valid frame received
+    msp_version_e peer_version; // Highest version received from the peer
 } msp_serial_t;
 
 void msp_serial_init(msp_serial_t *tr, io_t *io);
\ No newline at end of file
@@ -7,7 +7,8 @@
 
 #include "msp_telemetry.h"
 
-#define MSP_TELEMETRY_MSP_VERSION 1
+#define MSP_TELEMETRY_V1_HEADER_SIZE 2 // size and cmd, 1 byte each
+#define MSP_TELEMETRY_V2_HEADER_SIZE 5 // flags, then cmd and size, 2 bytes each
 #define MSP_TELEMETRY_TIMEOUT MILLIS_TO_TICKS(1000)
 
 #define MSP_TELEMETRY_MAX_CHUNK_DATA_SIZE(tr) (tr->max_size - 1)
@@ -27,42 +28,69 @@ enum
 typedef struct msp_telemetry_chunk_s
 {
     bool start;
+    uint8_t version;
     uint8_t size;
     uint8_t data[];
 } msp_telemetry_chunk_t;
 
 // Used to piece together chunks received into whole MSP requests.
-// CRC is at the end.
+// For MSPv1, the CRC is at the end. MSPv2 over telemetry has no CRC.
 typedef struct msp_telemetry_blob_s
 {
-    uint8_t payload_size;
-    uint8_t cmd;
+    uint16_t payload_size;
+    uint16_t cmd;
+    uint8_t version;
     uint8_t data[];
 } PACKED msp_telemetry_blob_t;
 
 // Packed MSP for sending over telemetry.
 //
 // The MSP payload must omit the preamble and direction data (1st 3 bytes
-// in MSPv1 "$M<"").
+// in MSPv1 "$M<"). For MSPv1, the start chunk begins with the size and
+// cmd bytes and the last one ends with the CRC. For MSPv2, it begins with
+// the flags followed by the cmd and size in little endian and there's no CRC.
 typedef struct msp_telemetry_req_chunk_s
 {
     unsigned seq : 4;     // sequence number
     unsigned start : 1;   // 1 for the 1st chunk in a sequence, zero for the rest
-    unsigned version : 3; // must be MSP_TRANSPORT_MSP_VERSION
+    unsigned version : 3; // MSP version, 1 or 2
     uint8_t data[];
 } PACKED msp_telemetry_req_chunk_t;
 
-// MSP over telemetry reply. Note that there's no MSP code, so we need to
-// store it ourselves.
+// MSP over telemetry reply. Note that there's no MSP code in MSPv1 replies,
+// so we need to store it ourselves. MSPv2 replies include the same header
+// as requests.
+//
+// The meaning of the flags depends on the version. MSPv1 replies keep the
+// error flag in bit 5 with the rest reserved, since receivers which only
+// know about MSPv1 check bit 5 for errors. MSPv2 replies use bits 5-6 for
+// the version and bit 7 for the error flag.
 typedef struct msp_telemetry_resp_chunk_s
 {
     unsigned seq : 4; // sequence number
     unsigned start : 1;
-    unsigned error : 1;
-    unsigned reserved1 : 2; // 2 bits reserved
+    unsigned flags : 3; // see msp_telemetry_resp_flags() and msp_telemetry_resp_error()
     uint8_t data[];
 } PACKED msp_telemetry_resp_chunk_t;
 
+#define MSP_TELEMETRY_RESP_V1_ERROR (1 << 0)
+#define MSP_TELEMETRY_RESP_V2_VERSION_MASK 0x03
+#define MSP_TELEMETRY_RESP_V2_ERROR (1 << 2)
+
+static unsigned msp_telemetry_resp_flags(uint8_t version, bool error)
+{
+    if (version == MSP_VERSION_1)
+    {
+        return error ? MSP_TELEMETRY_RESP_V1_ERROR : 0;
+    }
+    return (version & MSP_TELEMETRY_RESP_V2_VERSION_MASK) | (error ? MSP_TELEMETRY_RESP_V2_ERROR : 0);
+}
+
+static bool msp_telemetry_resp_error(const msp_telemetry_resp_chunk_t *chunk, uint8_t version)
+{
+    return chunk->flags & (version == MSP_VERSION_1 ? MSP_TELEMETRY_RESP_V1_ERROR : MSP_TELEMETRY_RESP_V2_ERROR);
+}
+
 static bool msp_telemetry_in_use(msp_telemetry_t *tr)
 {
     return tr->in_use_since > 0 && !(time_ticks_now() - tr->in_use_since > MSP_TELEMETRY_TIMEOUT);
@@ -76,6 +104,7 @@ static void msp_telemetry_init(msp_telemetry_t *tr, size_t max_size)
     tr->max_size = max_size;
     tr->req_seq = 0;
     tr->resp_seq = 0;
+    tr->version = MSP_VERSION_1;
 }
 
 static bool msp_telemetry_push_data(ring_buffer_t *rb, const void *data, size_t size)
@@ -151,6 +180,7 @@ static int msp_telemetry_read(msp_telemetry_t *tr, ring_buffer_t *rb, uint16_t *
 
     uint8_t ccrc = 0;
 
+    // CRC is only used by MSPv1, so size and cmd are truncated
     uint8_t size8 = (uint8_t)blob.payload_size;
     ccrc = crc_xor(ccrc, size8);
 
@@ -175,20 +205,25 @@ static int msp_telemetry_read(msp_telemetry_t *tr, ring_buffer_t *rb, uint16_t *
         }
     }
 
-    // Read the checksum
-    uint8_t crc;
-    if (!ring_buffer_pop(rb, &crc))
+    if (blob.version == MSP_VERSION_1)
     {
-        LOG_E(TAG, "Error popping CRC");
-        return MSP_EOF;
-    }
+        // Read the checksum
+        uint8_t crc;
+        if (!ring_buffer_pop(rb, &crc))
+        {
+            LOG_E(TAG, "Error popping CRC");
+            return MSP_EOF;
+        }
 
-    if (crc != ccrc)
-    {
-        LOG_W(TAG, "Invalid CRC %u, expecting %u", crc, ccrc);
+        if (crc != ccrc)
+        {
+            LOG_W(TAG, "Invalid CRC %u, expecting %u", crc, ccrc);
+        }
     }
 
-    if (ptr_pos >= size)
+    // ptr_pos is the payload size here, a payload which fills the
+    // whole buffer is fine.
+    if (ptr_pos > size)
     {
         return MSP_BUF_TOO_SMALL;
     }
@@ -199,78 +234,63 @@ static int msp_telemetry_read(msp_telemetry_t *tr, ring_buffer_t *rb, uint16_t *
 
 static int msp_telemetry_write(msp_telemetry_t *tr, ring_buffer_t *rb, msp_direction_e direction, uint16_t cmd, const void *payload, size_t size)
 {
-    // Messages to the FC need 3 additional bytes (size, cmd and crc),
+    // MSPv1 messages to the FC need 3 additional bytes (size, cmd and crc),
     // while messages from the FC omit the code (however the crc must
     // include the cmd byte). Callers are supposed to keep a list of
-    // sent messages to handle that.
-
-    // Size byte + crc byte
-    size_t total_size = size + 1 + 1;
-    if (direction == MSP_DIRECTION_TO_MWC)
-    {
-        // + msp cmd byte
-        total_size++;
-    }
-    size_t remaining = total_size;
-    size_t max_data_size = MSP_TELEMETRY_MAX_CHUNK_DATA_SIZE(tr);
-    size_t chunk_size = MIN(remaining, max_data_size);
-    msp_telemetry_chunk_t chunk = {
-        .start = true,
-        .size = chunk_size,
-    };
-    if (!msp_telemetry_push_chunk(rb, &chunk))
+    // sent messages to handle that. MSPv2 messages include the flags,
+    // cmd and size in both directions and have no CRC.
+    if (size > MSP_MAX_PAYLOAD_SIZE)
     {
         return -1;
     }
-    uint8_t crc = 0;
-    // Push size and cmd bytes
-    uint8_t size8 = (uint8_t)size;
-    crc = crc_xor(crc, size8);
-    if (!ring_buffer_push(rb, &size8))
+    uint8_t version = msp_version_required(cmd, size);
+    if (direction == MSP_DIRECTION_FROM_MWC)
     {
-        return -1;
+        version = MAX(version, tr->version);
     }
-    uint8_t cmd8 = (uint8_t)cmd;
-    crc = crc_xor(crc, cmd8);
-    remaining--;
-    chunk_size--;
-    if (direction == MSP_DIRECTION_TO_MWC)
+    uint8_t buf[MSP_TELEMETRY_V2_HEADER_SIZE + MSP_MAX_PAYLOAD_SIZE];
+    uint8_t *ptr = buf;
+    if (version == MSP_VERSION_1)
     {
-        if (!ring_buffer_push(rb, &cmd8))
+        *ptr++ = (uint8_t)size;
+        if (direction == MSP_DIRECTION_TO_MWC)
         {
-            return -1;
+            *ptr++ = (uint8_t)cmd;
         }
-        remaining--;
-        chunk_size--;
     }
-    // Now push the payload. Might require more chunks.
-    const uint8_t *payload_ptr = payload;
-    while (remaining > 1)
+    else
+    {
+        *ptr++ = 0; // flags
+        *ptr++ = cmd & 0xff;
+        *ptr++ = cmd >> 8;
+        *ptr++ = size & 0xff;
+        *ptr++ = size >> 8;
+    }
+    if (size > 0)
     {
-        if (!ring_buffer_push(rb, payload_ptr))
+        memcpy(ptr, payload, size);
+        ptr += size;
+    }
+    if (version == MSP_VERSION_1)
+    {
+        *ptr++ = crc_xor(crc_xor(crc_xor_bytes(payload, size), (uint8_t)size), (uint8_t)cmd);
+    }
+    // Now split the message into chunks
+    size_t total_size = ptr - buf;
+    size_t max_data_size = MSP_TELEMETRY_MAX_CHUNK_DATA_SIZE(tr);
+    msp_telemetry_chunk_t chunk = {
+        .start = true,
+        .version = version,
+    };
+    for (size_t pos = 0; pos < total_size; pos += chunk.size)
+    {
+        chunk.size = MIN(total_size - pos, max_data_size);
+        if (!msp_telemetry_push_chunk(rb, &chunk) ||
+            !ring_buffer_push_n(rb, &buf[pos], chunk.size))
         {
             return -1;
         }
-        crc = crc_xor(crc, *payload_ptr);
-        remaining--;
-        chunk_size--;
-        payload_ptr++;
-        if (chunk_size == 0)
-        {
-            // Push another chunk. We will always need at least
-            // another byte for the payload.
-            chunk.start = false;
-            chunk_size = chunk.size = MIN(remaining, max_data_size);
-            if (!msp_telemetry_push_chunk(rb, &chunk))
-            {
-                return -1;
-            }
-        }
-    }
-    // Finally, push the crc
-    if (!ring_buffer_push(rb, &crc))
-    {
-        return -1;
+        chunk.start = false;
     }
     return size;
 }
@@ -304,11 +324,13 @@ void msp_telemetry_init_input(msp_telemetry_t *tr, size_t max_resp_chunk_size)
 bool msp_telemetry_push_request_chunk(msp_telemetry_t *tr, const void *payload, size_t size)
 {
     const msp_telemetry_req_chunk_t *req_chunk = payload;
-    if (req_chunk->version != MSP_TELEMETRY_MSP_VERSION)
+    if (size < 1 || (req_chunk->version != MSP_VERSION_1 && req_chunk->version != MSP_VERSION_2))
     {
         return false;
     }
-    const uint8_t *ptr = payload;
+    // Skip the chunk header
+    const uint8_t *ptr = req_chunk->data;
+    size--;
     if (req_chunk->start)
     {
         if (msp_telemetry_in_use(tr))
@@ -316,19 +338,49 @@ bool msp_telemetry_push_request_chunk(msp_telemetry_t *tr, const void *payload,
             LOG_W(TAG, "Request chunk with request in flight");
             return false;
         }
-        msp_telemetry_blob_t blob;
-        blob.payload_size = req_chunk->data[0];
-        blob.cmd = req_chunk->data[1];
+        msp_telemetry_blob_t blob = {
+            .version = req_chunk->version,
+        };
+        size_t header_size;
+        if (blob.version == MSP_VERSION_1)
+        {
+            header_size = MSP_TELEMETRY_V1_HEADER_SIZE;
+            if (size < header_size)
+            {
+                return false;
+            }
+            blob.payload_size = ptr[0];
+            blob.cmd = ptr[1];
+            // Payload + crc byte
+            tr->size = blob.payload_size + 1;
+        }
+        else
+        {
+            header_size = MSP_TELEMETRY_V2_HEADER_SIZE;
+            if (size < header_size)
+            {
+                return false;
+            }
+            // ptr[0] contains the flags, ignored
+            blob.cmd = ptr[1] | (ptr[2] << 8);
+            blob.payload_size = ptr[3] | (ptr[4] << 8);
+            tr->size = blob.payload_size;
+        }
+        if (blob.payload_size > MSP_MAX_PAYLOAD_SIZE)
+        {
+            LOG_W(TAG, "MSP request too big (%u bytes)", blob.payload_size);
+            return false;
+        }
         if (!msp_telemetry_push_blob(&tr->req, &blob))
         {
             return false;
         }
         tr->req_seq = req_chunk->seq;
-        // Payload size (data[0]) + size byte + cmd byte + crc byte
-        tr->size = blob.payload_size + 3;
-        tr->recv = 2;
-        // Skip size and cmd
-        ptr += 2;
+        tr->version = blob.version;
+        tr->recv = 0;
+        // Skip the MSP header
+        ptr += header_size;
+        size -= header_size;
         tr->in_use_since = time_ticks_now();
     }
     else if (++tr->req_seq != req_chunk->seq)
@@ -338,10 +390,7 @@ bool msp_telemetry_push_request_chunk(msp_telemetry_t *tr, const void *payload,
         return false;
     }
     size_t data_size = MIN(size, tr->size - tr->recv);
-    for (size_t ii = 0; ii < data_size; ii++, ptr++)
-    {
-        ring_buffer_push(&tr->req, ptr);
-    }
+    ring_buffer_push_n(&tr->req, ptr, data_size);
     tr->recv += data_size;
     if (tr->size == tr->recv)
     {
@@ -360,8 +409,7 @@ size_t msp_telemetry_pop_response_chunk(msp_telemetry_t *tr, void *buf)
         msp_telemetry_resp_chunk_t *resp_chunk = buf;
         resp_chunk->seq = tr->resp_seq++;
         resp_chunk->start = chunk.start ? 1 : 0;
-        resp_chunk->error = 0;
-        resp_chunk->reserved1 = 0;
+        resp_chunk->flags = msp_telemetry_resp_flags(chunk.version, false);
         uint8_t *ptr = resp_chunk->data;
         for (int ii = 0; ii < chunk.size; ii++)
         {
@@ -404,9 +452,14 @@ bool msp_telemetry_push_response_chunk(msp_telemetry_t *tr, const void *payload,
 {
 #define Y_N(x) (x ? "Y" : "N")
     msp_telemetry_resp_chunk_t *chunk = (msp_telemetry_resp_chunk_t *)payload;
-    LOG_D(TAG, "MSP transport got chunk %u bytes (error: %s, start: %s)", size, Y_N(chunk->error), Y_N(chunk->start));
+    if (size < 1)
+    {
+        return false;
+    }
+    bool error = msp_telemetry_resp_error(chunk, tr->version);
+    LOG_D(TAG, "MSP transport got chunk %u bytes (error: %s, start: %s)", size, Y_N(error), Y_N(chunk->start));
     LOG_BUFFER_D(TAG, payload, size);
-    if (chunk->error)
+    if (error)
     {
         // TODO: Handle error
         LOG_W(TAG, "MSP reply with error flag");
@@ -415,25 +468,46 @@ bool msp_telemetry_push_response_chunk(msp_telemetry_t *tr, const void *payload,
     }
     // Check start flag and seq number
     const uint8_t *ptr = chunk->data;
+    size--;
     if (chunk->start)
     {
-        tr->resp_seq = chunk->seq;
         msp_telemetry_blob_t blob = {
-            .payload_size = chunk->data[0],
-            .cmd = tr->cmd,
+            .version = tr->version,
         };
+        size_t header_size;
+        if (blob.version == MSP_VERSION_1)
+        {
+            header_size = 1;
+            blob.payload_size = ptr[0];
+            blob.cmd = tr->cmd;
+            // We expect to get the payload plus the CRC
+            tr->size = blob.payload_size + 1;
+        }
+        else
+        {
+            header_size = MSP_TELEMETRY_V2_HEADER_SIZE;
+            // ptr[0] contains the flags, ignored
+            blob.cmd = ptr[1] | (ptr[2] << 8);
+            blob.payload_size = ptr[3] | (ptr[4] << 8);
+            tr->size = blob.payload_size;
+        }
+        if (size < header_size || blob.payload_size > MSP_MAX_PAYLOAD_SIZE)
+        {
+            LOG_W(TAG, "Invalid MSP response start chunk");
+            tr->in_use_since = 0;
+            return false;
+        }
         if (!msp_telemetry_push_blob(&tr->resp, &blob))
         {
             return false;
         }
-        // Grab expected response size. We expect to get the payload, plus the size byte plus the CRC
-        tr->size = blob.payload_size + 1;
+        tr->resp_seq = chunk->seq;
         // Initialize the number of received bytes from the response
         tr->recv = 0;
-        LOG_D(TAG, "Expecting response of size %d", tr->size);
-        // Skip the size byte
-        ptr++;
-        size--;
+        LOG_D(TAG, "Expecting MSPv%u response of size %d", blob.version, tr->size);
+        // Skip the MSP header
+        ptr += header_size;
+        size -= header_size;
     }
     else if (++tr->resp_seq != chunk->seq)
     {
@@ -475,7 +549,7 @@ size_t msp_telemetry_pop_request_chunk(msp_telemetry_t *tr, void *buf)
     msp_telemetry_req_chunk_t *output_chunk = buf;
     output_chunk->seq = tr->req_seq++;
     output_chunk->start = chunk.start;
-    output_chunk->version = MSP_TELEMETRY_MSP_VERSION;
+    output_chunk->version = chunk.version;
     uint8_t *ptr = output_chunk->data;
     for (unsigned ii = 0; ii < chunk.size; ii++, ptr++)
     {
@@ -487,8 +561,17 @@ size_t msp_telemetry_pop_request_chunk(msp_telemetry_t *tr, void *buf)
     if (chunk.start)
     {
         tr->in_use_since = time_ticks_now();
-        // 1st byte is cmd size, 2nd is the cmd itself
-        tr->cmd = output_chunk->data[1];
+        tr->version = chunk.version;
+        if (chunk.version == MSP_VERSION_1)
+        {
+            // 1st byte is cmd size, 2nd is the cmd itself
+            tr->cmd = output_chunk->data[1];
+        }
+        else
+        {
+            // Flags, then cmd in little endian
+            tr->cmd = output_chunk->data[1] | (output_chunk->data[2] << 8);
+        }
     }
     return chunk.size + 1;
 }
\ No newline at end of file
@@ -16,6 +16,8 @@
 // and CRSF. Note that this transport has two possible modes of operation,
 // depending on if it's used for input or output because MSP over telemetry
 // uses different representations for requests and responses.
+// Both MSPv1 and MSPv2 are supported. MSPv2 is used for messages which
+// can't be represented in MSPv1 and for responses to MSPv2 requests.
 typedef struct msp_telemetry_s
 {
     msp_transport_t transport;
@@ -25,12 +27,13 @@ typedef struct msp_telemetry_s
     RING_BUFFER_DECLARE(resp, uint8_t, MSP_TELEMETRY_RESP_QUEUE_SIZE);
     unsigned count;            // number of full requests (input) or responses (output) in the buffer
     size_t max_size;           // max req (input) or resp (output) chunk size asked by the caller
-    uint8_t cmd;               // the cmd being handled. note that 0 is a valid MSP cmd, so we need a flag
+    uint16_t cmd;              // the cmd being handled. note that 0 is a valid MSP cmd, so we need a flag
     time_ticks_t in_use_since; // wether a command is in flight
     unsigned req_seq : 4;      // sequence numbers for requests
     unsigned resp_seq : 4;     // sequence numbers for responses
-    uint8_t size;              // expected size of the MSP request or response - required because of padding
-    uint8_t recv;              // number of bytes already received from the request or response
+    uint8_t version;           // MSP version of the request being handled, responses use the same one
+    uint16_t size;             // expected size of the MSP request or response - required because of padding
+    uint16_t recv;             // number of bytes already received from the request or response
 } msp_telemetry_t;
 
 // INPUT mode
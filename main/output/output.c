@@ -10,6 +10,7 @@
 #include "rc/telemetry.h"
 
 #include "util/macros.h"
+#include "util/trace.h"
 
 #include "output.h"
 
@@ -35,6 +36,7 @@ static void telemetry_updated_callback(void *data, telemetry_downlink_id_e id, t
         telemetry->val = *val;
     }
     data_state_update(&telemetry->data_state, changed, now);
+    rc_data_telemetry_did_set(output->rc_data, id, changed, now);
 }
 
 static void telemetry_calculate_callback(void *data, telemetry_downlink_id_e id)
@@ -136,7 +138,12 @@ static void output_msp_configure_polling(output_t *output)
 
 static void output_msp_callback(msp_conn_t *conn, uint16_t cmd, const void *payload, int size, void *callback_data)
 {
-    // TODO: Stop if size < 0, indicates error
+    if (size < 0)
+    {
+        // Request timed out or couldn't be sent, it will be retried
+        // in the next poll.
+        return;
+    }
     output_t *output = callback_data;
     switch (cmd)
     {
@@ -217,6 +224,11 @@ bool output_open(rc_data_t *data, output_t *output, void *config)
             is_open = output->is_open = output->vtable.open(output, config);
             if (is_open)
             {
+                if (msp_io_is_connected(&output->msp) && !OUTPUT_HAS_FLAG(output, OUTPUT_FLAG_REMOTE))
+                {
+                    msp_cache_init(&output->msp_cache);
+                    msp_conn_set_cache(&output->msp.conn, &output->msp_cache);
+                }
                 settings_add_listener(output_setting_changed, output);
             }
         }
@@ -253,6 +265,7 @@ bool output_update(output_t *output, time_micros_t now)
                 updated = output->vtable.update(output, output->rc_data, now);
                 if (updated)
                 {
+                    TRACE(TRACE_POINT_OUTPUT_FRAME);
                     output->next_update = now + output->min_update_interval;
                 }
                 // Restore the channel data we ovewrote
@@ -278,6 +291,26 @@ bool output_update(output_t *output, time_micros_t now)
     return updated;
 }
 
+time_micros_t output_next_update(output_t *output, time_micros_t now)
+{
+    if (!output || !output->is_open || !output->vtable.update)
+    {
+        return TIME_MICROS_MAX;
+    }
+    time_micros_t next = now + OUTPUT_POLL_INTERVAL;
+    if (output->vtable.next_update)
+    {
+        // output_update() won't call update before output->next_update
+        next = MAX(output->vtable.next_update(output, now), output->next_update + 1);
+        if (msp_io_is_connected(&output->msp) && !OUTPUT_HAS_FLAG(output, OUTPUT_FLAG_REMOTE))
+        {
+            // MSP responses arrive via the serial port
+            next = MIN(next, now + OUTPUT_POLL_INTERVAL);
+        }
+    }
+    return MIN(next, failsafe_next_update(&output->failsafe));
+}
+
 void output_close(output_t *output, void *config)
 {
     if (output && output->is_open && output->vtable.close)
@@ -2,9 +2,11 @@
 
 #include <assert.h>
 #include <stdbool.h>
+#include <sys/types.h>
 
 #include "io/serial.h"
 
+#include "msp/msp_cache.h"
 #include "msp/msp_io.h"
 
 #include "rc/failsafe.h"
@@ -24,8 +26,14 @@ typedef struct output_vtable_s
     bool (*open)(void *output, void *config);
     bool (*update)(void *output, rc_data_t *data, time_micros_t now);
     void (*close)(void *output, void *config);
+    // Optional. Returns the time at which update needs to be called
+    // again, see input_vtable_t.
+    time_micros_t (*next_update)(void *output, time_micros_t now);
 } output_vtable_t;
 
+// Outputs without a next_update function are polled at this interval
+#define OUTPUT_POLL_INTERVAL MILLIS_TO_MICROS(1)
+
 #define OUTPUT_TELEMETRY_UPDATE(output, id, v) ((output_t *)output)->telemetry_updated(output, id, v)
 #define OUTPUT_TELEMETRY_CALCULATE(output, id) ((output_t *)output)->telemetry_calculate(output, id)
 
@@ -132,6 +140,7 @@ typedef struct output_s
     // are supported. See output.c for the available ones.
     telemetry_downlink_f telemetry_calculate;
     msp_io_t msp;
+    msp_cache_t msp_cache; // Used only by outputs connected to an FC
     output_fc_t fc;
     time_micros_t min_update_interval;
     time_micros_t max_update_interval;
@@ -143,4 +152,6 @@ typedef struct output_s
 
 bool output_open(rc_data_t *data, output_t *output, void *config);
 bool output_update(output_t *output, time_micros_t now);
+// Returns the time at which output_update() needs to be called again
+time_micros_t output_next_update(output_t *output, time_micros_t now);
 void output_close(output_t *output, void *config);
@@ -1,6 +1,9 @@
+#include <string.h>
+
 #include <hal/log.h>
 
 #include "air/air.h"
+#include "air/air_channels.h"
 #include "air/air_lora.h"
 
 #include "config/config.h"
@@ -11,6 +14,10 @@
 
 #define CHANNEL_TO_AIR_OUTPUT(ch) RC_CHANNEL_ENCODE_TO_BITS(ch, AIR_CHANNEL_BITS)
 #define MAX_DOWNLINK_LOST_PACKETS 5
+#define FREQ_SUBSTITUTION_RETRY_INTERVAL MILLIS_TO_MICROS(500)
+// MSP over air has a high latency, so allow more requests in flight
+#define MSP_WINDOW MSP_CONN_MAX_WINDOW
+#define MSP_TIMEOUT SECS_TO_MICROS(2)
 
 static const char *TAG = "Output.Air";
 
@@ -19,14 +26,8 @@ static time_micros_t cycle_begin;
 static time_micros_t cycle_end;
 #endif
 
+// The mode controller is updated when the uplink SNR is received
 #define MODE_SWITCH_TELEMETRY_ID TELEMETRY_ID_RX_SNR
-#define MODE_SWITCH_TELEMETRY_TYPE int8_t
-#define MODE_SWITCH_TELEMETRY_GET_VALUE(x) telemetry_get_i8(x, MODE_SWITCH_TELEMETRY_ID)
-// Switch to faster mode if SNR is above 4dBm
-#define MODE_SWITCH_FASTER_VALUE (4 * 4)
-// Switch to a longer mode if the SNR is below 1.5dBm
-#define MODE_SWITCH_LONGER_VALUE (1.5 * 4)
-#define MODE_SWITCH_WAIT_INTERVAL_US MILLIS_TO_MICROS(1000)
 
 static void output_air_lora_callback(lora_t *lora, lora_callback_reason_e reason, void *data)
 {
@@ -46,7 +47,7 @@ static void output_air_lora_callback(lora_t *lora, lora_callback_reason_e reason
         // just get ready for the next send.
         if (output_air->expecting_downlink_packet)
         {
-            lora_set_payload_size(output_air->lora, sizeof(air_rx_packet_t));
+            lora_set_payload_size(output_air->lora, air_rx_packet_size(air_io_uses_fec(&output_air->air, output_air->air_mode)));
             lora_enable_continous_rx(output_air->lora);
         }
         break;
@@ -56,10 +57,10 @@ static void output_air_lora_callback(lora_t *lora, lora_callback_reason_e reason
 static void output_air_update_lora_mode(output_air_t *output_air)
 {
     air_lora_set_parameters(output_air->lora, output_air->air_mode);
+    air_link_stats_set_mode(&output_air->air.link_stats, output_air->air_mode, time_micros_now());
     air_cmd_switch_mode_ack_reset(&output_air->switch_air_mode);
     output_air->requested_air_mode = 0;
-    output_air->start_switch_air_mode_up_at = 0;
-    output_air->start_switch_air_mode_down_at = 0;
+    air_mode_ctrl_reset(&output_air->mode_ctrl);
     output_air->full_cycle_time = air_lora_full_cycle_time(output_air->air_mode);
     output_air->uplink_cycle_time = air_lora_uplink_cycle_time(output_air->air_mode);
     failsafe_set_max_interval(&output_air->output.failsafe, air_lora_tx_failsafe_interval(output_air->air_mode));
@@ -70,8 +71,23 @@ static void output_air_update_frequency(output_air_t *output_air, unsigned freq_
     if (output_air->freq_index != freq_index)
     {
         output_air->freq_index = freq_index;
-        lora_set_frequency(output_air->lora, output_air->freq_table.freqs[freq_index]);
+        air_freq_table_set(&output_air->freq_table, output_air->lora, freq_index);
+    }
+}
+
+// Undoes the frequency substitutions, like the RX does on failsafe.
+// Either end might have been restarted with the base table.
+static void output_air_reset_freq_table(output_air_t *output_air)
+{
+    for (unsigned ii = 0; ii < AIR_NUM_HOPPING_FREQS; ii++)
+    {
+        if (air_freq_table_is_substituted(&output_air->freq_table, ii))
+        {
+            air_freq_stats_reset_slot(&output_air->freq_stats, ii);
+            air_link_stats_reset_freq(&output_air->air.link_stats, ii);
+        }
     }
+    air_freq_table_reset(&output_air->freq_table);
 }
 
 static void output_air_start_switch_air_mode(output_air_t *output_air)
@@ -81,7 +97,48 @@ static void output_air_start_switch_air_mode(output_air_t *output_air)
     air_stream_feed_output_cmd(&output_air->air_stream, cmd, NULL, 0);
 }
 
-static void output_air_reset_ack(output_air_t *output_air, rc_data_t *data)
+static void output_air_request_freq_substitution(output_air_t *output_air, time_micros_t now)
+{
+    air_stream_feed_output_cmd(&output_air->air_stream, AIR_CMD_FREQ_SUBSTITUTE,
+                               &output_air->freq_sub_requested, sizeof(output_air->freq_sub_requested));
+    output_air->freq_sub_requested_at = now;
+}
+
+static void output_air_update_freq_stats(output_air_t *output_air, unsigned slot, bool success, time_micros_t now)
+{
+    air_freq_stats_update(&output_air->freq_stats, slot, success);
+    air_link_stats_update_freq(&output_air->air.link_stats, slot, success);
+    if (!air_io_uses_freq_substitution(&output_air->air) ||
+        air_freq_substitution_ack_in_progress(&output_air->freq_sub_ack) ||
+        air_cmd_switch_mode_ack_in_progress(&output_air->switch_air_mode))
+    {
+        return;
+    }
+    if (output_air->freq_sub_pending)
+    {
+        if (output_air->freq_sub_requested_at + FREQ_SUBSTITUTION_RETRY_INTERVAL < now)
+        {
+            output_air_request_freq_substitution(output_air, now);
+        }
+        return;
+    }
+    int bad_slot = air_freq_stats_bad_slot(&output_air->freq_stats);
+    if (bad_slot >= 0)
+    {
+        int spare = air_freq_table_next_spare(&output_air->freq_table);
+        if (spare >= 0)
+        {
+            LOG_I(TAG, "Requesting substitution of slot %d (%d%% lost) with spare %d",
+                  bad_slot, air_freq_stats_loss_rate(&output_air->freq_stats, bad_slot), spare);
+            output_air->freq_sub_requested.slot = bad_slot;
+            output_air->freq_sub_requested.spare = spare;
+            output_air->freq_sub_pending = true;
+            output_air_request_freq_substitution(output_air, now);
+        }
+    }
+}
+
+static void output_air_reset_ack(output_air_t *output_air, rc_data_t *data, time_micros_t now)
 {
     for (int ii = 0; ii < ARRAY_COUNT(data->channels); ii++)
     {
@@ -90,6 +147,11 @@ static void output_air_reset_ack(output_air_t *output_air, rc_data_t *data)
     for (int ii = 0; ii < ARRAY_COUNT(data->telemetry_uplink); ii++)
     {
         data_state_reset_ack(&data->telemetry_uplink[ii].data_state);
+        // Acknowledged values are not scheduled, add them back
+        if (telemetry_has_value(&data->telemetry_uplink[ii]))
+        {
+            telemetry_sched_add(&output_air->telemetry_sched, ii, now);
+        }
     }
 }
 
@@ -105,13 +167,75 @@ static void output_air_stop_ack(output_air_t *output_air, rc_data_t *data)
     }
 }
 
+// Acknowledges the data sent in the packets from ack_first_seq up to
+// ack_seq, which the RX received without gaps.
+static void output_air_ack_received(output_air_t *output_air, rc_data_t *data, unsigned ack_seq)
+{
+    unsigned last_seq = (output_air->seq + AIR_SEQ_COUNT - 1) % AIR_SEQ_COUNT;
+    unsigned sent = (last_seq - output_air->ack_first_seq + AIR_SEQ_COUNT) % AIR_SEQ_COUNT;
+    unsigned received = (ack_seq - output_air->ack_first_seq + AIR_SEQ_COUNT) % AIR_SEQ_COUNT;
+    if (received > sent)
+    {
+        // Not a seq we sent since the previous downlink packet, so
+        // no packets were received in order.
+        return;
+    }
+    for (unsigned seq = output_air->ack_first_seq, ii = 0; ii <= received; seq = (seq + 1) % AIR_SEQ_COUNT, ii++)
+    {
+        for (int jj = 0; jj < ARRAY_COUNT(data->channels); jj++)
+        {
+            data_state_update_ack_received(&data->channels[jj].data_state, seq);
+        }
+        for (int jj = 0; jj < ARRAY_COUNT(data->telemetry_uplink); jj++)
+        {
+            data_state_update_ack_received(&data->telemetry_uplink[jj].data_state, seq);
+        }
+    }
+}
+
+// Updates the stats for the slots of the uplink packets sent since the
+// previous downlink one, so in modes with uplink only cycles every slot
+// gets samples, not just the ones with a downlink stage. The RX
+// acknowledges them up to the first one it missed. We can't tell
+// which ones after that were lost, except for the last one, since
+// it's the one being answered.
+static void output_air_update_uplink_freq_stats(output_air_t *output_air, unsigned ack_seq, time_micros_t now)
+{
+    unsigned last_seq = (output_air->seq + AIR_SEQ_COUNT - 1) % AIR_SEQ_COUNT;
+    unsigned sent = (last_seq - output_air->ack_first_seq + AIR_SEQ_COUNT) % AIR_SEQ_COUNT;
+    // AIR_SEQ_COUNT - 1 if the first one was lost
+    unsigned received = (ack_seq - output_air->ack_first_seq + AIR_SEQ_COUNT) % AIR_SEQ_COUNT;
+    unsigned gap = (received + 1) % AIR_SEQ_COUNT;
+    if (ack_seq == (last_seq + 1) % AIR_SEQ_COUNT || (received > sent && gap != 0))
+    {
+        // The RX doesn't know where the range starts
+        output_air_update_freq_stats(output_air, last_seq, true, now);
+        return;
+    }
+    for (unsigned seq = output_air->ack_first_seq, ii = 0; ii <= sent; seq = (seq + 1) % AIR_SEQ_COUNT, ii++)
+    {
+        if (ii == sent || (gap != 0 && ii < gap))
+        {
+            output_air_update_freq_stats(output_air, seq, true, now);
+        }
+        else if (ii == gap)
+        {
+            output_air_update_freq_stats(output_air, seq, false, now);
+        }
+    }
+}
+
 static void output_air_lora_start(output_air_t *output_air)
 {
+    air_link_stats_reset(&output_air->air.link_stats);
     output_air_update_lora_mode(output_air);
     lora_set_tx_power(output_air->lora, output_air->tx_power);
     output_air->tx_power = -1;
     lora_set_sync_word(output_air->lora, air_sync_word(output_air->air.pairing.key));
     air_freq_table_init(&output_air->freq_table, output_air->air.pairing.key, air_lora_band_frequency(output_air->band));
+    air_freq_stats_reset(&output_air->freq_stats);
+    output_air->freq_sub_pending = false;
+    air_freq_substitution_ack_reset(&output_air->freq_sub_ack);
     output_air->freq_index = 0xFF;
     output_air_update_frequency(output_air, 0);
     lora_set_callback(output_air->lora, output_air_lora_callback, output_air);
@@ -119,49 +243,34 @@ static void output_air_lora_start(output_air_t *output_air)
     output_air->expecting_downlink_packet = false;
 }
 
+static void output_air_update_air_mode(output_air_t *output_air, time_micros_t now)
+{
+    rc_data_t *data = output_air->output.rc_data;
+    // Use the worst value from uplink (as seen by the RX) and downlink
+    int snr = MIN(TELEMETRY_GET_DOWNLINK_I8(data, TELEMETRY_ID_RX_SNR), lpf_value(&output_air->air.snr));
+    air_mode_ctrl_update(&output_air->mode_ctrl, snr, now);
+    if (air_cmd_switch_mode_ack_in_progress(&output_air->switch_air_mode))
+    {
+        return;
+    }
+    air_lora_mode_e mode = air_mode_ctrl_select(&output_air->mode_ctrl, output_air->air_mode, now);
+    if (mode != output_air->air_mode)
+    {
+        output_air->requested_air_mode = mode;
+        output_air_start_switch_air_mode(output_air);
+    }
+}
+
 static void output_air_stream_telemetry_decoded(void *user, int telemetry_id, const void *data, size_t size, time_micros_t now)
 {
     output_air_t *output_air = user;
     telemetry_t *t = &output_air->output.rc_data->telemetry_downlink[TELEMETRY_DOWNLINK_GET_IDX(telemetry_id)];
-    bool changed = telemetry_set_bytes(t, data, size, now);
+    bool changed = rc_data_telemetry_did_set(output_air->output.rc_data, telemetry_id, telemetry_set_bytes(t, data, size, now), now);
     switch (telemetry_id)
     {
     case MODE_SWITCH_TELEMETRY_ID:
-    {
-        MODE_SWITCH_TELEMETRY_TYPE value = MODE_SWITCH_TELEMETRY_GET_VALUE(t);
-        if (value >= MODE_SWITCH_FASTER_VALUE && output_air->air_mode > output_air->air_mode_fastest &&
-            !air_cmd_switch_mode_ack_in_progress(&output_air->switch_air_mode))
-        {
-            if (output_air->start_switch_air_mode_down_at == 0)
-            {
-                output_air->start_switch_air_mode_down_at = now + MODE_SWITCH_WAIT_INTERVAL_US;
-            }
-            else if (now > output_air->start_switch_air_mode_down_at)
-            {
-                output_air->requested_air_mode = air_lora_mode_faster(output_air->air_mode);
-                output_air_start_switch_air_mode(output_air);
-            }
-        }
-        else if (value <= MODE_SWITCH_LONGER_VALUE && output_air->air_mode < output_air->air_mode_longest &&
-                 !air_cmd_switch_mode_ack_in_progress(&output_air->switch_air_mode))
-        {
-            if (output_air->start_switch_air_mode_up_at == 0)
-            {
-                output_air->start_switch_air_mode_up_at = now + MODE_SWITCH_WAIT_INTERVAL_US;
-            }
-            else if (now > output_air->start_switch_air_mode_up_at)
-            {
-                output_air->requested_air_mode = air_lora_mode_longer(output_air->air_mode);
-                output_air_start_switch_air_mode(output_air);
-            }
-        }
-        else
-        {
-            output_air->start_switch_air_mode_up_at = 0;
-            output_air->start_switch_air_mode_down_at = 0;
-        }
+        output_air_update_air_mode(output_air, now);
         break;
-    }
     case TELEMETRY_ID_CRAFT_NAME:
         if (changed)
         {
@@ -175,6 +284,33 @@ static void output_air_stream_telemetry_decoded(void *user, int telemetry_id, co
     }
 }
 
+static void output_air_telemetry_changed(void *user_data, int telemetry_id, bool changed, time_micros_t now)
+{
+    output_air_t *output_air = user_data;
+    if (TELEMETRY_IS_UPLINK(telemetry_id))
+    {
+        unsigned idx = TELEMETRY_UPLINK_GET_IDX(telemetry_id);
+        if (changed || !data_state_is_ack_received(&output_air->output.rc_data->telemetry_uplink[idx].data_state))
+        {
+            telemetry_sched_value_set(&output_air->telemetry_sched, idx, changed, now);
+        }
+    }
+}
+
+static void output_air_init_telemetry_sched(output_air_t *output_air, rc_data_t *data, time_micros_t now)
+{
+    telemetry_sched_init(&output_air->telemetry_sched, TELEMETRY_UPLINK_COUNT);
+    for (int ii = 0; ii < TELEMETRY_UPLINK_COUNT; ii++)
+    {
+        telemetry_sched_set_class(&output_air->telemetry_sched, ii, telemetry_sched_class_for_id(TELEMETRY_UPLINK_ID(ii)));
+        if (telemetry_has_value(&data->telemetry_uplink[ii]))
+        {
+            telemetry_sched_add(&output_air->telemetry_sched, ii, now);
+        }
+    }
+    rc_data_add_telemetry_listener(data, output_air_telemetry_changed, output_air);
+}
+
 static void output_air_stream_cmd_decoded(void *user, air_cmd_e cmd, const void *data, size_t size, time_micros_t now)
 {
     output_air_t *output_air = user;
@@ -199,8 +335,26 @@ static void output_air_stream_cmd_decoded(void *user, air_cmd_e cmd, const void
     case AIR_CMD_SWITCH_MODE_3:
     case AIR_CMD_SWITCH_MODE_4:
     case AIR_CMD_SWITCH_MODE_5:
+    case AIR_CMD_SWITCH_MODE_6:
+    case AIR_CMD_SWITCH_MODE_7:
+        // Only sent upstream
+        break;
+    case AIR_CMD_FREQ_SUBSTITUTE:
         // Only sent upstream
         break;
+    case AIR_CMD_FREQ_SUBSTITUTE_ACK:
+        if (size == sizeof(air_freq_substitution_ack_t) && output_air->freq_sub_pending)
+        {
+            const air_freq_substitution_ack_t *ack = data;
+            if (ack->sub.slot == output_air->freq_sub_requested.slot && ack->sub.spare == output_air->freq_sub_requested.spare)
+            {
+                memcpy(&output_air->freq_sub_ack, ack, sizeof(*ack));
+                output_air->freq_sub_pending = false;
+                LOG_I(TAG, "Got confirmation for freq substitution in slot %u at seq %u (current seq %u)",
+                      ack->sub.slot, ack->at_tx_seq, output_air->seq);
+            }
+        }
+        break;
     case AIR_CMD_MSP:
     {
         msp_conn_t *conn = msp_io_get_conn(&output_air->output.msp);
@@ -210,20 +364,45 @@ static void output_air_stream_cmd_decoded(void *user, air_cmd_e cmd, const void
         }
         break;
     }
+    case AIR_CMD_MSP_COMPRESSED:
+    {
+        msp_conn_t *conn = msp_io_get_conn(&output_air->output.msp);
+        if (conn)
+        {
+            msp_air_dispatch_compressed(&output_air->msp_air, conn, data, size);
+        }
+        break;
+    }
     case AIR_CMD_RMP:
         rmp_air_decode(&output_air->rmp_air, data, size);
         break;
     }
 }
 
+// Returns the index of the next uplink telemetry value to send or -1
+// if there are none. Acknowledged values are removed from the scheduler
+// until they change again.
+static int output_air_next_uplink_telemetry(output_air_t *output_air, rc_data_t *data)
+{
+    int idx;
+    while ((idx = telemetry_sched_peek(&output_air->telemetry_sched)) >= 0)
+    {
+        telemetry_t *t = &data->telemetry_uplink[idx];
+        if (!telemetry_has_value(t) || data_state_is_ack_received(&t->data_state))
+        {
+            telemetry_sched_remove(&output_air->telemetry_sched, idx);
+            continue;
+        }
+        break;
+    }
+    return idx;
+}
+
 static size_t output_air_feed_stream(output_air_t *output_air, rc_data_t *data, unsigned cur_seq, time_micros_t now, size_t *count)
 {
     control_channel_t *dch = NULL;
     unsigned dchn = 0;
-    telemetry_t *dt = NULL;
-    int dtidx = -1;
     uint32_t max_score = 0;
-    // First, try to fill the buffer with dirty data
     for (int ii = 4; ii < data->channels_num; ii++)
     {
         control_channel_t *ch = &data->channels[ii];
@@ -239,38 +418,34 @@ static size_t output_air_feed_stream(output_air_t *output_air, rc_data_t *data,
             max_score = score;
         }
     }
-    for (int ii = 0; ii < TELEMETRY_UPLINK_COUNT; ii++)
+    int dtidx = output_air_next_uplink_telemetry(output_air, data);
+    // Changed channels have priority, then telemetry that's due and
+    // then we use any spare bandwidth to resend channels.
+    bool send_channel = dch && (data_state_is_dirty(&dch->data_state) || dtidx < 0 ||
+                                telemetry_sched_deadline(&output_air->telemetry_sched, dtidx) > now);
+    if (send_channel)
     {
-        telemetry_t *t = &data->telemetry_uplink[ii];
-        if (!telemetry_has_value(t))
-        {
-            continue;
-        }
-        if (data_state_is_ack_received(&t->data_state))
-        {
-            continue;
-        }
-        uint32_t score = data_state_score(&t->data_state, now);
-        if (score > max_score)
+        size_t n = air_stream_feed_output_channel(&output_air->air_stream, dchn, dch->value);
+        if (n == 0)
         {
-            dch = NULL;
-            dt = t;
-            dtidx = ii;
-            max_score = score;
+            // No space, retry in the next packet
+            return 0;
         }
-    }
-    if (dch)
-    {
-        size_t n = air_stream_feed_output_channel(&output_air->air_stream, dchn, dch->value);
         *count += n;
         data_state_sent(&dch->data_state, AIR_SEQ_TO_SEND_UPLINK(cur_seq, *count), now);
         return n;
     }
-    if (dt)
+    if (dtidx >= 0)
     {
+        telemetry_t *dt = &data->telemetry_uplink[dtidx];
         size_t n = air_stream_feed_output_uplink_telemetry(&output_air->air_stream, dt, TELEMETRY_UPLINK_ID(dtidx));
+        if (n == 0)
+        {
+            return 0;
+        }
         *count += n;
         data_state_sent(&dt->data_state, AIR_SEQ_TO_SEND_UPLINK(cur_seq, *count), now);
+        telemetry_sched_sent(&output_air->telemetry_sched, dtidx, now);
         return n;
     }
     // No data to send
@@ -295,7 +470,8 @@ static void output_air_send_control_packet(output_air_t *output_air, rc_data_t *
 
     if (failsafe_is_active(&output_air->output.failsafe))
     {
-        output_air_reset_ack(output_air, data);
+        output_air_reset_ack(output_air, data, now);
+        air_channels_encoder_reset(&output_air->channels_enc);
 
         (void)TELEMETRY_SET_I8(data, TELEMETRY_ID_RX_RSSI_ANT1, 0, now);
         (void)TELEMETRY_SET_I8(data, TELEMETRY_ID_RX_RSSI_ANT2, 0, now);
@@ -305,6 +481,9 @@ static void output_air_send_control_packet(output_air_t *output_air, rc_data_t *
         // When the RX goes into FS, it switches to longest mode, so
         // eventually both ends will see each other.
         air_cmd_switch_mode_ack_reset(&output_air->switch_air_mode);
+        air_freq_substitution_ack_reset(&output_air->freq_sub_ack);
+        output_air->freq_sub_pending = false;
+        output_air_reset_freq_table(output_air);
         if (output_air->air_mode != output_air->air_mode_longest)
         {
             output_air->air_mode = output_air->air_mode_longest;
@@ -318,12 +497,25 @@ static void output_air_send_control_packet(output_air_t *output_air, rc_data_t *
         LOG_I(TAG, "Switch to mode %d for seq %u", output_air->air_mode, output_air->seq);
         output_air_update_lora_mode(output_air);
     }
+    if (air_freq_substitution_ack_proceed(&output_air->freq_sub_ack, output_air->seq))
+    {
+        air_freq_table_substitute(&output_air->freq_table, output_air->freq_sub_ack.sub.slot, output_air->freq_sub_ack.sub.spare);
+        air_freq_stats_reset_slot(&output_air->freq_stats, output_air->freq_sub_ack.sub.slot);
+        air_link_stats_reset_freq(&output_air->air.link_stats, output_air->freq_sub_ack.sub.slot);
+        air_freq_substitution_ack_reset(&output_air->freq_sub_ack);
+    }
     output_air_update_frequency(output_air, output_air->seq);
     air_io_on_frame(&output_air->air, now);
     if (output_air->expecting_downlink_packet)
     {
         LOG_D(TAG, "Missing or invalid downlink packet");
         output_air_stop_ack(output_air, data);
+        if (!failsafe_is_active(&output_air->output.failsafe))
+        {
+            // Packet was sent in the previous seq
+            unsigned slot = (output_air->seq + AIR_SEQ_COUNT - 1) % AIR_SEQ_COUNT;
+            output_air_update_freq_stats(output_air, slot, false, now);
+        }
     }
     if (air_lora_cycle_is_full(output_air->air_mode, output_air->seq))
     {
@@ -346,16 +538,33 @@ static void output_air_send_control_packet(output_air_t *output_air, rc_data_t *
         return;
     }
     unsigned cur_seq = output_air->seq;
-    air_tx_packet_t pkt = {
-        .seq = output_air->seq++,
-        .ch0 = CHANNEL_TO_AIR_OUTPUT(data->channels[0].value),
-        .ch1 = CHANNEL_TO_AIR_OUTPUT(data->channels[1].value),
-        .ch2 = CHANNEL_TO_AIR_OUTPUT(data->channels[2].value),
-        .ch3 = CHANNEL_TO_AIR_OUTPUT(data->channels[3].value),
-        // We might have no data to send. This leaves the data
-        // stream ready to accept data.
-        .data = {AIR_DATA_START_STOP, AIR_DATA_START_STOP},
+    if (output_air->expecting_downlink_packet)
+    {
+        output_air->ack_first_seq = output_air->ack_next_first_seq;
+        output_air->ack_next_first_seq = (cur_seq + 1) % AIR_SEQ_COUNT;
+    }
+    air_tx_fec_packet_t fec_pkt = {
+        .packet = {
+            .seq = output_air->seq++,
+            // We might have no data to send. This leaves the data
+            // stream ready to accept data.
+            .data = {AIR_DATA_START_STOP, AIR_DATA_START_STOP},
+        },
     };
+    air_tx_packet_t *pkt = &fec_pkt.packet;
+    if (air_io_uses_channel_delta(&output_air->air))
+    {
+        // Encode before feeding the stream, so aux channels sent
+        // in the channel bits are not sent again via the stream.
+        air_channels_encode(&output_air->channels_enc, pkt, data, now);
+    }
+    else
+    {
+        pkt->ch0 = CHANNEL_TO_AIR_OUTPUT(data->channels[0].value);
+        pkt->ch1 = CHANNEL_TO_AIR_OUTPUT(data->channels[1].value);
+        pkt->ch2 = CHANNEL_TO_AIR_OUTPUT(data->channels[2].value);
+        pkt->ch3 = CHANNEL_TO_AIR_OUTPUT(data->channels[3].value);
+    }
     // Check if we need to generate some data for other channels/telemetry
     size_t count = air_stream_output_count(&output_air->air_stream);
     if (output_air->force_stream_feed)
@@ -363,7 +572,7 @@ static void output_air_send_control_packet(output_air_t *output_air, rc_data_t *
         output_air->force_stream_feed = false;
         output_air_feed_stream(output_air, data, cur_seq, now, &count);
     }
-    while (count < sizeof(pkt.data))
+    while (count < sizeof(pkt->data))
     {
         size_t n = output_air_feed_stream(output_air, data, cur_seq, now, &count);
         if (n == 0)
@@ -372,30 +581,29 @@ static void output_air_send_control_packet(output_air_t *output_air, rc_data_t *
             break;
         }
     }
-    int p = 0;
-    uint8_t c;
     // Check if we have buffered data to send
-    while (p < sizeof(pkt.data) && air_stream_pop_output(&output_air->air_stream, &c))
-    {
-        pkt.data[p++] = c;
-    }
-    air_tx_packet_prepare(&pkt, output_air->air.pairing.key);
-    lora_send(output_air->lora, &pkt, sizeof(pkt));
+    air_stream_pop_output_n(&output_air->air_stream, pkt->data, sizeof(pkt->data));
+    size_t size = air_tx_fec_packet_prepare(&fec_pkt, output_air->air.pairing.key, air_io_uses_fec(&output_air->air, output_air->air_mode));
+    lora_send(output_air->lora, &fec_pkt, size);
     //LOG_BUFFER_I("LORAOUT", &pkt, sizeof(pkt));
 }
 
 static void output_air_recv_packet(output_air_t *output_air, rc_data_t *data, time_micros_t now)
 {
-    air_rx_packet_t in_pkt;
+    air_rx_fec_packet_t in_fec_pkt;
+    air_rx_packet_t *in_pkt = &in_fec_pkt.packet;
     int rssi, snr, lq;
 
     output_air->rx_done = false;
-    if (lora_read(output_air->lora, &in_pkt, sizeof(in_pkt)) == sizeof(in_pkt))
+    bool fec = air_io_uses_fec(&output_air->air, output_air->air_mode);
+    size_t size = lora_read(output_air->lora, &in_fec_pkt, air_rx_packet_size(fec));
+    if (size > 0)
     {
-        //LOG_BUFFER_I("LORAIN", &in_pkt, sizeof(in_pkt));
-        if (air_rx_packet_validate(&in_pkt, output_air->air.pairing.key))
+        //LOG_BUFFER_I("LORAIN", &in_fec_pkt, size);
+        if (air_rx_fec_packet_validate(&in_fec_pkt, size, output_air->air.pairing.key, fec))
         {
-            air_stream_feed_input(&output_air->air_stream, in_pkt.seq, in_pkt.data, sizeof(in_pkt.data), now);
+            air_stream_feed_input(&output_air->air_stream, in_pkt->seq, in_pkt->data, sizeof(in_pkt->data), now);
+            output_air_update_uplink_freq_stats(output_air, in_pkt->tx_seq, now);
             rssi = lora_rssi(output_air->lora, &snr, &lq);
             air_io_update_rssi(&output_air->air, rssi, snr, lq, now);
             output_air->consecutive_downlink_lost_packets = 0;
@@ -403,16 +611,7 @@ static void output_air_recv_packet(output_air_t *output_air, rc_data_t *data, ti
             output_air_update_frequency(output_air, output_air->seq);
             failsafe_reset_interval(&output_air->output.failsafe, now);
             output_air->last_downlink_packet_at = now;
-
-            // XXX: This only works when ALL cycles have both uplink and downlink stages
-            for (int ii = 0; ii < ARRAY_COUNT(data->channels); ii++)
-            {
-                data_state_update_ack_received(&data->channels[ii].data_state, in_pkt.tx_seq);
-            }
-            for (int ii = 0; ii < ARRAY_COUNT(data->telemetry_uplink); ii++)
-            {
-                data_state_update_ack_received(&data->telemetry_uplink[ii].data_state, in_pkt.tx_seq);
-            }
+            output_air_ack_received(output_air, data, in_pkt->tx_seq);
         }
         else
         {
@@ -441,14 +640,21 @@ static bool output_air_open(void *output, void *config)
     output_air_config_t *config_air = config;
     output_air->tx_power = config_air->tx_power;
     output_air->seq = 0;
+    output_air->ack_first_seq = 0;
+    output_air->ack_next_first_seq = 0;
     output_air->is_listening = false;
     output_air->force_stream_feed = false;
+    air_channels_encoder_reset(&output_air->channels_enc);
+    output_air_init_telemetry_sched(output_air, output_air->output.rc_data, time_micros_now());
     output_air->air_mode = output_air->air_mode_longest;
+    air_mode_ctrl_init(&output_air->mode_ctrl, output_air->air_mode_fastest, output_air->air_mode_longest);
     output_air_lora_start(output_air);
     air_stream_init(&output_air->air_stream, NULL,
                     output_air_stream_telemetry_decoded, output_air_stream_cmd_decoded, output);
     msp_air_init(&output_air->msp_air, &output_air->air_stream, output_air_msp_before_feed, output_air);
+    msp_air_set_compression(&output_air->msp_air, air_io_uses_msp_compression(&output_air->air));
     OUTPUT_SET_MSP_TRANSPORT(output_air, MSP_TRANSPORT(&output_air->msp_air));
+    msp_conn_set_window(OUTPUT_MSP_CONN_GET(output_air), MSP_WINDOW, MSP_TIMEOUT);
     return true;
 }
 
@@ -456,6 +662,7 @@ static bool output_air_update(void *output, rc_data_t *data, time_micros_t now)
 {
     output_air_t *output_air = output;
 
+    air_link_stats_update(&output_air->air.link_stats, now);
     if (output_air->rx_done)
     {
         output_air_recv_packet(output_air, data, now);
@@ -471,10 +678,21 @@ static bool output_air_update(void *output, rc_data_t *data, time_micros_t now)
     return true;
 }
 
+static time_micros_t output_air_next_update(void *output, time_micros_t now)
+{
+    output_air_t *output_air = output;
+    if (output_air->rx_done)
+    {
+        return now;
+    }
+    return output_air->next_packet + 1;
+}
+
 static void output_air_close(void *output, void *config)
 {
     LOG_I(TAG, "Close");
     output_air_t *output_air = output;
+    rc_data_remove_telemetry_listener(output_air->output.rc_data, output_air_telemetry_changed, output_air);
     lora_set_callback(output_air->lora, NULL, NULL);
     lora_sleep(output_air->lora);
 }
@@ -484,13 +702,12 @@ void output_air_init(output_air_t *output, air_addr_t addr, lora_t *lora, air_lo
     output->lora = lora;
     output->band = band;
     output->requested_air_mode = 0;
-    output->start_switch_air_mode_up_at = 0;
-    output->start_switch_air_mode_down_at = 0;
     output->output.flags = OUTPUT_FLAG_REMOTE;
     output->output.vtable = (output_vtable_t){
         .open = output_air_open,
         .update = output_air_update,
         .close = output_air_close,
+        .next_update = output_air_next_update,
     };
     rmp_air_init(&output->rmp_air, rmp, &addr, &output->air_stream);
     air_io_init(&output->air, addr, NULL, &output->rmp_air);
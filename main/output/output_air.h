@@ -1,13 +1,17 @@
 #pragma once
 
+#include "air/air_channels.h"
 #include "air/air_cmd.h"
 #include "air/air_io.h"
 #include "air/air_freq.h"
 #include "air/air_lora.h"
+#include "air/air_mode_ctrl.h"
 #include "air/air_stream.h"
 
 #include "output/output.h"
 
+#include "rc/telemetry_sched.h"
+
 #include "rmp/rmp_air.h"
 
 #include "util/time.h"
@@ -29,8 +33,7 @@ typedef struct output_air_s
     air_lora_mode_e air_mode_fastest;
     air_lora_mode_e air_mode_longest;
     air_lora_mode_e requested_air_mode;
-    time_micros_t start_switch_air_mode_up_at;
-    time_micros_t start_switch_air_mode_down_at;
+    air_mode_ctrl_t mode_ctrl;
     air_cmd_switch_mode_ack_t switch_air_mode;
     bool is_listening;
     bool force_stream_feed;
@@ -42,9 +45,21 @@ typedef struct output_air_s
     time_micros_t next_packet;
     bool rx_done;
     unsigned seq : AIR_SEQ_BITS;
+    // Range of seqs acknowledged by the downlink packet we're waiting
+    // for, starting after the previous cycle with a downlink stage. See
+    // input_air_t.ack_seq.
+    unsigned ack_first_seq : AIR_SEQ_BITS;
+    unsigned ack_next_first_seq : AIR_SEQ_BITS;
     unsigned freq_index;
     air_freq_table_t freq_table;
+    air_freq_stats_t freq_stats; // Round trip, a downlink packet means the uplink one was received
+    air_freq_substitution_t freq_sub_requested;
+    bool freq_sub_pending;
+    time_micros_t freq_sub_requested_at;
+    air_freq_substitution_ack_t freq_sub_ack;
     air_stream_t air_stream;
+    air_channels_encoder_t channels_enc;
+    telemetry_sched_t telemetry_sched; // Uplink telemetry
     bool expecting_downlink_packet;
     unsigned consecutive_downlink_lost_packets;
     int tx_power;
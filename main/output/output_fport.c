@@ -46,12 +46,6 @@ typedef struct fport_control_data_s
     uint8_t rssi;
 } PACKED fport_control_data_t;
 
-static void output_fport_serial_byte_callback(const serial_port_t *port, uint8_t c, void *user_data)
-{
-    output_fport_t *output_fport = user_data;
-    output_fport->buf[output_fport->buf_pos++] = c;
-}
-
 static uint8_t fport_checksum_from_sum(uint16_t sum)
 {
     return FPORT_CRC_VALUE - ((sum & 0xff) + (sum >> 8));
@@ -130,8 +124,6 @@ static bool output_fport_open(void *output, void *config)
         .parity = SERIAL_PARITY_DISABLE,
         .stop_bits = SERIAL_STOP_BITS_1,
         .inverted = cfg->inverted,
-        .byte_callback = output_fport_serial_byte_callback,
-        .byte_callback_data = output_fport,
     };
 
     output_fport->output.serial_port = serial_port_open(&port_config);
@@ -152,13 +144,7 @@ static void output_fport_receive(output_fport_t *output_fport)
 {
     // Read potential telemetry response
     int n = 0;
-    if (output_fport->buf_pos == 0)
-    {
-        // We're in half duplex mode (or we're talking to a faulty end).
-        // Read from the serial buffer, it won't hurt if we are in half
-        // duplex mode since serial_port_read() will just return zero.
-        output_fport->buf_pos = serial_port_read(output_fport->output.serial_port, output_fport->buf, sizeof(output_fport->buf), 0);
-    }
+    output_fport->buf_pos = serial_port_read(output_fport->output.serial_port, output_fport->buf, sizeof(output_fport->buf), 0);
     while (n < output_fport->buf_pos)
     {
         // First byte is size without counting length an CRC
@@ -133,6 +133,10 @@ typedef struct msp_misc_s
 
 static void output_msp_message_callback(msp_conn_t *conn, uint16_t cmd, const void *payload, int size, void *arg)
 {
+    if (size < 0)
+    {
+        return;
+    }
     switch (cmd)
     {
     case MSP_RAW_GPS:
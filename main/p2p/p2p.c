@@ -1,4 +1,5 @@
 
+#include <stdint.h>
 #include <string.h>
 
 #include <hal/log.h>
@@ -16,13 +17,16 @@ typedef struct p2p_rmp_hdr_s
     air_addr_t dst;
     uint8_t dst_port;
     uint8_t payload_size;
-    uint8_t has_signature;
+    uint8_t has_signature; // 0 if not signed, rmp_signature_version_e otherwise
 } PACKED p2p_rmp_hdr_t;
 
+// Limited by p2p_rmp_hdr_t.payload_size
+#define P2P_RMP_MAX_PAYLOAD_SIZE UINT8_MAX
+
 typedef struct p2p_rmp_msg_s
 {
     p2p_rmp_hdr_t hdr;
-    uint8_t payload[256];
+    uint8_t payload[P2P_RMP_MAX_PAYLOAD_SIZE + RMP_SIGNATURE_SIZE];
 } PACKED p2p_rmp_msg_t;
 
 static bool p2p_decode_rmp(rmp_msg_t *msg, const void *data, size_t size)
@@ -45,6 +49,7 @@ static bool p2p_decode_rmp(rmp_msg_t *msg, const void *data, size_t size)
         msg->dst_port = hdr->dst_port;
         msg->payload_size = hdr->payload_size;
         msg->has_signature = hdr->has_signature ? true : false;
+        msg->signature_version = hdr->has_signature;
         const uint8_t *ptr = ((const uint8_t *)data) + sizeof(*hdr);
         if (hdr->payload_size > 0)
         {
@@ -68,9 +73,10 @@ static bool p2p_decode_rmp(rmp_msg_t *msg, const void *data, size_t size)
 static int p2p_encode_rmp(rmp_msg_t *msg, void *data, size_t size)
 {
     size_t encoded_size = sizeof(p2p_rmp_hdr_t);
-    if (size < encoded_size)
+    size_t required_size = encoded_size + msg->payload_size + (msg->has_signature ? RMP_SIGNATURE_SIZE : 0);
+    if (msg->payload_size > P2P_RMP_MAX_PAYLOAD_SIZE || size < required_size)
     {
-        LOG_E(TAG, "Could not encode p2p message of %d bytes in buffer of size %d", (int)encoded_size, (int)size);
+        LOG_E(TAG, "Could not encode p2p message of %d bytes in buffer of size %d", (int)required_size, (int)size);
         return -1;
     }
     p2p_rmp_hdr_t *hdr = data;
@@ -79,7 +85,7 @@ static int p2p_encode_rmp(rmp_msg_t *msg, void *data, size_t size)
     hdr->dst = msg->dst;
     hdr->dst_port = msg->dst_port;
     hdr->payload_size = msg->payload_size;
-    hdr->has_signature = msg->has_signature ? 1 : 0;
+    hdr->has_signature = msg->has_signature ? msg->signature_version : 0;
     uint8_t *ptr = data;
     ptr += sizeof(*hdr);
     if (msg->payload)
@@ -134,7 +140,7 @@ void p2p_init(p2p_t *p2p, rmp_t *rmp)
     memset(p2p, 0, sizeof(*p2p));
     p2p->internal.rmp = rmp;
     p2p_hal_init(&p2p->internal.hal, p2p_hal_callback, p2p);
-    rmp_set_transport(rmp, RMP_TRANSPORT_P2P, p2p_rmp_send, p2p);
+    rmp_set_transport(rmp, RMP_TRANSPORT_P2P, p2p_rmp_send, P2P_RMP_MAX_PAYLOAD_SIZE, p2p);
 }
 
 void p2p_start(p2p_t *p2p)
@@ -61,6 +61,8 @@ void crsf_port_init(crsf_port_t *port, io_t *io, crsf_frame_f frame_callback, vo
     port->frame_callback = frame_callback;
     port->callback_data = callback_data;
     port->buf_pos = 0;
+    port->crc = 0;
+    port->sync_addr = -1;
 }
 
 int crsf_port_write(crsf_port_t *port, crsf_frame_t *frame)
@@ -73,60 +75,75 @@ int crsf_port_write(crsf_port_t *port, crsf_frame_t *frame)
 
 bool crsf_port_read(crsf_port_t *port)
 {
-    int rem = sizeof(port->buf) - port->buf_pos;
-    int n = io_read(&port->io, &port->buf[port->buf_pos], rem, 0);
+    uint8_t buf[CRSF_FRAME_SIZE_MAX];
+    int n = io_read(&port->io, buf, sizeof(buf), 0);
     if (n <= 0)
     {
         return false;
     }
-    port->buf_pos += n;
-    return crsf_port_decode(port);
+    return crsf_port_feed(port, buf, n);
 }
 
-bool crsf_port_decode(crsf_port_t *port)
+bool crsf_port_feed(crsf_port_t *port, const void *data, size_t size)
 {
-    int start = 0;
-    int end = port->buf_pos;
+    const uint8_t *ptr = data;
+    const uint8_t *end = ptr + size;
     bool found = false;
-    while (end - start >= 2)
+    while (ptr < end)
     {
-        size_t frame_length = port->buf[start + 1];
-        size_t total_frame_size = frame_length + CRSF_FRAME_NOT_COUNTED_BYTES;
-        if (end - start < total_frame_size)
+        if (port->buf_pos == 0)
         {
-            // No more complete frames to decode
-            break;
+            if (port->sync_addr >= 0)
+            {
+                const uint8_t *start = memchr(ptr, port->sync_addr, end - ptr);
+                if (!start)
+                {
+                    break;
+                }
+                ptr = start;
+            }
+            port->buf[port->buf_pos++] = *ptr++;
+            continue;
         }
-        //LOG_I(TAG, "Got frame of size %u", total_frame_size);
-        // We have a complete frame. Check checksum
-        crsf_frame_t *frame = (crsf_frame_t *)&port->buf[start];
-        uint8_t received_crc = port->buf[start + total_frame_size - 1];
-        uint8_t expected_crc = crsf_frame_crc(frame);
-        if (received_crc == expected_crc)
+        if (port->buf_pos == 1)
         {
-            found = true;
-            port->frame_callback(port->callback_data, frame);
+            uint8_t frame_size = *ptr++;
+            if (frame_size < CRSF_FRAME_SIZE(0) || frame_size > CRSF_FRAME_SIZE_MAX - CRSF_FRAME_NOT_COUNTED_BYTES)
+            {
+                // Can't be a valid frame, look for the next start
+                port->buf_pos = 0;
+                continue;
+            }
+            port->buf[port->buf_pos++] = frame_size;
+            port->crc = 0;
+            continue;
         }
-        else
+        unsigned total_frame_size = port->buf[1] + CRSF_FRAME_NOT_COUNTED_BYTES;
+        unsigned n = MIN((unsigned)(end - ptr), total_frame_size - port->buf_pos);
+        memcpy(&port->buf[port->buf_pos], ptr, n);
+        // CRC covers everything after the size, except the CRC itself
+        unsigned crc_size = MIN(n, total_frame_size - 1 - port->buf_pos);
+        port->crc = crc8_dvb_s2_bytes_from(port->crc, ptr, crc_size);
+        port->buf_pos += n;
+        ptr += n;
+        if (port->buf_pos == total_frame_size)
         {
-            LOG_W(TAG, "CRC error in frame with size %d: expected 0x%02x but got 0x%02x", total_frame_size, expected_crc, received_crc);
-            LOG_BUFFER_W(TAG, frame, total_frame_size);
+            crsf_frame_t *frame = (crsf_frame_t *)port->buf;
+            uint8_t received_crc = port->buf[total_frame_size - 1];
+            // Frame is complete, so the next byte starts a new one. Do this
+            // before calling the callback, since it might reset the port.
+            port->buf_pos = 0;
+            if (received_crc == port->crc)
+            {
+                found = true;
+                port->frame_callback(port->callback_data, frame);
+            }
+            else
+            {
+                LOG_W(TAG, "CRC error in frame with size %u: expected 0x%02x but got 0x%02x", total_frame_size, port->crc, received_crc);
+                LOG_BUFFER_W(TAG, frame, total_frame_size);
+            }
         }
-        start += total_frame_size;
-    }
-    if (start > 0)
-    {
-        if (start > port->buf_pos)
-        {
-            LOG_E(TAG, "Error %d > %d", start, (int)port->buf_pos);
-        }
-        assert(start <= port->buf_pos);
-        if (start != port->buf_pos)
-        {
-            // Move remaining data to the front
-            memmove(port->buf, &port->buf[start], end - start);
-        }
-        port->buf_pos -= start;
     }
     return found;
 }
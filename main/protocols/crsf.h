@@ -1,6 +1,7 @@
 #pragma once
 
 #include <stdbool.h>
+#include <stddef.h>
 #include <stdint.h>
 
 #include "io/io.h"
@@ -309,37 +310,46 @@ inline unsigned channel_to_crsf_value(unsigned val) { return val; }
 
 typedef void (*crsf_frame_f)(void *data, crsf_frame_t *frame);
 
+// Frames are decoded incrementally as bytes are fed, so each byte is
+// copied once into buf (at its final position) and the CRC is
+// updated as the payload arrives.
 typedef struct crsf_port_s
 {
     io_t io;
     crsf_frame_f frame_callback;
     void *callback_data;
     uint8_t buf[CRSF_FRAME_SIZE_MAX];
-    unsigned buf_pos;
+    unsigned buf_pos; // 0 while waiting for a frame start
+    uint8_t crc;      // CRC of buf[2:buf_pos], excluding the CRC byte
+    int sync_addr;
 } crsf_port_t;
 
 void crsf_port_init(crsf_port_t *port, io_t *io, crsf_frame_f frame_callback, void *callback_data);
 int crsf_port_write(crsf_port_t *port, crsf_frame_t *frame);
+// Reads available data from the io_t and decodes it. Returns true
+// iff at least one valid frame was decoded.
 bool crsf_port_read(crsf_port_t *port);
-
-inline bool crsf_port_push(crsf_port_t *port, uint8_t c)
+// Decodes the given data, calling the frame callback for each valid
+// frame as soon as its last byte is fed. Partial frames are kept
+// until the next call. Returns true iff at least one valid frame was
+// decoded.
+bool crsf_port_feed(crsf_port_t *port, const void *data, size_t size);
+
+// If addr is >= 0, bytes are discarded until one matching addr is
+// found when waiting for a frame start, which helps resynchronizing
+// after errors. Defaults to -1.
+inline void crsf_port_set_sync_addr(crsf_port_t *port, int addr)
 {
-    if (port->buf_pos < sizeof(port->buf))
-    {
-        port->buf[port->buf_pos++] = c;
-        return true;
-    }
-    return false;
+    port->sync_addr = addr;
 }
 
-bool crsf_port_decode(crsf_port_t *port);
-
 inline bool crsf_port_has_buffered_data(crsf_port_t *port)
 {
-    return port->buf_pos > 0 && port->buf_pos < sizeof(port->buf);
+    return port->buf_pos > 0;
 }
 
+// Discards any partially decoded frame
 inline void crsf_port_reset(crsf_port_t *port)
 {
     port->buf_pos = 0;
-}
\ No newline at end of file
+}
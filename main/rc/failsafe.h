@@ -28,3 +28,15 @@ inline bool failsafe_is_active(const failsafe_t *fs)
 {
     return fs && fs->active_since > 0;
 }
+
+// Returns the time at which failsafe_update() would activate the
+// failsafe if it's not reset before, or TIME_MICROS_MAX if it's
+// already active or has no interval.
+inline time_micros_t failsafe_next_update(const failsafe_t *fs)
+{
+    if (failsafe_is_active(fs) || fs->enable_at == TIME_MICROS_MAX)
+    {
+        return TIME_MICROS_MAX;
+    }
+    return fs->enable_at + 1;
+}
@@ -34,6 +34,13 @@ typedef struct rc_rmp_msp_s
     uint8_t payload[512];
 } PACKED rc_rmp_msp_t;
 
+typedef struct rc_rmp_msp_cache_stats_s
+{
+    uint8_t code; // AIR_LINK_STATS_RMP_MSP_CACHE_READ
+    uint8_t reserved[3];
+    msp_cache_stats_t stats;
+} PACKED rc_rmp_msp_cache_stats_t;
+
 // Initialize local telemetry values
 static void rc_data_initialize(rc_t *rc)
 {
@@ -341,6 +348,8 @@ static void rc_update_binding(rc_t *rc)
         }
         LOG_I(TAG, "Bind done");
         air_bind_packet_get_pairing(&packet, &pairing);
+        // Store peer information first, air_io_bind() reads it
+        config_set_air_info(&pairing.addr, &packet.info);
         air_io_bind(air_io, &pairing);
         switch (config_get_rc_mode())
         {
@@ -351,9 +360,6 @@ static void rc_update_binding(rc_t *rc)
             config_set_paired_tx(&pairing);
             break;
         }
-        // Store peer information
-        config_set_air_info(&pairing.addr, &packet.info);
-
         // Ignore the current pairing alternatives, to avoid
         // popping a dialog just after pairing a new RX while
         // another one is still powered.
@@ -469,6 +475,12 @@ static void rc_rmp_msp_request_response_handler(msp_conn_t *conn, uint16_t cmd,
     // Note that this callback will run on core 1, while RMP runs
     // on core 0, so we need some synchronization. TODO: Locking
     rc_rmp_resp_ctx_t *ctx = callback_data;
+    if (size < 0)
+    {
+        // No response from the FC, the requester will time out
+        rc_rmp_free_resp_ctx(ctx);
+        return;
+    }
     rc_rmp_msp_t resp = {
         .cmd = cmd,
         .payload_size = size,
@@ -505,8 +517,8 @@ static void rc_rmp_msp_request_handler(rmp_t *rmp, rmp_req_t *req, void *user_da
         ctx->rc = rc;
         air_addr_cpy(&ctx->dst, &req->msg->src);
         ctx->dst_port = req->msg->src_port;
-        msp_conn_send(request_output, msp_req->cmd, msp_req->payload, msp_req->payload_size,
-                      rc_rmp_msp_request_response_handler, ctx);
+        msp_conn_send_cached(request_output, msp_req->cmd, msp_req->payload, msp_req->payload_size,
+                             rc_rmp_msp_request_response_handler, ctx);
     }
 }
 
@@ -562,7 +574,7 @@ static void rc_msp_response_callback(msp_conn_t *conn, uint16_t cmd, const void
     // function is only called when we forward the request via MSP-to-MSP.
     // See rc_rmp_msp_request_handler() and rc_rmp_msp_response_handler().
     msp_conn_t *reply_output = callback_data;
-    if (reply_output)
+    if (reply_output && size >= 0)
     {
         msp_conn_write(reply_output, MSP_DIRECTION_FROM_MWC, cmd, payload, size);
     }
@@ -601,7 +613,7 @@ static void rc_msp_request_callback(msp_conn_t *conn, uint16_t cmd, const void *
     {
         // Send the conn argument as the callback data so the response is routed back
         // to the sender.
-        msp_conn_send(request_output, cmd, payload, size, rc_msp_response_callback, conn);
+        msp_conn_send_cached(request_output, cmd, payload, size, rc_msp_response_callback, conn);
     }
 }
 
@@ -732,6 +744,62 @@ static inline bool rc_should_update_output(rc_t *rc)
     return true;
 }
 
+static void rc_rmp_link_stats_handler(rmp_t *rmp, rmp_req_t *req, void *user_data)
+{
+    // Note that this runs on core 0 while the stats are updated from
+    // core 1, so the response might mix samples from 2 cycles. Resets
+    // are applied by the RC task, see air_link_stats_request_clear().
+    if (!req->msg->payload || req->msg->payload_size != 1)
+    {
+        return;
+    }
+    rc_t *rc = user_data;
+    air_io_t *air_io = rc_get_air_io(rc);
+    const uint8_t *code = req->msg->payload;
+    switch ((air_link_stats_rmp_code_e)*code)
+    {
+    case AIR_LINK_STATS_RMP_RESET_REQ:
+        if (!air_io || !req->is_authenticated)
+        {
+            break;
+        }
+        air_link_stats_request_clear(&air_io->link_stats);
+        // Fallthrough
+    case AIR_LINK_STATS_RMP_READ_REQ:
+    {
+        if (!air_io)
+        {
+            break;
+        }
+        air_link_stats_rmp_msg_t resp = {
+            .code = AIR_LINK_STATS_RMP_READ,
+        };
+        air_link_stats_get(&air_io->link_stats, &resp.data, time_micros_now());
+        req->resp(req->resp_data, &resp, sizeof(resp));
+        break;
+    }
+    case AIR_LINK_STATS_RMP_MSP_CACHE_READ_REQ:
+    {
+        // Only the RX has a cache, since the TX output is remote
+        msp_conn_t *conn = rc->output ? msp_io_get_conn(&rc->output->msp) : NULL;
+        if (!conn || !conn->cache)
+        {
+            break;
+        }
+        rc_rmp_msp_cache_stats_t resp = {
+            .code = AIR_LINK_STATS_RMP_MSP_CACHE_READ,
+        };
+        msp_cache_get_stats(conn->cache, &resp.stats);
+        req->resp(req->resp_data, &resp, sizeof(resp));
+        break;
+    }
+    // Responses, not handled here
+    case AIR_LINK_STATS_RMP_READ:
+    case AIR_LINK_STATS_RMP_MSP_CACHE_READ:
+        break;
+    }
+}
+
 void rc_init(rc_t *rc, lora_t *lora, rmp_t *rmp)
 {
     memset(rc, 0, sizeof(*rc));
@@ -761,7 +829,9 @@ void rc_init(rc_t *rc, lora_t *lora, rmp_t *rmp)
 
     settings_add_listener(rc_setting_changed, rc);
     rc->state.msp_recv_port = rmp_open_port(rmp, RMP_PORT_MSP, rc_rmp_msp_request_handler, rc);
-    rmp_set_transport(rmp, RMP_TRANSPORT_RC, rc_send_rmp, rc);
+    rmp_open_port(rmp, RMP_PORT_LINK_STATS, rc_rmp_link_stats_handler, rc);
+    rmp_set_transport(rmp, RMP_TRANSPORT_RC, rc_send_rmp, RMP_AIR_MAX_PAYLOAD_SIZE, rc);
+    rmp_set_transport_fragments(rmp, RMP_TRANSPORT_RC, RMP_AIR_MAX_FRAGMENT_SIZE, RMP_AIR_FRAGMENT_WINDOW);
 
     if (rc_should_autostart_bind(rc))
     {
@@ -888,6 +958,17 @@ unsigned rc_get_update_frequency(rc_t *rc)
     return io ? air_io_get_update_frequency(io) : 0;
 }
 
+bool rc_get_link_stats(rc_t *rc, air_link_stats_data_t *data)
+{
+    air_io_t *io = rc_get_air_io(rc);
+    if (io)
+    {
+        air_link_stats_get(&io->link_stats, data, time_micros_now());
+        return true;
+    }
+    return false;
+}
+
 const char *rc_get_pilot_name(rc_t *rc)
 {
     return rc_data_get_pilot_name(&rc->data);
@@ -1028,6 +1109,16 @@ void rc_invalidate_output(rc_t *rc)
     rc->state.invalidate_output = true;
 }
 
+time_micros_t rc_next_update(rc_t *rc, time_micros_t now)
+{
+    if (rc->state.invalidate_input || rc->state.invalidate_output ||
+        rc->state.bind_requested != rc->state.bind_active || rc->state.tx_rf_power >= 0)
+    {
+        return now;
+    }
+    return MIN(input_next_update(rc->input, now), output_next_update(rc->output, now));
+}
+
 void rc_update(rc_t *rc)
 {
     if (UNLIKELY(rc->state.invalidate_input))
@@ -96,6 +96,8 @@ int rc_get_rssi_db(rc_t *rc);
 int rc_get_rssi_percentage(rc_t *rc);
 float rc_get_snr(rc_t *rc);
 unsigned rc_get_update_frequency(rc_t *rc);
+// Returns the statistics for the air link. See air_link_stats_data_t.
+bool rc_get_link_stats(rc_t *rc, air_link_stats_data_t *data);
 
 const char *rc_get_pilot_name(rc_t *rc);
 const char *rc_get_craft_name(rc_t *rc);
@@ -112,4 +114,9 @@ void rc_dismiss_alternative_pairings(rc_t *rc);
 void rc_invalidate_input(rc_t *rc);
 void rc_invalidate_output(rc_t *rc);
 
-void rc_update(rc_t *rc);
\ No newline at end of file
+void rc_update(rc_t *rc);
+// Returns the time at which rc_update() needs to be called again,
+// assuming it also gets called after LoRa interrupts (see
+// lora_set_notify_task()). Changes requested from other tasks
+// (e.g. rc_invalidate_input()) might wait until then.
+time_micros_t rc_next_update(rc_t *rc, time_micros_t now);
\ No newline at end of file
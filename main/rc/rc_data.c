@@ -114,6 +114,44 @@ telemetry_t *rc_data_get_telemetry(rc_data_t *data, int telemetry_id)
     return &data->telemetry_downlink[TELEMETRY_DOWNLINK_GET_IDX(telemetry_id)];
 }
 
+void rc_data_add_telemetry_listener(rc_data_t *data, rc_data_telemetry_changed_f callback, void *user_data)
+{
+    rc_data_telemetry_listener_t *free_listener = NULL;
+    for (int ii = 0; ii < ARRAY_COUNT(data->telemetry_listeners); ii++)
+    {
+        rc_data_telemetry_listener_t *listener = &data->telemetry_listeners[ii];
+        if (listener->callback == callback && listener->user_data == user_data)
+        {
+            // Already registered, e.g. reopened without being closed
+            return;
+        }
+        if (!listener->callback && !free_listener)
+        {
+            free_listener = listener;
+        }
+    }
+    if (!free_listener)
+    {
+        // Must increase RC_DATA_TELEMETRY_LISTENERS_MAX
+        UNREACHABLE();
+        return;
+    }
+    free_listener->callback = callback;
+    free_listener->user_data = user_data;
+}
+
+void rc_data_remove_telemetry_listener(rc_data_t *data, rc_data_telemetry_changed_f callback, void *user_data)
+{
+    for (int ii = 0; ii < ARRAY_COUNT(data->telemetry_listeners); ii++)
+    {
+        if (data->telemetry_listeners[ii].callback == callback && data->telemetry_listeners[ii].user_data == user_data)
+        {
+            data->telemetry_listeners[ii].callback = NULL;
+            data->telemetry_listeners[ii].user_data = NULL;
+        }
+    }
+}
+
 const char *rc_data_get_pilot_name(const rc_data_t *data)
 {
     const telemetry_t *val = &data->telemetry_uplink[TELEMETRY_UPLINK_GET_IDX(TELEMETRY_ID_PILOT_NAME)];
@@ -57,6 +57,19 @@ typedef struct control_channel_s
 
 typedef struct rmp_s rmp_t;
 
+#define RC_DATA_TELEMETRY_LISTENERS_MAX 4
+
+// Called every time a telemetry value is set, with changed indicating wether
+// the value was changed. Used by telemetry senders to schedule the values
+// without scanning all of them.
+typedef void (*rc_data_telemetry_changed_f)(void *user_data, int telemetry_id, bool changed, time_micros_t now);
+
+typedef struct rc_data_telemetry_listener_s
+{
+    rc_data_telemetry_changed_f callback;
+    void *user_data;
+} rc_data_telemetry_listener_t;
+
 typedef struct rc_data_s
 {
     control_channel_t channels[RC_CHANNELS_NUM];
@@ -76,6 +89,7 @@ typedef struct rc_data_s
     } failsafe;
     telemetry_t telemetry_uplink[TELEMETRY_UPLINK_COUNT];
     telemetry_t telemetry_downlink[TELEMETRY_DOWNLINK_COUNT];
+    rc_data_telemetry_listener_t telemetry_listeners[RC_DATA_TELEMETRY_LISTENERS_MAX];
     // Provided here so inputs and outputs can both use
     // RMP messages.
     rmp_t *rmp;
@@ -134,6 +148,29 @@ inline bool rc_data_is_ready(rc_data_t *data)
 unsigned rc_data_get_channel_percentage(const rc_data_t *data, unsigned ch);
 telemetry_t *rc_data_get_telemetry(rc_data_t *data, int telemetry_id);
 
+// Listeners are called from the task setting the telemetry values, which
+// is always the RC task. Thus, they must also be added and removed from it
+// (i.e. from the open() and close() functions of inputs and outputs).
+// Adding a listener which is already registered is a no-op, so an input
+// or output reopened without being closed doesn't take another slot.
+void rc_data_add_telemetry_listener(rc_data_t *data, rc_data_telemetry_changed_f callback, void *user_data);
+void rc_data_remove_telemetry_listener(rc_data_t *data, rc_data_telemetry_changed_f callback, void *user_data);
+
+// Must be called after setting a telemetry value, with changed
+// indicating wether the value was changed. Returns changed.
+inline bool rc_data_telemetry_did_set(rc_data_t *data, int telemetry_id, bool changed, time_micros_t now)
+{
+    for (int ii = 0; ii < RC_DATA_TELEMETRY_LISTENERS_MAX; ii++)
+    {
+        rc_data_telemetry_listener_t *listener = &data->telemetry_listeners[ii];
+        if (listener->callback)
+        {
+            listener->callback(listener->user_data, telemetry_id, changed, now);
+        }
+    }
+    return changed;
+}
+
 inline telemetry_t *rc_data_get_downlink_telemetry(rc_data_t *data, telemetry_downlink_id_e id)
 {
     assert(!(id & TELEMETRY_UPLINK_MASK));
@@ -191,21 +228,21 @@ inline bool rc_data_output_failsafe_is_active(const rc_data_t *data)
 #define TELEMETRY_GET_UPLINK_I32(rc_data, id) telemetry_get_i32(rc_data_get_uplink_telemetry(rc_data, id), id)
 #define TELEMETRY_GET_UPLINK_STR(rc_data, id) telemetry_get_str(rc_data_get_uplink_telemetry(rc_data, id), id)
 
-#define TELEMETRY_SET_DOWNLINK_U8(rc_data, id, v, now) telemetry_set_u8(rc_data_get_downlink_telemetry(rc_data, id), id, v, now)
-#define TELEMETRY_SET_DOWNLINK_I8(rc_data, id, v, now) telemetry_set_i8(rc_data_get_downlink_telemetry(rc_data, id), id, v, now)
-#define TELEMETRY_SET_DOWNLINK_U16(rc_data, id, v, now) telemetry_set_u16(rc_data_get_downlink_telemetry(rc_data, id), id, v, now)
-#define TELEMETRY_SET_DOWNLINK_I16(rc_data, id, v, now) telemetry_set_i16(rc_data_get_downlink_telemetry(rc_data, id), id, v, now)
-#define TELEMETRY_SET_DOWNLINK_U32(rc_data, id, v, now) telemetry_set_u32(rc_data_get_downlink_telemetry(rc_data, id), id, v, now)
-#define TELEMETRY_SET_DOWNLINK_I32(rc_data, id, v, now) telemetry_set_i32(rc_data_get_downlink_telemetry(rc_data, id), id, v, now)
-#define TELEMETRY_SET_DOWNLINK_STR(rc_data, id, v, now) telemetry_set_str(rc_data_get_downlink_telemetry(rc_data, id), id, v, now)
-
-#define TELEMETRY_SET_UPLINK_U8(rc_data, id, v, now) telemetry_set_u8(rc_data_get_uplink_telemetry(rc_data, id), id, v, now)
-#define TELEMETRY_SET_UPLINK_I8(rc_data, id, v, now) telemetry_set_i8(rc_data_get_uplink_telemetry(rc_data, id), id, v, now)
-#define TELEMETRY_SET_UPLINK_U16(rc_data, id, v, now) telemetry_set_u16(rc_data_get_uplink_telemetry(rc_data, id), id, v, now)
-#define TELEMETRY_SET_UPLINK_I16(rc_data, id, v, now) telemetry_set_i16(rc_data_get_uplink_telemetry(rc_data, id), id, v, now)
-#define TELEMETRY_SET_UPLINK_U32(rc_data, id, v, now) telemetry_set_u32(rc_data_get_uplink_telemetry(rc_data, id), id, v, now)
-#define TELEMETRY_SET_UPLINK_I32(rc_data, id, v, now) telemetry_set_i32(rc_data_get_uplink_telemetry(rc_data, id), id, v, now)
-#define TELEMETRY_SET_UPLINK_STR(rc_data, id, v, now) telemetry_set_str(rc_data_get_uplink_telemetry(rc_data, id), id, v, now)
+#define TELEMETRY_SET_DOWNLINK_U8(rc_data, id, v, now) rc_data_telemetry_did_set(rc_data, id, telemetry_set_u8(rc_data_get_downlink_telemetry(rc_data, id), id, v, now), now)
+#define TELEMETRY_SET_DOWNLINK_I8(rc_data, id, v, now) rc_data_telemetry_did_set(rc_data, id, telemetry_set_i8(rc_data_get_downlink_telemetry(rc_data, id), id, v, now), now)
+#define TELEMETRY_SET_DOWNLINK_U16(rc_data, id, v, now) rc_data_telemetry_did_set(rc_data, id, telemetry_set_u16(rc_data_get_downlink_telemetry(rc_data, id), id, v, now), now)
+#define TELEMETRY_SET_DOWNLINK_I16(rc_data, id, v, now) rc_data_telemetry_did_set(rc_data, id, telemetry_set_i16(rc_data_get_downlink_telemetry(rc_data, id), id, v, now), now)
+#define TELEMETRY_SET_DOWNLINK_U32(rc_data, id, v, now) rc_data_telemetry_did_set(rc_data, id, telemetry_set_u32(rc_data_get_downlink_telemetry(rc_data, id), id, v, now), now)
+#define TELEMETRY_SET_DOWNLINK_I32(rc_data, id, v, now) rc_data_telemetry_did_set(rc_data, id, telemetry_set_i32(rc_data_get_downlink_telemetry(rc_data, id), id, v, now), now)
+#define TELEMETRY_SET_DOWNLINK_STR(rc_data, id, v, now) rc_data_telemetry_did_set(rc_data, id, telemetry_set_str(rc_data_get_downlink_telemetry(rc_data, id), id, v, now), now)
+
+#define TELEMETRY_SET_UPLINK_U8(rc_data, id, v, now) rc_data_telemetry_did_set(rc_data, id, telemetry_set_u8(rc_data_get_uplink_telemetry(rc_data, id), id, v, now), now)
+#define TELEMETRY_SET_UPLINK_I8(rc_data, id, v, now) rc_data_telemetry_did_set(rc_data, id, telemetry_set_i8(rc_data_get_uplink_telemetry(rc_data, id), id, v, now), now)
+#define TELEMETRY_SET_UPLINK_U16(rc_data, id, v, now) rc_data_telemetry_did_set(rc_data, id, telemetry_set_u16(rc_data_get_uplink_telemetry(rc_data, id), id, v, now), now)
+#define TELEMETRY_SET_UPLINK_I16(rc_data, id, v, now) rc_data_telemetry_did_set(rc_data, id, telemetry_set_i16(rc_data_get_uplink_telemetry(rc_data, id), id, v, now), now)
+#define TELEMETRY_SET_UPLINK_U32(rc_data, id, v, now) rc_data_telemetry_did_set(rc_data, id, telemetry_set_u32(rc_data_get_uplink_telemetry(rc_data, id), id, v, now), now)
+#define TELEMETRY_SET_UPLINK_I32(rc_data, id, v, now) rc_data_telemetry_did_set(rc_data, id, telemetry_set_i32(rc_data_get_uplink_telemetry(rc_data, id), id, v, now), now)
+#define TELEMETRY_SET_UPLINK_STR(rc_data, id, v, now) rc_data_telemetry_did_set(rc_data, id, telemetry_set_str(rc_data_get_uplink_telemetry(rc_data, id), id, v, now), now)
 
 #define TELEMETRY_SET_U8(rc_data, id, v, now) (TELEMETRY_IS_UPLINK(id) ? TELEMETRY_SET_UPLINK_U8(rc_data, id, v, now) : TELEMETRY_SET_DOWNLINK_U8(rc_data, id, v, now))
 #define TELEMETRY_SET_I8(rc_data, id, v, now) (TELEMETRY_IS_UPLINK(id) ? TELEMETRY_SET_UPLINK_I8(rc_data, id, v, now) : TELEMETRY_SET_DOWNLINK_I8(rc_data, id, v, now))
@@ -0,0 +1,139 @@
+#include <string.h>
+
+#include <hal/log.h>
+
+#include "util/macros.h"
+
+#include "rc_sched.h"
+
+static const char *TAG = "RC.Sched";
+
+static void rc_sched_timer_callback(timer_hal_t *timer, void *user_data)
+{
+    rc_sched_t *sched = user_data;
+    xTaskNotifyGive(sched->task);
+}
+
+static void rc_sched_reset_stats(rc_sched_t *sched, time_micros_t now)
+{
+    memset(&sched->stats, 0, sizeof(sched->stats));
+    sched->stats.since = now;
+}
+
+void rc_sched_init(rc_sched_t *sched)
+{
+    sched->task = xTaskGetCurrentTaskHandle();
+    timer_hal_init(&sched->timer, "RC", rc_sched_timer_callback, sched);
+    rc_sched_reset_stats(sched, time_micros_now());
+    sched->snapshot_requested = false;
+    sched->snapshot_ready = false;
+    sched->next_print = 0;
+}
+
+static void rc_sched_account_late(rc_sched_t *sched, time_micros_t deadline, time_micros_t now)
+{
+    uint32_t late = now > deadline ? now - deadline : 0;
+    sched->stats.late_count++;
+    sched->stats.late_max = MAX(sched->stats.late_max, late);
+    sched->stats.late_sum += late;
+}
+
+static void rc_sched_take_snapshot(rc_sched_t *sched, time_micros_t now)
+{
+    memcpy(&sched->snapshot, &sched->stats, sizeof(sched->snapshot));
+    sched->snapshot.until = now;
+    rc_sched_reset_stats(sched, now);
+    __atomic_store_n(&sched->snapshot_requested, false, __ATOMIC_RELAXED);
+    __atomic_store_n(&sched->snapshot_ready, true, __ATOMIC_RELEASE);
+}
+
+void rc_sched_wait(rc_sched_t *sched, time_micros_t deadline)
+{
+    time_micros_t start = time_micros_now();
+    if (__atomic_load_n(&sched->snapshot_requested, __ATOMIC_ACQUIRE))
+    {
+        rc_sched_take_snapshot(sched, start);
+    }
+    if (deadline <= start)
+    {
+        return;
+    }
+    if (deadline - start < RC_SCHED_SPIN_THRESHOLD)
+    {
+        sched->stats.spins++;
+        time_micros_t now;
+        while ((now = time_micros_now()) < deadline)
+        {
+        }
+        sched->stats.idle += now - start;
+        rc_sched_account_late(sched, deadline, now);
+        return;
+    }
+    bool capped = deadline - start > RC_SCHED_MAX_SLEEP;
+    time_micros_t wait = capped ? RC_SCHED_MAX_SLEEP : deadline - start;
+    timer_hal_start_once(&sched->timer, start + wait);
+    // The timeout is just a fallback, the timer should notify us
+    // before it expires.
+    ulTaskNotifyTake(pdTRUE, MILLIS_TO_TICKS(wait / 1000) + 2);
+    time_micros_t now = time_micros_now();
+    // If the timer fired after we were notified, we'll get a spurious
+    // wakeup on the next call, which is fine.
+    timer_hal_stop(&sched->timer);
+    sched->stats.idle += now - start;
+    if (now >= start + wait)
+    {
+        sched->stats.deadline_wakeups++;
+        if (!capped)
+        {
+            rc_sched_account_late(sched, deadline, now);
+        }
+    }
+    else
+    {
+        sched->stats.event_wakeups++;
+    }
+}
+
+void rc_sched_request_stats(rc_sched_t *sched)
+{
+    // The snapshot belongs to us until the RC task sees the request
+    __atomic_store_n(&sched->snapshot_ready, false, __ATOMIC_RELAXED);
+    __atomic_store_n(&sched->snapshot_requested, true, __ATOMIC_RELEASE);
+}
+
+bool rc_sched_get_stats(rc_sched_t *sched, rc_sched_stats_t *stats)
+{
+    if (!__atomic_load_n(&sched->snapshot_ready, __ATOMIC_ACQUIRE))
+    {
+        return false;
+    }
+    memcpy(stats, &sched->snapshot, sizeof(*stats));
+    __atomic_store_n(&sched->snapshot_ready, false, __ATOMIC_RELAXED);
+    return true;
+}
+
+void rc_sched_log_stats(rc_sched_t *sched, time_micros_t now)
+{
+    if (sched->next_print > now)
+    {
+        return;
+    }
+    sched->next_print = now + RC_SCHED_LOG_INTERVAL;
+    rc_sched_stats_t stats;
+    bool have_stats = rc_sched_get_stats(sched, &stats);
+    // Stats for the next interval start counting when the RC task
+    // sees the request.
+    rc_sched_request_stats(sched);
+    if (!have_stats || stats.until <= stats.since)
+    {
+        return;
+    }
+    time_micros_t elapsed = stats.until - stats.since;
+    LOG_I(TAG, "Idle %u%%, wakeups: %u event, %u deadline, %u spin",
+          (unsigned)((stats.idle * 100) / elapsed), stats.event_wakeups, stats.deadline_wakeups, stats.spins);
+    if (stats.late_count > 0)
+    {
+        LOG_I(TAG, "Deadline jitter in us: avg=%u max=%u",
+              (unsigned)(stats.late_sum / stats.late_count), stats.late_max);
+    }
+}
@@ -0,0 +1,67 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include <freertos/FreeRTOS.h>
+#include <freertos/task.h>
+
+#include <hal/timer.h>
+
+#include "util/time.h"
+
+// Puts the RC task to sleep until the next deadline returned by
+// rc_next_update() or until it's notified (e.g. by a LoRa interrupt,
+// see lora_set_notify_task()). Deadlines use a one shot timer_hal_t,
+// so they're not rounded to FreeRTOS ticks.
+
+// Maximum time to sleep, so changes requested by other tasks are
+// eventually applied and the WDT gets fed.
+#define RC_SCHED_MAX_SLEEP MILLIS_TO_MICROS(10)
+// Deadlines closer than this are busy-waited, since arming the
+// timer and switching tasks would take about the same time.
+#define RC_SCHED_SPIN_THRESHOLD 50
+#define RC_SCHED_LOG_INTERVAL SECS_TO_MICROS(10)
+
+typedef struct rc_sched_stats_s
+{
+    time_micros_t since;
+    time_micros_t until;
+    time_micros_t idle;        // Time spent sleeping or spinning
+    unsigned event_wakeups;    // Woken up by a notification
+    unsigned deadline_wakeups; // Woken up by the timer
+    unsigned spins;            // Busy-waited for a close deadline
+    // Delay between a deadline and the task running again. When using
+    // output_air, this is the jitter of the TX slots.
+    unsigned late_count;
+    uint32_t late_max;
+    uint64_t late_sum;
+} rc_sched_stats_t;
+
+typedef struct rc_sched_s
+{
+    TaskHandle_t task;
+    timer_hal_t timer;
+    rc_sched_stats_t stats; // Only touched by the RC task
+    // Stats are handed to other tasks via a snapshot taken
+    // by the RC task when requested.
+    rc_sched_stats_t snapshot;
+    bool snapshot_requested;
+    bool snapshot_ready;
+    time_micros_t next_print;
+} rc_sched_t;
+
+// Must be called from the task that will call rc_sched_wait()
+void rc_sched_init(rc_sched_t *sched);
+// Returns when deadline is reached or when the task is notified,
+// whatever happens first. Notifications should be sent with
+// xTaskNotifyGive() to sched->task.
+void rc_sched_wait(rc_sched_t *sched, time_micros_t deadline);
+// Asks the RC task to snapshot and reset the stats on its next
+// call to rc_sched_wait(). Might be called from any task.
+void rc_sched_request_stats(rc_sched_t *sched);
+// Copies the last snapshot and returns true if a requested one
+// is available. Might be called from any task.
+bool rc_sched_get_stats(rc_sched_t *sched, rc_sched_stats_t *stats);
+// Logs the stats every RC_SCHED_LOG_INTERVAL
+void rc_sched_log_stats(rc_sched_t *sched, time_micros_t now);
@@ -1,10 +1,29 @@
 #include <math.h>
+#include <stdio.h>
 #include <string.h>
 
 #include "util/macros.h"
 
 #include "telemetry.h"
 
+// External definitions for the inline functions in telemetry.h, used
+// when the compiler decides not to inline them.
+extern inline uint8_t telemetry_get_u8(const telemetry_t *val, int id);
+extern inline int8_t telemetry_get_i8(const telemetry_t *val, int id);
+extern inline uint16_t telemetry_get_u16(const telemetry_t *val, int id);
+extern inline int16_t telemetry_get_i16(const telemetry_t *val, int id);
+extern inline uint32_t telemetry_get_u32(const telemetry_t *val, int id);
+extern inline int32_t telemetry_get_i32(const telemetry_t *val, int id);
+extern inline const char *telemetry_get_str(const telemetry_t *val, int id);
+extern inline bool telemetry_set_u8(telemetry_t *val, int id, uint8_t v, time_micros_t now);
+extern inline bool telemetry_set_i8(telemetry_t *val, int id, int8_t v, time_micros_t now);
+extern inline bool telemetry_set_u16(telemetry_t *val, int id, uint16_t v, time_micros_t now);
+extern inline bool telemetry_set_i16(telemetry_t *val, int id, int16_t v, time_micros_t now);
+extern inline bool telemetry_set_u32(telemetry_t *val, int id, uint32_t v, time_micros_t now);
+extern inline bool telemetry_set_i32(telemetry_t *val, int id, int32_t v, time_micros_t now);
+extern inline bool telemetry_set_str(telemetry_t *val, int id, const char *str, time_micros_t now);
+extern inline bool telemetry_set_bytes(telemetry_t *val, const void *data, size_t size, time_micros_t now);
+
 typedef struct telemetry_info_s
 {
     telemetry_type_e type;
@@ -0,0 +1,205 @@
+#include <assert.h>
+
+#include "rc/telemetry.h"
+
+#include "util/macros.h"
+
+#include "telemetry_sched.h"
+
+typedef struct telemetry_sched_class_s
+{
+    time_micros_t max_latency; // Maximum time between a change and sending the item
+    time_micros_t refresh;     // Maximum time between sends when the item doesn't change
+} telemetry_sched_class_t;
+
+static const telemetry_sched_class_t classes[] = {
+    [TELEMETRY_SCHED_CLASS_CRITICAL] = {.max_latency = 0, .refresh = MILLIS_TO_MICROS(100)},
+    [TELEMETRY_SCHED_CLASS_NORMAL] = {.max_latency = MILLIS_TO_MICROS(10), .refresh = MILLIS_TO_MICROS(500)},
+    [TELEMETRY_SCHED_CLASS_SLOW] = {.max_latency = MILLIS_TO_MICROS(100), .refresh = MILLIS_TO_MICROS(2000)},
+};
+
+static void telemetry_sched_heap_swap(telemetry_sched_t *s, unsigned p1, unsigned p2)
+{
+    uint8_t item1 = s->heap[p1];
+    uint8_t item2 = s->heap[p2];
+    s->heap[p1] = item2;
+    s->heap_pos[item2] = p1;
+    s->heap[p2] = item1;
+    s->heap_pos[item1] = p2;
+}
+
+static void telemetry_sched_heap_up(telemetry_sched_t *s, unsigned pos)
+{
+    while (pos > 0)
+    {
+        unsigned parent = (pos - 1) / 2;
+        if (s->deadline[s->heap[parent]] <= s->deadline[s->heap[pos]])
+        {
+            break;
+        }
+        telemetry_sched_heap_swap(s, pos, parent);
+        pos = parent;
+    }
+}
+
+static void telemetry_sched_heap_down(telemetry_sched_t *s, unsigned pos)
+{
+    for (;;)
+    {
+        unsigned smallest = pos;
+        unsigned left = pos * 2 + 1;
+        unsigned right = left + 1;
+        if (left < s->heap_size && s->deadline[s->heap[left]] < s->deadline[s->heap[smallest]])
+        {
+            smallest = left;
+        }
+        if (right < s->heap_size && s->deadline[s->heap[right]] < s->deadline[s->heap[smallest]])
+        {
+            smallest = right;
+        }
+        if (smallest == pos)
+        {
+            break;
+        }
+        telemetry_sched_heap_swap(s, pos, smallest);
+        pos = smallest;
+    }
+}
+
+static time_micros_t telemetry_sched_item_deadline(const telemetry_sched_t *s, unsigned item)
+{
+    const telemetry_sched_class_t *cls = &classes[s->classes[item]];
+    time_micros_t deadline = s->last_sent[item] + cls->refresh;
+    if (telemetry_sched_is_dirty(s, item))
+    {
+        deadline = MIN(deadline, s->dirty_since[item] + cls->max_latency);
+    }
+    return deadline;
+}
+
+// Recalculates the item deadline, inserting it in the heap if needed
+static void telemetry_sched_update(telemetry_sched_t *s, unsigned item)
+{
+    s->deadline[item] = telemetry_sched_item_deadline(s, item);
+    if (!telemetry_sched_is_scheduled(s, item))
+    {
+        s->scheduled |= 1u << item;
+        s->heap_pos[item] = s->heap_size;
+        s->heap[s->heap_size++] = item;
+    }
+    telemetry_sched_heap_up(s, s->heap_pos[item]);
+    telemetry_sched_heap_down(s, s->heap_pos[item]);
+}
+
+void telemetry_sched_init(telemetry_sched_t *s, unsigned count)
+{
+    assert(count <= TELEMETRY_SCHED_MAX_ITEMS);
+    s->dirty = 0;
+    s->scheduled = 0;
+    s->count = count;
+    s->heap_size = 0;
+    for (int ii = 0; ii < count; ii++)
+    {
+        s->classes[ii] = TELEMETRY_SCHED_CLASS_NORMAL;
+        s->last_sent[ii] = 0;
+    }
+}
+
+void telemetry_sched_set_class(telemetry_sched_t *s, unsigned item, telemetry_sched_class_e cls)
+{
+    assert(item < s->count);
+    s->classes[item] = cls;
+    if (telemetry_sched_is_scheduled(s, item))
+    {
+        telemetry_sched_update(s, item);
+    }
+}
+
+void telemetry_sched_add(telemetry_sched_t *s, unsigned item, time_micros_t now)
+{
+    assert(item < s->count);
+    if (!telemetry_sched_is_scheduled(s, item))
+    {
+        telemetry_sched_update(s, item);
+    }
+}
+
+void telemetry_sched_mark_dirty(telemetry_sched_t *s, unsigned item, time_micros_t now)
+{
+    assert(item < s->count);
+    if (!telemetry_sched_is_dirty(s, item))
+    {
+        s->dirty |= 1u << item;
+        s->dirty_since[item] = now;
+        telemetry_sched_update(s, item);
+    }
+}
+
+void telemetry_sched_value_set(telemetry_sched_t *s, unsigned item, bool changed, time_micros_t now)
+{
+    if (changed)
+    {
+        telemetry_sched_mark_dirty(s, item, now);
+    }
+    else
+    {
+        telemetry_sched_add(s, item, now);
+    }
+}
+
+void telemetry_sched_remove(telemetry_sched_t *s, unsigned item)
+{
+    assert(item < s->count);
+    if (telemetry_sched_is_scheduled(s, item))
+    {
+        unsigned pos = s->heap_pos[item];
+        s->heap_size--;
+        if (pos != s->heap_size)
+        {
+            // Move the last item to the removed position and restore the heap
+            uint8_t moved = s->heap[s->heap_size];
+            telemetry_sched_heap_swap(s, pos, s->heap_size);
+            telemetry_sched_heap_up(s, pos);
+            telemetry_sched_heap_down(s, s->heap_pos[moved]);
+        }
+        s->scheduled &= ~(1u << item);
+    }
+    s->dirty &= ~(1u << item);
+}
+
+void telemetry_sched_sent(telemetry_sched_t *s, unsigned item, time_micros_t now)
+{
+    assert(item < s->count);
+    s->dirty &= ~(1u << item);
+    s->last_sent[item] = now;
+    if (telemetry_sched_is_scheduled(s, item))
+    {
+        telemetry_sched_update(s, item);
+    }
+}
+
+telemetry_sched_class_e telemetry_sched_class_for_id(int telemetry_id)
+{
+    switch (telemetry_id)
+    {
+    case TELEMETRY_ID_TX_RSSI_ANT1:
+    case TELEMETRY_ID_TX_LINK_QUALITY:
+    case TELEMETRY_ID_TX_SNR:
+    case TELEMETRY_ID_RX_RSSI_ANT1:
+    case TELEMETRY_ID_RX_LINK_QUALITY:
+    case TELEMETRY_ID_RX_SNR:
+    case TELEMETRY_ID_BAT_VOLTAGE:
+    case TELEMETRY_ID_AVG_CELL_VOLTAGE:
+    case TELEMETRY_ID_CURRENT:
+    case TELEMETRY_ID_BAT_REMAINING_P:
+        return TELEMETRY_SCHED_CLASS_CRITICAL;
+    case TELEMETRY_ID_PILOT_NAME:
+    case TELEMETRY_ID_TX_RF_POWER:
+    case TELEMETRY_ID_CRAFT_NAME:
+    case TELEMETRY_ID_BAT_CAPACITY:
+    case TELEMETRY_ID_RX_ACTIVE_ANT:
+    case TELEMETRY_ID_RX_RF_POWER:
+        return TELEMETRY_SCHED_CLASS_SLOW;
+    }
+    return TELEMETRY_SCHED_CLASS_NORMAL;
+}
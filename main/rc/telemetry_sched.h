@@ -0,0 +1,73 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "util/time.h"
+
+// Schedules telemetry items (telemetry values or frames grouping them)
+// for sending over a link with limited bandwidth, using the earliest
+// deadline first. Items have a rate class which determines how soon
+// they should be sent after changing and how often they should be
+// refreshed while they don't change. Items are kept in a binary heap
+// ordered by deadline, so picking the next item is O(1) and updating
+// an item is O(log n).
+#define TELEMETRY_SCHED_MAX_ITEMS 32
+
+typedef enum {
+    TELEMETRY_SCHED_CLASS_CRITICAL, // Link quality, battery, etc...
+    TELEMETRY_SCHED_CLASS_NORMAL,
+    TELEMETRY_SCHED_CLASS_SLOW, // Names and values which rarely change
+} telemetry_sched_class_e;
+
+typedef struct telemetry_sched_s
+{
+    uint32_t dirty;     // Bitmap of items changed since they were last sent
+    uint32_t scheduled; // Bitmap of items in the heap
+    uint8_t count;
+    uint8_t classes[TELEMETRY_SCHED_MAX_ITEMS];
+    time_micros_t dirty_since[TELEMETRY_SCHED_MAX_ITEMS];
+    time_micros_t last_sent[TELEMETRY_SCHED_MAX_ITEMS];
+    time_micros_t deadline[TELEMETRY_SCHED_MAX_ITEMS];
+    uint8_t heap[TELEMETRY_SCHED_MAX_ITEMS];
+    uint8_t heap_pos[TELEMETRY_SCHED_MAX_ITEMS];
+    uint8_t heap_size;
+} telemetry_sched_t;
+
+// Initializes the scheduler with count items, all of them with
+// TELEMETRY_SCHED_CLASS_NORMAL and unscheduled.
+void telemetry_sched_init(telemetry_sched_t *s, unsigned count);
+void telemetry_sched_set_class(telemetry_sched_t *s, unsigned item, telemetry_sched_class_e cls);
+// Schedules the item at its refresh rate. Does nothing if it was already scheduled.
+void telemetry_sched_add(telemetry_sched_t *s, unsigned item, time_micros_t now);
+// Marks the item as changed, scheduling it if required.
+void telemetry_sched_mark_dirty(telemetry_sched_t *s, unsigned item, time_micros_t now);
+// Convenience function for rc_data_telemetry_changed_f callbacks. Marks
+// the item as dirty if changed is true, otherwise just schedules it.
+void telemetry_sched_value_set(telemetry_sched_t *s, unsigned item, bool changed, time_micros_t now);
+void telemetry_sched_remove(telemetry_sched_t *s, unsigned item);
+// Marks the item as sent, rescheduling it for its next refresh.
+void telemetry_sched_sent(telemetry_sched_t *s, unsigned item, time_micros_t now);
+// Returns the scheduled item with the earliest deadline or -1 if
+// there are no scheduled items.
+inline int telemetry_sched_peek(const telemetry_sched_t *s)
+{
+    return s->heap_size > 0 ? s->heap[0] : -1;
+}
+// Returns the time at which the item should be sent. Only valid
+// for scheduled items.
+inline time_micros_t telemetry_sched_deadline(const telemetry_sched_t *s, unsigned item)
+{
+    return s->deadline[item];
+}
+inline bool telemetry_sched_is_dirty(const telemetry_sched_t *s, unsigned item)
+{
+    return s->dirty & (1u << item);
+}
+inline bool telemetry_sched_is_scheduled(const telemetry_sched_t *s, unsigned item)
+{
+    return s->scheduled & (1u << item);
+}
+
+// Returns the rate class for the given telemetry id
+telemetry_sched_class_e telemetry_sched_class_for_id(int telemetry_id);
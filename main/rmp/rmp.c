@@ -1,9 +1,19 @@
+#include <stddef.h>
+#include <stdio.h>
+#include <string.h>
+
+#include <freertos/FreeRTOS.h>
+#include <freertos/semphr.h>
+
 #include <mbedtls/md5.h>
 
 #include <hal/log.h>
+#include <hal/rand.h>
 
 #include "config/config.h"
 
+#include "util/macros.h"
+#include "util/siphash.h"
 #include "util/time.h"
 
 #include "rmp.h"
@@ -13,14 +23,35 @@ static const char *TAG = "RMP";
 #define RMP_P2P_PING_INTERVAL MILLIS_TO_TICKS(500)
 #define RMP_DEVICE_INFO_INTERVAL SECS_TO_TICKS(30)
 #define RMP_P2P_PEER_EXPIRATION_INTERVAL MILLIS_TO_TICKS(3000)
+#define RMP_PEERS_INFO_CHECK_INTERVAL SECS_TO_TICKS(1)
+// Used until we know the round trip time to the peer
+#define RMP_FRAGMENT_RETRY_DELAY MILLIS_TO_TICKS(250)
+// rmp_update() runs every 10ms, so shorter delays can't be honored
+#define RMP_FRAGMENT_MIN_RETRY_DELAY MILLIS_TO_TICKS(30)
+#define RMP_FRAGMENT_MAX_RETRY_DELAY SECS_TO_TICKS(2)
+#define RMP_FRAGMENT_MAX_RETRIES 6
+// Incomplete messages are dropped after this long without fragments
+#define RMP_REASSEMBLY_TIMEOUT SECS_TO_TICKS(5)
+// Must be longer than the time the sender keeps retrying, so
+// retransmitted fragments of completed messages are still acknowledged.
+#define RMP_COMPLETED_TIMEOUT SECS_TO_TICKS(15)
 
-#define RMP_TRANSPORT_LOOPBACK 0xFF
+// A wheel slot must be swept before it starts receiving peers again
+_Static_assert((RMP_PEER_WHEEL_SLOTS - 1) * RMP_PEER_WHEEL_RESOLUTION > RMP_P2P_PEER_EXPIRATION_INTERVAL, "RMP peer wheel too short");
+
+#define RMP_TRANSPORT_LOOPBACK RMP_TRANSPORT_COUNT
 
 typedef enum {
     RMP_DEVICE_CODE_REQ_INFO = 1,
     RMP_DEVICE_CODE_INFO,
 } rmp_device_code_e;
 
+// Sent in a byte after the name in RMP_DEVICE_CODE_INFO. Older
+// versions don't send it, so it's assumed to be zero when missing.
+typedef enum {
+    RMP_DEVICE_CAP_SIPHASH = 1 << 0, // Verifies RMP_SIGNATURE_SIPHASH
+} rmp_device_cap_e;
+
 typedef struct rmp_device_info_s
 {
     air_role_e role;
@@ -36,6 +67,42 @@ typedef struct rmp_device_frame_s
     };
 } PACKED rmp_device_frame_t;
 
+typedef enum {
+    RMP_FRAGMENT_CODE_DATA = 1,
+    RMP_FRAGMENT_CODE_ACK,
+} rmp_fragment_code_e;
+
+// Followed by the fragment data
+typedef struct rmp_fragment_data_s
+{
+    uint8_t dst_port; // Port the whole message goes to
+    uint8_t index;
+    uint8_t count;
+    uint16_t size;   // Of the whole message
+    uint16_t offset; // Of the fragment data in the whole message
+} PACKED rmp_fragment_data_t;
+
+typedef struct rmp_fragment_ack_s
+{
+    uint32_t received; // Bitmask with the fragments received so far
+    uint8_t index;     // Fragment which triggered this ack
+} PACKED rmp_fragment_ack_t;
+
+typedef struct rmp_fragment_frame_s
+{
+    uint8_t code; // from rmp_fragment_code_e
+    uint8_t id;   // Chosen by the sender of the whole message
+    union {
+        rmp_fragment_data_t data;
+        rmp_fragment_ack_t ack;
+    };
+} PACKED rmp_fragment_frame_t;
+
+#define RMP_FRAGMENT_DATA_HEADER_SIZE (offsetof(rmp_fragment_frame_t, data) + sizeof(rmp_fragment_data_t))
+#define RMP_FRAGMENT_ACK_SIZE (offsetof(rmp_fragment_frame_t, ack) + sizeof(rmp_fragment_ack_t))
+
+_Static_assert(RMP_MAX_FRAGMENTS <= 32, "rmp_fragment_ack_t can't hold RMP_MAX_FRAGMENTS");
+
 typedef struct rmp_resp_data_s
 {
     rmp_t *rmp;
@@ -44,17 +111,123 @@ typedef struct rmp_resp_data_s
     uint8_t dst_port;
 } rmp_resp_data_t;
 
-static rmp_peer_t *rmp_get_peer(rmp_t *rmp, air_addr_t *addr)
+#define RMP_PEER_NONE -1
+
+// FNV-1a, addresses are mostly random so this is enough
+static unsigned rmp_peer_hash(const air_addr_t *addr)
 {
+    uint32_t h = 2166136261u;
+    for (int ii = 0; ii < AIR_ADDR_LENGTH; ii++)
+    {
+        h ^= addr->addr[ii];
+        h *= 16777619u;
+    }
+    return h & (RMP_PEER_INDEX_SIZE - 1);
+}
+
+static void rmp_init_peers(rmp_t *rmp)
+{
+    for (int ii = 0; ii < RMP_PEER_INDEX_SIZE; ii++)
+    {
+        rmp->internal.peer_index[ii] = RMP_PEER_NONE;
+    }
     for (int ii = 0; ii < RMP_MAX_PEERS; ii++)
     {
-        rmp_peer_t *peer = &rmp->internal.peers[ii];
-        if (air_addr_equals(&peer->addr, addr))
+        rmp->internal.peer_links[ii].prev = RMP_PEER_NONE;
+        rmp->internal.peer_links[ii].next = ii < RMP_MAX_PEERS - 1 ? ii + 1 : RMP_PEER_NONE;
+    }
+    rmp->internal.free_peers = 0;
+    for (int ii = 0; ii < RMP_PEER_WHEEL_SLOTS; ii++)
+    {
+        rmp->internal.peer_wheel[ii] = RMP_PEER_NONE;
+    }
+    rmp->internal.peer_wheel_next = 0;
+}
+
+// Returns the position in peer_index for addr, which is empty if
+// the peer is not in the index.
+static unsigned rmp_peer_index_lookup(rmp_t *rmp, const air_addr_t *addr)
+{
+    unsigned pos = rmp_peer_hash(addr);
+    int16_t idx;
+    while ((idx = rmp->internal.peer_index[pos]) != RMP_PEER_NONE)
+    {
+        if (air_addr_equals(&rmp->internal.peers[idx].addr, addr))
         {
-            return peer;
+            break;
         }
+        pos = (pos + 1) & (RMP_PEER_INDEX_SIZE - 1);
     }
-    return NULL;
+    return pos;
+}
+
+static void rmp_peer_index_remove(rmp_t *rmp, unsigned pos)
+{
+    // Backwards shift the entries in the same probe sequence, so
+    // lookups don't need tombstones.
+    int16_t *index = rmp->internal.peer_index;
+    unsigned next = pos;
+    for (;;)
+    {
+        next = (next + 1) & (RMP_PEER_INDEX_SIZE - 1);
+        if (index[next] == RMP_PEER_NONE)
+        {
+            break;
+        }
+        unsigned home = rmp_peer_hash(&rmp->internal.peers[index[next]].addr);
+        // Entries with their home between the hole and themselves
+        // must stay where they are.
+        bool keep = pos <= next ? (pos < home && home <= next) : (pos < home || home <= next);
+        if (!keep)
+        {
+            index[pos] = index[next];
+            pos = next;
+        }
+    }
+    index[pos] = RMP_PEER_NONE;
+}
+
+static unsigned rmp_peer_wheel_slot(time_ticks_t last_seen)
+{
+    return (last_seen / RMP_PEER_WHEEL_RESOLUTION) % RMP_PEER_WHEEL_SLOTS;
+}
+
+static void rmp_peer_wheel_remove(rmp_t *rmp, int16_t idx)
+{
+    rmp_peer_link_t *link = &rmp->internal.peer_links[idx];
+    if (link->prev != RMP_PEER_NONE)
+    {
+        rmp->internal.peer_links[link->prev].next = link->next;
+    }
+    else
+    {
+        rmp->internal.peer_wheel[rmp_peer_wheel_slot(rmp->internal.peers[idx].last_seen)] = link->next;
+    }
+    if (link->next != RMP_PEER_NONE)
+    {
+        rmp->internal.peer_links[link->next].prev = link->prev;
+    }
+    link->prev = RMP_PEER_NONE;
+    link->next = RMP_PEER_NONE;
+}
+
+static void rmp_peer_wheel_insert(rmp_t *rmp, int16_t idx)
+{
+    int16_t *head = &rmp->internal.peer_wheel[rmp_peer_wheel_slot(rmp->internal.peers[idx].last_seen)];
+    rmp_peer_link_t *link = &rmp->internal.peer_links[idx];
+    link->prev = RMP_PEER_NONE;
+    link->next = *head;
+    if (*head != RMP_PEER_NONE)
+    {
+        rmp->internal.peer_links[*head].prev = idx;
+    }
+    *head = idx;
+}
+
+static rmp_peer_t *rmp_get_peer(rmp_t *rmp, air_addr_t *addr)
+{
+    int16_t idx = rmp->internal.peer_index[rmp_peer_index_lookup(rmp, addr)];
+    return idx != RMP_PEER_NONE ? &rmp->internal.peers[idx] : NULL;
 }
 
 static void rmp_update_peer_authentication(rmp_t *rmp, rmp_peer_t *peer)
@@ -72,19 +245,48 @@ static void rmp_update_peer_authentication(rmp_t *rmp, rmp_peer_t *peer)
 
 static rmp_peer_t *rmp_add_peer(rmp_t *rmp, air_addr_t *addr)
 {
-    for (int ii = 0; ii < RMP_MAX_PEERS; ii++)
+    int16_t idx = rmp->internal.free_peers;
+    if (idx == RMP_PEER_NONE)
     {
-        rmp_peer_t *peer = &rmp->internal.peers[ii];
-        if (!air_addr_is_valid(&peer->addr))
+        return NULL;
+    }
+    rmp->internal.free_peers = rmp->internal.peer_links[idx].next;
+    rmp->internal.peer_links[idx].next = RMP_PEER_NONE;
+    rmp_peer_t *peer = &rmp->internal.peers[idx];
+    air_addr_cpy(&peer->addr, addr);
+    rmp->internal.peer_index[rmp_peer_index_lookup(rmp, addr)] = idx;
+    rmp_update_peer_authentication(rmp, peer);
+    LOG_I(TAG, "Added p2p peer (can authenticate: %c)", (peer->flags & RMP_PEER_FLAG_CAN_AUTHENTICATE) ? 'Y' : 'N');
+    return peer;
+}
+
+static void rmp_remove_peer(rmp_t *rmp, int16_t idx)
+{
+    rmp_peer_t *peer = &rmp->internal.peers[idx];
+    if (peer->last_seen > 0)
+    {
+        rmp_peer_wheel_remove(rmp, idx);
+    }
+    rmp_peer_index_remove(rmp, rmp_peer_index_lookup(rmp, &peer->addr));
+    memset(peer, 0, sizeof(*peer));
+    rmp->internal.peer_links[idx].next = rmp->internal.free_peers;
+    rmp->internal.free_peers = idx;
+}
+
+static void rmp_peer_seen(rmp_t *rmp, rmp_peer_t *peer, time_ticks_t now)
+{
+    int16_t idx = peer - rmp->internal.peers;
+    if (peer->last_seen > 0)
+    {
+        if (rmp_peer_wheel_slot(peer->last_seen) == rmp_peer_wheel_slot(now))
         {
-            // Empty slot
-            air_addr_cpy(&peer->addr, addr);
-            rmp_update_peer_authentication(rmp, peer);
-            LOG_I(TAG, "Added p2p peer (can authenticate: %c)", (peer->flags & RMP_PEER_FLAG_CAN_AUTHENTICATE) ? 'Y' : 'N');
-            return peer;
+            peer->last_seen = now;
+            return;
         }
+        rmp_peer_wheel_remove(rmp, idx);
     }
-    return NULL;
+    peer->last_seen = now;
+    rmp_peer_wheel_insert(rmp, idx);
 }
 
 static bool rmp_get_peer_key(rmp_t *rmp, air_key_t *key, air_addr_t *addr)
@@ -98,7 +300,7 @@ static bool rmp_get_peer_key(rmp_t *rmp, air_key_t *key, air_addr_t *addr)
     return false;
 }
 
-static void rmp_get_message_signature(rmp_t *rmp, uint8_t *signature, rmp_msg_t *msg, air_key_t *key)
+static void rmp_get_md5_signature(uint8_t *signature, rmp_msg_t *msg, air_key_t *key)
 {
     mbedtls_md5_context ctx;
     unsigned char md5_output[16];
@@ -120,9 +322,52 @@ static void rmp_get_message_signature(rmp_t *rmp, uint8_t *signature, rmp_msg_t
     memcpy(signature, &md5_output[sizeof(md5_output) - RMP_SIGNATURE_SIZE], RMP_SIGNATURE_SIZE);
 }
 
+static void rmp_get_siphash_signature(uint8_t *signature, rmp_msg_t *msg, air_key_t *key)
+{
+    // air_key_t is only 32 bits, fill the rest of the key with
+    // a fixed salt.
+    uint8_t sip_key[SIPHASH_KEY_SIZE] = {0, 0, 0, 0, 'R', 'M', 'P', ' ', 'S', 'I', 'G', '2'};
+    _Static_assert(sizeof(*key) == 4, "update sip_key");
+    memcpy(sip_key, key, sizeof(*key));
+
+    siphash_t s;
+    siphash_init(&s, sip_key);
+    siphash_update(&s, &msg->src, sizeof(msg->src));
+    siphash_update(&s, &msg->src_port, sizeof(msg->src_port));
+    siphash_update(&s, &msg->dst, sizeof(msg->dst));
+    siphash_update(&s, &msg->dst_port, sizeof(msg->dst_port));
+    if (msg->payload && msg->payload_size > 0)
+    {
+        siphash_update(&s, msg->payload, msg->payload_size);
+    }
+    uint64_t h = siphash_final(&s);
+    for (int ii = 0; ii < RMP_SIGNATURE_SIZE; ii++)
+    {
+        signature[ii] = h >> (8 * ii);
+    }
+}
+
+// Returns false if msg->signature_version is not supported
+static bool rmp_get_message_signature(rmp_t *rmp, uint8_t *signature, rmp_msg_t *msg, air_key_t *key)
+{
+    switch ((rmp_signature_version_e)msg->signature_version)
+    {
+    case RMP_SIGNATURE_MD5:
+        rmp_get_md5_signature(signature, msg, key);
+        return true;
+    case RMP_SIGNATURE_SIPHASH:
+        rmp_get_siphash_signature(signature, msg, key);
+        return true;
+    }
+    return false;
+}
+
 static void rmp_sign_message(rmp_t *rmp, rmp_msg_t *msg, air_key_t *key)
 {
+    // Use SipHash only with peers that told us they support it
+    rmp_peer_t *peer = rmp_get_peer(rmp, &msg->dst);
     msg->has_signature = true;
+    msg->signature_version = peer && (peer->flags & RMP_PEER_FLAG_SIPHASH) ? RMP_SIGNATURE_SIPHASH : RMP_SIGNATURE_MD5;
     rmp_get_message_signature(rmp, msg->signature, msg, key);
 }
 
@@ -144,6 +389,37 @@ static void rmp_send_response(const void *data, const void *payload, size_t size
     rmp_send(resp_data->rmp, resp_data->src_port, resp_data->dst, resp_data->dst_port, payload, size);
 }
 
+static void rmp_deliver_message(rmp_t *rmp, rmp_msg_t *msg, bool is_authenticated, rmp_transport_type_e transport)
+{
+    if (msg->dst_port == 0)
+    {
+        // Nothing else to do
+        return;
+    }
+    // Match it to a port
+    for (int ii = 0; ii < RMP_MAX_PORTS; ii++)
+    {
+        if (rmp->internal.ports[ii].port == msg->dst_port)
+        {
+            rmp_resp_data_t resp_data = {
+                .rmp = rmp,
+                .src_port = &rmp->internal.ports[ii],
+                .dst = msg->src,
+                .dst_port = msg->src_port,
+            };
+            rmp_req_t req = {
+                .is_authenticated = is_authenticated,
+                .transport = transport,
+                .msg = msg,
+                .resp = rmp_send_response,
+                .resp_data = &resp_data,
+            };
+            rmp->internal.ports[ii].handler(rmp, &req, rmp->internal.ports[ii].user_data);
+            break;
+        }
+    }
+}
+
 static void rmp_remove_stale_peers(rmp_t *rmp, time_ticks_t now)
 {
     if (now < RMP_P2P_PEER_EXPIRATION_INTERVAL)
@@ -151,13 +427,25 @@ static void rmp_remove_stale_peers(rmp_t *rmp, time_ticks_t now)
         return;
     }
     time_ticks_t threshold = now - RMP_P2P_PEER_EXPIRATION_INTERVAL;
-    for (int ii = 0; ii < RMP_MAX_PEERS; ii++)
+    // Sweep the slots which only contain peers older than threshold.
+    // Sweeping all the slots once is enough to catch up.
+    time_ticks_t end = threshold / RMP_PEER_WHEEL_RESOLUTION;
+    if (end > rmp->internal.peer_wheel_next + RMP_PEER_WHEEL_SLOTS)
     {
-        rmp_peer_t *peer = &rmp->internal.peers[ii];
-        if (peer->last_seen > 0 && peer->last_seen < threshold)
+        rmp->internal.peer_wheel_next = end - RMP_PEER_WHEEL_SLOTS;
+    }
+    for (; rmp->internal.peer_wheel_next < end; rmp->internal.peer_wheel_next++)
+    {
+        int16_t idx = rmp->internal.peer_wheel[rmp->internal.peer_wheel_next % RMP_PEER_WHEEL_SLOTS];
+        while (idx != RMP_PEER_NONE)
         {
-            LOG_I(TAG, "Removing p2p peer");
-            memset(peer, 0, sizeof(*peer));
+            int16_t next = rmp->internal.peer_links[idx].next;
+            if (rmp->internal.peers[idx].last_seen < threshold)
+            {
+                LOG_I(TAG, "Removing p2p peer");
+                rmp_remove_peer(rmp, idx);
+            }
+            idx = next;
         }
     }
 }
@@ -165,10 +453,13 @@ static void rmp_remove_stale_peers(rmp_t *rmp, time_ticks_t now)
 static void rmp_update_peers_info(rmp_t *rmp, time_ticks_t now)
 {
     time_ticks_t interval = RMP_DEVICE_INFO_INTERVAL * 1.5f;
-    if (now < interval)
+    if (now < interval || now < rmp->internal.next_peers_info)
     {
         return;
     }
+    // Requests are rate limited to one every 10s per peer, no need
+    // to scan every peer on each update.
+    rmp->internal.next_peers_info = now + RMP_PEERS_INFO_CHECK_INTERVAL;
     time_ticks_t threshold = now - interval;
     uint8_t code = RMP_DEVICE_CODE_REQ_INFO;
     for (int ii = 0; ii < RMP_MAX_PEERS; ii++)
@@ -201,7 +492,11 @@ static void rmp_send_device_info(rmp_t *rmp, air_addr_t dst)
         strlcpy(frame.device_info.name, rmp->internal.name, sizeof(frame.device_info.name));
     }
     size_t frame_size = 1 + sizeof(frame.device_info) - sizeof(frame.device_info.name) + strlen(frame.device_info.name) + 1;
-    rmp_send(rmp, NULL, dst, RMP_PORT_DEVICE, &frame, frame_size);
+    // Capabilities go right after the name terminator
+    uint8_t buf[sizeof(frame) + 1];
+    memcpy(buf, &frame, frame_size);
+    buf[frame_size++] = RMP_DEVICE_CAP_SIPHASH;
+    rmp_send(rmp, NULL, dst, RMP_PORT_DEVICE, buf, frame_size);
 }
 
 static void rmp_broadcast_device_info(rmp_t *rmp, time_ticks_t now)
@@ -210,6 +505,30 @@ static void rmp_broadcast_device_info(rmp_t *rmp, time_ticks_t now)
     rmp->internal.next_device_info = now + RMP_DEVICE_INFO_INTERVAL;
 }
 
+static void rmp_update_peer_capabilities(rmp_peer_t *peer, const rmp_msg_t *msg)
+{
+    size_t name_offset = offsetof(rmp_device_frame_t, device_info.name);
+    uint8_t caps = 0;
+    if (msg->payload_size > name_offset)
+    {
+        const uint8_t *payload = msg->payload;
+        size_t name_size = strnlen((const char *)&payload[name_offset], msg->payload_size - name_offset);
+        size_t caps_offset = name_offset + name_size + 1;
+        if (caps_offset < msg->payload_size)
+        {
+            caps = payload[caps_offset];
+        }
+    }
+    if (caps & RMP_DEVICE_CAP_SIPHASH)
+    {
+        peer->flags |= RMP_PEER_FLAG_SIPHASH;
+    }
+    else
+    {
+        peer->flags &= ~RMP_PEER_FLAG_SIPHASH;
+    }
+}
+
 static void rmp_device_handler(rmp_t *rmp, rmp_req_t *req, void *user_data)
 {
     rmp_peer_t *peer = rmp_get_peer(rmp, &req->msg->src);
@@ -246,6 +565,7 @@ static void rmp_device_handler(rmp_t *rmp, rmp_req_t *req, void *user_data)
         peer->last_info_update = time_ticks_now();
         peer->last_info_req = 0;
         rmp_update_peer_authentication(rmp, peer);
+        rmp_update_peer_capabilities(peer, req->msg);
         break;
     }
 }
@@ -276,6 +596,566 @@ static bool rmp_send_rc(rmp_t *rmp, rmp_msg_t *msg, time_ticks_t now)
     return false;
 }
 
+// If transport is non NULL, it's set to the one used for sending
+// an unicast message.
+static bool rmp_send_msg_via(rmp_t *rmp, rmp_msg_t *msg, rmp_send_flags_e flags, rmp_transport_type_e *transport)
+{
+    // Check if it's a loopback message
+    if (air_addr_equals(&rmp->internal.addr, &msg->dst))
+    {
+        if (transport)
+        {
+            *transport = RMP_TRANSPORT_LOOPBACK;
+        }
+        rmp_process_message(rmp, msg, RMP_TRANSPORT_LOOPBACK);
+        return true;
+    }
+    time_ticks_t now = time_ticks_now();
+    bool is_broadcast = air_addr_is_broadcast(&msg->dst);
+    if (is_broadcast)
+    {
+        if (flags & RMP_SEND_FLAG_BROADCAST_SELF)
+        {
+            // Send via loopback too
+            rmp_process_message(rmp, msg, RMP_TRANSPORT_LOOPBACK);
+        }
+        if (flags & RMP_SEND_FLAG_BROADCAST_RC)
+        {
+            rmp_send_rc(rmp, msg, now);
+        }
+
+        rmp_send_p2p(rmp, msg, now);
+        return true;
+    }
+    // Not a broadcast message. Check if we should sign it.
+    air_key_t key;
+    if (rmp_get_peer_key(rmp, &key, &msg->dst))
+    {
+        rmp_sign_message(rmp, msg, &key);
+    }
+    if (rmp_has_p2p_peer(rmp, &msg->dst) && rmp_send_p2p(rmp, msg, now))
+    {
+        if (transport)
+        {
+            *transport = RMP_TRANSPORT_P2P;
+        }
+        return true;
+    }
+    if (transport)
+    {
+        *transport = RMP_TRANSPORT_RC;
+    }
+    return rmp_send_rc(rmp, msg, now);
+}
+
+static bool rmp_send_msg(rmp_t *rmp, rmp_msg_t *msg, rmp_send_flags_e flags)
+{
+    return rmp_send_msg_via(rmp, msg, flags, NULL);
+}
+
+// Biggest payload which can be sent to dst without fragmenting it.
+// Messages to P2P peers fall back to RC if P2P fails, so they must
+// fit in both.
+static size_t rmp_get_max_payload_size(rmp_t *rmp, air_addr_t *dst)
+{
+    size_t size = SIZE_MAX;
+    const rmp_transport_t *p2p = &rmp->internal.transports[RMP_TRANSPORT_P2P];
+    const rmp_transport_t *rc = &rmp->internal.transports[RMP_TRANSPORT_RC];
+    if (p2p->send && rmp_has_p2p_peer(rmp, dst))
+    {
+        size = MIN(size, p2p->max_payload_size);
+    }
+    if (rc->send)
+    {
+        size = MIN(size, rc->max_payload_size);
+    }
+    return size != SIZE_MAX ? size : 0;
+}
+
+// Fragment size and window for messages to dst, limited by every
+// transport which might be used to send them.
+static void rmp_get_fragment_limits(rmp_t *rmp, air_addr_t *dst, size_t *max_fragment_size, unsigned *window)
+{
+    *max_fragment_size = RMP_MAX_FRAGMENT_SIZE;
+    *window = RMP_FRAGMENT_WINDOW;
+    const rmp_transport_t *p2p = &rmp->internal.transports[RMP_TRANSPORT_P2P];
+    const rmp_transport_t *rc = &rmp->internal.transports[RMP_TRANSPORT_RC];
+    if (p2p->send && rmp_has_p2p_peer(rmp, dst))
+    {
+        *max_fragment_size = MIN(*max_fragment_size, p2p->max_fragment_size);
+        *window = MIN(*window, p2p->fragment_window);
+    }
+    if (rc->send)
+    {
+        *max_fragment_size = MIN(*max_fragment_size, rc->max_fragment_size);
+        *window = MIN(*window, rc->fragment_window);
+    }
+}
+
+static uint32_t rmp_fragment_mask(unsigned count)
+{
+    return count < 32 ? (1u << count) - 1 : UINT32_MAX;
+}
+
+static bool rmp_outgoing_send_fragment(rmp_t *rmp, rmp_outgoing_t *out, unsigned index, rmp_transport_type_e *transport)
+{
+    uint8_t buf[RMP_MAX_FRAGMENT_SIZE];
+    rmp_fragment_frame_t *frame = (rmp_fragment_frame_t *)buf;
+    size_t offset = index * out->fragment_size;
+    size_t data_size = MIN(out->fragment_size, out->size - offset);
+    frame->code = RMP_FRAGMENT_CODE_DATA;
+    frame->id = out->id;
+    frame->data.dst_port = out->dst_port;
+    frame->data.index = index;
+    frame->data.count = out->count;
+    frame->data.size = out->size;
+    frame->data.offset = offset;
+    memcpy(&buf[RMP_FRAGMENT_DATA_HEADER_SIZE], &out->payload[offset], data_size);
+    rmp_msg_t msg = {
+        .src = rmp->internal.addr,
+        .src_port = out->src_port,
+        .dst = out->dst,
+        .dst_port = RMP_PORT_FRAGMENT,
+        .payload = buf,
+        .payload_size = RMP_FRAGMENT_DATA_HEADER_SIZE + data_size,
+    };
+    return rmp_send_msg_via(rmp, &msg, RMP_SEND_FLAG_NONE, transport);
+}
+
+// Sends the fragments which are neither acknowledged nor in flight,
+// keeping up to out->window of them in flight. Fragments the transport
+// couldn't take (e.g. its buffer is full) are retried on the next call.
+static void rmp_outgoing_send(rmp_t *rmp, rmp_outgoing_t *out, time_ticks_t now)
+{
+    int in_flight = __builtin_popcount(out->in_flight);
+    bool sent = false;
+    for (int ii = 0; ii < out->count && in_flight < out->window; ii++)
+    {
+        uint32_t bit = 1u << ii;
+        if ((out->acked | out->in_flight) & bit)
+        {
+            continue;
+        }
+        rmp_transport_type_e transport;
+        if (!rmp_outgoing_send_fragment(rmp, out, ii, &transport))
+        {
+            break;
+        }
+        out->sent_via[ii] = transport;
+        if (out->sent_at[ii] > 0)
+        {
+            out->retransmitted |= bit;
+        }
+        out->sent_seq[ii] = out->next_seq++;
+        out->sent_at[ii] = now;
+        out->in_flight |= bit;
+        in_flight++;
+        sent = true;
+    }
+    if (sent)
+    {
+        out->retry_at = now + out->retry_delay;
+    }
+}
+
+static time_ticks_t rmp_get_fragment_retry_delay(rmp_t *rmp, air_addr_t *dst)
+{
+    rmp_peer_t *peer = rmp_get_peer(rmp, dst);
+    if (!peer || peer->rtt == 0)
+    {
+        return RMP_FRAGMENT_RETRY_DELAY;
+    }
+    time_ticks_t delay = peer->rtt + 4 * peer->rtt_var;
+    return MAX(MIN(delay, RMP_FRAGMENT_MAX_RETRY_DELAY), RMP_FRAGMENT_MIN_RETRY_DELAY);
+}
+
+// Same estimator as TCP (RFC 6298)
+static void rmp_update_peer_rtt(rmp_t *rmp, air_addr_t *addr, time_ticks_t rtt)
+{
+    rmp_peer_t *peer = rmp_get_peer(rmp, addr);
+    if (!peer)
+    {
+        return;
+    }
+    if (peer->rtt == 0)
+    {
+        peer->rtt = MAX(rtt, 1);
+        peer->rtt_var = rtt / 2;
+        return;
+    }
+    time_ticks_t diff = peer->rtt > rtt ? peer->rtt - rtt : rtt - peer->rtt;
+    peer->rtt_var = (3 * peer->rtt_var + diff) / 4;
+    peer->rtt = MAX((7 * peer->rtt + rtt) / 8, 1);
+}
+
+static bool rmp_send_fragmented(rmp_t *rmp, rmp_msg_t *msg)
+{
+    size_t max_fragment_size;
+    unsigned window;
+    rmp_get_fragment_limits(rmp, &msg->dst, &max_fragment_size, &window);
+    size_t max_size = MIN(rmp_get_max_payload_size(rmp, &msg->dst), max_fragment_size);
+    if (msg->payload_size > RMP_MAX_FRAGMENTED_PAYLOAD_SIZE || max_size <= RMP_FRAGMENT_DATA_HEADER_SIZE)
+    {
+        LOG_W(TAG, "Can't send payload of size %u", msg->payload_size);
+        return false;
+    }
+    size_t fragment_size = max_size - RMP_FRAGMENT_DATA_HEADER_SIZE;
+    size_t count = (msg->payload_size + fragment_size - 1) / fragment_size;
+    if (count > RMP_MAX_FRAGMENTS)
+    {
+        LOG_W(TAG, "Can't send payload of size %u in %u fragments", msg->payload_size, count);
+        return false;
+    }
+    time_ticks_t retry_delay = rmp_get_fragment_retry_delay(rmp, &msg->dst);
+    xSemaphoreTake(rmp->internal.fragments_lock, portMAX_DELAY);
+    rmp_outgoing_t *out = NULL;
+    for (int ii = 0; ii < RMP_MAX_OUTGOING_FRAGMENTED; ii++)
+    {
+        if (!rmp->internal.outgoing[ii].in_use)
+        {
+            out = &rmp->internal.outgoing[ii];
+            break;
+        }
+    }
+    if (!out)
+    {
+        xSemaphoreGive(rmp->internal.fragments_lock);
+        LOG_W(TAG, "Can't send payload of size %u, no space for more fragmented messages", msg->payload_size);
+        return false;
+    }
+    out->in_use = true;
+    out->id = rmp->internal.next_fragmented_id++;
+    out->dst = msg->dst;
+    out->src_port = msg->src_port;
+    out->dst_port = msg->dst_port;
+    out->size = msg->payload_size;
+    out->fragment_size = fragment_size;
+    out->count = count;
+    out->window = MAX(MIN(window, RMP_MAX_FRAGMENTS), 1);
+    out->retries = 0;
+    out->acked = 0;
+    memset(out->acked_via, 0, sizeof(out->acked_via));
+    out->in_flight = 0;
+    out->retransmitted = 0;
+    out->next_seq = 0;
+    memset(out->sent_at, 0, sizeof(out->sent_at));
+    out->retry_delay = retry_delay;
+    out->retry_at = time_ticks_now() + retry_delay;
+    memcpy(out->payload, msg->payload, msg->payload_size);
+    LOG_D(TAG, "Sending payload of size %u in %u fragments", msg->payload_size, count);
+    rmp_outgoing_send(rmp, out, time_ticks_now());
+    xSemaphoreGive(rmp->internal.fragments_lock);
+    return true;
+}
+
+static void rmp_outgoing_ack(rmp_t *rmp, rmp_req_t *req, const rmp_fragment_frame_t *frame, time_ticks_t now)
+{
+    air_key_t key;
+    if (!req->is_authenticated && rmp_get_peer_key(rmp, &key, &req->msg->src))
+    {
+        // Fragments to this peer are signed, don't let others ack them
+        return;
+    }
+    for (int ii = 0; ii < RMP_MAX_OUTGOING_FRAGMENTED; ii++)
+    {
+        rmp_outgoing_t *out = &rmp->internal.outgoing[ii];
+        if (!out->in_use || out->id != frame->id || !air_addr_equals(&out->dst, &req->msg->src))
+        {
+            continue;
+        }
+        uint32_t all = rmp_fragment_mask(out->count);
+        uint32_t received = frame->ack.received & all;
+        unsigned index = frame->ack.index;
+        if (index >= out->count)
+        {
+            break;
+        }
+        // Acks are only ordered within a transport: one sent via RC
+        // might arrive after a newer one sent via P2P.
+        bool has_transport = req->transport < RMP_TRANSPORT_COUNT;
+        if (has_transport && (out->acked_via[req->transport] & ~received))
+        {
+            // The receiver dropped what it had, send it again
+            LOG_W(TAG, "Fragmented message %u restarted by receiver", out->id);
+            out->acked = received;
+            memset(out->acked_via, 0, sizeof(out->acked_via));
+            out->acked_via[req->transport] = received;
+            out->in_flight = 0;
+            rmp_outgoing_send(rmp, out, now);
+            break;
+        }
+        if (has_transport)
+        {
+            out->acked_via[req->transport] |= received;
+        }
+        if ((received & ~out->acked) == 0)
+        {
+            // No progress, might be an ack for a retransmitted fragment
+            break;
+        }
+        if (!(out->retransmitted & (1u << index)))
+        {
+            // Retransmitted fragments give ambiguous samples
+            rmp_update_peer_rtt(rmp, &out->dst, now - out->sent_at[index]);
+        }
+        out->acked |= received;
+        out->in_flight &= ~out->acked;
+        if (out->acked == all)
+        {
+            LOG_D(TAG, "Fragmented message %u delivered", out->id);
+            out->in_use = false;
+            break;
+        }
+        // Transports deliver in order, so fragments sent before the
+        // acked one via the same transport which are still missing
+        // were lost. Resend them now rather than waiting for the timeout.
+        for (int jj = 0; jj < out->count; jj++)
+        {
+            if ((out->in_flight & (1u << jj)) && out->sent_via[jj] == out->sent_via[index] &&
+                (int16_t)(out->sent_seq[index] - out->sent_seq[jj]) > 0)
+            {
+                out->in_flight &= ~(1u << jj);
+            }
+        }
+        out->retries = 0;
+        out->retry_delay = rmp_get_fragment_retry_delay(rmp, &out->dst);
+        out->retry_at = now + out->retry_delay;
+        rmp_outgoing_send(rmp, out, now);
+        break;
+    }
+}
+
+static void rmp_update_outgoing(rmp_t *rmp, time_ticks_t now)
+{
+    for (int ii = 0; ii < RMP_MAX_OUTGOING_FRAGMENTED; ii++)
+    {
+        rmp_outgoing_t *out = &rmp->internal.outgoing[ii];
+        if (!out->in_use)
+        {
+            continue;
+        }
+        if (now < out->retry_at)
+        {
+            // Send the fragments the transport couldn't take before
+            rmp_outgoing_send(rmp, out, now);
+            continue;
+        }
+        if (++out->retries > RMP_FRAGMENT_MAX_RETRIES)
+        {
+            LOG_W(TAG, "Dropping fragmented message %u, no acknowledgement", out->id);
+            out->in_use = false;
+            continue;
+        }
+        // Resend everything not acknowledged, backing off in case
+        // the link is just slow.
+        out->in_flight = 0;
+        out->retry_delay = MIN(out->retry_delay * 2, RMP_FRAGMENT_MAX_RETRY_DELAY);
+        // Wait for the next timeout even if the transport can't take
+        // any fragment right now, so retries aren't burnt every update.
+        out->retry_at = now + out->retry_delay;
+        rmp_outgoing_send(rmp, out, now);
+    }
+}
+
+// Returns the reassembly for the message the fragment belongs to,
+// starting a new one if needed. Returns NULL if there's no space.
+static rmp_reassembly_t *rmp_get_reassembly(rmp_t *rmp, const rmp_msg_t *msg, const rmp_fragment_frame_t *frame, time_ticks_t now)
+{
+    rmp_reassembly_t *slot = NULL;
+    for (int ii = 0; ii < RMP_MAX_REASSEMBLIES; ii++)
+    {
+        rmp_reassembly_t *r = &rmp->internal.reassemblies[ii];
+        if (r->delivering)
+        {
+            // Already in completed, so no fragments for it get here
+            continue;
+        }
+        if (r->in_use && r->id == frame->id && air_addr_equals(&r->src, &msg->src))
+        {
+            if (r->src_port == msg->src_port && r->dst_port == frame->data.dst_port &&
+                r->size == frame->data.size && r->count == frame->data.count)
+            {
+                return r;
+            }
+            // Different message with the same id, the sender restarted
+            slot = r;
+            break;
+        }
+        if (!r->in_use && !slot)
+        {
+            slot = r;
+        }
+    }
+    // Messages being received are not evicted to avoid thrashing,
+    // stalled ones time out.
+    if (slot)
+    {
+        memset(slot, 0, sizeof(*slot));
+        slot->in_use = true;
+        slot->is_signed = true;
+        slot->id = frame->id;
+        slot->src = msg->src;
+        slot->src_port = msg->src_port;
+        slot->dst_port = frame->data.dst_port;
+        slot->size = frame->data.size;
+        slot->count = frame->data.count;
+        slot->last_update = now;
+    }
+    return slot;
+}
+
+static bool rmp_fragmented_is_completed(rmp_t *rmp, const rmp_msg_t *msg, const rmp_fragment_frame_t *frame, time_ticks_t now)
+{
+    for (int ii = 0; ii < RMP_MAX_COMPLETED_FRAGMENTED; ii++)
+    {
+        const rmp_completed_t *c = &rmp->internal.completed[ii];
+        if (c->completed_at > 0 && c->completed_at + RMP_COMPLETED_TIMEOUT >= now && c->id == frame->id &&
+            c->count == frame->data.count && c->size == frame->data.size && air_addr_equals(&c->src, &msg->src))
+        {
+            return true;
+        }
+    }
+    return false;
+}
+
+static void rmp_fragmented_add_completed(rmp_t *rmp, const rmp_reassembly_t *r, time_ticks_t now)
+{
+    rmp_completed_t *c = &rmp->internal.completed[rmp->internal.next_completed];
+    rmp->internal.next_completed = (rmp->internal.next_completed + 1) % RMP_MAX_COMPLETED_FRAGMENTED;
+    c->src = r->src;
+    c->id = r->id;
+    c->count = r->count;
+    c->size = r->size;
+    c->completed_at = now;
+}
+
+static void rmp_send_fragment_ack(rmp_t *rmp, air_addr_t dst, uint8_t id, uint32_t received, uint8_t index)
+{
+    rmp_fragment_frame_t ack = {
+        .code = RMP_FRAGMENT_CODE_ACK,
+        .id = id,
+        .ack.received = received,
+        .ack.index = index,
+    };
+    rmp_send(rmp, rmp->internal.fragment_port, dst, RMP_PORT_FRAGMENT, &ack, RMP_FRAGMENT_ACK_SIZE);
+}
+
+// Returns the reassembly if the message is now complete. It must be
+// delivered with rmp_reassembly_deliver() after releasing fragments_lock.
+static rmp_reassembly_t *rmp_reassembly_receive(rmp_t *rmp, rmp_req_t *req, const rmp_fragment_frame_t *frame, time_ticks_t now)
+{
+    rmp_msg_t *msg = req->msg;
+    const rmp_fragment_data_t *data = &frame->data;
+    size_t data_size = msg->payload_size - RMP_FRAGMENT_DATA_HEADER_SIZE;
+    if (air_addr_is_broadcast(&msg->dst) || data->count == 0 || data->count > RMP_MAX_FRAGMENTS ||
+        data->index >= data->count || data->size > RMP_MAX_FRAGMENTED_PAYLOAD_SIZE ||
+        data->offset + data_size > data->size)
+    {
+        LOG_W(TAG, "Dropping invalid fragment");
+        return NULL;
+    }
+    if (rmp_fragmented_is_completed(rmp, msg, frame, now))
+    {
+        // Our ack got lost
+        rmp_send_fragment_ack(rmp, msg->src, frame->id, rmp_fragment_mask(data->count), data->index);
+        return NULL;
+    }
+    rmp_reassembly_t *r = rmp_get_reassembly(rmp, msg, frame, now);
+    if (!r)
+    {
+        // Not acknowledged, so the sender will retry later
+        LOG_W(TAG, "Dropping fragment, no space for more fragmented messages");
+        return NULL;
+    }
+    uint32_t bit = 1u << data->index;
+    if (!(r->received & bit))
+    {
+        memcpy(&r->payload[data->offset], ((const uint8_t *)frame) + RMP_FRAGMENT_DATA_HEADER_SIZE, data_size);
+        r->received |= bit;
+        // The whole message is authenticated only if every part was
+        r->is_signed = r->is_signed && req->is_authenticated;
+        r->signature_version = msg->signature_version;
+    }
+    r->last_update = now;
+    rmp_send_fragment_ack(rmp, r->src, r->id, r->received, data->index);
+
+    if (r->received == rmp_fragment_mask(r->count))
+    {
+        LOG_D(TAG, "Reassembled message of size %u from port %u to port %u", r->size, r->src_port, r->dst_port);
+        rmp_fragmented_add_completed(rmp, r, now);
+        r->delivering = true;
+        return r;
+    }
+    return NULL;
+}
+
+static void rmp_reassembly_deliver(rmp_t *rmp, rmp_reassembly_t *r)
+{
+    // Port handlers might send fragmented messages, so this runs
+    // without fragments_lock. The slot is not reused while delivering.
+    rmp_msg_t whole = {
+        .src = r->src,
+        .src_port = r->src_port,
+        .dst = rmp->internal.addr,
+        .dst_port = r->dst_port,
+        .payload = r->payload,
+        .payload_size = r->size,
+        .has_signature = r->is_signed,
+        .signature_version = r->is_signed ? r->signature_version : 0,
+    };
+    rmp_deliver_message(rmp, &whole, r->is_signed, RMP_TRANSPORT_LOOPBACK);
+    xSemaphoreTake(rmp->internal.fragments_lock, portMAX_DELAY);
+    r->delivering = false;
+    r->in_use = false;
+    xSemaphoreGive(rmp->internal.fragments_lock);
+}
+
+static void rmp_update_reassemblies(rmp_t *rmp, time_ticks_t now)
+{
+    for (int ii = 0; ii < RMP_MAX_REASSEMBLIES; ii++)
+    {
+        rmp_reassembly_t *r = &rmp->internal.reassemblies[ii];
+        if (r->in_use && !r->delivering && r->last_update + RMP_REASSEMBLY_TIMEOUT < now)
+        {
+            LOG_W(TAG, "Dropping incomplete fragmented message %u", r->id);
+            r->in_use = false;
+        }
+    }
+}
+
+static void rmp_fragment_handler(rmp_t *rmp, rmp_req_t *req, void *user_data)
+{
+    const rmp_fragment_frame_t *frame = req->msg->payload;
+    size_t size = req->msg->payload_size;
+    if (size < offsetof(rmp_fragment_frame_t, data))
+    {
+        return;
+    }
+    time_ticks_t now = time_ticks_now();
+    rmp_reassembly_t *complete = NULL;
+    xSemaphoreTake(rmp->internal.fragments_lock, portMAX_DELAY);
+    switch ((rmp_fragment_code_e)frame->code)
+    {
+    case RMP_FRAGMENT_CODE_DATA:
+        if (size >= RMP_FRAGMENT_DATA_HEADER_SIZE)
+        {
+            complete = rmp_reassembly_receive(rmp, req, frame, now);
+        }
+        break;
+    case RMP_FRAGMENT_CODE_ACK:
+        if (size >= RMP_FRAGMENT_ACK_SIZE)
+        {
+            rmp_outgoing_ack(rmp, req, frame, now);
+        }
+        break;
+    }
+    xSemaphoreGive(rmp->internal.fragments_lock);
+    if (complete)
+    {
+        rmp_reassembly_deliver(rmp, complete);
+    }
+}
+
 static void rmp_send_p2p_ping(rmp_t *rmp, time_ticks_t now)
 {
     LOG_D(TAG, "Sending p2p ping");
@@ -286,7 +1166,13 @@ void rmp_init(rmp_t *rmp, air_addr_t *addr)
 {
     memset(rmp, 0, sizeof(*rmp));
     air_addr_cpy(&rmp->internal.addr, addr);
+    rmp_init_peers(rmp);
     rmp->internal.device_port = rmp_open_port(rmp, RMP_PORT_DEVICE, rmp_device_handler, rmp);
+    rmp->internal.fragment_port = rmp_open_port(rmp, RMP_PORT_FRAGMENT, rmp_fragment_handler, rmp);
+    rmp->internal.fragments_lock = xSemaphoreCreateMutex();
+    // Avoid reusing the ids from before a restart, receivers might
+    // still remember them.
+    rmp->internal.next_fragmented_id = rand_hal_u32();
 }
 
 void rmp_update(rmp_t *rmp)
@@ -302,6 +1188,10 @@ void rmp_update(rmp_t *rmp)
         rmp_send_p2p_ping(rmp, now);
     }
     rmp_update_peers(rmp, now);
+    xSemaphoreTake(rmp->internal.fragments_lock, portMAX_DELAY);
+    rmp_update_outgoing(rmp, now);
+    rmp_update_reassemblies(rmp, now);
+    xSemaphoreGive(rmp->internal.fragments_lock);
 }
 
 void rmp_set_name(rmp_t *rmp, const char *name)
@@ -459,41 +1349,14 @@ bool rmp_send_flags(rmp_t *rmp, const rmp_port_t *port, air_addr_t dst, int dst_
         .payload = payload,
         .payload_size = size,
         .has_signature = false,
+        .signature_version = 0,
     };
-    // Check if it's a loopback message
-    if (air_addr_equals(&rmp->internal.addr, &dst))
+    if (!air_addr_equals(&rmp->internal.addr, &dst) && !air_addr_is_broadcast(&dst) &&
+        size > rmp_get_max_payload_size(rmp, &dst))
     {
-        rmp_process_message(rmp, &msg, RMP_TRANSPORT_LOOPBACK);
-        return true;
-    }
-    time_ticks_t now = time_ticks_now();
-    bool is_broadcast = air_addr_is_broadcast(&dst);
-    if (is_broadcast)
-    {
-        if (flags & RMP_SEND_FLAG_BROADCAST_SELF)
-        {
-            // Send via loopback too
-            rmp_process_message(rmp, &msg, RMP_TRANSPORT_LOOPBACK);
-        }
-        if (flags & RMP_SEND_FLAG_BROADCAST_RC)
-        {
-            rmp_send_rc(rmp, &msg, now);
-        }
-
-        rmp_send_p2p(rmp, &msg, now);
-        return true;
+        return rmp_send_fragmented(rmp, &msg);
     }
-    // Not a broadcast message. Check if we should sign it.
-    air_key_t key;
-    if (rmp_get_peer_key(rmp, &key, &dst))
-    {
-        rmp_sign_message(rmp, &msg, &key);
-    }
-    if (rmp_has_p2p_peer(rmp, &dst) && rmp_send_p2p(rmp, &msg, now))
-    {
-        return true;
-    }
-    return rmp_send_rc(rmp, &msg, now);
+    return rmp_send_msg(rmp, &msg, flags);
 }
 
 bool rmp_send_loopback(rmp_t *rmp, const rmp_port_t *port, int dst_port, const void *payload, size_t size)
@@ -501,12 +1364,21 @@ bool rmp_send_loopback(rmp_t *rmp, const rmp_port_t *port, int dst_port, const v
     return rmp_send(rmp, port, rmp->internal.addr, dst_port, payload, size);
 }
 
-void rmp_set_transport(rmp_t *rmp, rmp_transport_type_e type, rmp_transport_send_f send, void *user_data)
+void rmp_set_transport(rmp_t *rmp, rmp_transport_type_e type, rmp_transport_send_f send, size_t max_payload_size, void *user_data)
 {
     rmp->internal.transports[type].send = send;
+    rmp->internal.transports[type].max_payload_size = max_payload_size;
+    rmp->internal.transports[type].max_fragment_size = RMP_MAX_FRAGMENT_SIZE;
+    rmp->internal.transports[type].fragment_window = RMP_FRAGMENT_WINDOW;
     rmp->internal.transports[type].user_data = user_data;
 }
 
+void rmp_set_transport_fragments(rmp_t *rmp, rmp_transport_type_e type, size_t max_fragment_size, unsigned window)
+{
+    rmp->internal.transports[type].max_fragment_size = MIN(max_fragment_size, RMP_MAX_FRAGMENT_SIZE);
+    rmp->internal.transports[type].fragment_window = window;
+}
+
 void rmp_process_message(rmp_t *rmp, rmp_msg_t *msg, rmp_transport_type_e source)
 {
     char addr_buf[AIR_ADDR_STRING_BUFFER_SIZE];
@@ -542,7 +1414,7 @@ void rmp_process_message(rmp_t *rmp, rmp_msg_t *msg, rmp_transport_type_e source
         peer = rmp_add_peer(rmp, &msg->src);
         if (!peer)
         {
-            LOG_W(TAG, "Can't handle message from %s, no space for more peers", addr_buf)
+            LOG_W(TAG, "Can't handle message from %s, no space for more peers", addr_buf);
             return;
         }
     }
@@ -556,7 +1428,11 @@ void rmp_process_message(rmp_t *rmp, rmp_msg_t *msg, rmp_transport_type_e source
             return;
         }
         uint8_t signature[RMP_SIGNATURE_SIZE];
-        rmp_get_message_signature(rmp, signature, msg, &key);
+        if (!rmp_get_message_signature(rmp, signature, msg, &key))
+        {
+            LOG_W(TAG, "Dropping signed message, unknown signature version %u", msg->signature_version);
+            return;
+        }
         if (memcmp(signature, msg->signature, RMP_SIGNATURE_SIZE) != 0)
         {
             LOG_W(TAG, "Dropping signed message, invalid signature");
@@ -566,34 +1442,9 @@ void rmp_process_message(rmp_t *rmp, rmp_msg_t *msg, rmp_transport_type_e source
     if (source == RMP_TRANSPORT_P2P)
     {
         // Update last seen time
-        peer->last_seen = time_ticks_now();
+        rmp_peer_seen(rmp, peer, time_ticks_now());
     }
     LOG_D(TAG, "Got message from port %u to port %u (signed: %c)", msg->src_port, msg->dst_port, msg->has_signature ? 'Y' : 'N');
-    if (msg->dst_port == 0)
-    {
-        // Nothing else to do
-        return;
-    }
-    // Match it to a port
-    for (int ii = 0; ii < RMP_MAX_PORTS; ii++)
-    {
-        if (rmp->internal.ports[ii].port == msg->dst_port)
-        {
-            rmp_resp_data_t resp_data = {
-                .rmp = rmp,
-                .src_port = &rmp->internal.ports[ii],
-                .dst = msg->src,
-                .dst_port = msg->src_port,
-            };
-            rmp_req_t req = {
-                // Signature has been previously verified
-                .is_authenticated = is_loopback || msg->has_signature,
-                .msg = msg,
-                .resp = rmp_send_response,
-                .resp_data = &resp_data,
-            };
-            rmp->internal.ports[ii].handler(rmp, &req, rmp->internal.ports[ii].user_data);
-            break;
-        }
-    }
+    // Signature has been previously verified
+    rmp_deliver_message(rmp, msg, is_loopback || msg->has_signature, source);
 }
\ No newline at end of file
@@ -1,6 +1,11 @@
 #pragma once
 
 #include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include <freertos/FreeRTOS.h>
+#include <freertos/semphr.h>
 
 #include "air/air.h"
 
@@ -9,15 +14,58 @@
 #ifndef RMP_MAX_PEERS
 #define RMP_MAX_PEERS 64
 #endif
+// Size of the open addressing index for the peers. Must be a power
+// of 2, at least twice RMP_MAX_PEERS to keep the probe sequences short.
+#ifndef RMP_PEER_INDEX_SIZE
+#define RMP_PEER_INDEX_SIZE 128
+#endif
 #ifndef RMP_MAX_PORTS
 #define RMP_MAX_PORTS 8
 #endif
 
 #define RMP_SIGNATURE_SIZE 4
 
+// Messages which don't fit in a single transport payload are split
+// into fragments sent to RMP_PORT_FRAGMENT. The receiver acknowledges
+// them and the sender retransmits the missing ones until the whole
+// message gets through. Only unicast messages can be fragmented.
+#ifndef RMP_MAX_FRAGMENTED_PAYLOAD_SIZE
+#define RMP_MAX_FRAGMENTED_PAYLOAD_SIZE 1024
+#endif
+// Fragmented messages being sent at the same time
+#ifndef RMP_MAX_OUTGOING_FRAGMENTED
+#define RMP_MAX_OUTGOING_FRAGMENTED 2
+#endif
+// Fragmented messages being received at the same time
+#ifndef RMP_MAX_REASSEMBLIES
+#define RMP_MAX_REASSEMBLIES 2
+#endif
+// Fragmented messages remembered after being received
+#ifndef RMP_MAX_COMPLETED_FRAGMENTED
+#define RMP_MAX_COMPLETED_FRAGMENTED 16
+#endif
+// Biggest payload for a fragment message, including its header.
+// Transports can use smaller ones, see rmp_set_transport_fragments().
+#define RMP_MAX_FRAGMENT_SIZE 255
+#define RMP_MAX_FRAGMENTS 32
+// Fragments sent without being acknowledged, by default
+#define RMP_FRAGMENT_WINDOW 4
+
+// P2P peers are expired using a timer wheel, with slots covering
+// RMP_PEER_WHEEL_RESOLUTION of last_seen each.
+#define RMP_PEER_WHEEL_SLOTS 8
+#define RMP_PEER_WHEEL_RESOLUTION MILLIS_TO_TICKS(500)
+
+_Static_assert((RMP_PEER_INDEX_SIZE & (RMP_PEER_INDEX_SIZE - 1)) == 0, "RMP_PEER_INDEX_SIZE must be a power of 2");
+_Static_assert(RMP_PEER_INDEX_SIZE >= RMP_MAX_PEERS * 2, "RMP_PEER_INDEX_SIZE too small");
+_Static_assert(RMP_MAX_PEERS <= INT16_MAX, "RMP_MAX_PEERS too big");
+_Static_assert(RMP_MAX_FRAGMENTED_PAYLOAD_SIZE <= UINT16_MAX, "RMP_MAX_FRAGMENTED_PAYLOAD_SIZE too big");
+
 enum
 {
     RMP_PORT_DEVICE = 0x22,
+    RMP_PORT_LINK_STATS = 0x23,
+    RMP_PORT_FRAGMENT = 0x24,
     RMP_PORT_MSP = 0x21,
     RMP_PORT_SETTINGS = 0x42,
 };
@@ -41,8 +89,17 @@ typedef bool (*rmp_transport_send_f)(rmp_t *rmp, rmp_msg_t *msg, void *user_data
 
 typedef enum {
     RMP_PEER_FLAG_CAN_AUTHENTICATE = 1 << 0, // We have some means to authenticate this peer
+    RMP_PEER_FLAG_SIPHASH = 1 << 1,          // Peer verifies RMP_SIGNATURE_SIPHASH
 } rmp_peer_flag_e;
 
+// Algorithm used for a message signature. Every peer supports
+// RMP_SIGNATURE_MD5, others are used only with peers which advertise
+// them in their device info.
+typedef enum {
+    RMP_SIGNATURE_MD5 = 1,     // Last bytes of MD5(key, msg)
+    RMP_SIGNATURE_SIPHASH = 2, // First bytes of SipHash-2-4(key + salt, msg), much cheaper
+} rmp_signature_version_e;
+
 typedef struct rmp_peer_s
 {
     air_addr_t addr;                    // The addr for the peer we've seen
@@ -53,8 +110,17 @@ typedef struct rmp_peer_s
     time_ticks_t last_seen;             // Last time we've seen this peer via p2p
     time_ticks_t last_info_update;      // Last time we got the device info for this peer
     time_ticks_t last_info_req;         // Last time we requested device info from this peer
+    time_ticks_t rtt;                   // Smoothed fragment round trip time, 0 if unknown
+    time_ticks_t rtt_var;               // Its mean deviation
 } rmp_peer_t;
 
+// Links for the free list and the timer wheel lists, -1 terminated
+typedef struct rmp_peer_link_s
+{
+    int16_t prev;
+    int16_t next;
+} rmp_peer_link_t;
+
 typedef struct rmp_msg_s
 {
     air_addr_t src;
@@ -64,12 +130,14 @@ typedef struct rmp_msg_s
     const void *payload;
     size_t payload_size;
     bool has_signature;
+    uint8_t signature_version; // From rmp_signature_version_e, if has_signature
     uint8_t signature[RMP_SIGNATURE_SIZE];
 } rmp_msg_t;
 
 typedef struct rmp_req_s
 {
     bool is_authenticated; // True iff request is loopback or signed
+    uint8_t transport;     // rmp_transport_type_e the request came from, RMP_TRANSPORT_COUNT for loopback and reassembled messages
     rmp_msg_t *msg;
     void (*resp)(const void *resp_data, const void *payload, size_t size);
     const void *resp_data;
@@ -87,9 +155,69 @@ typedef struct rmp_port_s
 typedef struct rmp_transport_s
 {
     rmp_transport_send_f send;
+    size_t max_payload_size;  // Bigger messages are fragmented
+    size_t max_fragment_size; // Biggest fragment, including its header
+    unsigned fragment_window; // Fragments sent without being acknowledged
     void *user_data;
 } rmp_transport_t;
 
+// Fragmented message being sent. Fragments are retransmitted until
+// acknowledged, so the payload is copied here.
+typedef struct rmp_outgoing_s
+{
+    bool in_use;
+    uint8_t id;
+    air_addr_t dst;
+    uint8_t src_port;
+    uint8_t dst_port;
+    uint16_t size;
+    uint16_t fragment_size;                  // Data bytes per fragment
+    uint8_t count;                           // Number of fragments
+    uint8_t window;                          // Fragments sent without being acknowledged
+    uint8_t retries;                         // Timeouts without progress
+    uint32_t acked;                          // Bitmask of fragments the receiver has
+    uint32_t acked_via[RMP_TRANSPORT_COUNT]; // Bitmask of fragments in the acks received from each transport
+    uint32_t in_flight;                      // Bitmask of fragments sent but not acknowledged
+    uint32_t retransmitted;                  // Bitmask of fragments sent more than once
+    uint16_t next_seq;                       // Transmission counter
+    uint16_t sent_seq[RMP_MAX_FRAGMENTS];    // Of the last transmission of each fragment
+    uint8_t sent_via[RMP_MAX_FRAGMENTS];     // Transport of the last transmission of each fragment
+    time_ticks_t sent_at[RMP_MAX_FRAGMENTS]; // Of the last transmission of each fragment, 0 if not sent
+    time_ticks_t retry_at;                   // Resend in_flight fragments if nothing is acknowledged by then
+    time_ticks_t retry_delay;                // Doubled on each retry
+    uint8_t payload[RMP_MAX_FRAGMENTED_PAYLOAD_SIZE];
+} rmp_outgoing_t;
+
+// Fragmented message being received
+typedef struct rmp_reassembly_s
+{
+    bool in_use;
+    bool delivering; // Complete, being delivered without holding fragments_lock
+    bool is_signed;  // All fragments were signed
+    uint8_t id;
+    air_addr_t src;
+    uint8_t src_port;
+    uint8_t dst_port;
+    uint8_t signature_version;
+    uint16_t size;
+    uint8_t count;
+    uint32_t received; // Bitmask of received fragments
+    time_ticks_t last_update;
+    uint8_t payload[RMP_MAX_FRAGMENTED_PAYLOAD_SIZE];
+} rmp_reassembly_t;
+
+// Fragmented message already received. Fragments retransmitted after
+// the message is complete are acknowledged again instead of starting
+// a new reassembly, which would never complete.
+typedef struct rmp_completed_s
+{
+    air_addr_t src;
+    uint8_t id;
+    uint8_t count;
+    uint16_t size;
+    time_ticks_t completed_at; // 0 if unused
+} rmp_completed_t;
+
 typedef struct rmp_s
 {
     struct
@@ -101,9 +229,25 @@ typedef struct rmp_s
         time_ticks_t next_p2p_ping;
         time_ticks_t next_device_info;
         const rmp_port_t *device_port;
+        const rmp_port_t *fragment_port;
         rmp_peer_t peers[RMP_MAX_PEERS];
+        int16_t peer_index[RMP_PEER_INDEX_SIZE]; // Indexes into peers, -1 if empty
+        rmp_peer_link_t peer_links[RMP_MAX_PEERS];
+        int16_t free_peers;                        // Free list, singly linked
+        int16_t peer_wheel[RMP_PEER_WHEEL_SLOTS];  // P2P peers by last_seen
+        time_ticks_t peer_wheel_next;              // Next wheel slot to sweep, in RMP_PEER_WHEEL_RESOLUTION units
+        time_ticks_t next_peers_info;
         rmp_port_t ports[RMP_MAX_PORTS];
         rmp_transport_t transports[RMP_TRANSPORT_COUNT];
+        // Fragments are sent from any task calling rmp_send(), and
+        // received from the RC and P2P tasks, while rmp_update()
+        // retransmits them. This protects the fields below.
+        SemaphoreHandle_t fragments_lock;
+        uint8_t next_fragmented_id;
+        rmp_outgoing_t outgoing[RMP_MAX_OUTGOING_FRAGMENTED];
+        rmp_reassembly_t reassemblies[RMP_MAX_REASSEMBLIES];
+        rmp_completed_t completed[RMP_MAX_COMPLETED_FRAGMENTED];
+        unsigned next_completed; // Oldest entry in completed
     } internal;
 } rmp_t;
 
@@ -119,7 +263,10 @@ bool rmp_can_authenticate_peer(rmp_t *rmp, air_addr_t *addr);
 bool rmp_has_p2p_peer(rmp_t *rmp, air_addr_t *addr);
 void rmp_get_p2p_counts(rmp_t *rmp, int *tx_count, int *rx_count, bool *has_pairing_as_peer);
 
-// Open/close ports and send
+// Open/close ports and send. Unicast payloads up to
+// RMP_MAX_FRAGMENTED_PAYLOAD_SIZE are fragmented if they don't fit
+// in a transport payload. In that case, true means the message was
+// queued.
 const rmp_port_t *rmp_open_port(rmp_t *rmp, uint8_t number, rmp_port_f handler, void *user_data);
 void rmp_close_port(rmp_t *rmp, const rmp_port_t *port);
 bool rmp_send(rmp_t *rmp, const rmp_port_t *port, air_addr_t dst, int dst_port, const void *payload, size_t size);
@@ -127,5 +274,8 @@ bool rmp_send_flags(rmp_t *rmp, const rmp_port_t *port, air_addr_t dst, int dst_
 bool rmp_send_loopback(rmp_t *rmp, const rmp_port_t *port, int dst_port, const void *payload, size_t size);
 
 // Transports
-void rmp_set_transport(rmp_t *rmp, rmp_transport_type_e type, rmp_transport_send_f send, void *user_data);
+void rmp_set_transport(rmp_t *rmp, rmp_transport_type_e type, rmp_transport_send_f send, size_t max_payload_size, void *user_data);
+// Overrides RMP_MAX_FRAGMENT_SIZE and RMP_FRAGMENT_WINDOW for a transport.
+// Must be called after rmp_set_transport().
+void rmp_set_transport_fragments(rmp_t *rmp, rmp_transport_type_e type, size_t max_fragment_size, unsigned window);
 void rmp_process_message(rmp_t *rmp, rmp_msg_t *msg, rmp_transport_type_e source);
@@ -15,6 +15,7 @@ typedef enum {
     RMP_AIR_MSG_DPORT = 1 << 3,
     RMP_AIR_MSG_SIGNED = 1 << 4,
     RMP_AIR_MSG_BROADCAST = 1 << 5,
+    RMP_AIR_MSG_SIPHASH = 1 << 6, // With RMP_AIR_MSG_SIGNED, signature is RMP_SIGNATURE_SIPHASH
 } rmp_air_msg_flags_e;
 
 void rmp_air_init(rmp_air_t *rmp_air, rmp_t *rmp, air_addr_t *addr, air_stream_t *stream)
@@ -44,7 +45,7 @@ bool rmp_air_encode(rmp_air_t *rmp_air, rmp_msg_t *msg)
     // RMP yet.
     if (air_addr_is_broadcast(&msg->dst) || air_addr_equals(&msg->dst, &rmp_air->bound_addr))
     {
-        uint8_t buf[512];
+        uint8_t buf[RMP_AIR_MAX_ENCODED_SIZE];
         int pos = 1;
         uint8_t flags = 0;
         if (!air_addr_equals(&rmp_air->addr, &msg->src))
@@ -79,6 +80,10 @@ bool rmp_air_encode(rmp_air_t *rmp_air, rmp_msg_t *msg)
         if (msg->has_signature)
         {
             flags |= RMP_AIR_MSG_SIGNED;
+            if (msg->signature_version == RMP_SIGNATURE_SIPHASH)
+            {
+                flags |= RMP_AIR_MSG_SIPHASH;
+            }
             memcpy(&buf[pos], msg->signature, RMP_SIGNATURE_SIZE);
             pos += RMP_SIGNATURE_SIZE;
         }
@@ -97,7 +102,11 @@ bool rmp_air_encode(rmp_air_t *rmp_air, rmp_msg_t *msg)
         }
 
         buf[0] = flags;
-        air_stream_feed_output_cmd(rmp_air->stream, AIR_CMD_RMP, buf, pos);
+        if (air_stream_feed_output_cmd(rmp_air->stream, AIR_CMD_RMP, buf, pos) == 0)
+        {
+            LOG_D(TAG, "No space for message of size %u in the air stream", pos);
+            return false;
+        }
         return true;
     }
 
@@ -176,12 +185,14 @@ void rmp_air_decode(rmp_air_t *rmp_air, const void *data, size_t size)
     {
         ENSURE_REMAINING_BYTES(RMP_SIGNATURE_SIZE, RMP_AIR_MSG_SIGNED);
         msg.has_signature = true;
+        msg.signature_version = (flags & RMP_AIR_MSG_SIPHASH) ? RMP_SIGNATURE_SIPHASH : RMP_SIGNATURE_MD5;
         memcpy(msg.signature, ptr, RMP_SIGNATURE_SIZE);
         ptr += RMP_SIGNATURE_SIZE;
     }
     else
     {
         msg.has_signature = false;
+        msg.signature_version = 0;
     }
 
     msg.payload_size = remaining_bytes();
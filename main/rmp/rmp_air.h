@@ -4,10 +4,26 @@
 #include <stddef.h>
 
 #include "air/air.h"
+#include "air/air_stream.h"
 
-typedef struct air_stream_s air_stream_t;
-typedef struct rmp_s rmp_t;
-typedef struct rmp_msg_s rmp_msg_t;
+#include "rmp/rmp.h"
+
+// Biggest encoded message, with room for all the optional fields
+#define RMP_AIR_MAX_ENCODED_SIZE 512
+#define RMP_AIR_MAX_HEADER_SIZE (1 + AIR_ADDR_LENGTH + 1 + AIR_ADDR_LENGTH + 1 + RMP_SIGNATURE_SIZE)
+#define RMP_AIR_MAX_PAYLOAD_SIZE (RMP_AIR_MAX_ENCODED_SIZE - RMP_AIR_MAX_HEADER_SIZE)
+// Space taken in the air stream output by a message with the given
+// payload size, if every byte needs stuffing: start-stop, then the
+// stuffed cmd, its 2 byte size and the encoded message.
+#define RMP_AIR_MAX_STREAM_SIZE(payload_size) (1 + 2 * (1 + 2 + RMP_AIR_MAX_HEADER_SIZE + (payload_size)))
+// Fragments sent over RC are small enough for a whole window of them
+// to fit in half of the air stream output, even in the worst case.
+// The other half is left for channels, telemetry and other commands.
+#define RMP_AIR_FRAGMENT_WINDOW 2
+#define RMP_AIR_MAX_FRAGMENT_SIZE ((AIR_STREAM_OUTPUT_BUFFER_CAPACITY / 2 / RMP_AIR_FRAGMENT_WINDOW - 1) / 2 - 1 - 2 - RMP_AIR_MAX_HEADER_SIZE)
+
+_Static_assert(RMP_AIR_MAX_STREAM_SIZE(RMP_AIR_MAX_PAYLOAD_SIZE) <= AIR_STREAM_OUTPUT_BUFFER_CAPACITY, "RMP_AIR_MAX_PAYLOAD_SIZE doesn't fit in the air stream");
+_Static_assert(RMP_AIR_FRAGMENT_WINDOW * RMP_AIR_MAX_STREAM_SIZE(RMP_AIR_MAX_FRAGMENT_SIZE) <= AIR_STREAM_OUTPUT_BUFFER_CAPACITY / 2, "RMP_AIR_MAX_FRAGMENT_SIZE too big");
 
 typedef struct rmp_air_s
 {
@@ -19,5 +35,7 @@ typedef struct rmp_air_s
 
 void rmp_air_init(rmp_air_t *rmp_air, rmp_t *rmp, air_addr_t *addr, air_stream_t *stream);
 void rmp_air_set_bound_addr(rmp_air_t *rmp_air, air_addr_t *bound_addr);
+// Returns false if the message can't be sent over the air or there's
+// no space for it in the air stream output right now.
 bool rmp_air_encode(rmp_air_t *rmp_air, rmp_msg_t *msg);
 void rmp_air_decode(rmp_air_t *rmp_air, const void *data, size_t size);
\ No newline at end of file
@@ -5,6 +5,7 @@ void data_state_init(data_state_t *ds)
     ds->dirty_since = 0;
     ds->last_sent = 0;
     ds->last_update = 0;
+    ds->last_change = 0;
     data_state_reset_ack(ds);
 }
 
@@ -28,6 +29,7 @@ void data_state_update(data_state_t *ds, bool changed, time_micros_t now)
         {
             ds->dirty_since = now;
         }
+        ds->last_change = now;
     }
     ds->last_update = now;
 }
@@ -15,6 +15,10 @@ typedef struct data_state_s
     time_micros_t last_sent;
     // Last time the data was received from the input.
     time_micros_t last_update;
+    // Last time the data changed. Unlike dirty_since, it's not
+    // cleared when the data is sent, so consumers other than the
+    // output can track changes by comparing it.
+    time_micros_t last_change;
     int ack_at_seq;
     bool ack_received;
 } data_state_t;
@@ -22,7 +26,9 @@ typedef struct data_state_s
 void data_state_init(data_state_t *ds);
 uint32_t data_state_score(data_state_t *ds, time_micros_t now);
 void data_state_update(data_state_t *ds, bool changed, time_micros_t now);
+inline bool data_state_is_dirty(const data_state_t *ds) { return ds->dirty_since > 0; }
 inline time_micros_t data_state_get_last_update(const data_state_t *ds) { return ds->last_update; }
+inline time_micros_t data_state_get_last_change(const data_state_t *ds) { return ds->last_change; }
 void data_state_sent(data_state_t *ds, int ack_at_seq, time_micros_t now);
 // Stop the ACK if it's in progress
 void data_state_stop_ack(data_state_t *ds);
@@ -0,0 +1,92 @@
+#include "fec.h"
+
+// Codeword positions are parity[0], parity[1], data[0]...data[size-1], with
+// position j having the locator alpha^j. The generator polynomial has
+// alpha^0 and alpha^1 as roots, using x^8 + x^4 + x^3 + x^2 + 1 as the
+// field polynomial with alpha = 2.
+#define FEC_GF_POLY 0x1D
+// 1 / (1 + alpha)
+#define FEC_GF_INV_1_PLUS_ALPHA 0xF4
+
+static uint8_t fec_gf_mul_alpha(uint8_t v)
+{
+    return (v << 1) ^ ((v & 0x80) ? FEC_GF_POLY : 0);
+}
+
+static uint8_t fec_gf_mul(uint8_t a, uint8_t b)
+{
+    uint8_t r = 0;
+    while (b)
+    {
+        if (b & 1)
+        {
+            r ^= a;
+        }
+        a = fec_gf_mul_alpha(a);
+        b >>= 1;
+    }
+    return r;
+}
+
+// Calculates s0 = sum(data[i]) and s1 = sum(data[i] * alpha^i)
+static void fec_rs_syndromes(const uint8_t *data, size_t size, uint8_t *s0, uint8_t *s1)
+{
+    uint8_t a = 0;
+    uint8_t b = 0;
+    for (size_t ii = size; ii > 0; ii--)
+    {
+        a ^= data[ii - 1];
+        b = fec_gf_mul_alpha(b) ^ data[ii - 1];
+    }
+    *s0 = a;
+    *s1 = b;
+}
+
+void fec_rs_encode(const void *data, size_t size, uint8_t *parity)
+{
+    uint8_t a;
+    uint8_t b;
+    fec_rs_syndromes(data, size, &a, &b);
+    // data starts at position 2
+    b = fec_gf_mul_alpha(fec_gf_mul_alpha(b));
+    // Solve p0 + p1 = a, p0 + p1 * alpha = b
+    parity[1] = fec_gf_mul(a ^ b, FEC_GF_INV_1_PLUS_ALPHA);
+    parity[0] = a ^ parity[1];
+}
+
+bool fec_rs_decode(void *data, size_t size, uint8_t *parity)
+{
+    uint8_t a;
+    uint8_t b;
+    fec_rs_syndromes(data, size, &a, &b);
+    uint8_t s0 = a ^ parity[0] ^ parity[1];
+    uint8_t s1 = fec_gf_mul_alpha(fec_gf_mul_alpha(b)) ^ parity[0] ^ fec_gf_mul_alpha(parity[1]);
+    if (s0 == 0 && s1 == 0)
+    {
+        return true;
+    }
+    if (s0 == 0 || s1 == 0)
+    {
+        // More than one error
+        return false;
+    }
+    // Single error with magnitude s0 at position j where s1 = s0 * alpha^j
+    uint8_t v = s0;
+    for (size_t jj = 0; jj < size + FEC_RS_PARITY_SIZE; jj++)
+    {
+        if (v == s1)
+        {
+            if (jj < FEC_RS_PARITY_SIZE)
+            {
+                parity[jj] ^= s0;
+            }
+            else
+            {
+                ((uint8_t *)data)[jj - FEC_RS_PARITY_SIZE] ^= s0;
+            }
+            return true;
+        }
+        v = fec_gf_mul_alpha(v);
+    }
+    return false;
+}
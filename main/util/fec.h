@@ -0,0 +1,17 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+// Reed-Solomon code over GF(2^8) with 2 parity bytes, which allows
+// correcting a single corrupted byte (any number of flipped bits within
+// it) in data + parity. Data might be up to FEC_RS_MAX_DATA_SIZE bytes.
+#define FEC_RS_PARITY_SIZE 2
+#define FEC_RS_MAX_DATA_SIZE (255 - FEC_RS_PARITY_SIZE)
+
+void fec_rs_encode(const void *data, size_t size, uint8_t *parity);
+// Returns true if data + parity contained no errors or a single byte
+// error which was corrected in place. Note that a multiple byte error
+// might be miscorrected, so data must still be validated by other means.
+bool fec_rs_decode(void *data, size_t size, uint8_t *parity);
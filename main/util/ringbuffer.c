@@ -1,5 +1,7 @@
 #include <string.h>
 
+#include "macros.h"
+
 #include "ringbuffer.h"
 
 bool ring_buffer_really_push(ring_buffer_t *rb, const void *item, bool force)
@@ -32,6 +34,34 @@ bool ring_buffer_force_push(ring_buffer_t *rb, const void *item)
     return ring_buffer_really_push(rb, item, true);
 }
 
+bool ring_buffer_push_n(ring_buffer_t *rb, const void *items, size_t count)
+{
+    if (rb->capacity - rb->count < count)
+    {
+        return false;
+    }
+    // Copy in at most 2 chunks: up to the end of the buffer and
+    // then from its start.
+    size_t size = count * rb->sz;
+    size_t first = MIN(size, (size_t)((char *)rb->buffer_end - (char *)rb->head));
+    memcpy(rb->head, items, first);
+    if (first < size)
+    {
+        memcpy(rb->buffer, (const char *)items + first, size - first);
+        rb->head = (char *)rb->buffer + (size - first);
+    }
+    else
+    {
+        rb->head = (char *)rb->head + first;
+        if (rb->head == rb->buffer_end)
+        {
+            rb->head = rb->buffer;
+        }
+    }
+    rb->count += count;
+    return true;
+}
+
 bool ring_buffer_pop(ring_buffer_t *rb, void *item)
 {
     if (!ring_buffer_peek(rb, item))
@@ -41,6 +71,29 @@ bool ring_buffer_pop(ring_buffer_t *rb, void *item)
     return ring_buffer_discard(rb);
 }
 
+size_t ring_buffer_pop_n(ring_buffer_t *rb, void *items, size_t count)
+{
+    count = MIN(count, rb->count);
+    size_t size = count * rb->sz;
+    size_t first = MIN(size, (size_t)((char *)rb->buffer_end - (char *)rb->tail));
+    memcpy(items, rb->tail, first);
+    if (first < size)
+    {
+        memcpy((char *)items + first, rb->buffer, size - first);
+        rb->tail = (char *)rb->buffer + (size - first);
+    }
+    else
+    {
+        rb->tail = (char *)rb->tail + first;
+        if (rb->tail == rb->buffer_end)
+        {
+            rb->tail = rb->buffer;
+        }
+    }
+    rb->count -= count;
+    return count;
+}
+
 bool ring_buffer_peek(ring_buffer_t *rb, void *item)
 {
     if (rb->count == 0)
@@ -79,4 +132,9 @@ void ring_buffer_empty(ring_buffer_t *rb)
 size_t ring_buffer_count(const ring_buffer_t *rb)
 {
     return rb->count;
-}
\ No newline at end of file
+}
+
+size_t ring_buffer_available(const ring_buffer_t *rb)
+{
+    return rb->capacity - rb->count;
+}
@@ -40,8 +40,15 @@ typedef struct ring_buffer_s
 
 bool ring_buffer_push(ring_buffer_t *rb, const void *item);
 bool ring_buffer_force_push(ring_buffer_t *rb, const void *item);
+// Pushes count items at once. Returns false without pushing
+// anything if there's not enough space for all of them.
+bool ring_buffer_push_n(ring_buffer_t *rb, const void *items, size_t count);
 bool ring_buffer_pop(ring_buffer_t *rb, void *item);
+// Pops up to count items, returning the number of popped items.
+size_t ring_buffer_pop_n(ring_buffer_t *rb, void *items, size_t count);
 bool ring_buffer_peek(ring_buffer_t *rb, void *item);
 bool ring_buffer_discard(ring_buffer_t *rb);
 void ring_buffer_empty(ring_buffer_t *rb);
 size_t ring_buffer_count(const ring_buffer_t *rb);
+// Number of items which can be pushed before the buffer is full
+size_t ring_buffer_available(const ring_buffer_t *rb);
@@ -0,0 +1,88 @@
+#include "siphash.h"
+
+#define SIPHASH_ROTL(x, b) (uint64_t)(((x) << (b)) | ((x) >> (64 - (b))))
+
+static uint64_t siphash_load64(const uint8_t *p)
+{
+    return ((uint64_t)p[0]) | ((uint64_t)p[1] << 8) | ((uint64_t)p[2] << 16) | ((uint64_t)p[3] << 24) |
+           ((uint64_t)p[4] << 32) | ((uint64_t)p[5] << 40) | ((uint64_t)p[6] << 48) | ((uint64_t)p[7] << 56);
+}
+
+static void siphash_round(siphash_t *s)
+{
+    s->v0 += s->v1;
+    s->v1 = SIPHASH_ROTL(s->v1, 13);
+    s->v1 ^= s->v0;
+    s->v0 = SIPHASH_ROTL(s->v0, 32);
+    s->v2 += s->v3;
+    s->v3 = SIPHASH_ROTL(s->v3, 16);
+    s->v3 ^= s->v2;
+    s->v0 += s->v3;
+    s->v3 = SIPHASH_ROTL(s->v3, 21);
+    s->v3 ^= s->v0;
+    s->v2 += s->v1;
+    s->v1 = SIPHASH_ROTL(s->v1, 17);
+    s->v1 ^= s->v2;
+    s->v2 = SIPHASH_ROTL(s->v2, 32);
+}
+
+static void siphash_compress(siphash_t *s, uint64_t m)
+{
+    s->v3 ^= m;
+    siphash_round(s);
+    siphash_round(s);
+    s->v0 ^= m;
+}
+
+void siphash_init(siphash_t *s, const uint8_t *key)
+{
+    uint64_t k0 = siphash_load64(key);
+    uint64_t k1 = siphash_load64(key + 8);
+    s->v0 = k0 ^ 0x736f6d6570736575ull;
+    s->v1 = k1 ^ 0x646f72616e646f6dull;
+    s->v2 = k0 ^ 0x6c7967656e657261ull;
+    s->v3 = k1 ^ 0x7465646279746573ull;
+    s->tail = 0;
+    s->size = 0;
+}
+
+void siphash_update(siphash_t *s, const void *data, size_t size)
+{
+    const uint8_t *p = data;
+    const uint8_t *end = p + size;
+    unsigned used = s->size & 7;
+    s->size += size;
+    // Complete the pending word first
+    if (used)
+    {
+        for (; used < 8 && p < end; used++)
+        {
+            s->tail |= ((uint64_t)*p++) << (8 * used);
+        }
+        if (used < 8)
+        {
+            return;
+        }
+        siphash_compress(s, s->tail);
+        s->tail = 0;
+    }
+    for (; end - p >= 8; p += 8)
+    {
+        siphash_compress(s, siphash_load64(p));
+    }
+    for (unsigned ii = 0; p < end; ii++)
+    {
+        s->tail |= ((uint64_t)*p++) << (8 * ii);
+    }
+}
+
+uint64_t siphash_final(siphash_t *s)
+{
+    siphash_compress(s, s->tail | ((uint64_t)(s->size & 0xff) << 56));
+    s->v2 ^= 0xff;
+    siphash_round(s);
+    siphash_round(s);
+    siphash_round(s);
+    siphash_round(s);
+    return s->v0 ^ s->v1 ^ s->v2 ^ s->v3;
+}
@@ -0,0 +1,20 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+// SipHash-2-4 keyed hash, see https://131002.net/siphash/. Data can
+// be fed in several calls to siphash_update().
+
+#define SIPHASH_KEY_SIZE 16
+
+typedef struct siphash_s
+{
+    uint64_t v0, v1, v2, v3;
+    uint64_t tail; // Bytes not yet processed, little endian
+    size_t size;   // Total bytes fed
+} siphash_t;
+
+void siphash_init(siphash_t *s, const uint8_t *key);
+void siphash_update(siphash_t *s, const void *data, size_t size);
+uint64_t siphash_final(siphash_t *s);
@@ -0,0 +1,94 @@
+#include <string.h>
+
+#include "macros.h"
+
+#include "spsc_ringbuffer.h"
+
+// The producer publishes head with release semantics after copying
+// the items and the consumer publishes tail with release semantics
+// after reading them, so each side always sees fully written data.
+#define SPSC_LOAD_ACQUIRE(p) __atomic_load_n(p, __ATOMIC_ACQUIRE)
+#define SPSC_LOAD_RELAXED(p) __atomic_load_n(p, __ATOMIC_RELAXED)
+#define SPSC_STORE_RELEASE(p, v) __atomic_store_n(p, v, __ATOMIC_RELEASE)
+
+static inline size_t spsc_ring_buffer_capacity(const spsc_ring_buffer_t *rb)
+{
+    return rb->mask + 1;
+}
+
+size_t spsc_ring_buffer_push_n(spsc_ring_buffer_t *rb, const void *items, size_t count)
+{
+    unsigned head = SPSC_LOAD_RELAXED(&rb->head);
+    unsigned tail = SPSC_LOAD_ACQUIRE(&rb->tail);
+    count = MIN(count, spsc_ring_buffer_capacity(rb) - (head - tail));
+    if (count == 0)
+    {
+        return 0;
+    }
+    unsigned pos = head & rb->mask;
+    size_t first = MIN(count, spsc_ring_buffer_capacity(rb) - pos);
+    memcpy(&rb->buffer[pos * rb->sz], items, first * rb->sz);
+    if (first < count)
+    {
+        memcpy(rb->buffer, (const unsigned char *)items + first * rb->sz, (count - first) * rb->sz);
+    }
+    SPSC_STORE_RELEASE(&rb->head, head + count);
+    return count;
+}
+
+bool spsc_ring_buffer_push(spsc_ring_buffer_t *rb, const void *item)
+{
+    return spsc_ring_buffer_push_n(rb, item, 1) == 1;
+}
+
+const void *spsc_ring_buffer_peek_contiguous(spsc_ring_buffer_t *rb, size_t *count)
+{
+    unsigned head = SPSC_LOAD_ACQUIRE(&rb->head);
+    unsigned tail = SPSC_LOAD_RELAXED(&rb->tail);
+    unsigned pos = tail & rb->mask;
+    *count = MIN(head - tail, spsc_ring_buffer_capacity(rb) - pos);
+    return *count > 0 ? &rb->buffer[pos * rb->sz] : NULL;
+}
+
+void spsc_ring_buffer_discard_n(spsc_ring_buffer_t *rb, size_t count)
+{
+    unsigned head = SPSC_LOAD_ACQUIRE(&rb->head);
+    unsigned tail = SPSC_LOAD_RELAXED(&rb->tail);
+    count = MIN(count, head - tail);
+    SPSC_STORE_RELEASE(&rb->tail, tail + count);
+}
+
+size_t spsc_ring_buffer_pop_n(spsc_ring_buffer_t *rb, void *items, size_t count)
+{
+    unsigned head = SPSC_LOAD_ACQUIRE(&rb->head);
+    unsigned tail = SPSC_LOAD_RELAXED(&rb->tail);
+    count = MIN(count, head - tail);
+    if (count == 0)
+    {
+        return 0;
+    }
+    unsigned pos = tail & rb->mask;
+    size_t first = MIN(count, spsc_ring_buffer_capacity(rb) - pos);
+    memcpy(items, &rb->buffer[pos * rb->sz], first * rb->sz);
+    if (first < count)
+    {
+        memcpy((unsigned char *)items + first * rb->sz, rb->buffer, (count - first) * rb->sz);
+    }
+    SPSC_STORE_RELEASE(&rb->tail, tail + count);
+    return count;
+}
+
+bool spsc_ring_buffer_pop(spsc_ring_buffer_t *rb, void *item)
+{
+    return spsc_ring_buffer_pop_n(rb, item, 1) == 1;
+}
+
+void spsc_ring_buffer_empty(spsc_ring_buffer_t *rb)
+{
+    SPSC_STORE_RELEASE(&rb->tail, SPSC_LOAD_ACQUIRE(&rb->head));
+}
+
+size_t spsc_ring_buffer_count(const spsc_ring_buffer_t *rb)
+{
+    return SPSC_LOAD_ACQUIRE(&rb->head) - SPSC_LOAD_ACQUIRE(&rb->tail);
+}
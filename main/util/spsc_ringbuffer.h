@@ -0,0 +1,58 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+
+// Lock-free ring buffer for a single producer and a single consumer
+// (e.g. an ISR pushing and a task popping). Capacity must be a power
+// of two, since indexes are free running and masked on access.
+// Functions marked as producer must only be called from the producer
+// side and functions marked as consumer only from the consumer side.
+
+#define SPSC_RING_BUFFER_DECLARE(name, typ, cap)                                             \
+    struct                                                                                   \
+    {                                                                                        \
+        spsc_ring_buffer_t name;                                                             \
+        char __##name##_backing[sizeof(typ) * cap];                                          \
+        char __##name##_pow2_check[((cap) > 0 && ((cap) & ((cap)-1)) == 0) ? 1 : -1];        \
+    }
+
+#define SPSC_RING_BUFFER_INIT(rb, typ, cap)    \
+    do                                         \
+    {                                          \
+        (rb)->buffer = (rb)->buffer_ptr;       \
+        (rb)->mask = (cap)-1;                  \
+        (rb)->sz = sizeof(typ);                \
+        (rb)->head = 0;                        \
+        (rb)->tail = 0;                        \
+    } while (0)
+
+typedef struct spsc_ring_buffer_s
+{
+    unsigned char *buffer;
+    unsigned mask;
+    unsigned sz;
+    unsigned head; // Only written by the producer
+    unsigned tail; // Only written by the consumer
+    unsigned char buffer_ptr[];
+} spsc_ring_buffer_t;
+
+// Producer
+bool spsc_ring_buffer_push(spsc_ring_buffer_t *rb, const void *item);
+// Pushes up to count items, returns the number of pushed items.
+size_t spsc_ring_buffer_push_n(spsc_ring_buffer_t *rb, const void *items, size_t count);
+
+// Consumer
+bool spsc_ring_buffer_pop(spsc_ring_buffer_t *rb, void *item);
+// Pops up to count items, returns the number of popped items.
+size_t spsc_ring_buffer_pop_n(spsc_ring_buffer_t *rb, void *items, size_t count);
+// Returns a pointer to the items which can be read without wrapping
+// around and stores their number in count, or NULL if the buffer is
+// empty. Use spsc_ring_buffer_discard_n() after consuming them.
+const void *spsc_ring_buffer_peek_contiguous(spsc_ring_buffer_t *rb, size_t *count);
+void spsc_ring_buffer_discard_n(spsc_ring_buffer_t *rb, size_t count);
+void spsc_ring_buffer_empty(spsc_ring_buffer_t *rb);
+
+// Either side. Note that the count might change immediately
+// after returning if the other side is active.
+size_t spsc_ring_buffer_count(const spsc_ring_buffer_t *rb);
@@ -42,13 +42,6 @@ inline bool time_ticks_ellapsed(time_ticks_t since, time_ticks_t now, time_ticks
 }
 
 inline time_micros_t time_micros_now(void) { return esp_timer_get_time(); }
-inline void time_micros_delay(time_micros_t delay)
-{
-    time_micros_t end = time_micros_now() + delay;
-    while (time_micros_now() < end)
-    {
-    }
-}
 
 unsigned long millis(void);
 bool millis_ellapsed(unsigned long since_ms, unsigned long now_ms, unsigned long interval_ms);
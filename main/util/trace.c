@@ -0,0 +1,159 @@
+#include "util/trace.h"
+
+#if defined(USE_TRACE)
+
+#include <stdio.h>
+#include <string.h>
+
+#include <esp_attr.h>
+
+#include <hal/log.h>
+
+#include "util/macros.h"
+#include "util/time.h"
+
+static const char *TAG = "Trace";
+
+// Entries store the point in the upper bits and the lower bits of
+// the timestamp in the lower ones, so each one is written with a
+// single store. Deltas are calculated modulo 2^28us (~268s).
+#define TRACE_TIME_BITS 28
+#define TRACE_TIME_MASK ((1u << TRACE_TIME_BITS) - 1)
+#define TRACE_PRINT_INTERVAL SECS_TO_MICROS(10)
+
+_Static_assert((TRACE_RING_SIZE & (TRACE_RING_SIZE - 1)) == 0, "TRACE_RING_SIZE must be a power of 2");
+_Static_assert(TRACE_POINT_COUNT <= (1 << (32 - TRACE_TIME_BITS)), "too many trace points");
+
+static uint32_t trace_ring[TRACE_RING_SIZE];
+static unsigned trace_pos; // Free running, written by trace_record()
+
+// Decoder state, only used by trace_update()
+static struct
+{
+    unsigned pos;
+    int last_point; // Last point seen in the current packet, -1 if none
+    uint32_t last_time;
+    unsigned overflows;
+    time_micros_t next_print;
+    trace_histogram_t histograms[TRACE_POINT_COUNT];
+} trace_decoder = {
+    .last_point = -1,
+};
+
+static const char *trace_point_names[] = {
+    [TRACE_POINT_LORA_DIO0] = "DIO0",
+    [TRACE_POINT_LORA_CALLBACK] = "CALLBACK",
+    [TRACE_POINT_AIR_DECODED] = "DECODED",
+    [TRACE_POINT_CHANNELS_UPDATED] = "CHANNELS",
+    [TRACE_POINT_OUTPUT_FRAME] = "OUTPUT",
+};
+
+ARRAY_ASSERT_COUNT(trace_point_names, TRACE_POINT_COUNT, "invalid trace_point_names");
+
+void IRAM_ATTR trace_record(trace_point_e point)
+{
+    uint32_t entry = ((uint32_t)point << TRACE_TIME_BITS) | (time_micros_now() & TRACE_TIME_MASK);
+    unsigned pos = __atomic_fetch_add(&trace_pos, 1, __ATOMIC_RELAXED);
+    trace_ring[pos & (TRACE_RING_SIZE - 1)] = entry;
+}
+
+static void trace_histogram_add(trace_histogram_t *h, uint32_t delta)
+{
+    unsigned bucket = delta > 0 ? 31 - __builtin_clz(delta) : 0;
+    h->buckets[MIN(bucket, TRACE_HISTOGRAM_BUCKETS - 1)]++;
+    h->min = h->count == 0 ? delta : MIN(h->min, delta);
+    h->max = MAX(h->max, delta);
+    h->sum += delta;
+    h->count++;
+}
+
+static void trace_decode(uint32_t entry)
+{
+    int point = entry >> TRACE_TIME_BITS;
+    uint32_t time = entry & TRACE_TIME_MASK;
+    if (point == TRACE_POINT_LORA_DIO0)
+    {
+        // New packet (or TX done, which won't be followed by
+        // the rest of the stages)
+        trace_decoder.last_point = point;
+        trace_decoder.last_time = time;
+        return;
+    }
+    // Only count a stage if it follows the previous one for the same
+    // packet, otherwise e.g. output frames sent without a new packet
+    // would be accounted.
+    if (trace_decoder.last_point >= 0 && point == trace_decoder.last_point + 1)
+    {
+        uint32_t delta = (time - trace_decoder.last_time) & TRACE_TIME_MASK;
+        trace_histogram_add(&trace_decoder.histograms[point], delta);
+        trace_decoder.last_point = point;
+        trace_decoder.last_time = time;
+        if (point == TRACE_POINT_COUNT - 1)
+        {
+            trace_decoder.last_point = -1;
+        }
+    }
+}
+
+static void trace_print(void)
+{
+    char buf[TRACE_HISTOGRAM_BUCKETS * 11 + 1];
+    LOG_I(TAG, "Latency since previous stage in us, buckets are powers of 2 (%u ring overflows)", trace_decoder.overflows);
+    for (int ii = TRACE_POINT_LORA_DIO0 + 1; ii < TRACE_POINT_COUNT; ii++)
+    {
+        const trace_histogram_t *h = &trace_decoder.histograms[ii];
+        if (h->count == 0)
+        {
+            LOG_I(TAG, "%s: no samples", trace_point_names[ii]);
+            continue;
+        }
+        int pos = 0;
+        for (int jj = 0; jj < TRACE_HISTOGRAM_BUCKETS; jj++)
+        {
+            pos += snprintf(&buf[pos], sizeof(buf) - pos, " %u", h->buckets[jj]);
+        }
+        LOG_I(TAG, "%s: n=%u min=%u avg=%u max=%u |%s", trace_point_names[ii],
+              h->count, h->min, (uint32_t)(h->sum / h->count), h->max, buf);
+    }
+}
+
+void trace_update(void)
+{
+    unsigned end = __atomic_load_n(&trace_pos, __ATOMIC_RELAXED);
+    if (end - trace_decoder.pos > TRACE_RING_SIZE)
+    {
+        // Writers wrapped around, skip what was lost
+        trace_decoder.overflows++;
+        trace_decoder.pos = end - TRACE_RING_SIZE;
+        trace_decoder.last_point = -1;
+    }
+    // Note that an entry might have been claimed but not written yet
+    // if we're racing with trace_record(). In that case we'll read a
+    // stale entry, which is fine for statistics.
+    for (; trace_decoder.pos != end; trace_decoder.pos++)
+    {
+        trace_decode(trace_ring[trace_decoder.pos & (TRACE_RING_SIZE - 1)]);
+    }
+    time_micros_t now = time_micros_now();
+    if (trace_decoder.next_print == 0)
+    {
+        trace_decoder.next_print = now + TRACE_PRINT_INTERVAL;
+    }
+    else if (trace_decoder.next_print < now)
+    {
+        trace_print();
+        trace_decoder.next_print = now + TRACE_PRINT_INTERVAL;
+    }
+}
+
+void trace_get_histogram(trace_point_e point, trace_histogram_t *h)
+{
+    memcpy(h, &trace_decoder.histograms[point], sizeof(*h));
+}
+
+unsigned trace_get_overflows(void)
+{
+    return trace_decoder.overflows;
+}
+
+#endif
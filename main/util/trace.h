@@ -0,0 +1,59 @@
+#pragma once
+
+// Latency tracepoints for the RX pipeline. When USE_TRACE is not
+// defined (see CONFIG_RAVEN_TRACE), TRACE() compiles to nothing.
+// Otherwise, each TRACE() stores a timestamp in a fixed size ring,
+// which is decoded by trace_update() into per stage histograms of the
+// time elapsed since the previous stage of the same packet. These
+// are periodically printed to the log.
+
+typedef enum {
+    TRACE_POINT_LORA_DIO0,        // DIO0 interrupt
+    TRACE_POINT_LORA_CALLBACK,    // lora_callback_task() handling RX done
+    TRACE_POINT_AIR_DECODED,      // input_air validated the packet
+    TRACE_POINT_CHANNELS_UPDATED, // Channels from the packet written to rc_data_t
+    TRACE_POINT_OUTPUT_FRAME,     // Output wrote a frame to the FC
+    TRACE_POINT_COUNT,
+} trace_point_e;
+
+#if defined(USE_TRACE)
+
+#include <stdint.h>
+
+// Must be a power of 2
+#define TRACE_RING_SIZE 256
+// Bucket n counts deltas in [2^n, 2^(n+1)) us, except the first one
+// (which includes 0) and the last one (which includes anything larger).
+#define TRACE_HISTOGRAM_BUCKETS 16
+
+typedef struct trace_histogram_s
+{
+    uint32_t buckets[TRACE_HISTOGRAM_BUCKETS];
+    uint32_t count;
+    uint32_t min;
+    uint32_t max;
+    uint64_t sum;
+} trace_histogram_t;
+
+// Safe to call from ISRs
+void trace_record(trace_point_e point);
+// Decodes the tracepoints recorded since the last call and prints the
+// histograms from time to time. Must be called periodically from a
+// single task, often enough so the ring doesn't wrap between calls.
+void trace_update(void);
+// Copies the histogram decoded so far for the given point. Must be
+// called from the task calling trace_update().
+void trace_get_histogram(trace_point_e point, trace_histogram_t *h);
+// Returns how many times the ring wrapped before trace_update() could
+// decode it.
+unsigned trace_get_overflows(void);
+
+#define TRACE(point) trace_record(point)
+#define TRACE_UPDATE() trace_update()
+
+#else
+
+#define TRACE(point) ((void)0)
+#define TRACE_UPDATE() ((void)0)
+
+#endif
@@ -0,0 +1,30 @@
+#pragma once
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <time.h>
+
+// Helpers for the host benchmarks. Results are printed, not checked,
+// since they depend on the machine running them.
+
+static inline uint64_t bench_now_ns(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+static int bench_cmp_u32(const void *a, const void *b)
+{
+    uint32_t x = *(const uint32_t *)a;
+    uint32_t y = *(const uint32_t *)b;
+    return x < y ? -1 : x > y;
+}
+
+// Sorts samples in place and returns the given percentile (0-100)
+static inline uint32_t bench_percentile(uint32_t *samples, unsigned count, unsigned pct)
+{
+    qsort(samples, count, sizeof(*samples), bench_cmp_u32);
+    unsigned idx = (count - 1) * pct / 100;
+    return samples[idx];
+}
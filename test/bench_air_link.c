@@ -0,0 +1,507 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "air/air.h"
+#include "air/air_lora.h"
+
+#include "config/config.h"
+#include "config/settings.h"
+
+#include "input/input_air.h"
+
+#include "io/io.h"
+#include "io/lora.h"
+
+#include "output/output_air.h"
+
+#include "rc/rc_data.h"
+
+#include "rmp/rmp.h"
+
+#include "util/macros.h"
+
+#include "bench.h"
+#include "host.h"
+#include "sx127x_sim.h"
+
+// Deterministic simulation of the air link between a TX (output_air)
+// and an RX (input_air), each one with its own simulated SX127x. Time
+// is virtual and both ends are updated from a single thread, like the
+// RC task does on each device. Packets are moved between the chips
+// when a transmission ends, after its time on air as calculated from
+// the modem registers. A packet is received if the other chip has been
+// listening on the same frequency and modem settings since before the
+// transmission started and the packet is not lost. DIO0 interrupts are
+// delivered after a configurable latency, running what lora.c does in
+// its callback task.
+//
+// For each mode, reports the uplink packet rate, the LQ seen by the
+// simulator and by input_air, the latency from a stick change in the TX
+// to the new value in the RX and the downlink telemetry throughput and
+// latency. Fails when the uplink LQ drops more than LQ_LOSS_TOLERANCE
+// below the random loss, which happens when a lost packet makes the RX
+// miss the next one too.
+
+#define SIM_DURATION SECS_TO_MICROS(10)
+#define SIM_IRQ_LATENCY 50
+#define STICK_PHASE 1300  // Added to the interval between stick changes, so they happen at every cycle phase
+#define STICK_TOLERANCE 8 // Channels might be sent with reduced resolution
+#define TELEMETRY_INTERVAL MILLIS_TO_MICROS(20)
+#define TELEMETRY_FIRST_VALUE 1000
+#define MAX_SAMPLES 4096
+#define SIM_RSSI 100 // RegPktRssiValue, -57dBm in the HF band
+#define SIM_SNR (8 * 4)
+#define LQ_LOSS_TOLERANCE 3 // %
+
+#define MODE_MASK 0x07
+#define MODE_TX 0x03
+#define MODE_RX_CONTINUOUS 0x05
+#define MODE_RX_SINGLE 0x06
+#define REG_OP_MODE 0x01
+#define REG_FIFO_TX_BASE_ADDR 0x0e
+#define REG_IRQ_FLAGS 0x12
+#define REG_MODEM_CONFIG_1 0x1d
+#define REG_MODEM_CONFIG_2 0x1e
+#define REG_PAYLOAD_LENGTH 0x22
+#define REG_SYNC_WORD 0x39
+#define REG_DIO_MAPPING_1 0x40
+#define IRQ_TX_DONE 0x08
+#define IRQ_RX_DONE 0x40
+
+typedef struct
+{
+    lora_t *lora;
+    int chip;
+    air_addr_t addr;
+    rc_data_t data;
+    rmp_t rmp;
+    time_micros_t tx_start; // 0 if not transmitting
+    time_micros_t tx_end;
+    time_micros_t irq_at; // TIME_MICROS_MAX if no interrupt is pending
+    unsigned sent;
+    unsigned received;
+} device_t;
+
+typedef struct
+{
+    uint32_t samples[MAX_SAMPLES];
+    unsigned count;
+} latency_t;
+
+static lora_t tx_lora = {.cs = GPIO_NUM_18, .dio0 = GPIO_NUM_26, .output_type = LORA_OUTPUT_PA_BOOST};
+static lora_t rx_lora = {.cs = GPIO_NUM_5, .dio0 = GPIO_NUM_27, .output_type = LORA_OUTPUT_PA_BOOST};
+static device_t tx;
+static device_t rx;
+static output_air_t tx_output;
+static input_air_t rx_input;
+static air_lora_mode_e sim_mode;
+static double sim_loss;
+static uint64_t rng_state;
+static unsigned telemetry_updates;
+static bool toa_mismatch;
+
+// Stubs for the parts of the firmware which aren't simulated
+
+bool config_get_pairing(air_pairing_t *pairing, air_addr_t *addr)
+{
+    return false;
+}
+
+bool config_get_air_info(air_info_t *info, const air_addr_t *addr)
+{
+    info->capabilities = AIR_CAP_FREQUENCY_868MHZ | AIR_CAP_FREQUENCY_915MHZ | AIR_CAP_FEC |
+                         AIR_CAP_CHANNEL_DELTA | AIR_CAP_FREQ_SUBSTITUTION | AIR_CAP_MSP_COMPRESSION;
+    info->max_tx_power = 20;
+    info->channels = RC_CHANNELS_NUM;
+    // A single mode, so the mode controller never switches
+    info->modes = 1 << sim_mode;
+    return true;
+}
+
+bool config_set_air_name(const air_addr_t *addr, const char *name)
+{
+    return true;
+}
+
+void settings_add_listener(setting_changed_f callback, void *user_data)
+{
+}
+
+void settings_remove_listener(setting_changed_f callback, void *user_data)
+{
+}
+
+setting_t *settings_get_key(const char *key)
+{
+    return NULL;
+}
+
+bool settings_get_key_bool(const char *key)
+{
+    return false;
+}
+
+void setting_set_string(setting_t *setting, const char *s)
+{
+}
+
+int io_read(io_t *io, void *buf, size_t size, time_ticks_t timeout)
+{
+    return -1;
+}
+
+int io_write(io_t *io, const void *buf, size_t size)
+{
+    return -1;
+}
+
+static uint32_t rng_next(void)
+{
+    rng_state ^= rng_state << 13;
+    rng_state ^= rng_state >> 7;
+    rng_state ^= rng_state << 17;
+    return rng_state;
+}
+
+static void device_init(device_t *dev, lora_t *lora, int n)
+{
+    memset(&dev->data, 0, sizeof(dev->data));
+    dev->data.channels_num = RC_CHANNELS_NUM;
+    dev->lora = lora;
+    dev->addr = (air_addr_t){.addr = {0x24, 0x0a, 0xc4, 0, 0, n}};
+    dev->tx_start = 0;
+    dev->irq_at = TIME_MICROS_MAX;
+    dev->sent = 0;
+    dev->received = 0;
+    lora_init(lora);
+    dev->chip = sx127x_sim_chip_for_cs(lora->cs);
+    rmp_init(&dev->rmp, &dev->addr);
+    dev->data.rmp = &dev->rmp;
+}
+
+static bool device_is_receiving(device_t *dev, const device_t *from)
+{
+    sx127x_sim_select(from->chip);
+    uint32_t frf = sx127x_sim_frf();
+    uint8_t config1 = sx127x_sim_reg(REG_MODEM_CONFIG_1);
+    uint8_t config2 = sx127x_sim_reg(REG_MODEM_CONFIG_2);
+    uint8_t sync_word = sx127x_sim_reg(REG_SYNC_WORD);
+    uint8_t size = sx127x_sim_reg(REG_PAYLOAD_LENGTH);
+    sx127x_sim_select(dev->chip);
+    uint8_t mode = sx127x_sim_reg(REG_OP_MODE) & MODE_MASK;
+    return (mode == MODE_RX_CONTINUOUS || mode == MODE_RX_SINGLE) &&
+           sx127x_sim_mode_changed_at() <= from->tx_start &&
+           sx127x_sim_frf() == frf &&
+           sx127x_sim_reg(REG_MODEM_CONFIG_1) == config1 &&
+           sx127x_sim_reg(REG_MODEM_CONFIG_2) == config2 &&
+           sx127x_sim_reg(REG_SYNC_WORD) == sync_word &&
+           // Implicit header, the receiver needs the right size
+           sx127x_sim_reg(REG_PAYLOAD_LENGTH) == size;
+}
+
+// Notices transmissions started by the last update
+static void device_poll_tx(device_t *dev, time_micros_t now)
+{
+    sx127x_sim_select(dev->chip);
+    if ((sx127x_sim_reg(REG_OP_MODE) & MODE_MASK) != MODE_TX)
+    {
+        // Not transmitting or aborted before finishing
+        dev->tx_start = 0;
+        return;
+    }
+    if (dev->tx_start == 0)
+    {
+        dev->tx_start = sx127x_sim_mode_changed_at();
+        dev->tx_end = dev->tx_start + sx127x_sim_time_on_air();
+        if (dev == &tx)
+        {
+            // The cycle times in air_lora.c are derived from this
+            bool fec = air_io_uses_fec(&tx_output.air, sim_mode);
+            size_t size = sx127x_sim_reg(REG_PAYLOAD_LENGTH);
+            if (size != air_tx_packet_size(fec) ||
+                air_lora_time_on_air(sim_mode, size) != sx127x_sim_time_on_air())
+            {
+                toa_mismatch = true;
+            }
+        }
+    }
+}
+
+static void device_finish_tx(device_t *dev, device_t *peer, time_micros_t now)
+{
+    sx127x_sim_select(dev->chip);
+    uint8_t size = sx127x_sim_reg(REG_PAYLOAD_LENGTH);
+    uint8_t payload[256];
+    const uint8_t *fifo = sx127x_sim_fifo();
+    uint8_t base = sx127x_sim_reg(REG_FIFO_TX_BASE_ADDR);
+    for (unsigned ii = 0; ii < size; ii++)
+    {
+        payload[ii] = fifo[(uint8_t)(base + ii)];
+    }
+    bool lost = rng_next() < sim_loss * UINT32_MAX;
+    bool received = !lost && device_is_receiving(peer, dev);
+    sx127x_sim_select(dev->chip);
+    sx127x_sim_finish_tx();
+    dev->tx_start = 0;
+    dev->sent++;
+    dev->irq_at = now + SIM_IRQ_LATENCY;
+    if (received)
+    {
+        sx127x_sim_select(peer->chip);
+        sx127x_sim_receive(payload, size, SIM_SNR, SIM_RSSI);
+        peer->irq_at = now + SIM_IRQ_LATENCY;
+        peer->received++;
+    }
+}
+
+// Same as lora_callback_task() in lora.c, if DIO0 is mapped to the
+// IRQ that was raised and it hasn't been cleared yet.
+static void device_irq(device_t *dev)
+{
+    dev->irq_at = TIME_MICROS_MAX;
+    sx127x_sim_select(dev->chip);
+    uint8_t mapping = sx127x_sim_reg(REG_DIO_MAPPING_1) >> 6;
+    uint8_t flags = sx127x_sim_reg(REG_IRQ_FLAGS);
+    lora_callback_t callback = dev->lora->state.callback;
+    if (mapping == 0 && (flags & IRQ_RX_DONE))
+    {
+        dev->lora->state.rx_done = true;
+        if (callback)
+        {
+            callback(dev->lora, LORA_CALLBACK_REASON_RX_DONE, dev->lora->state.callback_data);
+        }
+    }
+    else if (mapping == 1 && (flags & IRQ_TX_DONE))
+    {
+        dev->lora->state.tx_done = true;
+        if (callback)
+        {
+            callback(dev->lora, LORA_CALLBACK_REASON_TX_DONE, dev->lora->state.callback_data);
+        }
+    }
+}
+
+static time_micros_t device_next_event(const device_t *dev)
+{
+    return MIN(dev->tx_start ? dev->tx_end : TIME_MICROS_MAX, dev->irq_at);
+}
+
+static void device_process_events(device_t *dev, device_t *peer, time_micros_t now)
+{
+    if (dev->tx_start && dev->tx_end <= now)
+    {
+        device_finish_tx(dev, peer, now);
+    }
+    if (dev->irq_at <= now)
+    {
+        device_irq(dev);
+    }
+}
+
+static void latency_add(latency_t *lat, time_micros_t since, time_micros_t now)
+{
+    if (lat->count < MAX_SAMPLES)
+    {
+        lat->samples[lat->count++] = now - since;
+    }
+}
+
+static void latency_print(latency_t *lat)
+{
+    if (lat->count > 0)
+    {
+        printf("%5.1f %5.1f %5.1f  ", bench_percentile(lat->samples, lat->count, 50) / 1000.0,
+               bench_percentile(lat->samples, lat->count, 90) / 1000.0,
+               bench_percentile(lat->samples, lat->count, 99) / 1000.0);
+    }
+    else
+    {
+        printf("%5s %5s %5s  ", "-", "-", "-");
+    }
+}
+
+static void tx_telemetry_changed(void *user_data, int telemetry_id, bool changed, time_micros_t now)
+{
+    if (changed && TELEMETRY_IS_DOWNLINK(telemetry_id))
+    {
+        telemetry_updates++;
+    }
+}
+
+static bool sim_run(air_lora_mode_e mode, double loss)
+{
+    static latency_t stick;
+    static latency_t telemetry;
+    static time_micros_t telemetry_set_at[MAX_SAMPLES];
+    memset(&stick, 0, sizeof(stick));
+    memset(&telemetry, 0, sizeof(telemetry));
+    sim_mode = mode;
+    sim_loss = loss;
+    rng_state = 88172645463325252ull;
+    telemetry_updates = 0;
+    toa_mismatch = false;
+
+    sx127x_sim_reset();
+    device_init(&tx, &tx_lora, 1);
+    device_init(&rx, &rx_lora, 2);
+
+    // Same setup as rc_reconfigure_output() and rc_reconfigure_input()
+    output_air_init(&tx_output, tx.addr, tx.lora, AIR_LORA_BAND_DEFAULT, &tx.rmp);
+    air_pairing_t pairing = {.addr = rx.addr, .key = 0x12345678};
+    air_io_bind(&tx_output.air, &pairing);
+    input_air_init(&rx_input, rx.addr, rx.lora, AIR_LORA_BAND_DEFAULT, &rx.rmp);
+    pairing.addr = tx.addr;
+    air_io_bind(&rx_input.air, &pairing);
+
+    output_air_config_t config = {.tx_power = 17};
+    tx.data.failsafe.output = &tx_output.output.failsafe;
+    rx.data.failsafe.input = &rx_input.input.failsafe;
+    if (!output_open(&tx.data, &tx_output.output, &config) || !input_open(&rx.data, &rx_input.input, NULL))
+    {
+        printf("could not open the air output or input\n");
+        exit(1);
+    }
+    rc_data_add_telemetry_listener(&tx.data, tx_telemetry_changed, NULL);
+
+    time_micros_t now = time_micros_now();
+    for (int ii = 0; ii < RC_CHANNELS_NUM; ii++)
+    {
+        rc_data_update_channel(&tx.data, ii, (RC_CHANNEL_MIN_VALUE + RC_CHANNEL_MAX_VALUE) / 2, now);
+    }
+    time_micros_t end = now + SIM_DURATION;
+    // Let the link sync before measuring
+    time_micros_t measure_from = now + SECS_TO_MICROS(1);
+    time_micros_t next_stick = measure_from;
+    time_micros_t next_telemetry = measure_from;
+    // Hold each stick position for a few cycles, so it's never replaced
+    // before being sent
+    time_micros_t stick_interval = 3 * air_lora_full_cycle_time(mode) + STICK_PHASE;
+    int stick_target = 0;
+    time_micros_t stick_changed_at = 0; // 0 if the RX has seen the last change
+    unsigned stick_count = 0;
+    unsigned telemetry_count = 0;
+    int32_t telemetry_seen = 0;
+    unsigned tx_sent_before = 0;
+    unsigned rx_received_before = 0;
+    unsigned rx_sent_before = 0;
+    unsigned tx_received_before = 0;
+    int rx_success_before = 0;
+    int rx_errors_before = 0;
+
+    while (now < end)
+    {
+        if (now >= measure_from && tx_sent_before == 0)
+        {
+            tx_sent_before = tx.sent;
+            rx_received_before = rx.received;
+            rx_sent_before = rx.sent;
+            tx_received_before = tx.received;
+            rx_success_before = rx_input.rx_success;
+            rx_errors_before = rx_input.rx_errors;
+            telemetry_updates = 0;
+        }
+        device_process_events(&tx, &rx, now);
+        device_process_events(&rx, &tx, now);
+        if (now >= next_stick)
+        {
+            // Alternate between distant values
+            stick_target = RC_CHANNEL_MIN_VALUE + 100 + (stick_count % 2) * 1200 + (stick_count % 7) * 50;
+            stick_changed_at = now;
+            stick_count++;
+            rc_data_update_channel(&tx.data, 0, stick_target, now);
+            next_stick += stick_interval;
+        }
+        if (now >= next_telemetry && telemetry_count < MAX_SAMPLES)
+        {
+            // Altitude identifies the update, to measure its latency
+            telemetry_set_at[telemetry_count] = now;
+            (void)TELEMETRY_SET_I32(&rx.data, TELEMETRY_ID_ALTITUDE, TELEMETRY_FIRST_VALUE + telemetry_count, now);
+            (void)TELEMETRY_SET_I16(&rx.data, TELEMETRY_ID_ATTITUDE_X, telemetry_count % 1800, now);
+            (void)TELEMETRY_SET_I16(&rx.data, TELEMETRY_ID_ATTITUDE_Y, (telemetry_count * 3) % 1800, now);
+            telemetry_count++;
+            next_telemetry += TELEMETRY_INTERVAL;
+        }
+        input_update(&rx_input.input, now);
+        output_update(&tx_output.output, now);
+        device_poll_tx(&tx, now);
+        device_poll_tx(&rx, now);
+        if (stick_changed_at && abs(rx.data.channels[0].value - stick_target) <= STICK_TOLERANCE)
+        {
+            latency_add(&stick, stick_changed_at, now);
+            stick_changed_at = 0;
+        }
+        int32_t altitude = TELEMETRY_GET_I32(&tx.data, TELEMETRY_ID_ALTITUDE);
+        if (altitude != telemetry_seen && altitude >= TELEMETRY_FIRST_VALUE)
+        {
+            latency_add(&telemetry, telemetry_set_at[altitude - TELEMETRY_FIRST_VALUE], now);
+            telemetry_seen = altitude;
+        }
+
+        time_micros_t next = MIN(output_next_update(&tx_output.output, now), input_next_update(&rx_input.input, now));
+        next = MIN(next, MIN(device_next_event(&tx), device_next_event(&rx)));
+        next = MIN(next, MIN(next_stick, next_telemetry));
+        // Reading the clock moves it forward, so this never spins
+        time_micros_t clock = time_micros_now();
+        if (next > clock)
+        {
+            host_clock_advance(next - clock);
+        }
+        now = time_micros_now();
+    }
+
+    if (toa_mismatch)
+    {
+        printf("simulated time on air doesn't match air_lora_time_on_air()\n");
+        exit(1);
+    }
+
+    double secs = (double)(end - measure_from) / SECS_TO_MICROS(1);
+    unsigned up_sent = tx.sent - tx_sent_before;
+    unsigned up_received = rx.received - rx_received_before;
+    unsigned down_sent = rx.sent - rx_sent_before;
+    unsigned down_received = tx.received - tx_received_before;
+    int fw_success = rx_input.rx_success - rx_success_before;
+    int fw_errors = rx_input.rx_errors - rx_errors_before;
+    bool fec = air_io_uses_fec(&tx_output.air, mode);
+    printf("MODE_%d %3.0f%%  %6.2f  %6.1f  %5.1f  %5.1f  %5.1f  ",
+           mode, loss * 100, air_lora_time_on_air(mode, air_tx_packet_size(fec)) / 1000.0, up_sent / secs,
+           up_sent ? up_received * 100.0 / up_sent : 0, down_sent ? down_received * 100.0 / down_sent : 0,
+           fw_success + fw_errors ? fw_success * 100.0 / (fw_success + fw_errors) : 0);
+    latency_print(&stick);
+    printf("%6.1f  ", telemetry_updates / secs);
+    latency_print(&telemetry);
+    printf("\n");
+
+    input_close(&rx_input.input, NULL);
+    output_close(&tx_output.output, &config);
+    rc_data_remove_telemetry_listener(&tx.data, tx_telemetry_changed, NULL);
+
+    if (up_sent == 0 || up_received * 100.0 / up_sent < (1 - loss) * 100 - LQ_LOSS_TOLERANCE)
+    {
+        printf("uplink LQ too low for %.0f%% loss\n", loss * 100);
+        return false;
+    }
+    return true;
+}
+
+int main(void)
+{
+    static const double losses[] = {0, 0.1};
+    bool ok = true;
+    // Never goes back between runs, like in the firmware
+    host_clock_set_virtual(SECS_TO_MICROS(1));
+    host_clock_set_step(1);
+    printf("Simulated %u s per run, %u us IRQ latency. Latencies in ms, telemetry in values/s\n",
+           (unsigned)(SIM_DURATION / SECS_TO_MICROS(1)), SIM_IRQ_LATENCY);
+    printf("mode   loss  up ToA   pkt/s  up LQ  dn LQ  fw LQ  stick p50   p90   p99  telem/s  telem p50   p90   p99\n");
+    // MODE_1 has no rank, so it's never used
+    for (int rank = air_lora_mode_rank(AIR_LORA_MODE_FASTEST); rank <= air_lora_mode_rank(AIR_LORA_MODE_LONGEST); rank++)
+    {
+        for (unsigned ii = 0; ii < ARRAY_COUNT(losses); ii++)
+        {
+            ok &= sim_run(air_lora_mode_from_rank(rank), losses[ii]);
+        }
+    }
+    return ok ? 0 : 1;
+}
@@ -0,0 +1,320 @@
+#include <math.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "air/air_lora.h"
+#include "air/air_mode_ctrl.h"
+
+#include "util/lpf.h"
+#include "util/macros.h"
+
+#include "bench.h"
+
+// Replays link traces through a model of the TX/RX link and reports
+// how air_mode_ctrl_t and the fixed SNR thresholds it replaced behave:
+// time spent in each mode, mode switches and failsafes. Fails when
+// air_mode_ctrl_t doesn't use the fastest mode for at least half the
+// time the mean SNR margin allows switching to it.
+//
+// Recorded flight logs aren't available, so the traces are generated
+// from a log distance path loss model with per packet fading:
+//  - Packets are lost when their SNR is below the mode minimum.
+//  - The SNR reaches the controller like it does in output_air: the
+//    worst of the RX value (sent as telemetry) and the TX one, filtered
+//    with the same cutoff as air_io_t.
+//  - A mode switch is applied after the next downlink packet acks it.
+//  - Both ends fall back to the longest mode on failsafe.
+
+#define NOISE_FLOOR_DBM -106.0
+#define FADING_SIGMA_DB 2.0
+#define TELEMETRY_INTERVAL_US MILLIS_TO_MICROS(100)
+#define START_US SECS_TO_MICROS(1)
+
+// From the removed output_air code
+#define LEGACY_FASTER_SNR (4 * 4)
+#define LEGACY_LONGER_SNR (1.5 * 4)
+#define LEGACY_WAIT_INTERVAL_US MILLIS_TO_MICROS(1000)
+
+// Same as AIR_MODE_CTRL_FASTER_MARGIN
+#define FASTER_MARGIN (11.5 * 4)
+
+typedef double (*trace_rssi_f)(double t);
+
+typedef struct
+{
+    const char *name;
+    trace_rssi_f rssi;
+    double duration; // s
+} trace_t;
+
+typedef struct
+{
+    time_micros_t faster_at;
+    time_micros_t longer_at;
+} legacy_ctrl_t;
+
+typedef struct
+{
+    time_micros_t time_in_mode[AIR_LORA_MODE_LAST + 1];
+    unsigned switches;
+    unsigned failsafes;
+    time_micros_t failsafe_time;
+    time_micros_t fastest_allowed_time; // Mean SNR allows the fastest mode
+    unsigned uplink_sent;
+    unsigned uplink_received;
+} run_stats_t;
+
+static uint64_t rng_state = 88172645463325252ull;
+
+static uint32_t rng_next(void)
+{
+    rng_state ^= rng_state << 13;
+    rng_state ^= rng_state >> 7;
+    rng_state ^= rng_state << 17;
+    return rng_state;
+}
+
+static double rng_gaussian(void)
+{
+    // Box-Muller
+    double u1 = (rng_next() + 1.0) / 4294967297.0;
+    double u2 = (rng_next() + 1.0) / 4294967297.0;
+    return sqrt(-2 * log(u1)) * cos(2 * M_PI * u2);
+}
+
+static double rssi_at_distance(double meters)
+{
+    return -45 - 25 * log10(MAX(meters, 10) / 10);
+}
+
+// Quad cruising out at 15 m/s to 8km, then back
+static double trace_quad_out_and_back(double t)
+{
+    double d = t < 540 ? t * 15 : MAX(8100 - (t - 540) * 15, 0);
+    return rssi_at_distance(d);
+}
+
+// Wing flying out at 40 m/s to 9km, close to the MODE_5 limit, then back
+static double trace_wing_fast(double t)
+{
+    double d = t < 225 ? t * 40 : MAX(9000 - (t - 225) * 40, 0);
+    return rssi_at_distance(d);
+}
+
+// Loitering where the SNR is around the MODE_2 thresholds, with slow
+// shadowing as the craft turns.
+static double trace_hover_at_threshold(double t)
+{
+    return NOISE_FLOOR_DBM + 3 + 3 * sin(2 * M_PI * t / 7);
+}
+
+// Flying at 1km, going behind an obstacle for 3s every 20s
+static double trace_obstructions(double t)
+{
+    return rssi_at_distance(1000) - (fmod(t, 20) >= 17 ? 20 : 0);
+}
+
+static const trace_t traces[] = {
+    {"quad out and back", trace_quad_out_and_back, 1080},
+    {"wing fast out and back", trace_wing_fast, 460},
+    {"hover at threshold", trace_hover_at_threshold, 300},
+    {"obstructions", trace_obstructions, 300},
+};
+
+static air_lora_mode_e legacy_select(legacy_ctrl_t *ctrl, int snr, air_lora_mode_e current, time_micros_t now)
+{
+    air_lora_mode_e fastest = AIR_LORA_MODE_FASTEST;
+    air_lora_mode_e longest = AIR_LORA_MODE_LONGEST;
+    if (snr >= LEGACY_FASTER_SNR && current != fastest)
+    {
+        if (ctrl->faster_at == 0)
+        {
+            ctrl->faster_at = now + LEGACY_WAIT_INTERVAL_US;
+        }
+        else if (now > ctrl->faster_at)
+        {
+            return air_lora_mode_faster(current);
+        }
+    }
+    else if (snr <= LEGACY_LONGER_SNR && current != longest)
+    {
+        if (ctrl->longer_at == 0)
+        {
+            ctrl->longer_at = now + LEGACY_WAIT_INTERVAL_US;
+        }
+        else if (now > ctrl->longer_at)
+        {
+            return air_lora_mode_longer(current);
+        }
+    }
+    else
+    {
+        ctrl->faster_at = 0;
+        ctrl->longer_at = 0;
+    }
+    return current;
+}
+
+// Returns true iff a packet sent with the given mode and mean RSSI is
+// received, storing its SNR as reported by the modem (dB*4).
+static bool packet_receive(double mean_rssi, air_lora_mode_e mode, int *snr)
+{
+    double r = mean_rssi + rng_gaussian() * FADING_SIGMA_DB;
+    double s = r - NOISE_FLOOR_DBM;
+    if (s * 4 < air_lora_mode_min_snr(mode))
+    {
+        return false;
+    }
+    *snr = MIN(MAX(s * 4, INT8_MIN), INT8_MAX);
+    return true;
+}
+
+typedef struct
+{
+    air_lora_mode_e mode;
+    air_lora_mode_e requested;
+    air_mode_ctrl_t ctrl;
+    legacy_ctrl_t legacy_ctrl;
+} link_t;
+
+static void link_switch_mode(link_t *link, air_lora_mode_e mode, run_stats_t *stats)
+{
+    link->mode = mode;
+    link->requested = 0;
+    air_mode_ctrl_reset(&link->ctrl);
+    memset(&link->legacy_ctrl, 0, sizeof(link->legacy_ctrl));
+    stats->switches++;
+}
+
+static run_stats_t run_trace(const trace_t *trace, bool legacy)
+{
+    run_stats_t stats = {0};
+    link_t link = {.mode = AIR_LORA_MODE_LONGEST};
+    lpf_t tx_snr;
+    lpf_init(&tx_snr, 0.1);
+    rng_state = 88172645463325252ull;
+
+    air_mode_ctrl_init(&link.ctrl, AIR_LORA_MODE_FASTEST, AIR_LORA_MODE_LONGEST);
+    int rx_snr = 0;
+    time_micros_t now = START_US;
+    time_micros_t end = START_US + SECS_TO_MICROS(trace->duration);
+    time_micros_t last_uplink = now;
+    time_micros_t last_downlink = now;
+    time_micros_t next_telemetry = now;
+    bool in_failsafe = false;
+    for (unsigned seq = 0; now < end; seq++)
+    {
+        air_lora_mode_e mode = link.mode;
+        double rssi = trace->rssi((now - START_US) * 1e-6);
+        bool full = air_lora_cycle_is_full(mode, seq);
+        time_micros_t cycle = full ? air_lora_full_cycle_time(mode) : air_lora_uplink_cycle_time(mode);
+
+        if ((rssi - NOISE_FLOOR_DBM) * 4 >= air_lora_mode_min_snr(AIR_LORA_MODE_FASTEST) + FASTER_MARGIN)
+        {
+            stats.fastest_allowed_time += cycle;
+        }
+
+        int pkt_snr;
+        stats.uplink_sent++;
+        if (packet_receive(rssi, mode, &pkt_snr))
+        {
+            stats.uplink_received++;
+            rx_snr = pkt_snr;
+            last_uplink = now;
+        }
+        bool downlink = full && packet_receive(rssi, mode, &pkt_snr);
+        if (downlink)
+        {
+            lpf_update(&tx_snr, pkt_snr, now);
+            last_downlink = now;
+        }
+        if (last_uplink + air_lora_rx_failsafe_interval(mode) < now ||
+            last_downlink + air_lora_tx_failsafe_interval(mode) < now)
+        {
+            if (!in_failsafe)
+            {
+                stats.failsafes++;
+                in_failsafe = true;
+            }
+            stats.failsafe_time += cycle;
+            if (mode != AIR_LORA_MODE_LONGEST)
+            {
+                link_switch_mode(&link, AIR_LORA_MODE_LONGEST, &stats);
+            }
+        }
+        else if (downlink)
+        {
+            in_failsafe = false;
+        }
+
+        stats.time_in_mode[link.mode] += cycle;
+        now += cycle;
+
+        if (link.requested != 0 && downlink)
+        {
+            // Acked, both ends switch
+            link_switch_mode(&link, link.requested, &stats);
+            continue;
+        }
+        if (downlink && now >= next_telemetry)
+        {
+            // The RX SNR and LQ arrived as telemetry
+            next_telemetry = now + TELEMETRY_INTERVAL_US;
+            air_lora_mode_e selected;
+            if (legacy)
+            {
+                selected = legacy_select(&link.legacy_ctrl, rx_snr, mode, now);
+            }
+            else
+            {
+                air_mode_ctrl_update(&link.ctrl, MIN(rx_snr, lpf_value(&tx_snr)), now);
+                selected = air_mode_ctrl_select(&link.ctrl, mode, now);
+            }
+            if (link.requested == 0 && selected != mode)
+            {
+                link.requested = selected;
+            }
+        }
+    }
+    return stats;
+}
+
+static void print_stats(const char *name, const trace_t *trace, const run_stats_t *stats)
+{
+    printf("  %-10s", name);
+    for (int rank = 0; rank < AIR_LORA_MODE_COUNT - 1; rank++)
+    {
+        air_lora_mode_e mode = air_lora_mode_from_rank(rank);
+        printf(" %5.1f", 100.0 * stats->time_in_mode[mode] / SECS_TO_MICROS(trace->duration));
+    }
+    printf("  %8u  %9u  %7.1f  %6.1f\n", stats->switches, stats->failsafes, stats->failsafe_time * 1e-6,
+           100.0 * stats->uplink_received / stats->uplink_sent);
+}
+
+int main(void)
+{
+    bool ok = true;
+    printf("%% of time in each mode, mode switches, failsafe events and seconds in failsafe, uplink LQ\n");
+    for (int ii = 0; ii < ARRAY_COUNT(traces); ii++)
+    {
+        const trace_t *trace = &traces[ii];
+        printf("%s (%.0f s)\n", trace->name, trace->duration);
+        printf("  %-10s", "");
+        for (int rank = 0; rank < AIR_LORA_MODE_COUNT - 1; rank++)
+        {
+            printf("    M%d", air_lora_mode_from_rank(rank));
+        }
+        printf("  switches  failsafes  fs secs  uplink\n");
+        run_stats_t legacy = run_trace(trace, true);
+        run_stats_t ctrl = run_trace(trace, false);
+        print_stats("thresholds", trace, &legacy);
+        print_stats("mode_ctrl", trace, &ctrl);
+        if (ctrl.time_in_mode[AIR_LORA_MODE_FASTEST] * 2 < ctrl.fastest_allowed_time)
+        {
+            printf("  mode_ctrl used M%d for %.1fs, the SNR margin allowed it for %.1fs\n", AIR_LORA_MODE_FASTEST,
+                   ctrl.time_in_mode[AIR_LORA_MODE_FASTEST] * 1e-6, ctrl.fastest_allowed_time * 1e-6);
+            ok = false;
+        }
+    }
+    return ok ? 0 : 1;
+}
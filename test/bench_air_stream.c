@@ -0,0 +1,98 @@
+#include <stdio.h>
+#include <string.h>
+
+#include "air/air.h"
+#include "air/air_cmd.h"
+#include "air/air_stream.h"
+
+#include "util/macros.h"
+
+#include "bench.h"
+
+// Measures the air stream output (stuffing into the ring buffer and
+// popping it into packets) and input (unstuffing and decoding) paths
+// with command payloads of different sizes and stuffing ratios.
+
+#define ITERATIONS 20000
+#define PACKET_DATA_SIZE 3
+
+static unsigned received;
+
+static void cmd_received(void *user, air_cmd_e cmd, const void *data, size_t size, time_micros_t now)
+{
+    received++;
+}
+
+static void channel_received(void *user, unsigned chn, unsigned value, time_micros_t now)
+{
+}
+
+static void bench_payload(const char *name, const uint8_t *payload, size_t size)
+{
+    static air_stream_t tx;
+    static air_stream_t rx;
+    static uint8_t packets[AIR_STREAM_OUTPUT_BUFFER_CAPACITY + PACKET_DATA_SIZE];
+    air_stream_init(&tx, NULL, NULL, NULL, NULL);
+    air_stream_init(&rx, channel_received, NULL, cmd_received, NULL);
+    received = 0;
+    unsigned seq = 1;
+    uint64_t output_ns = 0;
+    uint64_t input_ns = 0;
+    size_t stream_bytes = 0;
+    for (int ii = 0; ii < ITERATIONS; ii++)
+    {
+        uint64_t start = bench_now_ns();
+        size_t n = air_stream_feed_output_cmd(&tx, AIR_CMD_RMP, payload, size);
+        // Packets are padded with start-stop bytes
+        size_t count = 0;
+        size_t popped;
+        while ((popped = air_stream_pop_output_n(&tx, &packets[count], PACKET_DATA_SIZE)) > 0)
+        {
+            count += popped;
+        }
+        size_t padded = (count + PACKET_DATA_SIZE - 1) / PACKET_DATA_SIZE * PACKET_DATA_SIZE;
+        memset(&packets[count], AIR_DATA_START_STOP, padded - count);
+        count = padded;
+        uint64_t mid = bench_now_ns();
+        for (size_t jj = 0; jj < count; jj += PACKET_DATA_SIZE)
+        {
+            air_stream_feed_input(&rx, seq++ % AIR_SEQ_COUNT, &packets[jj], PACKET_DATA_SIZE, 0);
+        }
+        // Terminates the frame
+        memset(packets, AIR_DATA_START_STOP, PACKET_DATA_SIZE);
+        air_stream_feed_input(&rx, seq++ % AIR_SEQ_COUNT, packets, PACKET_DATA_SIZE, 0);
+        uint64_t end = bench_now_ns();
+        output_ns += mid - start;
+        input_ns += end - mid;
+        stream_bytes += n;
+    }
+    if (received != ITERATIONS)
+    {
+        printf("%s: only %u of %u frames decoded\n", name, received, ITERATIONS);
+    }
+    double payload_bytes = (double)size * ITERATIONS;
+    printf("%-24s %4u %6.2f %10.1f %10.1f\n", name, (unsigned)size, stream_bytes / payload_bytes,
+           payload_bytes / output_ns * 1e3, payload_bytes / input_ns * 1e3);
+}
+
+int main(void)
+{
+    static uint8_t payload[512];
+    uint64_t state = 88172645463325252ull;
+    printf("%-24s %4s %6s %10s %10s\n", "payload", "size", "ratio", "out MB/s", "in MB/s");
+    const size_t sizes[] = {8, 64, 256, 480};
+    for (int ii = 0; ii < ARRAY_COUNT(sizes); ii++)
+    {
+        for (int jj = 0; jj < ARRAY_COUNT(payload); jj++)
+        {
+            state ^= state << 13;
+            state ^= state >> 7;
+            state ^= state << 17;
+            payload[jj] = state;
+        }
+        bench_payload("random", payload, sizes[ii]);
+        memset(payload, AIR_DATA_START_STOP, sizeof(payload));
+        bench_payload("all stuffed", payload, sizes[ii]);
+    }
+    return 0;
+}
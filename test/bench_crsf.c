@@ -0,0 +1,165 @@
+#include <stdio.h>
+#include <string.h>
+
+#include "protocols/crsf.h"
+
+#include "util/crc.h"
+#include "util/macros.h"
+
+#include "bench.h"
+#include "crsf_corpus.h"
+
+// Decoding throughput of the CRSF frames received from the radio,
+// using the generated corpus (see host/crsf_corpus.h). crsf_port_feed()
+// is compared with the decoder it replaced, copied below: bytes were
+// pushed one at a time after the address check, then the complete
+// frames were decoded and the rest moved to the front of the buffer.
+//
+// Data is fed per period, like input_crsf drains the ISR buffer when
+// the radio stops transmitting, and in fixed size spans. The old
+// decoder runs whenever its buffer fills, as it would otherwise drop
+// data with spans larger than a frame.
+
+#define CORPUS_PERIODS (250 * 60) // 1 minute
+#define ROUNDS 10
+
+typedef struct
+{
+    uint8_t buf[CRSF_FRAME_SIZE_MAX];
+    unsigned buf_pos;
+} legacy_port_t;
+
+static crsf_corpus_t corpus;
+static unsigned frames;
+static volatile unsigned sink; // Keeps the decoded data from being optimized away
+
+static void frame_callback(void *data, crsf_frame_t *frame)
+{
+    frames++;
+    sink += frame->header.type;
+}
+
+static bool legacy_push(legacy_port_t *port, uint8_t c)
+{
+    if (port->buf_pos < sizeof(port->buf))
+    {
+        port->buf[port->buf_pos++] = c;
+        return true;
+    }
+    return false;
+}
+
+static bool legacy_decode(legacy_port_t *port)
+{
+    int start = 0;
+    int end = port->buf_pos;
+    bool found = false;
+    while (end - start >= 2)
+    {
+        size_t frame_length = port->buf[start + 1];
+        size_t total_frame_size = frame_length + CRSF_FRAME_NOT_COUNTED_BYTES;
+        if (end - start < total_frame_size)
+        {
+            break;
+        }
+        crsf_frame_t *frame = (crsf_frame_t *)&port->buf[start];
+        uint8_t received_crc = port->buf[start + total_frame_size - 1];
+        uint8_t expected_crc = crc8_dvb_s2_bytes(&frame->header.type, crsf_frame_payload_size(frame) + 1);
+        if (received_crc == expected_crc)
+        {
+            found = true;
+            frame_callback(NULL, frame);
+        }
+        start += total_frame_size;
+    }
+    if (start > 0)
+    {
+        if (start != port->buf_pos)
+        {
+            memmove(port->buf, &port->buf[start], end - start);
+        }
+        port->buf_pos -= start;
+    }
+    return found;
+}
+
+static void legacy_feed(legacy_port_t *port, const uint8_t *data, size_t size)
+{
+    for (size_t ii = 0; ii < size; ii++)
+    {
+        if (port->buf_pos > 0 || data[ii] == CRSF_ADDRESS_CRSF_TRANSMITTER)
+        {
+            if (!legacy_push(port, data[ii]))
+            {
+                legacy_decode(port);
+                legacy_push(port, data[ii]);
+            }
+        }
+    }
+    legacy_decode(port);
+}
+
+// span 0 feeds a period at a time
+static uint64_t bench_decoder(bool legacy, size_t span)
+{
+    legacy_port_t legacy_port;
+    crsf_port_t port;
+    io_t io = {0};
+    frames = 0;
+    uint64_t start = bench_now_ns();
+    for (int round = 0; round < ROUNDS; round++)
+    {
+        legacy_port.buf_pos = 0;
+        crsf_port_init(&port, &io, frame_callback, NULL);
+        crsf_port_set_sync_addr(&port, CRSF_ADDRESS_CRSF_TRANSMITTER);
+        size_t pos = 0;
+        for (unsigned ii = 0; pos < corpus.size; ii++)
+        {
+            size_t end = span ? MIN(pos + span, corpus.size) : corpus.period_ends[ii];
+            if (legacy)
+            {
+                legacy_feed(&legacy_port, &corpus.data[pos], end - pos);
+            }
+            else
+            {
+                crsf_port_feed(&port, &corpus.data[pos], end - pos);
+            }
+            pos = end;
+        }
+    }
+    return bench_now_ns() - start;
+}
+
+static bool print_decoder(const char *name, size_t span)
+{
+    uint64_t legacy_ns = bench_decoder(true, span);
+    unsigned legacy_frames = frames;
+    uint64_t ns = bench_decoder(false, span);
+    double bytes = (double)corpus.size * ROUNDS;
+    printf("%-10s  %8.1f %8.1f  %8.1f %8.1f  %5.2fx\n", name, bytes / legacy_ns * 1e3, (double)legacy_ns / legacy_frames,
+           bytes / ns * 1e3, (double)ns / frames, (double)legacy_ns / ns);
+    if (legacy_frames != corpus.frames * ROUNDS || frames != corpus.frames * ROUNDS)
+    {
+        printf("decoded %u and %u frames, expected %u\n", legacy_frames, frames, corpus.frames * ROUNDS);
+        return false;
+    }
+    return true;
+}
+
+int main(void)
+{
+    static const size_t spans[] = {1, 16, 64, 128};
+    crsf_corpus_init(&corpus, CORPUS_PERIODS);
+    printf("%u frames, %u bytes, decoded %d times\n", corpus.frames, (unsigned)corpus.size, ROUNDS);
+    printf("%-10s  %17s  %17s\n", "", "memmove decoder", "crsf_port_feed");
+    printf("%-10s  %8s %8s  %8s %8s  %6s\n", "span", "MB/s", "ns/frame", "MB/s", "ns/frame", "speedup");
+    bool ok = print_decoder("period", 0);
+    for (int ii = 0; ii < ARRAY_COUNT(spans); ii++)
+    {
+        char name[16];
+        snprintf(name, sizeof(name), "%u", (unsigned)spans[ii]);
+        ok &= print_decoder(name, spans[ii]);
+    }
+    crsf_corpus_free(&corpus);
+    return ok ? 0 : 1;
+}
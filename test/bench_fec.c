@@ -0,0 +1,138 @@
+#include <stdio.h>
+#include <string.h>
+
+#include "air/air.h"
+#include "air/air_lora.h"
+
+#include "util/macros.h"
+
+#include "bench.h"
+
+// Simulates a binary symmetric channel and prints the packet success
+// rate (PSR) vs bit error rate (BER) for each mode, with and without
+// FEC. Packets which pass validation but don't match the sent ones
+// are counted as undetected errors.
+
+#define PACKETS 200000
+#define KEY 0x5a5aa5a5
+
+static uint64_t rng_state = 88172645463325252ull;
+
+static uint32_t rng_next(void)
+{
+    rng_state ^= rng_state << 13;
+    rng_state ^= rng_state >> 7;
+    rng_state ^= rng_state << 17;
+    return rng_state;
+}
+
+static void corrupt(void *buf, size_t size, double ber)
+{
+    uint8_t *p = buf;
+    uint32_t threshold = ber * UINT32_MAX;
+    for (size_t ii = 0; ii < size * 8; ii++)
+    {
+        if (rng_next() < threshold)
+        {
+            p[ii / 8] ^= 1 << (ii % 8);
+        }
+    }
+}
+
+typedef struct
+{
+    unsigned ok;
+    unsigned undetected;
+} bench_fec_result_t;
+
+static void bench_uplink(double ber, bool fec, bench_fec_result_t *res)
+{
+    memset(res, 0, sizeof(*res));
+    for (unsigned ii = 0; ii < PACKETS; ii++)
+    {
+        air_tx_fec_packet_t sent = {
+            .packet = {
+                .seq = ii,
+                .ch0 = rng_next(),
+                .ch1 = rng_next(),
+                .ch2 = rng_next(),
+                .ch3 = rng_next(),
+                .data = {rng_next(), rng_next()},
+            },
+        };
+        size_t size = air_tx_fec_packet_prepare(&sent, KEY, fec);
+        air_tx_fec_packet_t recv = sent;
+        corrupt(&recv, size, ber);
+        if (air_tx_fec_packet_validate(&recv, size, KEY, fec))
+        {
+            if (memcmp(&recv.packet, &sent.packet, sizeof(recv.packet)) == 0)
+            {
+                res->ok++;
+            }
+            else
+            {
+                res->undetected++;
+            }
+        }
+    }
+}
+
+static void bench_downlink(double ber, bool fec, bench_fec_result_t *res)
+{
+    memset(res, 0, sizeof(*res));
+    for (unsigned ii = 0; ii < PACKETS; ii++)
+    {
+        air_rx_fec_packet_t sent = {
+            .packet = {
+                .seq = ii,
+                .tx_seq = rng_next(),
+                .data = {rng_next(), rng_next(), rng_next()},
+            },
+        };
+        size_t size = air_rx_fec_packet_prepare(&sent, KEY, fec);
+        air_rx_fec_packet_t recv = sent;
+        corrupt(&recv, size, ber);
+        if (air_rx_fec_packet_validate(&recv, size, KEY, fec))
+        {
+            if (memcmp(&recv.packet, &sent.packet, sizeof(recv.packet)) == 0)
+            {
+                res->ok++;
+            }
+            else
+            {
+                res->undetected++;
+            }
+        }
+    }
+}
+
+int main(void)
+{
+    static const double bers[] = {1e-4, 1e-3, 3e-3, 1e-2, 3e-2};
+
+    printf("%-7s %14s %14s %14s %14s %10s\n", "BER", "uplink PSR", "uplink FEC", "downlink PSR", "downlink FEC", "undetected");
+    for (unsigned ii = 0; ii < ARRAY_COUNT(bers); ii++)
+    {
+        bench_fec_result_t up, up_fec, down, down_fec;
+        bench_uplink(bers[ii], false, &up);
+        bench_uplink(bers[ii], true, &up_fec);
+        bench_downlink(bers[ii], false, &down);
+        bench_downlink(bers[ii], true, &down_fec);
+        printf("%-7.0e %13.3f%% %13.3f%% %13.3f%% %13.3f%% %10u\n", bers[ii],
+               up.ok * 100.0 / PACKETS, up_fec.ok * 100.0 / PACKETS,
+               down.ok * 100.0 / PACKETS, down_fec.ok * 100.0 / PACKETS,
+               up.undetected + up_fec.undetected + down.undetected + down_fec.undetected);
+    }
+    // Bit errors are independent of the mode, but FEC is only used
+    // in the modes where the bigger packets fit.
+    printf("\n%-8s %-4s %12s %12s %12s\n", "mode", "fec", "uplink ToA", "downlink ToA", "full cycle");
+    for (air_lora_mode_e mode = AIR_LORA_MODE_1; mode <= AIR_LORA_MODE_COUNT; mode++)
+    {
+        bool fec = air_lora_mode_supports_fec(mode);
+        printf("MODE_%-3d %-4s %10.2fms %10.2fms %10.2fms\n", mode, fec ? "yes" : "no",
+               air_lora_time_on_air(mode, air_tx_packet_size(fec)) / 1000.0,
+               air_lora_time_on_air(mode, air_rx_packet_size(fec)) / 1000.0,
+               air_lora_full_cycle_time(mode) / 1000.0);
+    }
+    return 0;
+}
@@ -0,0 +1,429 @@
+#include <stdio.h>
+#include <string.h>
+
+#include "bluetooth/hm_serial.h"
+
+#include "msp/msp.h"
+#include "msp/msp_serial.h"
+
+#include "util/macros.h"
+
+// Loopback throughput of the HM-10 style MSP bridge over a stand-in
+// GATT transport, with a configurator reading and writing a Betaflight
+// configuration and then downloading the blackbox. Requests are answered
+// right away on the bridge side, so the air link is not involved (see
+// bench_msp_compress.c for that).
+//
+// The transport models BLE timing at the link layer:
+//  - Every connection interval, each side sends up to
+//    PACKETS_PER_EVENT link layer packets.
+//  - An ATT PDU (3 bytes) with its L2CAP header (4 bytes) takes as
+//    many packets as needed for the negotiated link layer payload:
+//    27 bytes, or 251 with data length extension.
+//  - PDUs queued during an event go out in the next one, since both
+//    stacks handle them after the event.
+//  - Write requests wait for their response, so only one is sent per
+//    event. Writes without response fill the event like notifications.
+// The configurator either waits for each response before sending the
+// next request, or keeps up to PIPELINE_DEPTH requests in flight.
+//
+// "before" is the bridge as it was before MTU negotiation: 20 byte
+// notifications and writes with response.
+
+#define CONN_INTERVAL_US 15000 // Typical for Android, iOS uses 30ms
+#define PACKETS_PER_EVENT 6
+#define ATT_HEADER_SIZE 3
+#define L2CAP_HEADER_SIZE 4
+#define QUEUE_SIZE 256
+#define PIPELINE_DEPTH 8
+
+// Not used by the firmware, so they're not in msp.h
+#define MSP_API_VERSION 1
+#define MSP_FC_VARIANT 2
+#define MSP_FC_VERSION 3
+#define MSP_BOARD_INFO 4
+#define MSP_BUILD_INFO 5
+#define MSP_NAME 10
+#define MSP_BATTERY_CONFIG 32
+#define MSP_MODE_RANGES 34
+#define MSP_FEATURE_CONFIG 36
+#define MSP_MIXER_CONFIG 42
+#define MSP_RX_CONFIG 44
+#define MSP_RSSI_CONFIG 50
+#define MSP_CF_SERIAL_CONFIG 54
+#define MSP_ARMING_CONFIG 61
+#define MSP_FAILSAFE_CONFIG 75
+#define MSP_OSD_CONFIG 84
+#define MSP_VTX_CONFIG 88
+#define MSP_ADVANCED_CONFIG 90
+#define MSP_FILTER_CONFIG 92
+#define MSP_PID_ADVANCED 94
+#define MSP_SENSOR_CONFIG 96
+#define MSP_RC_TUNING 111
+#define MSP_PID 112
+#define MSP_BOXNAMES 116
+#define MSP_PIDNAMES 117
+#define MSP_BOXIDS 119
+#define MSP_MOTOR_CONFIG 131
+#define MSP_STATUS_EX 150
+#define MSP_UID 160
+#define MSP_BEEPER_CONFIG 184
+#define MSP_DATAFLASH_READ 71
+#define MSP_SET_MODE_RANGE 35
+#define MSP_EEPROM_WRITE 250
+
+typedef struct
+{
+    uint16_t cmd;
+    uint16_t request_size;
+    uint16_t response_size;
+} msp_exchange_t;
+
+typedef struct
+{
+    const char *name;
+    unsigned mtu;
+    unsigned ll_payload;
+    bool write_with_response;
+} link_params_t;
+
+typedef struct
+{
+    uint8_t data[HM_SERIAL_MAX_NOTIFY_SIZE];
+    size_t size;
+    unsigned packets_left;
+    unsigned ready_at; // Event
+} pdu_t;
+
+typedef struct
+{
+    pdu_t pdus[QUEUE_SIZE];
+    unsigned head;
+    unsigned tail;
+    unsigned count; // Total PDUs queued
+} pdu_queue_t;
+
+// Approximate response sizes of Betaflight 4.x, reading every tab of
+// the configurator, then saving the modes.
+static const msp_exchange_t read_session[] = {
+    {MSP_API_VERSION, 0, 3},
+    {MSP_FC_VARIANT, 0, 4},
+    {MSP_FC_VERSION, 0, 3},
+    {MSP_BUILD_INFO, 0, 26},
+    {MSP_BOARD_INFO, 0, 45},
+    {MSP_UID, 0, 12},
+    {MSP_NAME, 0, 8},
+    {MSP_STATUS_EX, 0, 25},
+    {MSP_FEATURE_CONFIG, 0, 4},
+    {MSP_BOXNAMES, 0, 290},
+    {MSP_BOXIDS, 0, 40},
+    {MSP_MODE_RANGES, 0, 80},
+    {MSP_RX_CONFIG, 0, 36},
+    {MSP_RSSI_CONFIG, 0, 1},
+    {MSP_FAILSAFE_CONFIG, 0, 12},
+    {MSP_ARMING_CONFIG, 0, 3},
+    {MSP_MIXER_CONFIG, 0, 2},
+    {MSP_MOTOR_CONFIG, 0, 10},
+    {MSP_SENSOR_CONFIG, 0, 3},
+    {MSP_CF_SERIAL_CONFIG, 0, 42},
+    {MSP_BATTERY_CONFIG, 0, 15},
+    {MSP_BEEPER_CONFIG, 0, 9},
+    {MSP_ADVANCED_CONFIG, 0, 20},
+    {MSP_FILTER_CONFIG, 0, 47},
+    {MSP_PID_ADVANCED, 0, 58},
+    {MSP_PID, 0, 30},
+    {MSP_PIDNAMES, 0, 40},
+    {MSP_RC_TUNING, 0, 32},
+    {MSP_VTX_CONFIG, 0, 15},
+    {MSP_OSD_CONFIG, 0, 170},
+};
+
+#define MODE_RANGE_WRITES 20
+// Downloading the blackbox, as big as the MSP payload allows
+#define DATAFLASH_READS 64
+#define DATAFLASH_READ_SIZE MSP_MAX_PAYLOAD_SIZE
+
+static const link_params_t links[] = {
+    {"before: MTU 23", 23, 27, true},
+    {"MTU 23", 23, 27, false},
+    {"MTU 185, DLE", 185, 251, false},
+    {"MTU 247, DLE", 247, 251, false},
+    {"MTU 517, DLE", 517, 251, false},
+};
+
+static const link_params_t *link;
+static hm_serial_t serial;
+static pdu_queue_t uplink;
+static pdu_queue_t downlink;
+static unsigned event;
+
+// Configurator side
+static msp_conn_t client;
+static msp_serial_t client_serial;
+static uint8_t client_rx[HM_SERIAL_MAX_NOTIFY_SIZE * 2];
+static size_t client_rx_size;
+static msp_exchange_t session[ARRAY_COUNT(read_session) + MODE_RANGE_WRITES + 1 + DATAFLASH_READS];
+static unsigned session_count;
+static unsigned depth;
+static unsigned sent;
+static unsigned answered; // By the bridge
+static unsigned current; // Next expected response
+static size_t response_bytes;
+static bool failed;
+
+static void fill_payload(uint8_t *buf, size_t size, uint16_t cmd)
+{
+    for (size_t ii = 0; ii < size; ii++)
+    {
+        buf[ii] = cmd * 7 + ii * 31;
+    }
+}
+
+static void pdu_queue_push(pdu_queue_t *q, const void *data, size_t size)
+{
+    if (q->tail - q->head == QUEUE_SIZE)
+    {
+        printf("PDU queue full\n");
+        failed = true;
+        return;
+    }
+    pdu_t *pdu = &q->pdus[q->tail++ % QUEUE_SIZE];
+    memcpy(pdu->data, data, size);
+    pdu->size = size;
+    pdu->packets_left = (size + ATT_HEADER_SIZE + L2CAP_HEADER_SIZE + link->ll_payload - 1) / link->ll_payload;
+    pdu->ready_at = event + 1;
+    q->count++;
+}
+
+typedef void (*pdu_deliver_f)(const pdu_t *pdu);
+
+// Sends up to the given number of packets from the queue, returning
+// the number of delivered PDUs.
+static unsigned pdu_queue_transmit(pdu_queue_t *q, unsigned packets, unsigned max_pdus, pdu_deliver_f deliver)
+{
+    unsigned delivered = 0;
+    while (packets > 0 && delivered < max_pdus && q->head != q->tail)
+    {
+        pdu_t *pdu = &q->pdus[q->head % QUEUE_SIZE];
+        if (pdu->ready_at > event)
+        {
+            break;
+        }
+        unsigned n = MIN(packets, pdu->packets_left);
+        pdu->packets_left -= n;
+        packets -= n;
+        if (pdu->packets_left == 0)
+        {
+            q->head++;
+            delivered++;
+            deliver(pdu);
+        }
+    }
+    return delivered;
+}
+
+static void gatt_notify(void *data, const void *buf, size_t size)
+{
+    pdu_queue_push(&downlink, buf, size);
+}
+
+static size_t gatt_notify_size(void *data)
+{
+    return link->mtu - ATT_HEADER_SIZE;
+}
+
+static void gatt_write(const pdu_t *pdu)
+{
+    hm_serial_received(&serial, pdu->data, pdu->size);
+}
+
+// Answers like the FC would
+static void bridge_msp_callback(msp_conn_t *conn, uint16_t cmd, const void *payload, int size, void *callback_data)
+{
+    if (answered == sent)
+    {
+        printf("request %u was not sent\n", cmd);
+        failed = true;
+        return;
+    }
+    const msp_exchange_t *exchange = &session[answered++];
+    uint8_t expected[MSP_MAX_PAYLOAD_SIZE];
+    fill_payload(expected, exchange->request_size, cmd);
+    if (cmd != exchange->cmd || size != exchange->request_size || memcmp(payload, expected, size) != 0)
+    {
+        printf("unexpected request %u with %d bytes\n", cmd, size);
+        failed = true;
+        return;
+    }
+    uint8_t response[MSP_MAX_PAYLOAD_SIZE];
+    fill_payload(response, exchange->response_size, cmd + 1);
+    msp_conn_write(conn, MSP_DIRECTION_FROM_MWC, cmd, response, exchange->response_size);
+}
+
+static int client_io_read(void *data, void *buf, size_t size, time_ticks_t timeout)
+{
+    size_t n = MIN(size, client_rx_size);
+    memcpy(buf, client_rx, n);
+    memmove(client_rx, &client_rx[n], client_rx_size - n);
+    client_rx_size -= n;
+    return n;
+}
+
+static int client_io_write(void *data, const void *buf, size_t size)
+{
+    const uint8_t *ptr = buf;
+    size_t max_write = link->mtu - ATT_HEADER_SIZE;
+    for (size_t ii = 0; ii < size; ii += max_write)
+    {
+        pdu_queue_push(&uplink, &ptr[ii], MIN(max_write, size - ii));
+    }
+    return size;
+}
+
+static void client_send_requests(void)
+{
+    while (sent < session_count && sent - current < depth)
+    {
+        const msp_exchange_t *exchange = &session[sent++];
+        uint8_t payload[MSP_MAX_PAYLOAD_SIZE];
+        fill_payload(payload, exchange->request_size, exchange->cmd);
+        msp_conn_write(&client, MSP_DIRECTION_TO_MWC, exchange->cmd, payload, exchange->request_size);
+    }
+}
+
+static void client_msp_callback(msp_conn_t *conn, uint16_t cmd, const void *payload, int size, void *callback_data)
+{
+    if (current == sent)
+    {
+        printf("response %u was not requested\n", cmd);
+        failed = true;
+        return;
+    }
+    const msp_exchange_t *exchange = &session[current];
+    uint8_t expected[MSP_MAX_PAYLOAD_SIZE];
+    fill_payload(expected, exchange->response_size, cmd + 1);
+    if (cmd != exchange->cmd || size != exchange->response_size || memcmp(payload, expected, size) != 0)
+    {
+        printf("unexpected response %u with %d bytes\n", cmd, size);
+        failed = true;
+        return;
+    }
+    response_bytes += size;
+    current++;
+    client_send_requests();
+}
+
+static void gatt_notified(const pdu_t *pdu)
+{
+    if (client_rx_size + pdu->size > sizeof(client_rx))
+    {
+        printf("client rx overflow\n");
+        failed = true;
+        return;
+    }
+    memcpy(&client_rx[client_rx_size], pdu->data, pdu->size);
+    client_rx_size += pdu->size;
+    // msp_serial reads at most its free buffer space per update
+    size_t prev;
+    do
+    {
+        prev = client_rx_size;
+        msp_conn_update(&client);
+    } while (client_rx_size > 0 && client_rx_size < prev);
+}
+
+static void build_configurator_session(void)
+{
+    session_count = 0;
+    for (int ii = 0; ii < ARRAY_COUNT(read_session); ii++)
+    {
+        session[session_count++] = read_session[ii];
+    }
+    for (int ii = 0; ii < MODE_RANGE_WRITES; ii++)
+    {
+        session[session_count++] = (msp_exchange_t){MSP_SET_MODE_RANGE, 5, 0};
+    }
+    session[session_count++] = (msp_exchange_t){MSP_EEPROM_WRITE, 0, 0};
+}
+
+static void build_dataflash_session(void)
+{
+    session_count = 0;
+    for (int ii = 0; ii < DATAFLASH_READS; ii++)
+    {
+        // Address and size
+        session[session_count++] = (msp_exchange_t){MSP_DATAFLASH_READ, 6, DATAFLASH_READ_SIZE};
+    }
+}
+
+static double run_session(const link_params_t *params, unsigned pipeline_depth)
+{
+    link = params;
+    depth = pipeline_depth;
+    sent = 0;
+    answered = 0;
+    memset(&uplink, 0, sizeof(uplink));
+    memset(&downlink, 0, sizeof(downlink));
+    memset(&serial, 0, sizeof(serial));
+    memset(&client, 0, sizeof(client));
+    event = 0;
+    current = 0;
+    response_bytes = 0;
+    client_rx_size = 0;
+
+    hm_serial_init(&serial, gatt_notify, gatt_notify_size, NULL);
+    msp_conn_set_global_callback(&serial.msp, bridge_msp_callback, NULL);
+    io_t io = {.read = client_io_read, .write = client_io_write};
+    msp_serial_init(&client_serial, &io);
+    msp_conn_init(&client, MSP_TRANSPORT(&client_serial));
+    msp_conn_set_global_callback(&client, client_msp_callback, NULL);
+
+    client_send_requests();
+    while (current < session_count && !failed)
+    {
+        // Write requests are answered in the same event, using one packet
+        unsigned max_writes = link->write_with_response ? 1 : QUEUE_SIZE;
+        unsigned writes = pdu_queue_transmit(&uplink, PACKETS_PER_EVENT, max_writes, gatt_write);
+        unsigned downlink_packets = PACKETS_PER_EVENT - (link->write_with_response ? writes : 0);
+        pdu_queue_transmit(&downlink, downlink_packets, QUEUE_SIZE, gatt_notified);
+        event++;
+    }
+    double secs = (double)event * CONN_INTERVAL_US / 1e6;
+    printf("%-16s %8.2f %9.0f %7u %7u", link->name, secs, response_bytes / secs, uplink.count, downlink.count);
+    return secs;
+}
+
+static void print_session(const char *name)
+{
+    size_t bytes = 0;
+    for (unsigned ii = 0; ii < session_count; ii++)
+    {
+        bytes += session[ii].response_size;
+    }
+    printf("\n%s: %u MSP requests, %u response payload bytes\n", name, session_count, (unsigned)bytes);
+    static const unsigned depths[] = {1, PIPELINE_DEPTH};
+    for (int ii = 0; ii < ARRAY_COUNT(depths); ii++)
+    {
+        printf("%u in flight       %8s %9s %7s %7s %7s\n", depths[ii], "secs", "bytes/s", "writes", "notifs", "speedup");
+        double before = 0;
+        for (int jj = 0; jj < ARRAY_COUNT(links) && !failed; jj++)
+        {
+            double secs = run_session(&links[jj], depths[ii]);
+            if (jj == 0)
+            {
+                before = secs;
+            }
+            printf(" %6.2fx\n", before / secs);
+        }
+    }
+}
+
+int main(void)
+{
+    printf("connection interval %.1fms, %d packets per event\n", CONN_INTERVAL_US / 1000.0, PACKETS_PER_EVENT);
+    build_configurator_session();
+    print_session("configurator");
+    build_dataflash_session();
+    print_session("blackbox download");
+    return failed ? 1 : 0;
+}
@@ -0,0 +1,202 @@
+#include <stdio.h>
+#include <string.h>
+
+#include "air/air.h"
+#include "air/air_freq.h"
+#include "air/air_lora.h"
+
+#include "io/lora.h"
+
+#include "util/macros.h"
+
+#include "sx127x_sim.h"
+
+// SPI traffic of the operations the RC task does on every packet or
+// mode switch, counted by the simulated SX127x. Each operation is
+// compared with the way it was done before registers were written in
+// bursts:
+//  - Hopping wrote each RegFrf register that changed with its own
+//    2 byte transaction, derived from the writes in the burst.
+//  - Mode switches used the per register setters, which are still
+//    available and measured directly.
+// Bus time is the time on the wire at the 9MHz SPI clock, each
+// transaction also pays the fixed cost of the SPI driver on top.
+
+#define SPI_CLOCK_HZ (9 * 1000 * 1000)
+#define BASE_FREQ 868000000
+#define HOPS 1024
+#define CYCLES 1024
+
+#define REG_FRF_MSB 0x06
+#define REG_FRF_LSB 0x08
+#define REG_MODEM_CONFIG_1 0x1d
+#define REG_MODEM_CONFIG_2 0x1e
+#define REG_PREAMBLE_MSB 0x20
+#define REG_PREAMBLE_LSB 0x21
+
+typedef struct
+{
+    double transactions;
+    double bytes;
+} spi_cost_t;
+
+typedef struct
+{
+    int sf;
+    lora_coding_rate_e cr;
+    long preamble_length;
+} mode_params_t;
+
+static lora_t lora = {.output_type = LORA_OUTPUT_PA_BOOST};
+static air_freq_table_t freq_table;
+static mode_params_t mode_params[AIR_LORA_MODE_LAST + 1];
+
+static spi_cost_t spi_cost_since_reset(unsigned ops)
+{
+    sx127x_sim_stats_t stats;
+    sx127x_sim_get_stats(&stats);
+    return (spi_cost_t){.transactions = (double)stats.transactions / ops, .bytes = (double)stats.bytes / ops};
+}
+
+static double spi_cost_us(const spi_cost_t *cost)
+{
+    return cost->bytes * 8 * 1e6 / SPI_CLOCK_HZ;
+}
+
+static void print_cost(const char *name, const spi_cost_t *cost, const spi_cost_t *before)
+{
+    printf("%-22s %5.1f %6.1f %7.2f", name, cost->transactions, cost->bytes, spi_cost_us(cost));
+    if (before)
+    {
+        printf("   %5.1f %6.1f %7.2f   %5.1f%%", before->transactions, before->bytes, spi_cost_us(before),
+               100.0 * (before->transactions - cost->transactions) / before->transactions);
+    }
+    printf("\n");
+}
+
+static unsigned mode_count(void)
+{
+    return air_lora_mode_rank(AIR_LORA_MODE_LONGEST) - air_lora_mode_rank(AIR_LORA_MODE_FASTEST) + 1;
+}
+
+static air_lora_mode_e mode_at(unsigned ii)
+{
+    return air_lora_mode_from_rank(air_lora_mode_rank(AIR_LORA_MODE_FASTEST) + ii % mode_count());
+}
+
+static void setup(void)
+{
+    sx127x_sim_reset();
+    lora_init(&lora);
+    air_freq_table_init(&freq_table, 0x12345678, BASE_FREQ);
+    // Read back what each mode programs, to replay it with the setters
+    for (unsigned ii = 0; ii < mode_count(); ii++)
+    {
+        air_lora_mode_e mode = mode_at(ii);
+        air_lora_set_parameters(&lora, mode);
+        mode_params[mode].sf = sx127x_sim_reg(REG_MODEM_CONFIG_2) >> 4;
+        mode_params[mode].cr = (sx127x_sim_reg(REG_MODEM_CONFIG_1) >> 1) & 0x07;
+        mode_params[mode].preamble_length = sx127x_sim_reg(REG_PREAMBLE_MSB) << 8 | sx127x_sim_reg(REG_PREAMBLE_LSB);
+    }
+}
+
+static spi_cost_t bench_hop(spi_cost_t *before)
+{
+    sx127x_sim_stats_t stats;
+    sx127x_sim_reset_stats();
+    for (unsigned ii = 0; ii < HOPS; ii++)
+    {
+        air_freq_table_set(&freq_table, &lora, ii % AIR_SEQ_COUNT);
+    }
+    sx127x_sim_get_stats(&stats);
+    unsigned writes = 0;
+    for (int addr = REG_FRF_MSB; addr <= REG_FRF_LSB; addr++)
+    {
+        writes += stats.reg_writes[addr];
+    }
+    before->transactions = (double)writes / HOPS;
+    before->bytes = (double)writes * 2 / HOPS;
+    return spi_cost_since_reset(HOPS);
+}
+
+static spi_cost_t bench_mode_switch(void)
+{
+    sx127x_sim_reset_stats();
+    for (unsigned ii = 0; ii < CYCLES; ii++)
+    {
+        air_lora_set_parameters(&lora, mode_at(ii));
+    }
+    return spi_cost_since_reset(CYCLES);
+}
+
+static spi_cost_t bench_mode_switch_setters(void)
+{
+    sx127x_sim_reset_stats();
+    for (unsigned ii = 0; ii < CYCLES; ii++)
+    {
+        const mode_params_t *params = &mode_params[mode_at(ii)];
+        lora_idle(&lora);
+        lora_set_signal_bw(&lora, LORA_SIGNAL_BW_500);
+        lora_set_header_mode(&lora, LORA_HEADER_IMPLICIT);
+        lora_set_crc(&lora, false);
+        lora_set_preamble_length(&lora, params->preamble_length);
+        lora_set_spreading_factor(&lora, params->sf);
+        lora_set_coding_rate(&lora, params->cr);
+    }
+    return spi_cost_since_reset(CYCLES);
+}
+
+// A full cycle on the TX side, like output_air does it: hop, send
+// the uplink packet, switch to RX on TxDone and read the downlink.
+static spi_cost_t bench_tx_cycle(bool fec)
+{
+    air_tx_fec_packet_t tx_pkt;
+    air_rx_fec_packet_t rx_pkt;
+    int snr, lq;
+    memset(&tx_pkt, 0, sizeof(tx_pkt));
+    memset(&rx_pkt, 0, sizeof(rx_pkt));
+    sx127x_sim_reset_stats();
+    for (unsigned ii = 0; ii < CYCLES; ii++)
+    {
+        air_freq_table_set(&freq_table, &lora, ii % AIR_SEQ_COUNT);
+        lora_send(&lora, &tx_pkt, air_tx_packet_size(fec));
+        sx127x_sim_finish_tx();
+        lora_sleep(&lora);
+        lora_set_payload_size(&lora, air_rx_packet_size(fec));
+        lora_enable_continous_rx(&lora);
+        sx127x_sim_receive(&rx_pkt, air_rx_packet_size(fec), 20, 100);
+        lora_read(&lora, &rx_pkt, air_rx_packet_size(fec));
+        lora_rssi(&lora, &snr, &lq);
+    }
+    return spi_cost_since_reset(CYCLES);
+}
+
+int main(void)
+{
+    setup();
+
+    spi_cost_t hop_before;
+    spi_cost_t hop = bench_hop(&hop_before);
+    spi_cost_t mode_switch = bench_mode_switch();
+    spi_cost_t mode_switch_before = bench_mode_switch_setters();
+    spi_cost_t tx_cycle = bench_tx_cycle(false);
+    spi_cost_t tx_cycle_fec = bench_tx_cycle(true);
+    spi_cost_t tx_cycle_before = {
+        .transactions = tx_cycle.transactions - hop.transactions + hop_before.transactions,
+        .bytes = tx_cycle.bytes - hop.bytes + hop_before.bytes,
+    };
+    spi_cost_t tx_cycle_fec_before = {
+        .transactions = tx_cycle_fec.transactions - hop.transactions + hop_before.transactions,
+        .bytes = tx_cycle_fec.bytes - hop.bytes + hop_before.bytes,
+    };
+
+    printf("SPI traffic per operation, bus time in us at %d MHz\n", SPI_CLOCK_HZ / 1000000);
+    printf("%-22s %5s %6s %7s   %5s %6s %7s   %6s\n", "", "trans", "bytes", "us", "trans", "bytes", "us",
+           "saved");
+    printf("%-22s %20s   %20s\n", "", "bursts", "one per register");
+    print_cost("hop", &hop, &hop_before);
+    print_cost("mode switch", &mode_switch, &mode_switch_before);
+    print_cost("tx cycle", &tx_cycle, &tx_cycle_before);
+    print_cost("tx cycle (fec)", &tx_cycle_fec, &tx_cycle_fec_before);
+    return 0;
+}
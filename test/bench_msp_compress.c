@@ -0,0 +1,606 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "air/air.h"
+#include "air/air_cmd.h"
+#include "air/air_lora.h"
+#include "air/air_stream.h"
+
+#include "msp/msp.h"
+#include "msp/msp_air.h"
+#include "msp/msp_transport.h"
+
+#include "util/macros.h"
+
+#include "bench.h"
+
+// Replays the MSP traffic of configurator sessions over a pair of air
+// streams with and without compression, and reports the time it takes
+// to transfer it in each air mode. Requests go in the uplink, 2 bytes
+// per cycle, and responses in the downlink, 3 bytes per full cycle.
+// Requests are pipelined, so a session takes as long as the slowest
+// direction. Every message is checked after its round trip.
+//
+// Recorded sessions aren't available, so the payloads are built from
+// the messages Betaflight and iNAV configurators request when
+// connecting and while showing the setup and receiver tabs, with the
+// sizes and layouts used by their FCs.
+
+// Not used by the firmware, so they're not in msp.h
+#define MSP_API_VERSION 1
+#define MSP_BOARD_INFO 4
+#define MSP_BUILD_INFO 5
+#define MSP_MODE_RANGES 34
+#define MSP_FEATURE_CONFIG 36
+#define MSP_RX_CONFIG 44
+#define MSP_CF_SERIAL_CONFIG 54
+#define MSP_FAILSAFE_CONFIG 75
+#define MSP_STATUS 101
+#define MSP_MOTOR 104
+#define MSP_RC 105
+#define MSP_RC_TUNING 111
+#define MSP_PID 112
+#define MSP_BOXNAMES 116
+#define MSP_PIDNAMES 117
+#define MSP_BOXIDS 119
+#define MSP_BATTERY_STATE 130
+#define MSP_STATUS_EX 150
+#define MSP_UID 160
+#define MSP2_INAV_STATUS 0x2000
+#define MSP2_INAV_ANALOG 0x2002
+#define MSP2_INAV_MISC 0x2003
+#define MSP2_INAV_MIXER 0x2010
+
+#define UPLINK_BYTES AIR_UPLINK_DATA_BYTES
+#define DOWNLINK_BYTES AIR_DOWNLINK_DATA_BYTES
+#define POLL_ROUNDS 50
+
+typedef struct
+{
+    uint8_t data[MSP_MAX_PAYLOAD_SIZE];
+    size_t size;
+} payload_t;
+
+typedef struct
+{
+    air_stream_t out;
+    air_stream_t in;
+    msp_air_t tx;
+    msp_air_t rx;
+    msp_conn_t conn; // Receives the messages from rx
+    unsigned seq;
+    size_t per_packet;
+    size_t bytes;
+} link_dir_t;
+
+typedef struct
+{
+    size_t up_bytes;
+    size_t down_bytes;
+    unsigned messages;
+    uint64_t write_ns;
+} session_stats_t;
+
+static link_dir_t uplink;
+static link_dir_t downlink;
+static session_stats_t stats;
+static const payload_t *expected;
+static uint16_t expected_cmd;
+static unsigned received;
+static uint64_t rng_state = 88172645463325252ull;
+
+static uint32_t rng_next(void)
+{
+    rng_state ^= rng_state << 13;
+    rng_state ^= rng_state >> 7;
+    rng_state ^= rng_state << 17;
+    return rng_state;
+}
+
+static void put_u8(payload_t *p, uint8_t v)
+{
+    p->data[p->size++] = v;
+}
+
+static void put_u16(payload_t *p, uint16_t v)
+{
+    put_u8(p, v);
+    put_u8(p, v >> 8);
+}
+
+static void put_u32(payload_t *p, uint32_t v)
+{
+    put_u16(p, v);
+    put_u16(p, v >> 16);
+}
+
+static void put_str(payload_t *p, const char *s)
+{
+    size_t n = strlen(s);
+    memcpy(&p->data[p->size], s, n);
+    p->size += n;
+}
+
+static void put_zeros(payload_t *p, size_t n)
+{
+    memset(&p->data[p->size], 0, n);
+    p->size += n;
+}
+
+// Small random variation around v, like sensor readings
+static int noisy(int v, int amplitude)
+{
+    return v + (int)(rng_next() % (2 * amplitude + 1)) - amplitude;
+}
+
+static void msp_received(msp_conn_t *conn, uint16_t cmd, const void *payload, int size, void *callback_data)
+{
+    if (cmd != expected_cmd || size != expected->size || (size > 0 && memcmp(payload, expected->data, size) != 0))
+    {
+        printf("cmd %u: payload doesn't match after the round trip\n", cmd);
+        exit(1);
+    }
+    received++;
+}
+
+static void cmd_received(void *user, air_cmd_e cmd, const void *data, size_t size, time_micros_t now)
+{
+    link_dir_t *dir = user;
+    switch (cmd)
+    {
+    case AIR_CMD_MSP:
+        msp_air_dispatch(&dir->rx, &dir->conn, data, size);
+        break;
+    case AIR_CMD_MSP_COMPRESSED:
+        msp_air_dispatch_compressed(&dir->rx, &dir->conn, data, size);
+        break;
+    default:
+        break;
+    }
+}
+
+static void link_dir_init(link_dir_t *dir, size_t per_packet, bool compression)
+{
+    air_stream_init(&dir->out, NULL, NULL, NULL, NULL);
+    air_stream_init(&dir->in, NULL, NULL, cmd_received, dir);
+    msp_air_init(&dir->tx, &dir->out, NULL, NULL);
+    msp_air_set_compression(&dir->tx, compression);
+    msp_air_init(&dir->rx, &dir->in, NULL, NULL);
+    msp_conn_init(&dir->conn, MSP_TRANSPORT(&dir->rx));
+    msp_conn_set_global_callback(&dir->conn, msp_received, NULL);
+    dir->per_packet = per_packet;
+    dir->bytes = 0;
+}
+
+// Sends a message through dir and returns the bytes it used in the stream
+static size_t link_dir_send(link_dir_t *dir, msp_direction_e direction, uint16_t cmd, const payload_t *payload)
+{
+    expected = payload;
+    expected_cmd = cmd;
+    received = 0;
+    uint64_t start = bench_now_ns();
+    msp_transport_write(MSP_TRANSPORT(&dir->tx), direction, cmd, payload->data, payload->size);
+    stats.write_ns += bench_now_ns() - start;
+    // Empty space in the packets is filled with start-stop bytes, which
+    // also terminates the frame.
+    size_t used = 0;
+    uint8_t pkt[DOWNLINK_BYTES + 1];
+    do
+    {
+        memset(pkt, AIR_DATA_START_STOP, sizeof(pkt));
+        size_t n = air_stream_pop_output_n(&dir->out, pkt, dir->per_packet);
+        used += n;
+        air_stream_feed_input(&dir->in, ++dir->seq % AIR_SEQ_COUNT, pkt, dir->per_packet, 0);
+    } while (received == 0);
+    return used;
+}
+
+static void exchange(uint16_t cmd, const payload_t *resp)
+{
+    static const payload_t empty;
+    stats.up_bytes += link_dir_send(&uplink, MSP_DIRECTION_TO_MWC, cmd, &empty);
+    stats.down_bytes += link_dir_send(&downlink, MSP_DIRECTION_FROM_MWC, cmd, resp);
+    stats.messages += 2;
+}
+
+static void exchange_str(uint16_t cmd, const char *s)
+{
+    payload_t p = {0};
+    put_str(&p, s);
+    exchange(cmd, &p);
+}
+
+static void exchange_u16s(uint16_t cmd, const uint16_t *values, size_t count)
+{
+    payload_t p = {0};
+    for (size_t ii = 0; ii < count; ii++)
+    {
+        put_u16(&p, values[ii]);
+    }
+    exchange(cmd, &p);
+}
+
+static void exchange_mode_ranges(unsigned count, const uint8_t (*ranges)[4], unsigned used)
+{
+    payload_t p = {0};
+    for (unsigned ii = 0; ii < used; ii++)
+    {
+        memcpy(&p.data[p.size], ranges[ii], 4);
+        p.size += 4;
+    }
+    put_zeros(&p, (count - used) * 4);
+    exchange(MSP_MODE_RANGES, &p);
+}
+
+static void exchange_common_live(bool inav)
+{
+    payload_t p = {0};
+    // Attitude in decidegrees, roll, pitch and yaw
+    put_u16(&p, noisy(0, 15));
+    put_u16(&p, noisy(0, 15));
+    put_u16(&p, noisy(1200, 5));
+    exchange(MSP_ATTITUDE, &p);
+
+    p.size = 0;
+    put_u16(&p, noisy(0, 8));
+    put_u16(&p, noisy(0, 8));
+    put_u16(&p, noisy(512, 8));
+    for (int ii = 0; ii < 3; ii++)
+    {
+        put_u16(&p, noisy(0, 3));
+    }
+    for (int ii = 0; ii < 3; ii++)
+    {
+        put_u16(&p, noisy(0, 40));
+    }
+    exchange(MSP_RAW_IMU, &p);
+
+    p.size = 0;
+    put_u32(&p, noisy(100, 20));
+    put_u16(&p, 0);
+    exchange(MSP_ALTITUDE, &p);
+
+    p.size = 0;
+    if (inav)
+    {
+        // MSP2_INAV_ANALOG: flags, voltage, amperage, power, mAh, mWh, RSSI, remaining
+        put_u8(&p, 0x02);
+        put_u16(&p, noisy(1640, 2));
+        put_u16(&p, noisy(120, 10));
+        put_u32(&p, noisy(19680, 100));
+        put_u32(&p, 230);
+        put_u32(&p, 3700);
+        put_u16(&p, 1023);
+        put_u8(&p, 91);
+        exchange(MSP2_INAV_ANALOG, &p);
+        p.size = 0;
+        // MSP2_INAV_STATUS: cycle time, I2C errors, sensors, load,
+        // profiles, arming flags and the active box bitmask.
+        put_u16(&p, noisy(1000, 2));
+        put_u16(&p, 0);
+        put_u16(&p, 0x23);
+        put_u16(&p, noisy(8, 1));
+        put_u8(&p, 0);
+        put_u32(&p, 0x80000);
+        put_u32(&p, 0x04);
+        put_zeros(&p, 4);
+        put_u8(&p, 0);
+        exchange(MSP2_INAV_STATUS, &p);
+    }
+    else
+    {
+        // MSP_ANALOG: voltage, mAh, RSSI, amperage and voltage in 0.01V
+        put_u8(&p, 164);
+        put_u16(&p, 230);
+        put_u16(&p, 1023);
+        put_u16(&p, noisy(120, 10));
+        put_u16(&p, noisy(1640, 2));
+        exchange(MSP_ANALOG, &p);
+        p.size = 0;
+        // MSP_STATUS_EX
+        put_u16(&p, noisy(125, 2));
+        put_u16(&p, 0);
+        put_u16(&p, 0x23);
+        put_u32(&p, 0x04);
+        put_u8(&p, 0);
+        put_u16(&p, noisy(12, 1));
+        put_u8(&p, 3);
+        put_u8(&p, 0);
+        put_u8(&p, 4);
+        put_u8(&p, 0);
+        put_u8(&p, 25);
+        put_u32(&p, 0x80000);
+        put_u8(&p, 0);
+        exchange(MSP_STATUS_EX, &p);
+    }
+}
+
+static void exchange_rc(unsigned count)
+{
+    uint16_t channels[18];
+    for (unsigned ii = 0; ii < count; ii++)
+    {
+        channels[ii] = ii < 4 ? noisy(ii == 2 ? 1000 : 1500, 4) : (ii == 4 ? 1000 : 1500);
+    }
+    exchange_u16s(MSP_RC, channels, count);
+}
+
+static void exchange_motors(void)
+{
+    const uint16_t motors[] = {1000, 1000, 1000, 1000, 0, 0, 0, 0};
+    exchange_u16s(MSP_MOTOR, motors, ARRAY_COUNT(motors));
+}
+
+static void exchange_uid(void)
+{
+    payload_t p = {0};
+    for (int ii = 0; ii < 12; ii++)
+    {
+        put_u8(&p, rng_next());
+    }
+    exchange(MSP_UID, &p);
+}
+
+static void exchange_serial_config(unsigned ports)
+{
+    // Identifier, function mask and 4 baud rate indexes per port
+    payload_t p = {0};
+    const uint8_t ids[] = {20, 0, 1, 2, 3, 4};
+    for (unsigned ii = 0; ii < ports; ii++)
+    {
+        put_u8(&p, ids[ii]);
+        put_u16(&p, ii == 0 ? 1 : (ii == 2 ? 64 : 0));
+        put_u8(&p, 5);
+        put_u8(&p, 0);
+        put_u8(&p, 5);
+        put_u8(&p, 0);
+    }
+    exchange(MSP_CF_SERIAL_CONFIG, &p);
+}
+
+static void session_betaflight_connect(void)
+{
+    payload_t p = {0};
+    put_u8(&p, 0);
+    put_u8(&p, 1);
+    put_u8(&p, 43);
+    exchange(MSP_API_VERSION, &p);
+    exchange_str(MSP_FC_VARIANT, "BTFL");
+    p.size = 0;
+    put_u8(&p, 4);
+    put_u8(&p, 2);
+    put_u8(&p, 9);
+    exchange(MSP_FC_VERSION, &p);
+    exchange_str(MSP_BUILD_INFO, "Mar 28 202114:35:32a8e4bc6");
+    p.size = 0;
+    put_str(&p, "S411");
+    put_u16(&p, 0);
+    put_u8(&p, 2);
+    put_u8(&p, 0x16);
+    put_u8(&p, 9);
+    put_str(&p, "MATEKF411");
+    put_u8(&p, 4);
+    put_str(&p, "MTKS");
+    put_zeros(&p, 3);
+    exchange(MSP_BOARD_INFO, &p);
+    exchange_uid();
+    exchange_str(MSP_NAME, "Raven 5in");
+    exchange_common_live(false);
+    exchange_str(MSP_BOXNAMES, "ARM;ANGLE;HORIZON;HEADFREE;FAILSAFE;AIR MODE;BEEPER;OSD DISABLE SW;"
+                               "BLACKBOX;BLACKBOX ERASE;FPV ANGLE MIX;CAMERA CONTROL 1;"
+                               "CAMERA CONTROL 2;CAMERA CONTROL 3;FLIP OVER AFTER CRASH;PREARM;"
+                               "BEEP GPS SATELLITE COUNT;VTX PIT MODE;PARALYZE;USER1;USER2;"
+                               "ACRO TRAINER;DISABLE VTX CONTROL;LAUNCH CONTROL;");
+    p.size = 0;
+    const uint8_t box_ids[] = {0, 1, 2, 6, 27, 28, 13, 19, 26, 31, 32, 35, 36, 37, 38, 39, 40, 41, 44, 45, 46, 47, 48, 49};
+    memcpy(p.data, box_ids, sizeof(box_ids));
+    p.size = sizeof(box_ids);
+    exchange(MSP_BOXIDS, &p);
+    const uint8_t ranges[][4] = {{0, 0, 32, 48}, {1, 1, 0, 16}, {28, 1, 32, 48}, {13, 2, 32, 48}};
+    exchange_mode_ranges(20, ranges, ARRAY_COUNT(ranges));
+    p.size = 0;
+    put_u32(&p, 0x30440c08);
+    exchange(MSP_FEATURE_CONFIG, &p);
+    exchange_serial_config(4);
+    exchange_str(MSP_PIDNAMES, "ROLL;PITCH;YAW;LEVEL;MAG;");
+    p.size = 0;
+    const uint8_t pids[][3] = {{42, 85, 35}, {46, 90, 38}, {45, 90, 0}, {0, 0, 0}, {0, 0, 0}, {0, 0, 0}, {0, 0, 0}, {50, 50, 75}, {40, 0, 0}, {0, 0, 0}};
+    memcpy(p.data, pids, sizeof(pids));
+    p.size = sizeof(pids);
+    exchange(MSP_PID, &p);
+    p.size = 0;
+    const uint8_t rc_tuning[] = {100, 0, 70, 70, 0, 50, 75, 0, 0, 100, 70, 0, 0, 0, 0, 0, 100, 0, 0, 0, 1, 0, 0};
+    memcpy(p.data, rc_tuning, sizeof(rc_tuning));
+    p.size = sizeof(rc_tuning);
+    exchange(MSP_RC_TUNING, &p);
+    p.size = 0;
+    put_u8(&p, 3);
+    put_u16(&p, 1900);
+    put_u8(&p, 0);
+    put_u8(&p, 0);
+    put_u16(&p, 1500);
+    put_u16(&p, 1050);
+    put_u16(&p, 1050);
+    put_zeros(&p, 12);
+    exchange(MSP_RX_CONFIG, &p);
+    p.size = 0;
+    put_u8(&p, 4);
+    put_u8(&p, 0);
+    put_u16(&p, 1000);
+    put_u8(&p, 0);
+    put_u16(&p, 100);
+    put_u8(&p, 1);
+    exchange(MSP_FAILSAFE_CONFIG, &p);
+    exchange_rc(16);
+    exchange_motors();
+}
+
+static void session_betaflight_tabs(void)
+{
+    // Setup tab and status bar, then receiver and motors tabs
+    for (int ii = 0; ii < POLL_ROUNDS; ii++)
+    {
+        exchange_common_live(false);
+    }
+    for (int ii = 0; ii < POLL_ROUNDS; ii++)
+    {
+        exchange_rc(16);
+        exchange_motors();
+    }
+}
+
+static void session_inav_connect(void)
+{
+    payload_t p = {0};
+    put_u8(&p, 0);
+    put_u8(&p, 2);
+    put_u8(&p, 4);
+    exchange(MSP_API_VERSION, &p);
+    exchange_str(MSP_FC_VARIANT, "INAV");
+    p.size = 0;
+    put_u8(&p, 3);
+    put_u8(&p, 0);
+    put_u8(&p, 1);
+    exchange(MSP_FC_VERSION, &p);
+    exchange_str(MSP_BUILD_INFO, "Jul 12 202110:08:34b4ad4b7");
+    p.size = 0;
+    put_str(&p, "MF4S");
+    put_u16(&p, 0);
+    put_u8(&p, 2);
+    put_u8(&p, 9);
+    put_str(&p, "MATEKF411");
+    exchange(MSP_BOARD_INFO, &p);
+    exchange_uid();
+    exchange_str(MSP_NAME, "Raven wing");
+    exchange_common_live(true);
+    exchange_str(MSP_BOXNAMES, "ARM;ANGLE;HORIZON;NAV ALTHOLD;HEADING HOLD;HEADFREE;HEADADJ;CAMSTAB;"
+                               "NAV RTH;NAV POSHOLD;MANUAL;BEEPER;LEDLOW;LIGHTS;NAV LAUNCH;OSD SW;"
+                               "TELEMETRY;BLACKBOX;FAILSAFE;NAV WP;AIR MODE;HOME RESET;GCS NAV;"
+                               "SURFACE;FLAPERON;TURN ASSIST;SERVO AUTOTRIM;AUTO TUNE;"
+                               "CAMERA CONTROL 1;CAMERA CONTROL 2;CAMERA CONTROL 3;OSD ALT 1;"
+                               "OSD ALT 2;OSD ALT 3;NAV CRUISE;MC BRAKING;USER1;USER2;"
+                               "LOITER CHANGE;MSP RC OVERRIDE;PREARM;");
+    p.size = 0;
+    for (int ii = 0; ii < 41; ii++)
+    {
+        put_u8(&p, ii < 12 ? ii : ii + 14);
+    }
+    exchange(MSP_BOXIDS, &p);
+    const uint8_t ranges[][4] = {{0, 0, 32, 48}, {10, 1, 0, 16}, {1, 1, 16, 32}, {8, 2, 32, 48}, {35, 3, 32, 48}};
+    exchange_mode_ranges(40, ranges, ARRAY_COUNT(ranges));
+    p.size = 0;
+    put_u32(&p, 0x20400408);
+    exchange(MSP_FEATURE_CONFIG, &p);
+    exchange_serial_config(4);
+    p.size = 0;
+    // MSP2_INAV_MISC
+    put_u16(&p, 1500);
+    put_u16(&p, 1150);
+    put_u16(&p, 1850);
+    put_u16(&p, 1000);
+    put_u16(&p, 1000);
+    put_u8(&p, 2);
+    put_u8(&p, 0);
+    put_u8(&p, 1);
+    put_u8(&p, 8);
+    put_u16(&p, 300);
+    put_u8(&p, 1);
+    put_u8(&p, 0);
+    put_u16(&p, 1100);
+    put_u16(&p, 330);
+    put_u16(&p, 420);
+    put_u16(&p, 350);
+    put_u32(&p, 3000);
+    put_u32(&p, 0);
+    put_u8(&p, 0);
+    exchange(MSP2_INAV_MISC, &p);
+    p.size = 0;
+    // MSP2_INAV_MIXER
+    put_u8(&p, 0);
+    put_u8(&p, 0);
+    put_u8(&p, 0);
+    put_u8(&p, 2);
+    put_u16(&p, 8);
+    put_u8(&p, 1);
+    put_u8(&p, 4);
+    put_u8(&p, 8);
+    exchange(MSP2_INAV_MIXER, &p);
+    exchange_rc(18);
+    exchange_motors();
+}
+
+static void session_inav_tabs(void)
+{
+    for (int ii = 0; ii < POLL_ROUNDS; ii++)
+    {
+        exchange_common_live(true);
+    }
+    for (int ii = 0; ii < POLL_ROUNDS; ii++)
+    {
+        exchange_rc(18);
+        exchange_motors();
+    }
+}
+
+// Time between uplink and downlink packets for the given mode
+static void mode_intervals(air_lora_mode_e mode, double *up, double *down)
+{
+    time_micros_t total = 0;
+    unsigned full = 0;
+    for (unsigned seq = 0; seq < AIR_SEQ_COUNT; seq++)
+    {
+        if (air_lora_cycle_is_full(mode, seq))
+        {
+            total += air_lora_full_cycle_time(mode);
+            full++;
+        }
+        else
+        {
+            total += air_lora_uplink_cycle_time(mode);
+        }
+    }
+    *up = (double)total / AIR_SEQ_COUNT;
+    *down = (double)total / full;
+}
+
+static session_stats_t run_session(void (*session)(void), bool compression)
+{
+    memset(&stats, 0, sizeof(stats));
+    rng_state = 88172645463325252ull;
+    link_dir_init(&uplink, UPLINK_BYTES, compression);
+    link_dir_init(&downlink, DOWNLINK_BYTES, compression);
+    session();
+    return stats;
+}
+
+static void bench_session(const char *name, void (*session)(void))
+{
+    session_stats_t raw = run_session(session, false);
+    session_stats_t comp = run_session(session, true);
+    printf("%s: %u messages, uplink %u -> %u bytes, downlink %u -> %u bytes, %.2f -> %.2f us per write\n", name,
+           raw.messages, (unsigned)raw.up_bytes, (unsigned)comp.up_bytes, (unsigned)raw.down_bytes,
+           (unsigned)comp.down_bytes, raw.write_ns / 1e3 / raw.messages, comp.write_ns / 1e3 / comp.messages);
+    for (int rank = 0; rank < AIR_LORA_MODE_COUNT - 1; rank++)
+    {
+        air_lora_mode_e mode = air_lora_mode_from_rank(rank);
+        double up;
+        double down;
+        mode_intervals(mode, &up, &down);
+        double raw_s = MAX((raw.up_bytes + UPLINK_BYTES - 1) / UPLINK_BYTES * up,
+                           (raw.down_bytes + DOWNLINK_BYTES - 1) / DOWNLINK_BYTES * down) / 1e6;
+        double comp_s = MAX((comp.up_bytes + UPLINK_BYTES - 1) / UPLINK_BYTES * up,
+                            (comp.down_bytes + DOWNLINK_BYTES - 1) / DOWNLINK_BYTES * down) / 1e6;
+        printf("  MODE_%d  %7.2f s  %7.2f s  %5.1f%%\n", mode, raw_s, comp_s, 100 * (1 - comp_s / raw_s));
+    }
+}
+
+int main(void)
+{
+    printf("Transfer time: raw, compressed and saved\n");
+    bench_session("Betaflight connect", session_betaflight_connect);
+    bench_session("Betaflight tabs", session_betaflight_tabs);
+    bench_session("iNAV connect", session_inav_connect);
+    bench_session("iNAV tabs", session_inav_tabs);
+    return 0;
+}
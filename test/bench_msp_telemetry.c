@@ -0,0 +1,93 @@
+#include <stdio.h>
+#include <string.h>
+
+#include "msp/msp_telemetry.h"
+#include "msp/msp_transport.h"
+
+#include "bench.h"
+
+// Measures MSP over telemetry in input mode (requests from the radio,
+// responses from the FC) for MSPv1 and MSPv2 with different payload
+// sizes, using S.Port and CRSF sized chunks.
+
+#define ITERATIONS 20000
+
+static void bench_round_trip(const char *name, int version, size_t chunk_size, size_t size)
+{
+    static msp_telemetry_t tr;
+    uint16_t cmd = version == MSP_VERSION_1 ? 10 : 0x1005;
+    uint8_t payload[MSP_MAX_PAYLOAD_SIZE];
+    memset(payload, 0x5a, sizeof(payload));
+
+    // Request chunks are built once, the radio sends a cmd without payload
+    uint8_t req[2][8];
+    size_t req_sizes[2];
+    unsigned req_count;
+    if (version == MSP_VERSION_1)
+    {
+        uint8_t r[] = {1 << 4 | 1 << 5, 0, cmd, cmd};
+        memcpy(req[0], r, sizeof(r));
+        req_sizes[0] = sizeof(r);
+        req_count = 1;
+    }
+    else
+    {
+        // Header doesn't fit in a S.Port chunk
+        uint8_t r[] = {1 << 4 | 2 << 5, 0, cmd & 0xff, cmd >> 8, 0, 0};
+        size_t first = chunk_size < sizeof(r) ? chunk_size : sizeof(r);
+        memcpy(req[0], r, first);
+        req_sizes[0] = first;
+        req_count = 1;
+        if (first < sizeof(r))
+        {
+            req[1][0] = 1 | 2 << 5;
+            memcpy(&req[1][1], &r[first], sizeof(r) - first);
+            req_sizes[1] = sizeof(r) - first + 1;
+            req_count = 2;
+        }
+    }
+
+    msp_telemetry_init_input(&tr, chunk_size);
+    uint8_t chunk[64];
+    uint8_t buf[MSP_MAX_PAYLOAD_SIZE];
+    size_t air_bytes = 0;
+    uint64_t start = bench_now_ns();
+    for (int ii = 0; ii < ITERATIONS; ii++)
+    {
+        for (unsigned jj = 0; jj < req_count; jj++)
+        {
+            req[jj][0] = (req[jj][0] & 0xf0) | ((ii * req_count + jj) & 0x0f);
+            msp_telemetry_push_request_chunk(&tr, req[jj], req_sizes[jj]);
+        }
+        msp_direction_e direction;
+        uint16_t req_cmd;
+        if (msp_transport_read(MSP_TRANSPORT(&tr), &direction, &req_cmd, buf, sizeof(buf)) < 0)
+        {
+            printf("%s: request %d lost\n", name, ii);
+            return;
+        }
+        msp_transport_write(MSP_TRANSPORT(&tr), MSP_DIRECTION_FROM_MWC, req_cmd, payload, size);
+        size_t n;
+        while ((n = msp_telemetry_pop_response_chunk(&tr, chunk)) > 0)
+        {
+            air_bytes += n;
+        }
+    }
+    uint64_t elapsed = bench_now_ns() - start;
+    double secs = elapsed / 1e9;
+    printf("%-24s %4zu bytes  %8.0f msgs/s  %7.2f MB/s payload  %5.1f chunk bytes/msg\n",
+           name, size, ITERATIONS / secs, ITERATIONS * size / secs / 1e6, (double)air_bytes / ITERATIONS);
+}
+
+int main(void)
+{
+    static const size_t sizes[] = {0, 16, 64, 128, 200};
+    for (unsigned ii = 0; ii < sizeof(sizes) / sizeof(sizes[0]); ii++)
+    {
+        bench_round_trip("v1 S.Port (6 byte)", MSP_VERSION_1, 6, sizes[ii]);
+        bench_round_trip("v2 S.Port (6 byte)", MSP_VERSION_2, 6, sizes[ii]);
+        bench_round_trip("v1 CRSF (58 byte)", MSP_VERSION_1, 58, sizes[ii]);
+        bench_round_trip("v2 CRSF (58 byte)", MSP_VERSION_2, 58, sizes[ii]);
+    }
+    return 0;
+}
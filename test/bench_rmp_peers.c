@@ -0,0 +1,217 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "air/air.h"
+
+#include "config/config.h"
+
+#include "rmp/rmp.h"
+
+#include "util/macros.h"
+
+#include "bench.h"
+#include "host.h"
+
+// Simulates a swarm of P2P peers sending pings to a node, with peers
+// joining and leaving over time. Measures the cost of handling each
+// message and of rmp_update(), and compares the peer lookup with the
+// linear scan it replaced. A brute force model of the peers checks
+// that they're expired at the right time.
+//
+// Built with RMP_MAX_PEERS=1024, see the Makefile.
+
+#define PING_INTERVAL_MS 100
+#define CHURN_INTERVAL_MS 1000
+#define CHURN_PERCENT 5
+#define SIM_SECS 30
+// Peers are expired between these after they were last seen
+#define EXPIRES_AFTER_MS 3000
+#define EXPIRED_BEFORE_MS (EXPIRES_AFTER_MS + 500 + 1)
+
+typedef struct
+{
+    air_addr_t addr;
+    bool active;            // Sending pings
+    time_ticks_t last_seen; // 0 if never seen
+    time_ticks_t next_ping;
+} model_peer_t;
+
+static rmp_t rmp;
+static model_peer_t model[RMP_MAX_PEERS];
+static air_addr_t scan_addrs[RMP_MAX_PEERS];
+static uint64_t rng_state = 88172645463325252ull;
+static volatile unsigned sink; // Keeps the lookups from being optimized away
+
+bool config_get_pairing(air_pairing_t *pairing, air_addr_t *addr)
+{
+    return false;
+}
+
+static uint32_t rng_next(void)
+{
+    rng_state ^= rng_state << 13;
+    rng_state ^= rng_state >> 7;
+    rng_state ^= rng_state << 17;
+    return rng_state;
+}
+
+static bool p2p_send(rmp_t *rmp, rmp_msg_t *msg, void *user_data)
+{
+    return true;
+}
+
+static void model_peer_join(model_peer_t *peer, time_ticks_t now)
+{
+    for (int ii = 0; ii < AIR_ADDR_LENGTH; ii++)
+    {
+        peer->addr.addr[ii] = rng_next();
+    }
+    peer->active = true;
+    peer->last_seen = 0;
+    peer->next_ping = now + rng_next() % PING_INTERVAL_MS;
+}
+
+// Same as rmp_get_peer() before the index
+static int linear_scan(const air_addr_t *addrs, unsigned count, const air_addr_t *addr)
+{
+    for (unsigned ii = 0; ii < count; ii++)
+    {
+        if (memcmp(&addrs[ii], addr, sizeof(*addr)) == 0)
+        {
+            return ii;
+        }
+    }
+    return -1;
+}
+
+static unsigned model_check(unsigned count, time_ticks_t now)
+{
+    unsigned errors = 0;
+    for (unsigned ii = 0; ii < count; ii++)
+    {
+        model_peer_t *peer = &model[ii];
+        if (peer->last_seen == 0)
+        {
+            continue;
+        }
+        bool has = rmp_has_p2p_peer(&rmp, &peer->addr);
+        time_ticks_t age = now - peer->last_seen;
+        if ((age < MILLIS_TO_TICKS(EXPIRES_AFTER_MS) && !has) || (age >= MILLIS_TO_TICKS(EXPIRED_BEFORE_MS) && has))
+        {
+            errors++;
+        }
+    }
+    return errors;
+}
+
+static void bench_swarm(unsigned count)
+{
+    time_ticks_t now = time_ticks_now();
+    rmp_init(&rmp, &(air_addr_t){.addr = {0x24, 0x0a, 0xc4, 0, 0, 1}});
+    rmp_set_transport(&rmp, RMP_TRANSPORT_P2P, p2p_send, 255, NULL);
+    for (unsigned ii = 0; ii < count; ii++)
+    {
+        model_peer_join(&model[ii], now);
+    }
+
+    uint64_t process_ns = 0;
+    uint64_t update_ns = 0;
+    unsigned messages = 0;
+    unsigned updates = 0;
+    unsigned errors = 0;
+    time_ticks_t end = now + SECS_TO_TICKS(SIM_SECS);
+    time_ticks_t next_churn = now + MILLIS_TO_TICKS(CHURN_INTERVAL_MS);
+    for (; now < end; now++)
+    {
+        for (unsigned ii = 0; ii < count; ii++)
+        {
+            model_peer_t *peer = &model[ii];
+            if (peer->active && peer->next_ping <= now)
+            {
+                rmp_msg_t msg = {
+                    .src = peer->addr,
+                    .dst = AIR_ADDR_BROADCAST,
+                };
+                uint64_t start = bench_now_ns();
+                rmp_process_message(&rmp, &msg, RMP_TRANSPORT_P2P);
+                process_ns += bench_now_ns() - start;
+                messages++;
+                peer->last_seen = now;
+                peer->next_ping = now + MILLIS_TO_TICKS(PING_INTERVAL_MS);
+            }
+        }
+        uint64_t start = bench_now_ns();
+        rmp_update(&rmp);
+        update_ns += bench_now_ns() - start;
+        updates++;
+        if (now >= next_churn)
+        {
+            // Some peers go silent and get replaced by new ones once
+            // they have expired, so the table never fills up.
+            for (unsigned ii = 0; ii < count; ii++)
+            {
+                model_peer_t *peer = &model[ii];
+                if (peer->active && rng_next() % 100 < CHURN_PERCENT)
+                {
+                    peer->active = false;
+                }
+                else if (!peer->active && now - peer->last_seen >= MILLIS_TO_TICKS(EXPIRED_BEFORE_MS))
+                {
+                    model_peer_join(peer, now);
+                }
+            }
+            errors += model_check(count, now);
+            next_churn += MILLIS_TO_TICKS(CHURN_INTERVAL_MS);
+        }
+        vTaskDelay(1);
+    }
+    if (errors > 0)
+    {
+        printf("%u peers: %u mismatches against the model\n", count, errors);
+        exit(1);
+    }
+
+    // The lookup alone, with the index and with a linear scan over the
+    // same peers.
+    for (unsigned ii = 0; ii < count; ii++)
+    {
+        air_addr_cpy(&scan_addrs[ii], &model[ii].addr);
+    }
+    uint64_t index_start = bench_now_ns();
+    for (unsigned rep = 0; rep < 1000000 / count; rep++)
+    {
+        for (unsigned ii = 0; ii < count; ii++)
+        {
+            sink += rmp_has_p2p_peer(&rmp, &model[(ii * 7) % count].addr);
+        }
+    }
+    uint64_t index_ns = bench_now_ns() - index_start;
+    uint64_t scan_start = bench_now_ns();
+    for (unsigned rep = 0; rep < 1000000 / count; rep++)
+    {
+        for (unsigned ii = 0; ii < count; ii++)
+        {
+            sink += linear_scan(scan_addrs, count, &model[(ii * 7) % count].addr) >= 0;
+        }
+    }
+    uint64_t scan_ns = bench_now_ns() - scan_start;
+    unsigned total = (1000000 / count) * count;
+
+    printf("%5u  %9u  %8.1f  %9.1f  %9.1f  %9.1f\n", count, messages, (double)process_ns / messages,
+           (double)update_ns / updates, (double)index_ns / total, (double)scan_ns / total);
+}
+
+int main(void)
+{
+    static const unsigned counts[] = {16, 64, 256, 1024};
+    host_clock_set_virtual(SECS_TO_MICROS(1));
+    printf("Swarm of P2P peers pinging every %d ms for %d s, %d%% leaving each second. Times in ns\n",
+           PING_INTERVAL_MS, SIM_SECS, CHURN_PERCENT);
+    printf("peers   messages  per msg  rmp_update  index get  lin. scan\n");
+    for (unsigned ii = 0; ii < ARRAY_COUNT(counts); ii++)
+    {
+        bench_swarm(counts[ii]);
+    }
+    return 0;
+}
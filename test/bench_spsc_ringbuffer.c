@@ -0,0 +1,158 @@
+#include <pthread.h>
+#include <sched.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "util/macros.h"
+#include "util/ringbuffer.h"
+#include "util/spsc_ringbuffer.h"
+
+#include "bench.h"
+
+// Byte throughput of the ISR to task buffers, with the 128 byte
+// capacity used by input_crsf and serial. The generic ring_buffer_t
+// they used before is measured pushing and popping 1 byte at a time,
+// as they did, and with its bulk functions. The SPSC buffer is measured
+// in a single thread and with a producer and a consumer thread, the
+// consumer draining it with peek_contiguous like input_crsf does.
+
+#define CAPACITY 128
+#define TOTAL_BYTES (16 * 1024 * 1024)
+
+static RING_BUFFER_DECLARE(rb, uint8_t, CAPACITY) generic;
+static SPSC_RING_BUFFER_DECLARE(rb, uint8_t, CAPACITY) spsc;
+static uint8_t chunk[CAPACITY];
+static volatile unsigned sink; // Keeps the popped data from being optimized away
+
+static double mb_per_sec(uint64_t ns)
+{
+    return (double)TOTAL_BYTES / ns * 1e3;
+}
+
+static double bench_generic_bytes(void)
+{
+    RING_BUFFER_INIT(&generic.rb, uint8_t, CAPACITY);
+    unsigned sum = 0;
+    uint64_t start = bench_now_ns();
+    for (size_t done = 0; done < TOTAL_BYTES; done += CAPACITY)
+    {
+        for (int ii = 0; ii < CAPACITY; ii++)
+        {
+            ring_buffer_push(&generic.rb, &chunk[ii]);
+        }
+        uint8_t c;
+        while (ring_buffer_pop(&generic.rb, &c))
+        {
+            sum += c;
+        }
+    }
+    sink += sum;
+    return mb_per_sec(bench_now_ns() - start);
+}
+
+static double bench_generic_bulk(size_t chunk_size)
+{
+    RING_BUFFER_INIT(&generic.rb, uint8_t, CAPACITY);
+    uint8_t out[CAPACITY];
+    uint64_t start = bench_now_ns();
+    for (size_t done = 0; done < TOTAL_BYTES; done += chunk_size)
+    {
+        ring_buffer_push_n(&generic.rb, chunk, chunk_size);
+        sink += ring_buffer_pop_n(&generic.rb, out, chunk_size);
+    }
+    return mb_per_sec(bench_now_ns() - start);
+}
+
+static double bench_spsc_bytes(void)
+{
+    SPSC_RING_BUFFER_INIT(&spsc.rb, uint8_t, CAPACITY);
+    unsigned sum = 0;
+    uint64_t start = bench_now_ns();
+    for (size_t done = 0; done < TOTAL_BYTES; done += CAPACITY)
+    {
+        for (int ii = 0; ii < CAPACITY; ii++)
+        {
+            spsc_ring_buffer_push(&spsc.rb, &chunk[ii]);
+        }
+        uint8_t c;
+        while (spsc_ring_buffer_pop(&spsc.rb, &c))
+        {
+            sum += c;
+        }
+    }
+    sink += sum;
+    return mb_per_sec(bench_now_ns() - start);
+}
+
+static double bench_spsc_bulk(size_t chunk_size)
+{
+    SPSC_RING_BUFFER_INIT(&spsc.rb, uint8_t, CAPACITY);
+    uint8_t out[CAPACITY];
+    uint64_t start = bench_now_ns();
+    for (size_t done = 0; done < TOTAL_BYTES; done += chunk_size)
+    {
+        spsc_ring_buffer_push_n(&spsc.rb, chunk, chunk_size);
+        sink += spsc_ring_buffer_pop_n(&spsc.rb, out, chunk_size);
+    }
+    return mb_per_sec(bench_now_ns() - start);
+}
+
+static void *spsc_producer(void *arg)
+{
+    size_t chunk_size = *(size_t *)arg;
+    size_t done = 0;
+    while (done < TOTAL_BYTES)
+    {
+        size_t n = spsc_ring_buffer_push_n(&spsc.rb, chunk, MIN(chunk_size, TOTAL_BYTES - done));
+        if (n == 0)
+        {
+            sched_yield();
+        }
+        done += n;
+    }
+    return NULL;
+}
+
+static double bench_spsc_threads(size_t chunk_size)
+{
+    SPSC_RING_BUFFER_INIT(&spsc.rb, uint8_t, CAPACITY);
+    pthread_t producer;
+    uint64_t start = bench_now_ns();
+    pthread_create(&producer, NULL, spsc_producer, &chunk_size);
+    size_t done = 0;
+    while (done < TOTAL_BYTES)
+    {
+        const uint8_t *data;
+        size_t size;
+        if (!(data = spsc_ring_buffer_peek_contiguous(&spsc.rb, &size)))
+        {
+            sched_yield();
+            continue;
+        }
+        sink += data[size - 1];
+        spsc_ring_buffer_discard_n(&spsc.rb, size);
+        done += size;
+    }
+    pthread_join(producer, NULL);
+    return mb_per_sec(bench_now_ns() - start);
+}
+
+int main(void)
+{
+    static const size_t chunk_sizes[] = {1, 16, 64, 128};
+    for (int ii = 0; ii < CAPACITY; ii++)
+    {
+        chunk[ii] = ii;
+    }
+    printf("%d MB through a %d byte buffer, in MB/s\n", TOTAL_BYTES >> 20, CAPACITY);
+    printf("1 byte per call: ring_buffer %8.1f  spsc %8.1f\n", bench_generic_bytes(), bench_spsc_bytes());
+    printf("chunk  ring_buffer_n   spsc_n  spsc 2 threads\n");
+    for (int ii = 0; ii < ARRAY_COUNT(chunk_sizes); ii++)
+    {
+        size_t size = chunk_sizes[ii];
+        printf("%5u  %13.1f  %7.1f  %14.1f\n", (unsigned)size, bench_generic_bulk(size), bench_spsc_bulk(size),
+               bench_spsc_threads(size));
+    }
+    return 0;
+}
@@ -0,0 +1,125 @@
+#include <stdbool.h>
+#include <stdio.h>
+
+#include <hal/timer.h>
+
+#include "rc/rc_sched.h"
+
+#include "bench.h"
+
+// Measures how late timer_hal_t callbacks and rc_sched_wait() wakeups
+// are relative to their deadlines, using the POSIX timer backend.
+
+#define SAMPLES 400
+
+typedef struct
+{
+    uint64_t deadline;
+    uint64_t period;
+    uint32_t late[SAMPLES];
+    volatile unsigned count;
+} bench_timer_state_t;
+
+static void bench_timer_callback(timer_hal_t *timer, void *user_data)
+{
+    bench_timer_state_t *s = user_data;
+    uint64_t now = timer_hal_now();
+    if (s->count < SAMPLES)
+    {
+        s->late[s->count++] = now > s->deadline ? now - s->deadline : 0;
+    }
+    s->deadline += s->period;
+}
+
+static void bench_print(const char *name, uint32_t *late, unsigned count)
+{
+    uint32_t p50 = bench_percentile(late, count, 50);
+    uint32_t p99 = bench_percentile(late, count, 99);
+    printf("%-28s n=%-4u p50=%5uus p99=%5uus max=%5uus\n", name, count, p50, p99, late[count - 1]);
+}
+
+static void bench_once(uint64_t delay)
+{
+    bench_timer_state_t s = {0};
+    timer_hal_t timer;
+    timer_hal_init(&timer, "bench", bench_timer_callback, &s);
+    for (unsigned ii = 0; ii < SAMPLES; ii++)
+    {
+        s.deadline = timer_hal_now() + delay;
+        timer_hal_start_once(&timer, s.deadline);
+        while (s.count == ii)
+        {
+        }
+    }
+    timer_hal_destroy(&timer);
+    char name[32];
+    snprintf(name, sizeof(name), "once %uus", (unsigned)delay);
+    bench_print(name, s.late, SAMPLES);
+}
+
+static void bench_periodic(uint64_t period)
+{
+    bench_timer_state_t s = {.period = period};
+    timer_hal_t timer;
+    timer_hal_init(&timer, "bench", bench_timer_callback, &s);
+    s.deadline = timer_hal_now() + period;
+    timer_hal_start_periodic(&timer, period);
+    while (s.count < SAMPLES)
+    {
+        vTaskDelay(1);
+    }
+    timer_hal_stop(&timer);
+    timer_hal_destroy(&timer);
+    char name[32];
+    snprintf(name, sizeof(name), "periodic %uus", (unsigned)period);
+    bench_print(name, s.late, SAMPLES);
+}
+
+// Sleeps until slot deadlines like the RC task does with output_air,
+// so this is the TX slot jitter on this machine.
+static bool bench_sched(uint64_t slot)
+{
+    static uint32_t late[SAMPLES];
+    rc_sched_t sched;
+    rc_sched_init(&sched);
+    time_micros_t deadline = time_micros_now();
+    for (unsigned ii = 0; ii < SAMPLES; ii++)
+    {
+        deadline += slot;
+        time_micros_t now;
+        while ((now = time_micros_now()) < deadline)
+        {
+            rc_sched_wait(&sched, deadline);
+        }
+        late[ii] = now - deadline;
+    }
+    rc_sched_stats_t stats;
+    rc_sched_request_stats(&sched);
+    rc_sched_wait(&sched, 0);
+    timer_hal_destroy(&sched.timer);
+    if (!rc_sched_get_stats(&sched, &stats))
+    {
+        return false;
+    }
+    char name[32];
+    snprintf(name, sizeof(name), "rc_sched slot %uus", (unsigned)slot);
+    bench_print(name, late, SAMPLES);
+    printf("%-28s wakeups: %u deadline, %u event, %u spin\n", "", stats.deadline_wakeups,
+           stats.event_wakeups, stats.spins);
+    return true;
+}
+
+int main(void)
+{
+    bench_once(200);
+    bench_once(1000);
+    bench_once(5000);
+    bench_periodic(1000);
+    bench_periodic(4500);
+    if (!bench_sched(4500) || !bench_sched(20000))
+    {
+        printf("rc_sched stats snapshot not taken\n");
+        return 1;
+    }
+    return 0;
+}
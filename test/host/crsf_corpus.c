@@ -0,0 +1,137 @@
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "protocols/crsf.h"
+
+#include "util/crc.h"
+
+#include "crsf_corpus.h"
+
+// Phases of the session, in periods. They repeat every 10s.
+#define SESSION_PERIODS 2500
+#define PING_UNTIL 250
+#define PING_INTERVAL 50
+#define PARAMS_FROM 250
+#define PARAMS_UNTIL 750
+#define PARAMS_INTERVAL 5
+#define PARAMS_COUNT 20
+#define PARAM_WRITE_AT 700
+#define MSP_FROM 1000
+#define MSP_UNTIL 1500
+#define MSP_INTERVAL 5
+
+static uint8_t *crsf_corpus_put_frame(uint8_t *ptr, uint8_t type, const void *payload, size_t payload_size)
+{
+    *ptr++ = CRSF_ADDRESS_CRSF_TRANSMITTER;
+    *ptr++ = CRSF_FRAME_SIZE(payload_size);
+    uint8_t *crc_start = ptr;
+    *ptr++ = type;
+    memcpy(ptr, payload, payload_size);
+    ptr += payload_size;
+    *ptr = crc8_dvb_s2_bytes(crc_start, payload_size + 1);
+    return ptr + 1;
+}
+
+static uint8_t *crsf_corpus_put_ext_frame(uint8_t *ptr, uint8_t type, uint8_t dest, const void *payload,
+                                          size_t payload_size)
+{
+    uint8_t buf[CRSF_PAYLOAD_SIZE_MAX];
+    buf[0] = dest;
+    buf[1] = CRSF_ADDRESS_RADIO_TRANSMITTER;
+    memcpy(&buf[2], payload, payload_size);
+    return crsf_corpus_put_frame(ptr, type, buf, payload_size + 2);
+}
+
+static uint8_t *crsf_corpus_put_channels(uint8_t *ptr, unsigned period)
+{
+    // Sticks moving slowly, switches and pots still
+    double t = period * CRSF_CORPUS_PERIOD_US * 1e-6;
+    unsigned sticks[4];
+    for (int ii = 0; ii < 4; ii++)
+    {
+        double v = sin(t * (0.7 + ii * 0.3) + ii);
+        sticks[ii] = CRSF_CHANNEL_VALUE_MID + (int)(v * (CRSF_CHANNEL_VALUE_MAX - CRSF_CHANNEL_VALUE_MID));
+    }
+    crsf_channels_t channels = {
+        .ch0 = sticks[0],
+        .ch1 = sticks[1],
+        .ch2 = sticks[2],
+        .ch3 = sticks[3],
+        .ch4 = CRSF_CHANNEL_VALUE_MAX,
+        .ch5 = CRSF_CHANNEL_VALUE_MIN,
+        .ch6 = CRSF_CHANNEL_VALUE_MID,
+        .ch7 = CRSF_CHANNEL_VALUE_MIN,
+        .ch8 = CRSF_CHANNEL_VALUE_MID,
+        .ch9 = CRSF_CHANNEL_VALUE_MID,
+        .ch10 = CRSF_CHANNEL_VALUE_MIN,
+        .ch11 = CRSF_CHANNEL_VALUE_MIN,
+        .ch12 = CRSF_CHANNEL_VALUE_MID,
+        .ch13 = CRSF_CHANNEL_VALUE_MID,
+        .ch14 = CRSF_CHANNEL_VALUE_MID,
+        .ch15 = CRSF_CHANNEL_VALUE_MID,
+    };
+    return crsf_corpus_put_frame(ptr, CRSF_FRAMETYPE_RC_CHANNELS_PACKED, &channels, sizeof(channels));
+}
+
+// Returns the end of the data, or ptr if the period only has channels
+static uint8_t *crsf_corpus_put_extra(uint8_t *ptr, unsigned period, unsigned *frames)
+{
+    unsigned p = period % SESSION_PERIODS;
+    if (p < PING_UNTIL && p % PING_INTERVAL == 0)
+    {
+        ptr = crsf_corpus_put_ext_frame(ptr, CRSF_FRAMETYPE_DEVICE_PING, CRSF_ADDRESS_BROADCAST, NULL, 0);
+        (*frames)++;
+    }
+    else if (p == PARAM_WRITE_AT)
+    {
+        crsf_parameter_write_t write = {.param_index = 3, .payload.u8 = 2};
+        ptr = crsf_corpus_put_ext_frame(ptr, CRSF_FRAMETYPE_PARAMETER_WRITE, CRSF_ADDRESS_CRSF_TRANSMITTER, &write, 2);
+        (*frames)++;
+    }
+    else if (p >= PARAMS_FROM && p < PARAMS_UNTIL && p % PARAMS_INTERVAL == 0)
+    {
+        crsf_parameter_read_t read = {
+            .param_index = 1 + (p - PARAMS_FROM) / PARAMS_INTERVAL % PARAMS_COUNT,
+            .chunks = 0,
+        };
+        ptr = crsf_corpus_put_ext_frame(ptr, CRSF_FRAMETYPE_PARAMETER_READ, CRSF_ADDRESS_CRSF_TRANSMITTER, &read,
+                                        sizeof(read));
+        (*frames)++;
+    }
+    else if (p >= MSP_FROM && p < MSP_UNTIL && p % MSP_INTERVAL == 0)
+    {
+        uint8_t chunk[CRSF_MSP_REQ_PAYLOAD_SIZE];
+        for (int ii = 0; ii < sizeof(chunk); ii++)
+        {
+            chunk[ii] = p + ii;
+        }
+        ptr = crsf_corpus_put_ext_frame(ptr, CRSF_FRAMETYPE_MSP_WRITE, CRSF_ADDRESS_FLIGHT_CONTROLLER, chunk,
+                                        sizeof(chunk));
+        (*frames)++;
+    }
+    return ptr;
+}
+
+void crsf_corpus_init(crsf_corpus_t *corpus, unsigned periods)
+{
+    corpus->data = malloc(periods * 2 * CRSF_FRAME_SIZE_MAX);
+    corpus->period_ends = malloc(periods * sizeof(*corpus->period_ends));
+    corpus->periods = periods;
+    corpus->frames = 0;
+    uint8_t *ptr = corpus->data;
+    for (unsigned ii = 0; ii < periods; ii++)
+    {
+        ptr = crsf_corpus_put_channels(ptr, ii);
+        corpus->frames++;
+        ptr = crsf_corpus_put_extra(ptr, ii, &corpus->frames);
+        corpus->period_ends[ii] = ptr - corpus->data;
+    }
+    corpus->size = ptr - corpus->data;
+}
+
+void crsf_corpus_free(crsf_corpus_t *corpus)
+{
+    free(corpus->data);
+    free(corpus->period_ends);
+}
@@ -0,0 +1,32 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+// Traffic received by the TX module on the CRSF line from an EdgeTX
+// radio, split in 4ms periods (250Hz). Every period carries an RC
+// channels frame. Some also carry the other frames the radio sends
+// during a session:
+//  - Device pings while the radio looks for modules.
+//  - Parameter reads and writes from the configuration script.
+//  - MSP writes, in 8 byte chunks, from a telemetry script.
+// No captures from a real radio are available in the tree. The frames
+// are generated with the same layout, sizes and addresses as EdgeTX
+// uses, so the parser sees the same mix. The module doesn't listen
+// while it transmits, so no telemetry is included.
+
+#define CRSF_CORPUS_PERIOD_US 4000
+
+typedef struct crsf_corpus_s
+{
+    uint8_t *data;
+    size_t size;
+    size_t *period_ends; // End offset in data of each period
+    unsigned periods;
+    unsigned frames;
+} crsf_corpus_t;
+
+// Generates the traffic for the given number of periods. Frames are
+// back to back, without any line errors.
+void crsf_corpus_init(crsf_corpus_t *corpus, unsigned periods);
+void crsf_corpus_free(crsf_corpus_t *corpus);
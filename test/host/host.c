@@ -0,0 +1,277 @@
+#include <pthread.h>
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include <esp_log.h>
+#include <esp_system.h>
+#include <esp_timer.h>
+#include <freertos/FreeRTOS.h>
+#include <freertos/semphr.h>
+#include <freertos/task.h>
+
+#include "host.h"
+
+typedef struct host_task_s
+{
+    pthread_t thread;
+    pthread_mutex_t mutex;
+    pthread_cond_t cond;
+    uint32_t notify;
+    TaskFunction_t fn;
+    void *arg;
+} host_task_t;
+
+typedef struct host_mutex_s
+{
+    pthread_mutex_t mutex;
+} host_mutex_t;
+
+static bool clock_virtual;
+static uint64_t clock_now;
+static uint64_t clock_step;
+static __thread host_task_t *current_task;
+
+static uint64_t host_monotonic_micros(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+void host_clock_set_virtual(uint64_t now)
+{
+    clock_virtual = true;
+    __atomic_store_n(&clock_now, now, __ATOMIC_RELAXED);
+}
+
+void host_clock_set_step(uint64_t us)
+{
+    __atomic_store_n(&clock_step, us, __ATOMIC_RELAXED);
+}
+
+void host_clock_advance(uint64_t us)
+{
+    __atomic_add_fetch(&clock_now, us, __ATOMIC_RELAXED);
+}
+
+int64_t esp_timer_get_time(void)
+{
+    if (clock_virtual)
+    {
+        uint64_t step = __atomic_load_n(&clock_step, __ATOMIC_RELAXED);
+        return __atomic_fetch_add(&clock_now, step, __ATOMIC_RELAXED);
+    }
+    return host_monotonic_micros();
+}
+
+uint32_t esp_random(void)
+{
+    return ((uint32_t)rand() << 16) ^ (uint32_t)rand();
+}
+
+static int host_log_level(void)
+{
+    static int level = -1;
+    if (level < 0)
+    {
+        const char *env = getenv("RAVEN_LOG");
+        level = ESP_LOG_NONE;
+        if (env)
+        {
+            const char *levels = "NEWIDV";
+            const char *p = strchr(levels, env[0]);
+            level = p ? p - levels : ESP_LOG_INFO;
+        }
+    }
+    return level;
+}
+
+void host_log_write(int level, const char *tag, const char *format, ...)
+{
+    if (level > host_log_level())
+    {
+        return;
+    }
+    va_list ap;
+    va_start(ap, format);
+    fprintf(stderr, "%c (%llu) %s: ", "NEWIDV"[level], (unsigned long long)esp_timer_get_time() / 1000, tag);
+    vfprintf(stderr, format, ap);
+    fputc('\n', stderr);
+    va_end(ap);
+}
+
+void host_log_buffer(int level, const char *tag, const void *buf, unsigned size)
+{
+    if (level > host_log_level())
+    {
+        return;
+    }
+    const uint8_t *p = buf;
+    fprintf(stderr, "%c %s:", "NEWIDV"[level], tag);
+    for (unsigned ii = 0; ii < size; ii++)
+    {
+        fprintf(stderr, " %02x", p[ii]);
+    }
+    fputc('\n', stderr);
+}
+
+static host_task_t *host_task_new(void)
+{
+    host_task_t *task = calloc(1, sizeof(*task));
+    pthread_condattr_t attr;
+    pthread_condattr_init(&attr);
+    pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+    pthread_cond_init(&task->cond, &attr);
+    pthread_condattr_destroy(&attr);
+    pthread_mutex_init(&task->mutex, NULL);
+    return task;
+}
+
+static void *host_task_main(void *arg)
+{
+    host_task_t *task = arg;
+    current_task = task;
+    task->fn(task->arg);
+    return NULL;
+}
+
+TickType_t xTaskGetTickCount(void)
+{
+    return esp_timer_get_time() / 1000;
+}
+
+void vTaskDelay(TickType_t ticks)
+{
+    if (clock_virtual)
+    {
+        host_clock_advance((uint64_t)ticks * 1000);
+        return;
+    }
+    struct timespec ts = {
+        .tv_sec = ticks / 1000,
+        .tv_nsec = (ticks % 1000) * 1000000,
+    };
+    nanosleep(&ts, NULL);
+}
+
+TaskHandle_t xTaskGetCurrentTaskHandle(void)
+{
+    if (!current_task)
+    {
+        current_task = host_task_new();
+        current_task->thread = pthread_self();
+    }
+    return current_task;
+}
+
+BaseType_t xTaskCreatePinnedToCore(TaskFunction_t fn, const char *name, uint32_t stack, void *arg,
+                                   UBaseType_t prio, TaskHandle_t *handle, BaseType_t core)
+{
+    host_task_t *task = host_task_new();
+    task->fn = fn;
+    task->arg = arg;
+    if (handle)
+    {
+        *handle = task;
+    }
+    if (pthread_create(&task->thread, NULL, host_task_main, task) != 0)
+    {
+        return pdFAIL;
+    }
+    pthread_detach(task->thread);
+    return pdPASS;
+}
+
+BaseType_t xTaskNotifyGive(TaskHandle_t task)
+{
+    pthread_mutex_lock(&task->mutex);
+    task->notify++;
+    pthread_cond_signal(&task->cond);
+    pthread_mutex_unlock(&task->mutex);
+    return pdPASS;
+}
+
+void vTaskNotifyGiveFromISR(TaskHandle_t task, BaseType_t *woken)
+{
+    xTaskNotifyGive(task);
+    if (woken)
+    {
+        *woken = pdTRUE;
+    }
+}
+
+uint32_t ulTaskNotifyTake(BaseType_t clear, TickType_t ticks)
+{
+    host_task_t *task = xTaskGetCurrentTaskHandle();
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    uint64_t ns = ts.tv_nsec + (uint64_t)ticks * 1000000;
+    ts.tv_sec += ns / 1000000000;
+    ts.tv_nsec = ns % 1000000000;
+    pthread_mutex_lock(&task->mutex);
+    while (task->notify == 0 && ticks > 0)
+    {
+        if (ticks == portMAX_DELAY)
+        {
+            pthread_cond_wait(&task->cond, &task->mutex);
+        }
+        else if (pthread_cond_timedwait(&task->cond, &task->mutex, &ts) != 0)
+        {
+            break;
+        }
+    }
+    uint32_t value = task->notify;
+    if (value > 0)
+    {
+        task->notify = clear ? 0 : value - 1;
+    }
+    pthread_mutex_unlock(&task->mutex);
+    return value;
+}
+
+SemaphoreHandle_t xSemaphoreCreateMutex(void)
+{
+    host_mutex_t *sem = calloc(1, sizeof(*sem));
+    pthread_mutex_init(&sem->mutex, NULL);
+    return sem;
+}
+
+BaseType_t xSemaphoreTake(SemaphoreHandle_t sem, TickType_t ticks)
+{
+    if (ticks == portMAX_DELAY)
+    {
+        pthread_mutex_lock(&sem->mutex);
+        return pdTRUE;
+    }
+    // Non blocking or bounded waits are only used as try-locks
+    return pthread_mutex_trylock(&sem->mutex) == 0 ? pdTRUE : pdFALSE;
+}
+
+BaseType_t xSemaphoreGive(SemaphoreHandle_t sem)
+{
+    pthread_mutex_unlock(&sem->mutex);
+    return pdTRUE;
+}
+
+void vSemaphoreDelete(SemaphoreHandle_t sem)
+{
+    pthread_mutex_destroy(&sem->mutex);
+    free(sem);
+}
+
+#if defined(HOST_NEEDS_STRLCPY)
+size_t strlcpy(char *dst, const char *src, size_t size)
+{
+    size_t len = strlen(src);
+    if (size > 0)
+    {
+        size_t n = len < size - 1 ? len : size - 1;
+        memcpy(dst, src, n);
+        dst[n] = '\0';
+    }
+    return len;
+}
+#endif
@@ -0,0 +1,14 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stdint.h>
+
+// Controls for the host runtime in host.c. By default time comes from
+// CLOCK_MONOTONIC. Simulations can switch to a virtual clock, which
+// only moves when advanced explicitly (vTaskDelay() advances it too).
+// A step can be set to advance it on every read, so code busy waiting
+// for some microseconds (e.g. for the SX127x PLL lock) makes progress.
+
+void host_clock_set_virtual(uint64_t now);
+void host_clock_set_step(uint64_t us);
+void host_clock_advance(uint64_t us);
@@ -0,0 +1,61 @@
+#pragma once
+
+#include <esp_err.h>
+
+typedef int gpio_num_t;
+typedef void (*gpio_isr_t)(void *arg);
+
+#define GPIO_NUM_0 0
+#define GPIO_NUM_2 2
+#define GPIO_NUM_4 4
+#define GPIO_NUM_5 5
+#define GPIO_NUM_12 12
+#define GPIO_NUM_13 13
+#define GPIO_NUM_14 14
+#define GPIO_NUM_15 15
+#define GPIO_NUM_16 16
+#define GPIO_NUM_17 17
+#define GPIO_NUM_18 18
+#define GPIO_NUM_19 19
+#define GPIO_NUM_21 21
+#define GPIO_NUM_22 22
+#define GPIO_NUM_23 23
+#define GPIO_NUM_25 25
+#define GPIO_NUM_26 26
+#define GPIO_NUM_27 27
+#define GPIO_NUM_32 32
+#define GPIO_NUM_33 33
+#define GPIO_NUM_34 34
+#define GPIO_NUM_35 35
+#define GPIO_NUM_36 36
+#define GPIO_NUM_39 39
+
+typedef enum {
+    GPIO_MODE_INPUT,
+    GPIO_MODE_OUTPUT,
+} gpio_mode_t;
+
+typedef enum {
+    GPIO_PULLUP_ONLY,
+    GPIO_PULLDOWN_ONLY,
+    GPIO_PULLUP_PULLDOWN,
+    GPIO_FLOATING,
+} gpio_pull_mode_t;
+
+typedef enum {
+    GPIO_INTR_DISABLE,
+    GPIO_INTR_POSEDGE,
+    GPIO_INTR_NEGEDGE,
+} gpio_int_type_t;
+
+#define ESP_INTR_FLAG_IRAM (1 << 10)
+
+esp_err_t gpio_set_direction(gpio_num_t gpio, gpio_mode_t mode);
+esp_err_t gpio_set_level(gpio_num_t gpio, unsigned level);
+int gpio_get_level(gpio_num_t gpio);
+esp_err_t gpio_pullup_en(gpio_num_t gpio);
+esp_err_t gpio_pulldown_dis(gpio_num_t gpio);
+esp_err_t gpio_set_pull_mode(gpio_num_t gpio, gpio_pull_mode_t pull);
+esp_err_t gpio_set_intr_type(gpio_num_t gpio, gpio_int_type_t type);
+esp_err_t gpio_install_isr_service(int flags);
+esp_err_t gpio_isr_handler_add(gpio_num_t gpio, gpio_isr_t handler, void *arg);
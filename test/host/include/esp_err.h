@@ -0,0 +1,16 @@
+#pragma once
+
+#include <assert.h>
+
+typedef int esp_err_t;
+
+#define ESP_OK 0
+#define ESP_FAIL -1
+
+#define ESP_ERROR_CHECK(x)          \
+    do                              \
+    {                               \
+        esp_err_t __err = (x);      \
+        assert(__err == ESP_OK);    \
+        (void)__err;                \
+    } while (0)
@@ -0,0 +1,24 @@
+#pragma once
+
+#include <stdarg.h>
+
+// Host replacement for the ESP-IDF logger. Messages are discarded
+// unless RAVEN_LOG is set in the environment (e.g. RAVEN_LOG=W).
+
+#define ESP_LOG_NONE 0
+#define ESP_LOG_ERROR 1
+#define ESP_LOG_WARN 2
+#define ESP_LOG_INFO 3
+#define ESP_LOG_DEBUG 4
+#define ESP_LOG_VERBOSE 5
+
+void host_log_write(int level, const char *tag, const char *format, ...) __attribute__((format(printf, 3, 4)));
+void host_log_buffer(int level, const char *tag, const void *buf, unsigned size);
+
+#define ESP_LOGE(tag, format, ...) host_log_write(ESP_LOG_ERROR, tag, format, ##__VA_ARGS__)
+#define ESP_LOGW(tag, format, ...) host_log_write(ESP_LOG_WARN, tag, format, ##__VA_ARGS__)
+#define ESP_LOGI(tag, format, ...) host_log_write(ESP_LOG_INFO, tag, format, ##__VA_ARGS__)
+#define ESP_LOGD(tag, format, ...) host_log_write(ESP_LOG_DEBUG, tag, format, ##__VA_ARGS__)
+#define ESP_LOGV(tag, format, ...) host_log_write(ESP_LOG_VERBOSE, tag, format, ##__VA_ARGS__)
+
+#define ESP_LOG_BUFFER_HEX_LEVEL(tag, buf, size, level) host_log_buffer(level, tag, buf, size)
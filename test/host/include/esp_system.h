@@ -0,0 +1,7 @@
+#pragma once
+
+#include <stdint.h>
+
+#include <esp_err.h>
+
+uint32_t esp_random(void);
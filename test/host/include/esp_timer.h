@@ -0,0 +1,7 @@
+#pragma once
+
+#include <stdint.h>
+
+// Microseconds since boot. See host.h for switching to a virtual
+// clock in tests.
+int64_t esp_timer_get_time(void);
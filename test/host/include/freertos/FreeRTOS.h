@@ -0,0 +1,25 @@
+#pragma once
+
+#include <assert.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include <esp_attr.h>
+
+// Minimal FreeRTOS API on top of pthreads. Ticks are 1ms, like in
+// the ESP32 sdkconfig, and derived from esp_timer_get_time().
+
+typedef uint32_t TickType_t;
+typedef int BaseType_t;
+typedef unsigned UBaseType_t;
+
+#define portTICK_PERIOD_MS 1
+#define portMAX_DELAY ((TickType_t)0xffffffff)
+#define pdFALSE 0
+#define pdTRUE 1
+#define pdPASS 1
+#define pdFAIL 0
+#define pdMS_TO_TICKS(ms) ((TickType_t)(ms))
+
+#define portYIELD_FROM_ISR()
@@ -0,0 +1,19 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+// MD5 with the mbedtls API used by the tree, implemented in host/md5.c
+
+typedef struct
+{
+    uint32_t state[4];
+    uint64_t count; // In bytes
+    unsigned char buffer[64];
+} mbedtls_md5_context;
+
+void mbedtls_md5_init(mbedtls_md5_context *ctx);
+void mbedtls_md5_free(mbedtls_md5_context *ctx);
+int mbedtls_md5_starts(mbedtls_md5_context *ctx);
+int mbedtls_md5_update(mbedtls_md5_context *ctx, const unsigned char *input, size_t ilen);
+int mbedtls_md5_finish(mbedtls_md5_context *ctx, unsigned char output[16]);
@@ -0,0 +1,9 @@
+#pragma once
+
+#include_next <string.h>
+
+// newlib has strlcpy(), glibc only since 2.38
+#if defined(__GLIBC__) && (__GLIBC__ < 2 || (__GLIBC__ == 2 && __GLIBC_MINOR__ < 38))
+#define HOST_NEEDS_STRLCPY
+size_t strlcpy(char *dst, const char *src, size_t size);
+#endif
@@ -0,0 +1,69 @@
+#include <driver/gpio.h>
+#include <esp_sleep.h>
+
+// Peripherals which aren't simulated. Writes are ignored and reads
+// return their idle state.
+
+esp_err_t gpio_set_direction(gpio_num_t gpio, gpio_mode_t mode)
+{
+    return ESP_OK;
+}
+
+esp_err_t gpio_set_level(gpio_num_t gpio, unsigned level)
+{
+    return ESP_OK;
+}
+
+int gpio_get_level(gpio_num_t gpio)
+{
+    return 1;
+}
+
+esp_err_t gpio_pullup_en(gpio_num_t gpio)
+{
+    return ESP_OK;
+}
+
+esp_err_t gpio_pulldown_dis(gpio_num_t gpio)
+{
+    return ESP_OK;
+}
+
+esp_err_t gpio_set_pull_mode(gpio_num_t gpio, gpio_pull_mode_t pull)
+{
+    return ESP_OK;
+}
+
+esp_err_t gpio_set_intr_type(gpio_num_t gpio, gpio_int_type_t type)
+{
+    return ESP_OK;
+}
+
+esp_err_t gpio_install_isr_service(int flags)
+{
+    return ESP_OK;
+}
+
+esp_err_t gpio_isr_handler_add(gpio_num_t gpio, gpio_isr_t handler, void *arg)
+{
+    return ESP_OK;
+}
+
+esp_sleep_wakeup_cause_t esp_sleep_get_wakeup_cause(void)
+{
+    return ESP_SLEEP_WAKEUP_UNDEFINED;
+}
+
+esp_err_t esp_sleep_pd_config(esp_sleep_pd_domain_t domain, esp_sleep_pd_option_t option)
+{
+    return ESP_OK;
+}
+
+esp_err_t esp_sleep_enable_ext1_wakeup(uint64_t mask, esp_sleep_ext1_wakeup_mode_t mode)
+{
+    return ESP_OK;
+}
+
+void esp_deep_sleep_start(void)
+{
+}
@@ -0,0 +1,279 @@
+#include <math.h>
+#include <stdbool.h>
+#include <string.h>
+
+#include <driver/spi_master.h>
+#include <esp_timer.h>
+
+#include "sx127x_sim.h"
+
+#define REG_FIFO 0x00
+#define REG_OP_MODE 0x01
+#define REG_FRF_MSB 0x06
+#define REG_FRF_MID 0x07
+#define REG_FRF_LSB 0x08
+#define REG_FIFO_ADDR_PTR 0x0d
+#define REG_FIFO_RX_BASE_ADDR 0x0f
+#define REG_FIFO_RX_CURRENT_ADDR 0x10
+#define REG_IRQ_FLAGS 0x12
+#define REG_RX_NB_BYTES 0x13
+#define REG_PKT_SNR_VALUE 0x19
+#define REG_PKT_RSSI_VALUE 0x1a
+#define REG_MODEM_CONFIG_1 0x1d
+#define REG_MODEM_CONFIG_2 0x1e
+#define REG_PREAMBLE_MSB 0x20
+#define REG_PREAMBLE_LSB 0x21
+#define REG_PAYLOAD_LENGTH 0x22
+#define REG_MODEM_CONFIG_3 0x26
+
+#define MODE_MASK 0x07
+#define MODE_STDBY 0x01
+#define MODE_RX_SINGLE 0x06
+#define IRQ_TX_DONE 0x08
+#define IRQ_RX_DONE 0x40
+
+typedef struct sx127x_sim_chip_s
+{
+    bool attached;
+    int cs;
+    uint8_t regs[SX127X_SIM_REGS];
+    uint8_t fifo[256];
+    uint32_t frf;
+    uint64_t mode_changed_at;
+    sx127x_sim_stats_t stats;
+} sx127x_sim_chip_t;
+
+static sx127x_sim_chip_t chips[SX127X_SIM_MAX_CHIPS];
+static sx127x_sim_chip_t *selected = &chips[0];
+
+// Table 41/85, reset values of the LoRa registers
+static const struct
+{
+    uint8_t addr;
+    uint8_t value;
+} reset_values[] = {
+    {0x01, 0x09},
+    {0x06, 0x6c},
+    {0x07, 0x80},
+    {0x08, 0x00},
+    {0x09, 0x4f},
+    {0x0a, 0x09},
+    {0x0b, 0x2b},
+    {0x0c, 0x20},
+    {0x0e, 0x80},
+    {0x1d, 0x72},
+    {0x1e, 0x70},
+    {0x1f, 0x64},
+    {0x21, 0x08},
+    {0x22, 0x01},
+    {0x23, 0xff},
+    {0x26, 0x04},
+    {0x31, 0xc3},
+    {0x37, 0x0a},
+    {0x39, 0x12},
+    {0x42, 0x12},
+    {0x4d, 0x84},
+};
+
+static void sx127x_sim_chip_reset(sx127x_sim_chip_t *chip)
+{
+    memset(chip, 0, sizeof(*chip));
+    for (unsigned ii = 0; ii < sizeof(reset_values) / sizeof(reset_values[0]); ii++)
+    {
+        chip->regs[reset_values[ii].addr] = reset_values[ii].value;
+    }
+    chip->frf = (chip->regs[REG_FRF_MSB] << 16) | (chip->regs[REG_FRF_MID] << 8) | chip->regs[REG_FRF_LSB];
+}
+
+void sx127x_sim_reset(void)
+{
+    for (unsigned ii = 0; ii < SX127X_SIM_MAX_CHIPS; ii++)
+    {
+        sx127x_sim_chip_reset(&chips[ii]);
+    }
+}
+
+void sx127x_sim_select(unsigned chip)
+{
+    selected = &chips[chip % SX127X_SIM_MAX_CHIPS];
+}
+
+int sx127x_sim_chip_for_cs(int cs)
+{
+    for (unsigned ii = 0; ii < SX127X_SIM_MAX_CHIPS; ii++)
+    {
+        if (chips[ii].attached && chips[ii].cs == cs)
+        {
+            return ii;
+        }
+    }
+    return -1;
+}
+
+uint8_t sx127x_sim_reg(uint8_t addr)
+{
+    return selected->regs[addr % SX127X_SIM_REGS];
+}
+
+void sx127x_sim_set_reg(uint8_t addr, uint8_t value)
+{
+    selected->regs[addr % SX127X_SIM_REGS] = value;
+}
+
+uint32_t sx127x_sim_frf(void)
+{
+    return selected->frf;
+}
+
+const uint8_t *sx127x_sim_fifo(void)
+{
+    return selected->fifo;
+}
+
+void sx127x_sim_get_stats(sx127x_sim_stats_t *stats)
+{
+    *stats = selected->stats;
+}
+
+void sx127x_sim_reset_stats(void)
+{
+    memset(&selected->stats, 0, sizeof(selected->stats));
+}
+
+uint64_t sx127x_sim_mode_changed_at(void)
+{
+    return selected->mode_changed_at;
+}
+
+uint64_t sx127x_sim_time_on_air(void)
+{
+    // Table 13, RegModemConfig1 bandwidths
+    static const double bandwidths[] = {7.8e3, 10.4e3, 15.6e3, 20.8e3, 31.25e3, 41.7e3, 62.5e3, 125e3, 250e3, 500e3};
+    const uint8_t *regs = selected->regs;
+    int bw_idx = regs[REG_MODEM_CONFIG_1] >> 4;
+    double bw = bandwidths[bw_idx < 10 ? bw_idx : 9];
+    int cr = (regs[REG_MODEM_CONFIG_1] >> 1) & 0x07;
+    int implicit_header = regs[REG_MODEM_CONFIG_1] & 0x01;
+    int sf = regs[REG_MODEM_CONFIG_2] >> 4;
+    int crc = (regs[REG_MODEM_CONFIG_2] >> 2) & 0x01;
+    int ldro = (regs[REG_MODEM_CONFIG_3] >> 3) & 0x01;
+    int preamble = (regs[REG_PREAMBLE_MSB] << 8) | regs[REG_PREAMBLE_LSB];
+    int payload = regs[REG_PAYLOAD_LENGTH];
+    double symbol = (1 << sf) / bw;
+    double num = 8 * payload - 4 * sf + 28 + 16 * crc - 20 * implicit_header;
+    double symbols = 8 + fmax(ceil(num / (4 * (sf - 2 * ldro))) * (cr + 4), 0);
+    return llround(((preamble + 4.25) + symbols) * symbol * 1e6);
+}
+
+void sx127x_sim_finish_tx(void)
+{
+    selected->regs[REG_IRQ_FLAGS] |= IRQ_TX_DONE;
+    selected->regs[REG_OP_MODE] = (selected->regs[REG_OP_MODE] & ~MODE_MASK) | MODE_STDBY;
+    selected->mode_changed_at = esp_timer_get_time();
+}
+
+void sx127x_sim_receive(const void *payload, size_t size, int snr, uint8_t rssi)
+{
+    uint8_t base = selected->regs[REG_FIFO_RX_BASE_ADDR];
+    for (size_t ii = 0; ii < size; ii++)
+    {
+        selected->fifo[(uint8_t)(base + ii)] = ((const uint8_t *)payload)[ii];
+    }
+    selected->regs[REG_FIFO_RX_CURRENT_ADDR] = base;
+    selected->regs[REG_RX_NB_BYTES] = size;
+    selected->regs[REG_PKT_SNR_VALUE] = (int8_t)snr;
+    selected->regs[REG_PKT_RSSI_VALUE] = rssi;
+    selected->regs[REG_IRQ_FLAGS] |= IRQ_RX_DONE;
+    if ((selected->regs[REG_OP_MODE] & MODE_MASK) == MODE_RX_SINGLE)
+    {
+        selected->regs[REG_OP_MODE] = (selected->regs[REG_OP_MODE] & ~MODE_MASK) | MODE_STDBY;
+        selected->mode_changed_at = esp_timer_get_time();
+    }
+}
+
+static void sx127x_sim_write(sx127x_sim_chip_t *chip, uint8_t addr, uint8_t value)
+{
+    chip->stats.reg_writes[addr]++;
+    switch (addr)
+    {
+    case REG_FIFO:
+        chip->fifo[chip->regs[REG_FIFO_ADDR_PTR]++] = value;
+        break;
+    case REG_OP_MODE:
+        chip->regs[addr] = value;
+        chip->mode_changed_at = esp_timer_get_time();
+        break;
+    case REG_IRQ_FLAGS:
+        chip->regs[addr] &= ~value;
+        break;
+    case REG_FRF_LSB:
+        chip->regs[addr] = value;
+        chip->frf = (chip->regs[REG_FRF_MSB] << 16) | (chip->regs[REG_FRF_MID] << 8) | value;
+        break;
+    default:
+        chip->regs[addr] = value;
+    }
+}
+
+static uint8_t sx127x_sim_read(sx127x_sim_chip_t *chip, uint8_t addr)
+{
+    if (addr == REG_FIFO)
+    {
+        return chip->fifo[chip->regs[REG_FIFO_ADDR_PTR]++];
+    }
+    return chip->regs[addr];
+}
+
+esp_err_t spi_bus_initialize(spi_host_device_t host, const spi_bus_config_t *config, int dma_chan)
+{
+    return ESP_OK;
+}
+
+esp_err_t spi_bus_add_device(spi_host_device_t host, const spi_device_interface_config_t *config, spi_device_handle_t *handle)
+{
+    int idx = sx127x_sim_chip_for_cs(config->spics_io_num);
+    for (unsigned ii = 0; idx < 0 && ii < SX127X_SIM_MAX_CHIPS; ii++)
+    {
+        if (!chips[ii].attached)
+        {
+            chips[ii].attached = true;
+            chips[ii].cs = config->spics_io_num;
+            idx = ii;
+        }
+    }
+    if (idx < 0)
+    {
+        return ESP_FAIL;
+    }
+    *handle = (spi_device_handle_t)&chips[idx];
+    return ESP_OK;
+}
+
+esp_err_t spi_device_transmit(spi_device_handle_t handle, spi_transaction_t *trans)
+{
+    sx127x_sim_chip_t *chip = (sx127x_sim_chip_t *)handle;
+    size_t count = trans->length / 8;
+    uint8_t addr = trans->addr % SX127X_SIM_REGS;
+    const uint8_t *tx = (trans->flags & SPI_TRANS_USE_TXDATA) ? trans->tx_data : trans->tx_buffer;
+    uint8_t *rx = (trans->flags & SPI_TRANS_USE_RXDATA) ? trans->rx_data : trans->rx_buffer;
+    chip->stats.transactions++;
+    chip->stats.bytes += 1 + count;
+    for (size_t ii = 0; ii < count; ii++)
+    {
+        if (trans->cmd)
+        {
+            sx127x_sim_write(chip, addr, tx[ii]);
+        }
+        else if (rx)
+        {
+            rx[ii] = sx127x_sim_read(chip, addr);
+        }
+        // The address is incremented after each byte, except
+        // for the FIFO (see 4.3, SPI interface).
+        if (addr != REG_FIFO)
+        {
+            addr = (addr + 1) % SX127X_SIM_REGS;
+        }
+    }
+    return ESP_OK;
+}
@@ -0,0 +1,54 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+// Register map of a simulated SX127x in LoRa mode, connected to the
+// host SPI master. Only the register semantics io/lora.c relies on are
+// modelled: burst address increment, FIFO access through
+// RegFifoAddrPtr, write-1-to-clear IRQ flags and RegFrf being latched
+// when RegFrfLsb is written (see RegFrfMsb in the datasheet).
+//
+// Up to SX127X_SIM_MAX_CHIPS chips can be simulated, assigned to the
+// SPI devices in the order they're added, by their CS pin. The
+// functions below act on the selected chip, which is chip 0 unless
+// sx127x_sim_select() is called. The radio itself is not simulated,
+// callers move packets between chips (see bench_air_link.c).
+
+#define SX127X_SIM_REGS 0x80
+#define SX127X_SIM_MAX_CHIPS 2
+
+typedef struct sx127x_sim_stats_s
+{
+    unsigned transactions;
+    unsigned bytes; // Including the address byte
+    unsigned reg_writes[SX127X_SIM_REGS];
+} sx127x_sim_stats_t;
+
+// Restores the reset values of all registers in every chip, clears
+// the stats and forgets the CS pins of the chips.
+void sx127x_sim_reset(void);
+void sx127x_sim_select(unsigned chip);
+// Returns the chip attached with the given CS pin, -1 if none
+int sx127x_sim_chip_for_cs(int cs);
+uint8_t sx127x_sim_reg(uint8_t addr);
+// Sets a register as if the chip had changed it on its own
+void sx127x_sim_set_reg(uint8_t addr, uint8_t value);
+// Frequency the PLL is tuned to, as a 24 bit Frf value
+uint32_t sx127x_sim_frf(void);
+const uint8_t *sx127x_sim_fifo(void);
+void sx127x_sim_get_stats(sx127x_sim_stats_t *stats);
+void sx127x_sim_reset_stats(void);
+// Time when RegOpMode was last written, from esp_timer_get_time()
+uint64_t sx127x_sim_mode_changed_at(void);
+// Time on air in microseconds of a packet of RegPayloadLength bytes,
+// using the modem settings in the registers (see 4.1.1.7 in the
+// datasheet).
+uint64_t sx127x_sim_time_on_air(void);
+// Ends the transmission in progress, setting TxDone and going back
+// to standby.
+void sx127x_sim_finish_tx(void);
+// Stores a received packet at RegFifoRxBaseAddr and sets RxDone, as
+// well as the registers with its size, SNR (in 0.25dB) and RSSI (in
+// RegPktRssiValue units). Chips in RxSingle go back to standby.
+void sx127x_sim_receive(const void *payload, size_t size, int snr, uint8_t rssi);
@@ -0,0 +1,37 @@
+#pragma once
+
+#include <stdio.h>
+#include <stdlib.h>
+
+// Tiny assertion helpers for the host tests. A failed check prints
+// its location and aborts the test binary, so `make check` stops.
+
+#define TEST_ASSERT(x)                                                        \
+    do                                                                        \
+    {                                                                         \
+        if (!(x))                                                             \
+        {                                                                     \
+            fprintf(stderr, "%s:%d: check failed: %s\n", __FILE__, __LINE__, #x); \
+            abort();                                                          \
+        }                                                                     \
+    } while (0)
+
+#define TEST_ASSERT_EQ(a, b)                                                  \
+    do                                                                        \
+    {                                                                         \
+        long long __a = (long long)(a);                                       \
+        long long __b = (long long)(b);                                       \
+        if (__a != __b)                                                       \
+        {                                                                     \
+            fprintf(stderr, "%s:%d: %s == %s failed (%lld != %lld)\n",         \
+                    __FILE__, __LINE__, #a, #b, __a, __b);                    \
+            abort();                                                          \
+        }                                                                     \
+    } while (0)
+
+#define TEST_RUN(fn)                     \
+    do                                   \
+    {                                    \
+        fn();                            \
+        printf("%-40s ok\n", #fn);       \
+    } while (0)
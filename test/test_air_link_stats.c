@@ -0,0 +1,51 @@
+#include <string.h>
+
+#include "air/air_link_stats.h"
+
+#include "util/time.h"
+
+#include "test.h"
+
+static void test_clear_keeps_mode(void)
+{
+    air_link_stats_t stats;
+    air_link_stats_data_t data;
+    time_micros_t now = SECS_TO_MICROS(1);
+    air_link_stats_reset(&stats);
+    air_link_stats_set_mode(&stats, AIR_LORA_MODE_2, now);
+    air_link_stats_update_freq(&stats, 3, true);
+    air_link_stats_update_signal(&stats, -80, 20);
+    now += MILLIS_TO_MICROS(500);
+    air_link_stats_set_mode(&stats, AIR_LORA_MODE_3, now);
+    now += MILLIS_TO_MICROS(200);
+
+    // Requested from another task, applied later by the RC task
+    air_link_stats_request_clear(&stats);
+    air_link_stats_get(&stats, &data, now);
+    TEST_ASSERT_EQ(data.mode, AIR_LORA_MODE_3);
+    TEST_ASSERT_EQ(data.freq_success[3], 0);
+    TEST_ASSERT_EQ(data.mode_time[AIR_LORA_MODE_2 - 1], 0);
+    TEST_ASSERT_EQ(data.mode_time[AIR_LORA_MODE_3 - 1], 0);
+
+    now += MILLIS_TO_MICROS(100);
+    air_link_stats_update(&stats, now);
+    TEST_ASSERT(!stats.clear_requested);
+    now += MILLIS_TO_MICROS(300);
+    air_link_stats_get(&stats, &data, now);
+    TEST_ASSERT_EQ(data.mode, AIR_LORA_MODE_3);
+    TEST_ASSERT_EQ(data.mode_time[AIR_LORA_MODE_3 - 1], 300);
+    TEST_ASSERT_EQ(data.mode_switches[AIR_LORA_MODE_3 - 1], 0);
+    TEST_ASSERT_EQ(data.rssi[0] + data.rssi[8] + data.snr[0], 0);
+
+    // Switching after the clear counts from the time it was applied
+    air_link_stats_set_mode(&stats, AIR_LORA_MODE_4, now);
+    air_link_stats_get(&stats, &data, now);
+    TEST_ASSERT_EQ(data.mode_time[AIR_LORA_MODE_3 - 1], 300);
+    TEST_ASSERT_EQ(data.mode_switches[AIR_LORA_MODE_4 - 1], 1);
+}
+
+int main(void)
+{
+    TEST_RUN(test_clear_keeps_mode);
+    return 0;
+}
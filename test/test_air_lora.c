@@ -0,0 +1,111 @@
+#include <math.h>
+
+#include "air/air.h"
+#include "air/air_lora.h"
+
+#include "io/lora.h"
+
+#include "sx127x_sim.h"
+#include "test.h"
+
+// Time on air calculated with the floating point formula from the
+// SX1276/77/78/79 datasheet (4.1.1.7), for BW500, implicit header and
+// no CRC, to check the integer version in air_lora.c.
+static double reference_time_on_air(int sf, int cr, int preamble, int size)
+{
+    double symbol_time = pow(2, sf) / 500e3;
+    double payload = 8 + fmax(ceil((8.0 * size - 4 * sf + 28 - 20) / (4 * sf)) * (cr + 4), 0);
+    return (preamble + 4.25 + payload) * symbol_time * 1e6;
+}
+
+static void test_time_on_air(void)
+{
+    static const struct
+    {
+        air_lora_mode_e mode;
+        int sf;
+        int cr;
+        int preamble;
+    } modes[] = {
+        {AIR_LORA_MODE_1, 6, 1, 8},
+        {AIR_LORA_MODE_2, 7, 2, 6},
+        {AIR_LORA_MODE_3, 8, 2, 6},
+        {AIR_LORA_MODE_4, 9, 2, 6},
+        {AIR_LORA_MODE_5, 10, 4, 6},
+        {AIR_LORA_MODE_6, 6, 1, 6},
+        {AIR_LORA_MODE_7, 6, 1, 6},
+    };
+    for (unsigned ii = 0; ii < sizeof(modes) / sizeof(modes[0]); ii++)
+    {
+        for (int size = 1; size <= AIR_MAX_PACKET_SIZE; size++)
+        {
+            double expected = reference_time_on_air(modes[ii].sf, modes[ii].cr, modes[ii].preamble, size);
+            TEST_ASSERT_EQ(air_lora_time_on_air(modes[ii].mode, size), (time_micros_t)llround(expected));
+        }
+    }
+}
+
+static void test_packets_fit_cycles(void)
+{
+    for (air_lora_mode_e mode = AIR_LORA_MODE_1; mode <= AIR_LORA_MODE_COUNT; mode++)
+    {
+        time_micros_t full = air_lora_full_cycle_time(mode);
+        time_micros_t uplink = air_lora_uplink_cycle_time(mode);
+        bool fec = air_lora_mode_supports_fec(mode);
+        time_micros_t tx = air_lora_time_on_air(mode, air_tx_packet_size(fec));
+        time_micros_t rx = air_lora_time_on_air(mode, air_rx_packet_size(fec));
+        TEST_ASSERT(tx + rx < full);
+        TEST_ASSERT(tx < uplink);
+    }
+    // MODE_5 full cycle and MODE_1 uplink cycle are too short
+    TEST_ASSERT(!air_lora_mode_supports_fec(AIR_LORA_MODE_1));
+    TEST_ASSERT(air_lora_mode_supports_fec(AIR_LORA_MODE_2));
+    TEST_ASSERT(!air_lora_mode_supports_fec(AIR_LORA_MODE_5));
+    TEST_ASSERT(air_lora_mode_supports_fec(AIR_LORA_MODE_7));
+}
+
+static void test_set_parameters(void)
+{
+    lora_t lora = {.output_type = LORA_OUTPUT_PA_BOOST};
+    sx127x_sim_reset();
+    lora_init(&lora);
+    air_lora_set_parameters(&lora, AIR_LORA_MODE_5);
+    TEST_ASSERT_EQ(sx127x_sim_reg(0x1e) >> 4, 10);
+    TEST_ASSERT_EQ((sx127x_sim_reg(0x1d) >> 1) & 0x07, LORA_CODING_RATE_4_8);
+    air_lora_set_parameters(&lora, AIR_LORA_MODE_1);
+    TEST_ASSERT_EQ(sx127x_sim_reg(0x1e) >> 4, 6);
+    TEST_ASSERT_EQ(sx127x_sim_reg(0x21), 8);
+    TEST_ASSERT_EQ(sx127x_sim_reg(0x31), 0xc5);
+}
+
+static void test_mode_ranks(void)
+{
+    // Ranks are contiguous and round trip
+    for (int ii = air_lora_mode_rank(AIR_LORA_MODE_FASTEST); ii <= air_lora_mode_rank(AIR_LORA_MODE_LONGEST); ii++)
+    {
+        TEST_ASSERT_EQ(air_lora_mode_rank(air_lora_mode_from_rank(ii)), ii);
+    }
+    TEST_ASSERT_EQ(air_lora_mode_rank(AIR_LORA_MODE_1), -1);
+    TEST_ASSERT_EQ(air_lora_mode_faster(AIR_LORA_MODE_2), AIR_LORA_MODE_6);
+    TEST_ASSERT_EQ(air_lora_mode_faster(AIR_LORA_MODE_6), AIR_LORA_MODE_7);
+    TEST_ASSERT_EQ(air_lora_mode_faster(AIR_LORA_MODE_7), AIR_LORA_MODE_7);
+    TEST_ASSERT_EQ(air_lora_mode_longer(AIR_LORA_MODE_5), AIR_LORA_MODE_5);
+
+    uint8_t modes = air_lora_modes_pack();
+    TEST_ASSERT(!(modes & (1 << AIR_LORA_MODE_1)));
+    air_lora_mode_e fastest, longest;
+    TEST_ASSERT(air_lora_modes_unpack(modes, &fastest, &longest));
+    TEST_ASSERT_EQ(fastest, AIR_LORA_MODE_FASTEST);
+    TEST_ASSERT_EQ(longest, AIR_LORA_MODE_LONGEST);
+    // A peer that only supports MODE_1 has nothing in common with us
+    TEST_ASSERT(!air_lora_modes_unpack(1 << AIR_LORA_MODE_1, &fastest, &longest));
+}
+
+int main(void)
+{
+    TEST_RUN(test_time_on_air);
+    TEST_RUN(test_packets_fit_cycles);
+    TEST_RUN(test_set_parameters);
+    TEST_RUN(test_mode_ranks);
+    return 0;
+}
@@ -0,0 +1,112 @@
+#include <string.h>
+
+#include "air/air.h"
+#include "air/air_cmd.h"
+#include "air/air_stream.h"
+
+#include "util/macros.h"
+
+#include "test.h"
+
+typedef struct
+{
+    unsigned count;
+    air_cmd_e cmd;
+    size_t size;
+    uint8_t data[AIR_STREAM_MAX_PAYLOAD_SIZE];
+} received_t;
+
+static void cmd_received(void *user, air_cmd_e cmd, const void *data, size_t size, time_micros_t now)
+{
+    received_t *r = user;
+    r->count++;
+    r->cmd = cmd;
+    r->size = size;
+    memcpy(r->data, data, size);
+}
+
+static void channel_received(void *user, unsigned chn, unsigned value, time_micros_t now)
+{
+}
+
+// Moves the output of tx into rx in chunks of the given size, like
+// the air packets do, followed by an idle chunk which terminates the
+// last frame.
+static void transfer(air_stream_t *tx, air_stream_t *rx, unsigned *seq, size_t chunk)
+{
+    uint8_t buf[16];
+    size_t n;
+    TEST_ASSERT(chunk <= sizeof(buf));
+    do
+    {
+        n = air_stream_pop_output_n(tx, buf, chunk);
+        memset(&buf[n], AIR_DATA_START_STOP, chunk - n);
+        air_stream_feed_input(rx, (*seq)++ % AIR_SEQ_COUNT, buf, chunk, 0);
+    } while (n > 0);
+}
+
+static void test_round_trip(void)
+{
+    air_stream_t tx;
+    air_stream_t rx;
+    received_t r = {0};
+    unsigned seq = 1;
+    air_stream_init(&tx, NULL, NULL, NULL, NULL);
+    air_stream_init(&rx, channel_received, NULL, cmd_received, &r);
+
+    // Include every byte value, so stuffing is exercised
+    uint8_t payload[300];
+    for (int ii = 0; ii < ARRAY_COUNT(payload); ii++)
+    {
+        payload[ii] = ii;
+    }
+    // Syncs the input
+    transfer(&tx, &rx, &seq, 3);
+    TEST_ASSERT(air_stream_feed_output_cmd(&tx, AIR_CMD_RMP, payload, sizeof(payload)) > sizeof(payload));
+    TEST_ASSERT(air_stream_feed_output_cmd(&tx, AIR_CMD_RMP, payload, 10) > 0);
+    transfer(&tx, &rx, &seq, 3);
+    TEST_ASSERT_EQ(r.count, 2);
+    TEST_ASSERT_EQ(r.cmd, AIR_CMD_RMP);
+    TEST_ASSERT_EQ(r.size, 10);
+    TEST_ASSERT(memcmp(r.data, payload, 10) == 0);
+}
+
+static void test_full_output_is_atomic(void)
+{
+    air_stream_t tx;
+    air_stream_t rx;
+    received_t r = {0};
+    unsigned seq = 1;
+    air_stream_init(&tx, NULL, NULL, NULL, NULL);
+    air_stream_init(&rx, channel_received, NULL, cmd_received, &r);
+    transfer(&tx, &rx, &seq, 3);
+
+    // Every byte needs stuffing, so each frame takes 2x its size
+    uint8_t payload[400];
+    memset(payload, AIR_DATA_START_STOP, sizeof(payload));
+    size_t n = air_stream_feed_output_cmd(&tx, AIR_CMD_RMP, payload, sizeof(payload));
+    TEST_ASSERT(n > 2 * sizeof(payload));
+    size_t count = air_stream_output_count(&tx);
+    TEST_ASSERT_EQ(count, n);
+    // Doesn't fit, nothing must be added
+    TEST_ASSERT_EQ(air_stream_feed_output_cmd(&tx, AIR_CMD_RMP, payload, sizeof(payload)), 0);
+    TEST_ASSERT_EQ(air_stream_output_count(&tx), count);
+    // Smaller frames still fit
+    TEST_ASSERT(air_stream_feed_output_cmd(&tx, AIR_CMD_RMP, payload, 16) > 0);
+    transfer(&tx, &rx, &seq, 3);
+    TEST_ASSERT_EQ(r.count, 2);
+    TEST_ASSERT_EQ(r.size, 16);
+    // Everything fits again once the output is sent
+    TEST_ASSERT(air_stream_feed_output_cmd(&tx, AIR_CMD_RMP, payload, sizeof(payload)) > 0);
+    transfer(&tx, &rx, &seq, 3);
+    TEST_ASSERT_EQ(r.count, 3);
+    TEST_ASSERT_EQ(r.size, sizeof(payload));
+    TEST_ASSERT(memcmp(r.data, payload, sizeof(payload)) == 0);
+}
+
+int main(void)
+{
+    TEST_RUN(test_round_trip);
+    TEST_RUN(test_full_output_is_atomic);
+    return 0;
+}
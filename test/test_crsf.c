@@ -0,0 +1,178 @@
+#include <string.h>
+
+#include "protocols/crsf.h"
+
+#include "util/macros.h"
+
+#include "crsf_corpus.h"
+#include "test.h"
+
+// Feeds the corpus to crsf_port_feed() split in every way the ISR
+// buffer can deliver it, checking that every frame is dispatched once,
+// in order and unmodified. Then checks resynchronization after the
+// line errors the parser must survive.
+
+#define CORPUS_PERIODS 1600 // Covers every frame type
+#define MAX_FRAMES (CORPUS_PERIODS * 2)
+
+static crsf_corpus_t corpus;
+static const uint8_t *expected[MAX_FRAMES];
+static unsigned expected_count;
+static unsigned received;
+static crsf_port_t port;
+
+static void frame_callback(void *data, crsf_frame_t *frame)
+{
+    TEST_ASSERT(received < expected_count);
+    const uint8_t *exp = expected[received];
+    TEST_ASSERT_EQ(crsf_frame_total_size(frame), exp[1] + CRSF_FRAME_NOT_COUNTED_BYTES);
+    TEST_ASSERT(memcmp(frame, exp, crsf_frame_total_size(frame)) == 0);
+    received++;
+}
+
+static void expect_frames(const uint8_t *data, size_t size)
+{
+    expected_count = 0;
+    received = 0;
+    for (size_t pos = 0; pos < size; pos += data[pos + 1] + CRSF_FRAME_NOT_COUNTED_BYTES)
+    {
+        TEST_ASSERT(expected_count < MAX_FRAMES);
+        expected[expected_count++] = &data[pos];
+    }
+}
+
+static void setup(void)
+{
+    io_t io = {0};
+    crsf_port_init(&port, &io, frame_callback, NULL);
+    crsf_port_set_sync_addr(&port, CRSF_ADDRESS_CRSF_TRANSMITTER);
+}
+
+static void test_corpus_fixed_spans(void)
+{
+    expect_frames(corpus.data, corpus.size);
+    TEST_ASSERT_EQ(expected_count, corpus.frames);
+    for (size_t span = 1; span <= 2 * CRSF_FRAME_SIZE_MAX; span++)
+    {
+        setup();
+        received = 0;
+        for (size_t pos = 0; pos < corpus.size; pos += span)
+        {
+            crsf_port_feed(&port, &corpus.data[pos], MIN(span, corpus.size - pos));
+        }
+        TEST_ASSERT_EQ(received, expected_count);
+        TEST_ASSERT(!crsf_port_has_buffered_data(&port));
+    }
+}
+
+static void test_corpus_periods(void)
+{
+    // Like input_crsf, which drains the ISR buffer when the radio stops
+    // transmitting.
+    expect_frames(corpus.data, corpus.size);
+    setup();
+    size_t start = 0;
+    for (unsigned ii = 0; ii < corpus.periods; ii++)
+    {
+        TEST_ASSERT(crsf_port_feed(&port, &corpus.data[start], corpus.period_ends[ii] - start));
+        start = corpus.period_ends[ii];
+    }
+    TEST_ASSERT_EQ(received, expected_count);
+}
+
+// Copies the first frames of the corpus after the given prefix,
+// returning the total size. Expects all the copied frames.
+static size_t after_prefix(uint8_t *buf, const uint8_t *prefix, size_t prefix_size, unsigned frames)
+{
+    size_t size = 0;
+    for (unsigned ii = 0; ii < frames; ii++)
+    {
+        size += corpus.data[size + 1] + CRSF_FRAME_NOT_COUNTED_BYTES;
+    }
+    memcpy(buf, prefix, prefix_size);
+    memcpy(&buf[prefix_size], corpus.data, size);
+    expect_frames(&buf[prefix_size], size);
+    return prefix_size + size;
+}
+
+static void test_garbage_between_frames(void)
+{
+    uint8_t buf[256];
+    // Bytes that don't match the address are skipped, invalid sizes
+    // make it look for the next address.
+    const uint8_t garbage[] = {0x00, 0xc8, 0x18, CRSF_ADDRESS_CRSF_TRANSMITTER, 0x01,
+                               CRSF_ADDRESS_CRSF_TRANSMITTER, 0xff, 0x55};
+    size_t size = after_prefix(buf, garbage, sizeof(garbage), 3);
+    for (size_t split = 0; split <= size; split++)
+    {
+        setup();
+        received = 0;
+        crsf_port_feed(&port, buf, split);
+        crsf_port_feed(&port, &buf[split], size - split);
+        TEST_ASSERT_EQ(received, 3);
+    }
+}
+
+static void test_bad_crc(void)
+{
+    uint8_t buf[256];
+    size_t first = corpus.data[1] + CRSF_FRAME_NOT_COUNTED_BYTES;
+    size_t size = after_prefix(buf, corpus.data, first, 2);
+    // Flip a bit in the payload of the first frame
+    buf[5] ^= 0x10;
+    setup();
+    TEST_ASSERT(crsf_port_feed(&port, buf, size));
+    TEST_ASSERT_EQ(received, 2);
+
+    // Only the bad one
+    setup();
+    received = 0;
+    TEST_ASSERT(!crsf_port_feed(&port, buf, first));
+    TEST_ASSERT_EQ(received, 0);
+    TEST_ASSERT(!crsf_port_has_buffered_data(&port));
+}
+
+static void test_truncated_frame(void)
+{
+    uint8_t buf[256];
+    // A frame missing its last bytes swallows the start of the next one,
+    // which fails the CRC. Decoding recovers at a later frame.
+    size_t first = corpus.data[1] + CRSF_FRAME_NOT_COUNTED_BYTES;
+    size_t prefix_size = first - 5;
+    size_t size = after_prefix(buf, corpus.data, prefix_size, 4);
+    expect_frames(&buf[prefix_size + first], size - prefix_size - first);
+    setup();
+    crsf_port_feed(&port, buf, size);
+    TEST_ASSERT_EQ(received, 3);
+}
+
+static void reset_callback(void *data, crsf_frame_t *frame)
+{
+    received++;
+    crsf_port_reset(&port);
+}
+
+static void test_reset_from_callback(void)
+{
+    // The callback can reset the port, e.g. when changing baud rates
+    io_t io = {0};
+    crsf_port_init(&port, &io, reset_callback, NULL);
+    received = 0;
+    // Channels and a ping, then channels
+    size_t size = corpus.period_ends[1];
+    TEST_ASSERT(crsf_port_feed(&port, corpus.data, size));
+    TEST_ASSERT_EQ(received, 3);
+}
+
+int main(void)
+{
+    crsf_corpus_init(&corpus, CORPUS_PERIODS);
+    TEST_RUN(test_corpus_fixed_spans);
+    TEST_RUN(test_corpus_periods);
+    TEST_RUN(test_garbage_between_frames);
+    TEST_RUN(test_bad_crc);
+    TEST_RUN(test_truncated_frame);
+    TEST_RUN(test_reset_from_callback);
+    crsf_corpus_free(&corpus);
+    return 0;
+}
@@ -0,0 +1,148 @@
+#include "io/lora.h"
+
+#include "sx127x_sim.h"
+#include "test.h"
+
+// Tests for the register shadow cache in io/lora.c against the
+// simulated SX127x register map.
+
+#define REG_OP_MODE 0x01
+#define REG_FRF_MSB 0x06
+#define REG_FRF_MID 0x07
+#define REG_FRF_LSB 0x08
+#define REG_IRQ_FLAGS 0x12
+#define REG_MODEM_CONFIG_1 0x1d
+#define REG_MODEM_CONFIG_2 0x1e
+#define REG_PAYLOAD_LENGTH 0x22
+
+static lora_t lora = {.output_type = LORA_OUTPUT_PA_BOOST};
+
+static void setup(void)
+{
+    sx127x_sim_reset();
+    lora_init(&lora);
+    sx127x_sim_reset_stats();
+}
+
+static unsigned spi_transactions(void)
+{
+    sx127x_sim_stats_t stats;
+    sx127x_sim_get_stats(&stats);
+    return stats.transactions;
+}
+
+static void test_frf_lsb_always_written(void)
+{
+    setup();
+    lora_frf_t a = {.bytes = {0xd9, 0x00, 0x00}};
+    lora_frf_t b = {.bytes = {0xd9, 0x40, 0x00}};
+    lora_frf_t c = {.bytes = {0xe4, 0x40, 0x00}};
+    lora_set_frequency_frf(&lora, 1, &a);
+    TEST_ASSERT_EQ(sx127x_sim_frf(), 0xd90000);
+    // Only RegFrfMid changes, but RegFrfLsb must be written too
+    sx127x_sim_stats_t stats;
+    sx127x_sim_reset_stats();
+    lora_set_frequency_frf(&lora, 2, &b);
+    sx127x_sim_get_stats(&stats);
+    TEST_ASSERT_EQ(sx127x_sim_frf(), 0xd94000);
+    TEST_ASSERT_EQ(stats.reg_writes[REG_FRF_MSB], 0);
+    TEST_ASSERT_EQ(stats.reg_writes[REG_FRF_MID], 1);
+    TEST_ASSERT_EQ(stats.reg_writes[REG_FRF_LSB], 1);
+    TEST_ASSERT_EQ(stats.transactions, 1);
+    // Only RegFrfMsb changes
+    lora_set_frequency_frf(&lora, 3, &c);
+    TEST_ASSERT_EQ(sx127x_sim_frf(), 0xe44000);
+    // Only RegFrfLsb changes
+    lora_frf_t d = {.bytes = {0xe4, 0x40, 0x01}};
+    sx127x_sim_reset_stats();
+    lora_set_frequency_frf(&lora, 4, &d);
+    sx127x_sim_get_stats(&stats);
+    TEST_ASSERT_EQ(sx127x_sim_frf(), 0xe44001);
+    TEST_ASSERT_EQ(stats.reg_writes[REG_FRF_MSB] + stats.reg_writes[REG_FRF_MID], 0);
+    // Every frequency in the band must be applied
+    for (unsigned long freq = 863e6; freq < 870e6; freq += 150e3)
+    {
+        lora_frf_t frf;
+        lora_frf_from_frequency(&frf, freq);
+        lora_set_frequency(&lora, freq);
+        TEST_ASSERT_EQ(sx127x_sim_frf(), (frf.bytes[0] << 16) | (frf.bytes[1] << 8) | frf.bytes[2]);
+    }
+}
+
+static void test_noop_writes_skipped(void)
+{
+    setup();
+    lora_set_spreading_factor(&lora, 9);
+    lora_set_coding_rate(&lora, LORA_CODING_RATE_4_6);
+    lora_set_crc(&lora, false);
+    TEST_ASSERT_EQ(sx127x_sim_reg(REG_MODEM_CONFIG_2) >> 4, 9);
+    unsigned before = spi_transactions();
+    lora_set_spreading_factor(&lora, 9);
+    lora_set_coding_rate(&lora, LORA_CODING_RATE_4_6);
+    lora_set_signal_bw(&lora, LORA_SIGNAL_BW_500);
+    lora_set_crc(&lora, false);
+    TEST_ASSERT_EQ(spi_transactions(), before);
+}
+
+static void test_reg_program(void)
+{
+    setup();
+    lora_reg_program_t prog;
+    lora_modem_config_t config = {
+        .signal_bw = LORA_SIGNAL_BW_500,
+        .coding_rate = LORA_CODING_RATE_4_8,
+        .sf = 10,
+        .header = LORA_HEADER_IMPLICIT,
+        .crc = false,
+        .preamble_length = 6,
+    };
+    lora_reg_program_init(&prog);
+    lora_reg_program_modem_config(&prog, &config);
+    lora_run_reg_program(&lora, &prog);
+    TEST_ASSERT_EQ(sx127x_sim_reg(REG_MODEM_CONFIG_1), (LORA_SIGNAL_BW_500 << 4) | (LORA_CODING_RATE_4_8 << 1) | 1);
+    TEST_ASSERT_EQ(sx127x_sim_reg(REG_MODEM_CONFIG_2), 10 << 4);
+    TEST_ASSERT_EQ(sx127x_sim_reg(0x21), 6);
+    // Running it again must not touch the chip
+    unsigned before = spi_transactions();
+    lora_run_reg_program(&lora, &prog);
+    TEST_ASSERT_EQ(spi_transactions(), before);
+}
+
+static void test_volatile_regs_not_cached(void)
+{
+    setup();
+    // The chip sets the IRQ flags on its own, so they must be read
+    // from it every time.
+    sx127x_sim_set_reg(REG_IRQ_FLAGS, 0);
+    TEST_ASSERT_EQ(lora_wait(&lora, 8), 0);
+    sx127x_sim_set_reg(REG_IRQ_FLAGS, 0x40);
+    TEST_ASSERT_EQ(lora_wait(&lora, 8), 8);
+    TEST_ASSERT_EQ(sx127x_sim_reg(REG_IRQ_FLAGS), 0);
+}
+
+static void test_init_invalidates(void)
+{
+    setup();
+    lora_set_payload_size(&lora, 10);
+    TEST_ASSERT_EQ(sx127x_sim_reg(REG_PAYLOAD_LENGTH), 10);
+    lora_set_spreading_factor(&lora, 7);
+    // A reset restores the defaults, which must not be hidden
+    // by the values we wrote before.
+    sx127x_sim_reset();
+    lora_init(&lora);
+    lora_set_spreading_factor(&lora, 7);
+    TEST_ASSERT_EQ(sx127x_sim_reg(REG_MODEM_CONFIG_2) >> 4, 7);
+    TEST_ASSERT_EQ(lora.state.payload_size, 1);
+    lora_set_payload_size(&lora, 10);
+    TEST_ASSERT_EQ(sx127x_sim_reg(REG_PAYLOAD_LENGTH), 10);
+}
+
+int main(void)
+{
+    TEST_RUN(test_frf_lsb_always_written);
+    TEST_RUN(test_noop_writes_skipped);
+    TEST_RUN(test_reg_program);
+    TEST_RUN(test_volatile_regs_not_cached);
+    TEST_RUN(test_init_invalidates);
+    return 0;
+}
@@ -0,0 +1,263 @@
+#include <pthread.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "msp/msp.h"
+#include "msp/msp_cache.h"
+#include "msp/msp_transport.h"
+
+#include "util/macros.h"
+#include "util/time.h"
+
+#include "test.h"
+
+// An FC answering after a random latency, sometimes not at all, with
+// requests sent from one thread while another one dispatches the
+// responses and expires the requests, like the RMP and RC tasks do
+// on different cores. Every callback must be called exactly once.
+
+#define REQUEST_COUNT 20000
+#define RESPONSE_QUEUE_SIZE 64
+#define TIMEOUT_US 2000
+#define MAX_LATENCY_US 3000
+
+typedef struct
+{
+    uint16_t cmd;
+    time_micros_t due;
+} response_t;
+
+typedef struct
+{
+    msp_transport_t transport;
+    pthread_mutex_t mutex;
+    response_t queue[RESPONSE_QUEUE_SIZE];
+    unsigned head;
+    unsigned tail;
+    unsigned rng;
+} fake_fc_t;
+
+typedef struct
+{
+    int calls;
+    int size;
+} request_t;
+
+static fake_fc_t fc;
+static msp_conn_t conn;
+static request_t requests[REQUEST_COUNT];
+static int callbacks;
+static bool sender_done;
+
+static unsigned fake_fc_rand(fake_fc_t *f)
+{
+    f->rng = f->rng * 1103515245 + 12345;
+    return f->rng >> 8;
+}
+
+static int fake_fc_read(void *transport, msp_direction_e *direction, uint16_t *cmd, void *payload, size_t size)
+{
+    fake_fc_t *f = transport;
+    int n = MSP_EOF;
+    pthread_mutex_lock(&f->mutex);
+    if (f->head != f->tail && f->queue[f->head % RESPONSE_QUEUE_SIZE].due <= time_micros_now())
+    {
+        *direction = MSP_DIRECTION_FROM_MWC;
+        *cmd = f->queue[f->head++ % RESPONSE_QUEUE_SIZE].cmd;
+        ((uint8_t *)payload)[0] = *cmd;
+        n = 1;
+    }
+    pthread_mutex_unlock(&f->mutex);
+    return n;
+}
+
+static int fake_fc_write(void *transport, msp_direction_e direction, uint16_t cmd, const void *payload, size_t size)
+{
+    fake_fc_t *f = transport;
+    pthread_mutex_lock(&f->mutex);
+    unsigned r = fake_fc_rand(f);
+    if (f->tail - f->head == RESPONSE_QUEUE_SIZE)
+    {
+        // Like a full UART buffer
+        pthread_mutex_unlock(&f->mutex);
+        return -1;
+    }
+    if (r % 10 != 0)
+    {
+        // FCs answer in order, so latency can't go backwards
+        time_micros_t due = time_micros_now() + (r >> 4) % MAX_LATENCY_US;
+        if (f->head != f->tail)
+        {
+            due = MAX(due, f->queue[(f->tail - 1) % RESPONSE_QUEUE_SIZE].due);
+        }
+        f->queue[f->tail++ % RESPONSE_QUEUE_SIZE] = (response_t){.cmd = cmd, .due = due};
+    }
+    pthread_mutex_unlock(&f->mutex);
+    return size + MSP_V1_PROTOCOL_BYTES;
+}
+
+static void request_callback(msp_conn_t *c, uint16_t cmd, const void *payload, int size, void *callback_data)
+{
+    request_t *req = callback_data;
+    // A second call would double free the context in rc.c
+    __atomic_add_fetch(&req->calls, 1, __ATOMIC_RELAXED);
+    req->size = size;
+    __atomic_add_fetch(&callbacks, 1, __ATOMIC_RELAXED);
+}
+
+static void *sender(void *arg)
+{
+    for (int ii = 0; ii < REQUEST_COUNT; ii++)
+    {
+        msp_conn_send(&conn, MSP_FC_VARIANT + ii % 4, NULL, 0, request_callback, &requests[ii]);
+        if (ii % 8 == 0)
+        {
+            usleep(100);
+        }
+    }
+    __atomic_store_n(&sender_done, true, __ATOMIC_RELEASE);
+    return NULL;
+}
+
+static void *dispatcher(void *arg)
+{
+    time_micros_t deadline = 0;
+    while (__atomic_load_n(&callbacks, __ATOMIC_RELAXED) < REQUEST_COUNT)
+    {
+        msp_conn_update(&conn);
+        if (__atomic_load_n(&sender_done, __ATOMIC_ACQUIRE))
+        {
+            // Everything left expires after TIMEOUT_US
+            if (deadline == 0)
+            {
+                deadline = time_micros_now() + SECS_TO_MICROS(1);
+            }
+            if (time_micros_now() > deadline)
+            {
+                break;
+            }
+        }
+    }
+    return NULL;
+}
+
+static void test_concurrent_send_and_dispatch(void)
+{
+    memset(&fc, 0, sizeof(fc));
+    pthread_mutex_init(&fc.mutex, NULL);
+    fc.rng = 1;
+    fc.transport.vtable.read = fake_fc_read;
+    fc.transport.vtable.write = fake_fc_write;
+    msp_conn_init(&conn, &fc.transport);
+    msp_conn_set_window(&conn, MSP_CONN_MAX_WINDOW, TIMEOUT_US);
+
+    pthread_t threads[2];
+    pthread_create(&threads[0], NULL, dispatcher, NULL);
+    pthread_create(&threads[1], NULL, sender, NULL);
+    pthread_join(threads[1], NULL);
+    pthread_join(threads[0], NULL);
+
+    unsigned answered = 0;
+    for (int ii = 0; ii < REQUEST_COUNT; ii++)
+    {
+        TEST_ASSERT_EQ(requests[ii].calls, 1);
+        if (requests[ii].size > 0)
+        {
+            answered++;
+        }
+    }
+    TEST_ASSERT_EQ(callbacks, REQUEST_COUNT);
+    TEST_ASSERT_EQ(conn.pending_count, 0);
+    // Both responses and timeouts must have happened
+    TEST_ASSERT(answered > 0);
+    TEST_ASSERT(answered < REQUEST_COUNT);
+}
+
+// Transport for an FC which never answers, counting the requests
+typedef struct
+{
+    msp_transport_t transport;
+    int writes;
+} silent_fc_t;
+
+typedef struct
+{
+    int calls;
+    int size;
+    uint8_t payload[MSP_CACHE_MAX_PAYLOAD_SIZE];
+} cached_request_t;
+
+static int silent_fc_read(void *transport, msp_direction_e *direction, uint16_t *cmd, void *payload, size_t size)
+{
+    return MSP_EOF;
+}
+
+static int silent_fc_write(void *transport, msp_direction_e direction, uint16_t cmd, const void *payload, size_t size)
+{
+    silent_fc_t *f = transport;
+    f->writes++;
+    return size + MSP_V1_PROTOCOL_BYTES;
+}
+
+static void cached_request_callback(msp_conn_t *c, uint16_t cmd, const void *payload, int size, void *callback_data)
+{
+    cached_request_t *req = callback_data;
+    req->calls++;
+    req->size = size;
+    if (size > 0)
+    {
+        memcpy(req->payload, payload, size);
+    }
+}
+
+static void test_cache_hits_answered_from_update(void)
+{
+    static silent_fc_t silent_fc;
+    static msp_conn_t cache_conn;
+    static msp_cache_t cache;
+    silent_fc.transport.vtable.read = silent_fc_read;
+    silent_fc.transport.vtable.write = silent_fc_write;
+    msp_conn_init(&cache_conn, &silent_fc.transport);
+    msp_cache_init(&cache);
+    msp_conn_set_cache(&cache_conn, &cache);
+
+    time_micros_t now = time_micros_now();
+    msp_cache_store(&cache, MSP_FC_VARIANT, "BTFL", 4, now, now);
+
+    // A hit must not call the callback from the sending task
+    cached_request_t hit = {0};
+    TEST_ASSERT_EQ(msp_conn_send_cached(&cache_conn, MSP_FC_VARIANT, NULL, 0, cached_request_callback, &hit), 0);
+    TEST_ASSERT_EQ(hit.calls, 0);
+
+    // A miss is sent to the FC when the connection is updated
+    cached_request_t miss = {0};
+    TEST_ASSERT_EQ(msp_conn_send_cached(&cache_conn, MSP_NAME, NULL, 0, cached_request_callback, &miss), 0);
+    TEST_ASSERT_EQ(silent_fc.writes, 0);
+
+    // Uncacheable requests are always sent right away
+    cached_request_t uncacheable = {0};
+    TEST_ASSERT(msp_conn_send_cached(&cache_conn, MSP_ATTITUDE, NULL, 0, cached_request_callback, &uncacheable) > 0);
+    TEST_ASSERT_EQ(silent_fc.writes, 1);
+
+    msp_conn_update(&cache_conn);
+    TEST_ASSERT_EQ(hit.calls, 1);
+    TEST_ASSERT_EQ(hit.size, 4);
+    TEST_ASSERT(memcmp(hit.payload, "BTFL", 4) == 0);
+    TEST_ASSERT_EQ(miss.calls, 0);
+    TEST_ASSERT_EQ(uncacheable.calls, 0);
+    TEST_ASSERT_EQ(silent_fc.writes, 2);
+    TEST_ASSERT_EQ(cache_conn.pending_count, 2);
+
+    msp_cache_stats_t stats;
+    msp_cache_get_stats(&cache, &stats);
+    TEST_ASSERT_EQ(stats.hits, 1);
+    TEST_ASSERT_EQ(stats.misses, 1);
+    TEST_ASSERT_EQ(stats.stores, 1);
+}
+
+int main(void)
+{
+    TEST_RUN(test_concurrent_send_and_dispatch);
+    TEST_RUN(test_cache_hits_answered_from_update);
+    return 0;
+}
@@ -0,0 +1,152 @@
+#include <string.h>
+
+#include "msp/msp_telemetry.h"
+#include "msp/msp_transport.h"
+
+#include "util/crc.h"
+
+#include "test.h"
+
+// Request and response chunks as seen by a radio or FC talking MSP
+// over CRSF or S.Port.
+
+#define CHUNK_SIZE 8
+#define CHUNK_START (1 << 4)
+#define RESP_V1_ERROR (1 << 5)
+#define RESP_V2_VERSION(b) (((b) >> 5) & 0x03)
+#define RESP_V2_ERROR (1 << 7)
+
+static msp_telemetry_t tr;
+
+// Splits a request into chunks and pushes them like input_crsf does
+static void push_request(int version, uint16_t cmd, const uint8_t *payload, size_t size)
+{
+    uint8_t buf[MSP_MAX_PAYLOAD_SIZE + 8];
+    uint8_t *ptr = buf;
+    if (version == MSP_VERSION_1)
+    {
+        *ptr++ = size;
+        *ptr++ = cmd;
+    }
+    else
+    {
+        *ptr++ = 0;
+        *ptr++ = cmd & 0xff;
+        *ptr++ = cmd >> 8;
+        *ptr++ = size & 0xff;
+        *ptr++ = size >> 8;
+    }
+    memcpy(ptr, payload, size);
+    ptr += size;
+    if (version == MSP_VERSION_1)
+    {
+        *ptr++ = crc_xor(crc_xor(crc_xor_bytes(payload, size), size), cmd);
+    }
+    static unsigned seq;
+    size_t total = ptr - buf;
+    for (size_t pos = 0; pos < total; pos += CHUNK_SIZE - 1)
+    {
+        uint8_t chunk[CHUNK_SIZE];
+        size_t n = total - pos < CHUNK_SIZE - 1 ? total - pos : CHUNK_SIZE - 1;
+        chunk[0] = (seq++ & 0x0f) | (pos == 0 ? CHUNK_START : 0) | (version << 5);
+        memcpy(&chunk[1], &buf[pos], n);
+        TEST_ASSERT(msp_telemetry_push_request_chunk(&tr, chunk, n + 1));
+    }
+}
+
+static void test_v1_response_flags(void)
+{
+    msp_telemetry_init_input(&tr, CHUNK_SIZE);
+    push_request(MSP_VERSION_1, MSP_NAME, NULL, 0);
+    msp_direction_e direction;
+    uint16_t cmd;
+    uint8_t payload[MSP_MAX_PAYLOAD_SIZE];
+    TEST_ASSERT_EQ(msp_transport_read(MSP_TRANSPORT(&tr), &direction, &cmd, payload, sizeof(payload)), 0);
+    TEST_ASSERT_EQ(cmd, MSP_NAME);
+    TEST_ASSERT_EQ(msp_transport_write(MSP_TRANSPORT(&tr), MSP_DIRECTION_FROM_MWC, MSP_NAME, "craft", 5), 5);
+
+    uint8_t chunk[CHUNK_SIZE];
+    TEST_ASSERT_EQ(msp_telemetry_pop_response_chunk(&tr, chunk), CHUNK_SIZE);
+    // Same layout as before MSPv2 support, bits 5-7 are clear
+    TEST_ASSERT_EQ(chunk[0] & 0xf0, CHUNK_START);
+    TEST_ASSERT_EQ(chunk[1], 5);
+    TEST_ASSERT(memcmp(&chunk[2], "craft", 5) == 0);
+    TEST_ASSERT_EQ(chunk[7], crc_xor(crc_xor(crc_xor_bytes("craft", 5), 5), MSP_NAME));
+    TEST_ASSERT_EQ(msp_telemetry_pop_response_chunk(&tr, chunk), 0);
+}
+
+static void test_v2_response_flags(void)
+{
+    msp_telemetry_init_input(&tr, CHUNK_SIZE);
+    const uint8_t req[] = {1, 2};
+    push_request(MSP_VERSION_2, 0x1005, req, sizeof(req));
+    msp_direction_e direction;
+    uint16_t cmd;
+    uint8_t payload[MSP_MAX_PAYLOAD_SIZE];
+    TEST_ASSERT_EQ(msp_transport_read(MSP_TRANSPORT(&tr), &direction, &cmd, payload, sizeof(payload)), 2);
+    TEST_ASSERT_EQ(cmd, 0x1005);
+    TEST_ASSERT_EQ(msp_transport_write(MSP_TRANSPORT(&tr), MSP_DIRECTION_FROM_MWC, cmd, "abc", 3), 3);
+
+    uint8_t chunk[CHUNK_SIZE];
+    TEST_ASSERT_EQ(msp_telemetry_pop_response_chunk(&tr, chunk), CHUNK_SIZE);
+    TEST_ASSERT(chunk[0] & CHUNK_START);
+    TEST_ASSERT_EQ(RESP_V2_VERSION(chunk[0]), MSP_VERSION_2);
+    TEST_ASSERT_EQ(chunk[0] & RESP_V2_ERROR, 0);
+    const uint8_t header[] = {0, 0x05, 0x10, 3, 0};
+    TEST_ASSERT(memcmp(&chunk[1], header, sizeof(header)) == 0);
+}
+
+static void test_response_error_flag(void)
+{
+    uint8_t chunk[CHUNK_SIZE];
+    msp_telemetry_init_output(&tr, CHUNK_SIZE);
+
+    // MSPv1 errors use bit 5
+    TEST_ASSERT(msp_transport_write(MSP_TRANSPORT(&tr), MSP_DIRECTION_TO_MWC, MSP_NAME, NULL, 0) >= 0);
+    TEST_ASSERT(msp_telemetry_pop_request_chunk(&tr, chunk) > 0);
+    const uint8_t v1_error[] = {CHUNK_START | RESP_V1_ERROR, 0, 0};
+    TEST_ASSERT(!msp_telemetry_push_response_chunk(&tr, v1_error, sizeof(v1_error)));
+
+    // MSPv2 errors use bit 7, bit 5 is part of the version
+    TEST_ASSERT(msp_transport_write(MSP_TRANSPORT(&tr), MSP_DIRECTION_TO_MWC, 0x1005, NULL, 0) >= 0);
+    TEST_ASSERT(msp_telemetry_pop_request_chunk(&tr, chunk) > 0);
+    const uint8_t v2_error[] = {CHUNK_START | (MSP_VERSION_2 << 5) | RESP_V2_ERROR, 0, 0x05, 0x10, 0, 0};
+    TEST_ASSERT(!msp_telemetry_push_response_chunk(&tr, v2_error, sizeof(v2_error)));
+
+    TEST_ASSERT(msp_transport_write(MSP_TRANSPORT(&tr), MSP_DIRECTION_TO_MWC, 0x1005, NULL, 0) >= 0);
+    TEST_ASSERT(msp_telemetry_pop_request_chunk(&tr, chunk) > 0);
+    const uint8_t v2_ok[] = {CHUNK_START | (MSP_VERSION_2 << 5), 0, 0x05, 0x10, 1, 0, 0xaa};
+    TEST_ASSERT(msp_telemetry_push_response_chunk(&tr, v2_ok, sizeof(v2_ok)));
+    msp_direction_e direction;
+    uint16_t cmd;
+    uint8_t payload[MSP_MAX_PAYLOAD_SIZE];
+    TEST_ASSERT_EQ(msp_transport_read(MSP_TRANSPORT(&tr), &direction, &cmd, payload, sizeof(payload)), 1);
+    TEST_ASSERT_EQ(cmd, 0x1005);
+    TEST_ASSERT_EQ(payload[0], 0xaa);
+}
+
+static void test_read_exact_buffer_size(void)
+{
+    msp_telemetry_init_input(&tr, CHUNK_SIZE);
+    const uint8_t req[] = {1, 2, 3, 4};
+    msp_direction_e direction;
+    uint16_t cmd;
+    uint8_t payload[sizeof(req)];
+
+    // A payload filling the whole buffer fits
+    push_request(MSP_VERSION_1, MSP_SET_NAME, req, sizeof(req));
+    TEST_ASSERT_EQ(msp_transport_read(MSP_TRANSPORT(&tr), &direction, &cmd, payload, sizeof(payload)), sizeof(req));
+    TEST_ASSERT(memcmp(payload, req, sizeof(req)) == 0);
+
+    push_request(MSP_VERSION_1, MSP_SET_NAME, req, sizeof(req));
+    TEST_ASSERT_EQ(msp_transport_read(MSP_TRANSPORT(&tr), &direction, &cmd, payload, sizeof(payload) - 1), MSP_BUF_TOO_SMALL);
+}
+
+int main(void)
+{
+    TEST_RUN(test_v1_response_flags);
+    TEST_RUN(test_v2_response_flags);
+    TEST_RUN(test_response_error_flag);
+    TEST_RUN(test_read_exact_buffer_size);
+    return 0;
+}
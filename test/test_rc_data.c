@@ -0,0 +1,57 @@
+#include <string.h>
+
+#include "rc/rc_data.h"
+
+#include "util/macros.h"
+
+#include "test.h"
+
+static int calls[RC_DATA_TELEMETRY_LISTENERS_MAX];
+
+static void listener(void *user_data, int telemetry_id, bool changed, time_micros_t now)
+{
+    calls[(int *)user_data - calls]++;
+}
+
+static void test_reopen_keeps_one_listener(void)
+{
+    static rc_data_t data;
+    memset(&data, 0, sizeof(data));
+    memset(calls, 0, sizeof(calls));
+
+    // Every slot is taken by a different listener
+    for (int ii = 0; ii < ARRAY_COUNT(calls); ii++)
+    {
+        rc_data_add_telemetry_listener(&data, listener, &calls[ii]);
+    }
+    // Reopening an input or output without closing it must not
+    // need another slot nor call its listener twice.
+    for (int ii = 0; ii < 10; ii++)
+    {
+        rc_data_add_telemetry_listener(&data, listener, &calls[0]);
+    }
+    rc_data_telemetry_did_set(&data, TELEMETRY_ID_TX_SNR, true, 1);
+    for (int ii = 0; ii < ARRAY_COUNT(calls); ii++)
+    {
+        TEST_ASSERT_EQ(calls[ii], 1);
+    }
+
+    // Open and close cycles reuse the same slot
+    for (int ii = 0; ii < 10; ii++)
+    {
+        rc_data_remove_telemetry_listener(&data, listener, &calls[1]);
+        rc_data_add_telemetry_listener(&data, listener, &calls[1]);
+    }
+    rc_data_remove_telemetry_listener(&data, listener, &calls[2]);
+    rc_data_telemetry_did_set(&data, TELEMETRY_ID_TX_SNR, false, 2);
+    TEST_ASSERT_EQ(calls[0], 2);
+    TEST_ASSERT_EQ(calls[1], 2);
+    TEST_ASSERT_EQ(calls[2], 1);
+    TEST_ASSERT_EQ(calls[3], 2);
+}
+
+int main(void)
+{
+    TEST_RUN(test_reopen_keeps_one_listener);
+    return 0;
+}
@@ -0,0 +1,447 @@
+#include <string.h>
+
+#include "air/air.h"
+#include "air/air_cmd.h"
+#include "air/air_stream.h"
+
+#include "config/config.h"
+
+#include "rmp/rmp.h"
+#include "rmp/rmp_air.h"
+
+#include "util/macros.h"
+
+#include "host.h"
+#include "test.h"
+
+// Two RMP nodes, A and B, connected by simulated P2P and RC links
+// with configurable loss. The RC link goes through rmp_air and the
+// air streams, moving a few bytes per simulated packet like the radio
+// does. Time is virtual, advanced 1ms per tick.
+
+#define TEST_PORT 0x50
+#define REPLY_PORT 0x51
+#define P2P_QUEUE_SIZE 1024
+#define RC_PACKET_INTERVAL_MS 2
+#define RC_PACKET_DATA_SIZE 3
+// From rmp_fragment_code_e in rmp.c
+#define FRAGMENT_CODE_ACK 2
+
+bool config_get_pairing(air_pairing_t *pairing, air_addr_t *addr)
+{
+    if (pairing)
+    {
+        pairing->key = 0x12345678;
+    }
+    return true;
+}
+
+static uint64_t rng_state = 88172645463325252ull;
+
+static uint32_t rng_next(void)
+{
+    rng_state ^= rng_state << 13;
+    rng_state ^= rng_state >> 7;
+    rng_state ^= rng_state << 17;
+    return rng_state;
+}
+
+static bool rng_lose(double loss)
+{
+    return rng_next() < loss * UINT32_MAX;
+}
+
+typedef struct
+{
+    rmp_msg_t msg;
+    uint8_t payload[RMP_MAX_FRAGMENT_SIZE + 32];
+    time_ticks_t at;
+} p2p_packet_t;
+
+// One direction of the P2P link, which delivers in order
+typedef struct
+{
+    rmp_t *to;
+    p2p_packet_t queue[P2P_QUEUE_SIZE];
+    unsigned head;
+    unsigned tail;
+} p2p_link_t;
+
+// One node and its end of both links
+typedef struct
+{
+    rmp_t rmp;
+    air_addr_t addr;
+    p2p_link_t p2p_out;
+    air_stream_t stream;
+    rmp_air_t rmp_air;
+    unsigned rc_seq;
+    unsigned p2p_sent;
+    unsigned rc_sent;
+    unsigned rc_rejected;
+} node_t;
+
+static node_t A;
+static node_t B;
+static double p2p_loss;
+static double rc_loss;
+static bool p2p_enabled;
+
+typedef struct
+{
+    unsigned count;
+    unsigned duplicates;
+    unsigned unauthenticated;
+    unsigned corrupted;
+    uint8_t seen[256];
+    bool reply; // Reply to each message with a fragmented one
+} receiver_t;
+
+static receiver_t B_received;
+static receiver_t A_received;
+static uint8_t big[RMP_MAX_FRAGMENTED_PAYLOAD_SIZE];
+static bool capture_ack;
+static p2p_packet_t captured_ack;
+
+static bool p2p_send(rmp_t *rmp, rmp_msg_t *msg, void *user_data)
+{
+    node_t *node = user_data;
+    if (!p2p_enabled)
+    {
+        return false;
+    }
+    TEST_ASSERT(msg->payload_size <= UINT8_MAX);
+    node->p2p_sent++;
+    if (rng_lose(p2p_loss))
+    {
+        return true;
+    }
+    if (capture_ack && node == &B && msg->dst_port == RMP_PORT_FRAGMENT &&
+        msg->payload_size > 0 && ((const uint8_t *)msg->payload)[0] == FRAGMENT_CODE_ACK)
+    {
+        // Keep the first ack, signature included, to replay it later
+        capture_ack = false;
+        captured_ack.msg = *msg;
+        memcpy(captured_ack.payload, msg->payload, msg->payload_size);
+        captured_ack.msg.payload = captured_ack.payload;
+    }
+    p2p_link_t *link = &node->p2p_out;
+    TEST_ASSERT(link->tail - link->head < P2P_QUEUE_SIZE);
+    p2p_packet_t *p = &link->queue[link->tail++ % P2P_QUEUE_SIZE];
+    p->msg = *msg;
+    if (msg->payload_size > 0)
+    {
+        memcpy(p->payload, msg->payload, msg->payload_size);
+        p->msg.payload = p->payload;
+    }
+    p->at = time_ticks_now() + 2;
+    return true;
+}
+
+static bool rc_send(rmp_t *rmp, rmp_msg_t *msg, void *user_data)
+{
+    node_t *node = user_data;
+    if (msg->dst_port == RMP_PORT_FRAGMENT)
+    {
+        TEST_ASSERT(msg->payload_size <= RMP_AIR_MAX_FRAGMENT_SIZE);
+    }
+    if (!rmp_air_encode(&node->rmp_air, msg))
+    {
+        node->rc_rejected++;
+        return false;
+    }
+    node->rc_sent++;
+    return true;
+}
+
+static void rc_cmd(void *user, air_cmd_e cmd, const void *data, size_t size, time_micros_t now)
+{
+    node_t *node = user;
+    if (cmd == AIR_CMD_RMP)
+    {
+        rmp_air_decode(&node->rmp_air, data, size);
+    }
+}
+
+static void rc_channel(void *user, unsigned chn, unsigned value, time_micros_t now)
+{
+}
+
+static void receiver_handler(rmp_t *rmp, rmp_req_t *req, void *user_data)
+{
+    receiver_t *r = user_data;
+    const uint8_t *p = req->msg->payload;
+    size_t size = req->msg->payload_size;
+    TEST_ASSERT(size > 1);
+    if (r->seen[p[0]]++)
+    {
+        r->duplicates++;
+    }
+    if (!req->is_authenticated)
+    {
+        r->unauthenticated++;
+    }
+    if (memcmp(&p[1], &big[1], size - 1) != 0)
+    {
+        r->corrupted++;
+    }
+    r->count++;
+    if (r->reply)
+    {
+        // Runs from the reassembly, so it must not hold any locks
+        TEST_ASSERT(req->resp);
+        req->resp(req->resp_data, p, size);
+    }
+}
+
+static void pump_p2p(p2p_link_t *link)
+{
+    while (link->head != link->tail && link->queue[link->head % P2P_QUEUE_SIZE].at <= time_ticks_now())
+    {
+        p2p_packet_t *p = &link->queue[link->head++ % P2P_QUEUE_SIZE];
+        rmp_process_message(link->to, &p->msg, RMP_TRANSPORT_P2P);
+    }
+}
+
+// Moves one simulated radio packet from src to dst
+static void pump_rc(node_t *src, node_t *dst)
+{
+    uint8_t buf[RC_PACKET_DATA_SIZE];
+    size_t n = air_stream_pop_output_n(&src->stream, buf, sizeof(buf));
+    memset(&buf[n], AIR_DATA_START_STOP, sizeof(buf) - n);
+    src->rc_seq = (src->rc_seq + 1) % AIR_SEQ_COUNT;
+    if (!rng_lose(rc_loss))
+    {
+        // Lost packets make the receiving stream resync
+        air_stream_feed_input(&dst->stream, src->rc_seq, buf, sizeof(buf), 0);
+    }
+}
+
+static void tick(void)
+{
+    host_clock_advance(1000);
+    time_ticks_t now = time_ticks_now();
+    pump_p2p(&A.p2p_out);
+    pump_p2p(&B.p2p_out);
+    if (now % RC_PACKET_INTERVAL_MS == 0)
+    {
+        pump_rc(&A, &B);
+        pump_rc(&B, &A);
+    }
+    if (now % 10 == 0)
+    {
+        rmp_update(&A.rmp);
+        rmp_update(&B.rmp);
+    }
+}
+
+static void ticks(unsigned count)
+{
+    for (unsigned ii = 0; ii < count; ii++)
+    {
+        tick();
+    }
+}
+
+static void node_init(node_t *node, node_t *peer, int n, bool rc)
+{
+    memset(&node->p2p_out, 0, sizeof(node->p2p_out));
+    node->p2p_out.to = &peer->rmp;
+    node->addr = (air_addr_t){.addr = {0x24, 0x0a, 0xc4, 0, 0, n}};
+    node->rc_seq = 0;
+    node->p2p_sent = 0;
+    node->rc_sent = 0;
+    node->rc_rejected = 0;
+    rmp_init(&node->rmp, &node->addr);
+    rmp_set_transport(&node->rmp, RMP_TRANSPORT_P2P, p2p_send, UINT8_MAX, node);
+    if (rc)
+    {
+        air_stream_init(&node->stream, n == 1 ? NULL : rc_channel, NULL, rc_cmd, node);
+        rmp_air_init(&node->rmp_air, &node->rmp, &node->addr, &node->stream);
+        rmp_air_set_bound_addr(&node->rmp_air, &peer->addr);
+        rmp_set_transport(&node->rmp, RMP_TRANSPORT_RC, rc_send, RMP_AIR_MAX_PAYLOAD_SIZE, node);
+        rmp_set_transport_fragments(&node->rmp, RMP_TRANSPORT_RC, RMP_AIR_MAX_FRAGMENT_SIZE, RMP_AIR_FRAGMENT_WINDOW);
+    }
+}
+
+// Sets up both nodes. With P2P, waits until they see each other.
+static void setup(bool p2p, bool rc)
+{
+    host_clock_set_virtual(1000000);
+    p2p_loss = 0;
+    rc_loss = 0;
+    p2p_enabled = p2p;
+    node_init(&A, &B, 1, rc);
+    node_init(&B, &A, 2, rc);
+    memset(&A_received, 0, sizeof(A_received));
+    memset(&B_received, 0, sizeof(B_received));
+    capture_ack = false;
+    memset(&captured_ack, 0, sizeof(captured_ack));
+    rmp_open_port(&B.rmp, TEST_PORT, receiver_handler, &B_received);
+    if (p2p)
+    {
+        ticks(600);
+        TEST_ASSERT(rmp_has_p2p_peer(&A.rmp, &B.addr));
+    }
+}
+
+// Fragmented messages A is still sending
+static int sender_in_use(void)
+{
+    int count = 0;
+    for (int ii = 0; ii < RMP_MAX_OUTGOING_FRAGMENTED; ii++)
+    {
+        if (A.rmp.internal.outgoing[ii].in_use)
+        {
+            count++;
+        }
+    }
+    return count;
+}
+
+// Sends count messages from A to B and waits for them
+static void transfer(const rmp_port_t *port, unsigned count, size_t size, unsigned timeout_ms)
+{
+    unsigned queued = 0;
+    for (unsigned ii = 0; ii < timeout_ms && (B_received.count < count || sender_in_use() > 0); ii++)
+    {
+        if (queued < count && sender_in_use() < RMP_MAX_OUTGOING_FRAGMENTED)
+        {
+            big[0] = queued;
+            if (rmp_send(&A.rmp, port, B.addr, TEST_PORT, big, size))
+            {
+                queued++;
+            }
+        }
+        tick();
+    }
+    TEST_ASSERT_EQ(queued, count);
+    TEST_ASSERT_EQ(B_received.count, count);
+    TEST_ASSERT_EQ(B_received.duplicates, 0);
+    TEST_ASSERT_EQ(B_received.unauthenticated, 0);
+    TEST_ASSERT_EQ(B_received.corrupted, 0);
+}
+
+static void test_p2p(void)
+{
+    setup(true, false);
+    const rmp_port_t *port = rmp_open_port(&A.rmp, REPLY_PORT, NULL, NULL);
+    transfer(port, 20, sizeof(big), 10000);
+}
+
+static void test_p2p_lossy(void)
+{
+    setup(true, false);
+    p2p_loss = 0.2;
+    const rmp_port_t *port = rmp_open_port(&A.rmp, REPLY_PORT, NULL, NULL);
+    transfer(port, 20, sizeof(big), 60000);
+}
+
+static void test_rc(void)
+{
+    setup(false, true);
+    const rmp_port_t *port = rmp_open_port(&A.rmp, REPLY_PORT, NULL, NULL);
+    transfer(port, 3, sizeof(big), 20000);
+    TEST_ASSERT_EQ(A.rc_rejected, 0);
+}
+
+static void test_rc_lossy(void)
+{
+    setup(false, true);
+    rc_loss = 0.01;
+    const rmp_port_t *port = rmp_open_port(&A.rmp, REPLY_PORT, NULL, NULL);
+    transfer(port, 3, sizeof(big), 60000);
+}
+
+static void test_rc_output_full(void)
+{
+    setup(false, true);
+    // Fill the air stream output, so the fragments can't be sent
+    uint8_t filler[400];
+    memset(filler, 0, sizeof(filler));
+    for (size_t size = sizeof(filler); size > 0; size /= 2)
+    {
+        while (air_stream_feed_output_cmd(&A.stream, AIR_CMD_MSP, filler, size) > 0)
+        {
+        }
+    }
+    const rmp_port_t *port = rmp_open_port(&A.rmp, REPLY_PORT, NULL, NULL);
+    big[0] = 0;
+    TEST_ASSERT(rmp_send(&A.rmp, port, B.addr, TEST_PORT, big, sizeof(big)));
+    const rmp_outgoing_t *out = &A.rmp.internal.outgoing[0];
+    TEST_ASSERT(out->in_use);
+    TEST_ASSERT(A.rc_rejected > 0);
+    TEST_ASSERT_EQ(out->in_flight, 0);
+    // Once the output drains, the fragments go out
+    ticks(10000);
+    TEST_ASSERT_EQ(B_received.count, 1);
+    TEST_ASSERT_EQ(B_received.corrupted, 0);
+    TEST_ASSERT(!out->in_use);
+}
+
+static void test_reply_from_handler(void)
+{
+    setup(true, false);
+    B_received.reply = true;
+    const rmp_port_t *port = rmp_open_port(&A.rmp, REPLY_PORT, receiver_handler, &A_received);
+    transfer(port, 2, sizeof(big), 10000);
+    ticks(1000);
+    TEST_ASSERT_EQ(A_received.count, 2);
+    TEST_ASSERT_EQ(A_received.corrupted, 0);
+}
+
+static void test_acks_reordered_across_transports(void)
+{
+    setup(true, false);
+    capture_ack = true;
+    const rmp_port_t *port = rmp_open_port(&A.rmp, REPLY_PORT, NULL, NULL);
+    big[0] = 0;
+    TEST_ASSERT(rmp_send(&A.rmp, port, B.addr, TEST_PORT, big, sizeof(big)));
+    const rmp_outgoing_t *out = &A.rmp.internal.outgoing[0];
+    for (int ii = 0; ii < 100 && __builtin_popcount(out->acked) < 2; ii++)
+    {
+        tick();
+    }
+    TEST_ASSERT(out->in_use);
+    TEST_ASSERT(captured_ack.msg.payload_size > 0);
+    TEST_ASSERT(__builtin_popcount(out->acked) >= 2);
+    // The first ack arriving late via another transport must not look
+    // like the receiver dropped the fragments it had.
+    uint32_t acked = out->acked;
+    uint32_t in_flight = out->in_flight;
+    rmp_process_message(&A.rmp, &captured_ack.msg, RMP_TRANSPORT_RC);
+    TEST_ASSERT_EQ(out->acked, acked);
+    TEST_ASSERT_EQ(out->in_flight, in_flight);
+    ticks(1000);
+    TEST_ASSERT(!out->in_use);
+    TEST_ASSERT_EQ(B_received.count, 1);
+    TEST_ASSERT_EQ(B_received.duplicates, 0);
+}
+
+static void test_dead_link(void)
+{
+    setup(true, false);
+    p2p_loss = 1;
+    const rmp_port_t *port = rmp_open_port(&A.rmp, REPLY_PORT, NULL, NULL);
+    TEST_ASSERT(rmp_send(&A.rmp, port, B.addr, TEST_PORT, big, sizeof(big)));
+    TEST_ASSERT_EQ(sender_in_use(), 1);
+    ticks(20000);
+    TEST_ASSERT_EQ(sender_in_use(), 0);
+}
+
+int main(void)
+{
+    for (int ii = 0; ii < ARRAY_COUNT(big); ii++)
+    {
+        big[ii] = ii * 7 + 3;
+    }
+    TEST_RUN(test_p2p);
+    TEST_RUN(test_p2p_lossy);
+    TEST_RUN(test_rc);
+    TEST_RUN(test_rc_lossy);
+    TEST_RUN(test_rc_output_full);
+    TEST_RUN(test_reply_from_handler);
+    TEST_RUN(test_acks_reordered_across_transports);
+    TEST_RUN(test_dead_link);
+    return 0;
+}
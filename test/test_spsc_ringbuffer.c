@@ -0,0 +1,227 @@
+#include <limits.h>
+#include <pthread.h>
+#include <sched.h>
+#include <stdint.h>
+#include <string.h>
+
+#include "util/macros.h"
+#include "util/spsc_ringbuffer.h"
+
+#include "test.h"
+
+// Single threaded checks of the wrap around paths, followed by a
+// producer and a consumer thread hammering a small buffer with every
+// push and pop variant. Items carry a checksum of their sequence
+// number, so torn or reordered items are detected.
+
+#define CAPACITY 64
+#define STRESS_ITEMS 10000000
+#define MAX_BATCH (CAPACITY + CAPACITY / 2)
+// Failed polls before yielding. Spinning keeps both threads running
+// at the same time, which is when races show up.
+#define SPINS_BEFORE_YIELD 100
+
+typedef struct
+{
+    uint32_t seq;
+    uint32_t check;
+} item_t;
+
+static SPSC_RING_BUFFER_DECLARE(rb, item_t, CAPACITY) items;
+static SPSC_RING_BUFFER_DECLARE(rb, uint8_t, 8) bytes;
+
+static uint32_t item_check(uint32_t seq)
+{
+    return (seq * 2654435761u) ^ 0xa5a5a5a5;
+}
+
+static item_t item_make(uint32_t seq)
+{
+    return (item_t){.seq = seq, .check = item_check(seq)};
+}
+
+static uint32_t rng_next(uint64_t *state)
+{
+    *state ^= *state << 13;
+    *state ^= *state >> 7;
+    *state ^= *state << 17;
+    return *state;
+}
+
+static void test_push_pop(void)
+{
+    SPSC_RING_BUFFER_INIT(&bytes.rb, uint8_t, 8);
+    uint8_t c;
+    TEST_ASSERT(!spsc_ring_buffer_pop(&bytes.rb, &c));
+    for (int ii = 0; ii < 8; ii++)
+    {
+        c = ii;
+        TEST_ASSERT(spsc_ring_buffer_push(&bytes.rb, &c));
+    }
+    TEST_ASSERT(!spsc_ring_buffer_push(&bytes.rb, &c));
+    TEST_ASSERT_EQ(spsc_ring_buffer_count(&bytes.rb), 8);
+    for (int ii = 0; ii < 8; ii++)
+    {
+        TEST_ASSERT(spsc_ring_buffer_pop(&bytes.rb, &c));
+        TEST_ASSERT_EQ(c, ii);
+    }
+    TEST_ASSERT_EQ(spsc_ring_buffer_count(&bytes.rb), 0);
+}
+
+static void test_bulk_wrap_around(void)
+{
+    SPSC_RING_BUFFER_INIT(&bytes.rb, uint8_t, 8);
+    const uint8_t in[] = {1, 2, 3, 4, 5, 6, 7, 8, 9, 10};
+    uint8_t out[10];
+    TEST_ASSERT_EQ(spsc_ring_buffer_push_n(&bytes.rb, in, 5), 5);
+    TEST_ASSERT_EQ(spsc_ring_buffer_pop_n(&bytes.rb, out, 5), 5);
+
+    // Only the free space is used, wrapping around the end
+    TEST_ASSERT_EQ(spsc_ring_buffer_push_n(&bytes.rb, in, 10), 8);
+    TEST_ASSERT_EQ(spsc_ring_buffer_push_n(&bytes.rb, in, 1), 0);
+    size_t count;
+    const uint8_t *data = spsc_ring_buffer_peek_contiguous(&bytes.rb, &count);
+    TEST_ASSERT(data != NULL);
+    TEST_ASSERT_EQ(count, 3);
+    TEST_ASSERT(memcmp(data, in, 3) == 0);
+    spsc_ring_buffer_discard_n(&bytes.rb, 2);
+    data = spsc_ring_buffer_peek_contiguous(&bytes.rb, &count);
+    TEST_ASSERT_EQ(count, 1);
+    TEST_ASSERT_EQ(data[0], 3);
+    spsc_ring_buffer_discard_n(&bytes.rb, 1);
+    data = spsc_ring_buffer_peek_contiguous(&bytes.rb, &count);
+    TEST_ASSERT_EQ(count, 5);
+    TEST_ASSERT_EQ(data[0], 4);
+
+    // Discarding more than available only empties it
+    spsc_ring_buffer_discard_n(&bytes.rb, 100);
+    TEST_ASSERT(spsc_ring_buffer_peek_contiguous(&bytes.rb, &count) == NULL);
+    TEST_ASSERT_EQ(count, 0);
+
+    TEST_ASSERT_EQ(spsc_ring_buffer_push_n(&bytes.rb, in, 6), 6);
+    memset(out, 0, sizeof(out));
+    TEST_ASSERT_EQ(spsc_ring_buffer_pop_n(&bytes.rb, out, 10), 6);
+    TEST_ASSERT(memcmp(out, in, 6) == 0);
+    TEST_ASSERT_EQ(spsc_ring_buffer_push_n(&bytes.rb, in, 3), 3);
+    spsc_ring_buffer_empty(&bytes.rb);
+    TEST_ASSERT_EQ(spsc_ring_buffer_count(&bytes.rb), 0);
+    TEST_ASSERT_EQ(spsc_ring_buffer_pop_n(&bytes.rb, out, 10), 0);
+}
+
+static void test_index_overflow(void)
+{
+    // Indexes are free running, so they eventually overflow
+    SPSC_RING_BUFFER_INIT(&bytes.rb, uint8_t, 8);
+    bytes.rb.head = UINT_MAX - 2;
+    bytes.rb.tail = UINT_MAX - 2;
+    const uint8_t in[] = {1, 2, 3, 4, 5, 6, 7, 8};
+    uint8_t out[8];
+    for (int ii = 0; ii < 4; ii++)
+    {
+        TEST_ASSERT_EQ(spsc_ring_buffer_push_n(&bytes.rb, in, 8), 8);
+        TEST_ASSERT_EQ(spsc_ring_buffer_count(&bytes.rb), 8);
+        TEST_ASSERT_EQ(spsc_ring_buffer_push_n(&bytes.rb, in, 1), 0);
+        TEST_ASSERT_EQ(spsc_ring_buffer_pop_n(&bytes.rb, out, 5), 5);
+        TEST_ASSERT_EQ(spsc_ring_buffer_pop_n(&bytes.rb, out + 5, 5), 3);
+        TEST_ASSERT(memcmp(out, in, 8) == 0);
+    }
+    TEST_ASSERT(bytes.rb.head < 32);
+}
+
+static void *stress_producer(void *arg)
+{
+    uint64_t rng = 88172645463325252ull;
+    item_t batch[MAX_BATCH];
+    uint32_t seq = 0;
+    while (seq < STRESS_ITEMS)
+    {
+        size_t n = MIN(1 + rng_next(&rng) % MAX_BATCH, STRESS_ITEMS - seq);
+        for (size_t ii = 0; ii < n; ii++)
+        {
+            batch[ii] = item_make(seq + ii);
+        }
+        size_t pushed = 0;
+        unsigned spins = 0;
+        while (pushed < n)
+        {
+            size_t p;
+            if (n - pushed == 1 || rng_next(&rng) % 4 == 0)
+            {
+                p = spsc_ring_buffer_push(&items.rb, &batch[pushed]) ? 1 : 0;
+            }
+            else
+            {
+                p = spsc_ring_buffer_push_n(&items.rb, &batch[pushed], n - pushed);
+            }
+            TEST_ASSERT(spsc_ring_buffer_count(&items.rb) <= CAPACITY);
+            if (p == 0 && ++spins % SPINS_BEFORE_YIELD == 0)
+            {
+                sched_yield();
+            }
+            pushed += p;
+        }
+        seq += n;
+    }
+    return NULL;
+}
+
+static void test_stress_threads(void)
+{
+    SPSC_RING_BUFFER_INIT(&items.rb, item_t, CAPACITY);
+    pthread_t producer;
+    TEST_ASSERT(pthread_create(&producer, NULL, stress_producer, NULL) == 0);
+
+    uint64_t rng = 0x2545f4914f6cdd1dull;
+    item_t batch[MAX_BATCH];
+    uint32_t expected = 0;
+    unsigned spins = 0;
+    while (expected < STRESS_ITEMS)
+    {
+        size_t n = 0;
+        const item_t *data = NULL;
+        switch (rng_next(&rng) % 3)
+        {
+        case 0:
+            n = spsc_ring_buffer_pop(&items.rb, batch) ? 1 : 0;
+            data = batch;
+            break;
+        case 1:
+            n = spsc_ring_buffer_pop_n(&items.rb, batch, 1 + rng_next(&rng) % MAX_BATCH);
+            data = batch;
+            break;
+        case 2:
+        {
+            size_t available;
+            data = spsc_ring_buffer_peek_contiguous(&items.rb, &available);
+            // Consume only part of them sometimes
+            n = available > 0 ? 1 + rng_next(&rng) % available : 0;
+            break;
+        }
+        }
+        for (size_t ii = 0; ii < n; ii++)
+        {
+            TEST_ASSERT_EQ(data[ii].seq, expected);
+            TEST_ASSERT_EQ(data[ii].check, item_check(expected));
+            expected++;
+        }
+        if (data != batch && n > 0)
+        {
+            spsc_ring_buffer_discard_n(&items.rb, n);
+        }
+        if (n == 0 && ++spins % SPINS_BEFORE_YIELD == 0)
+        {
+            sched_yield();
+        }
+    }
+    TEST_ASSERT(pthread_join(producer, NULL) == 0);
+    TEST_ASSERT_EQ(spsc_ring_buffer_count(&items.rb), 0);
+}
+
+int main(void)
+{
+    TEST_RUN(test_push_pop);
+    TEST_RUN(test_bulk_wrap_around);
+    TEST_RUN(test_index_overflow);
+    TEST_RUN(test_stress_threads);
+    return 0;
+}
@@ -0,0 +1,204 @@
+#include <string.h>
+
+#include "bluetooth/telemetry_stream.h"
+
+#include "rc/rc_data.h"
+
+#include "util/time.h"
+
+#include "test.h"
+
+#define BUF_SIZE 256
+
+static rc_data_t data;
+static telemetry_stream_t stream;
+static uint8_t buf[BUF_SIZE];
+
+static void setup(const uint8_t *subscriptions, size_t size)
+{
+    memset(&data, 0, sizeof(data));
+    telemetry_stream_init(&stream);
+    TEST_ASSERT(telemetry_stream_configure(&stream, subscriptions, size));
+}
+
+static size_t encode(size_t size, time_micros_t now)
+{
+    memset(buf, 0xee, sizeof(buf));
+    return telemetry_stream_encode(&stream, &data, buf, size, now);
+}
+
+static void test_record_format(void)
+{
+    const uint8_t subs[] = {
+        TELEMETRY_ID_RX_SNR, 0,
+        TELEMETRY_ID_CRAFT_NAME, 0,
+        TELEMETRY_ID_CURRENT_DRAWN, 0,
+        TELEMETRY_ID_BAT_VOLTAGE, 0,
+    };
+    setup(subs, sizeof(subs));
+    TEST_ASSERT(telemetry_stream_has_subscriptions(&stream));
+    time_micros_t now = SECS_TO_MICROS(1);
+    (void)TELEMETRY_SET_STR(&data, TELEMETRY_ID_CRAFT_NAME, "Raven", now);
+    (void)TELEMETRY_SET_U16(&data, TELEMETRY_ID_BAT_VOLTAGE, 0x0642, now);
+    (void)TELEMETRY_SET_I32(&data, TELEMETRY_ID_CURRENT_DRAWN, -2, now);
+    (void)TELEMETRY_SET_I8(&data, TELEMETRY_ID_RX_SNR, -20, now);
+
+    // Records follow the id order, not the subscription one
+    const uint8_t expected[] = {
+        TELEMETRY_ID_CRAFT_NAME, 5, 'R', 'a', 'v', 'e', 'n',
+        TELEMETRY_ID_BAT_VOLTAGE, 0x42, 0x06,
+        TELEMETRY_ID_CURRENT_DRAWN, 0xfe, 0xff, 0xff, 0xff,
+        TELEMETRY_ID_RX_SNR, (uint8_t)-20,
+    };
+    TEST_ASSERT_EQ(encode(BUF_SIZE, now), sizeof(expected));
+    TEST_ASSERT(memcmp(buf, expected, sizeof(expected)) == 0);
+}
+
+static void test_only_changes_are_sent(void)
+{
+    const uint8_t subs[] = {
+        TELEMETRY_ID_BAT_VOLTAGE, 0,
+        TELEMETRY_ID_ALTITUDE, 0,
+        TELEMETRY_ID_HEADING, 0,
+    };
+    setup(subs, sizeof(subs));
+    time_micros_t now = SECS_TO_MICROS(1);
+    // Subscribed but without a value yet
+    TEST_ASSERT_EQ(encode(BUF_SIZE, now), 0);
+    (void)TELEMETRY_SET_U16(&data, TELEMETRY_ID_BAT_VOLTAGE, 1200, now);
+    (void)TELEMETRY_SET_I32(&data, TELEMETRY_ID_ALTITUDE, 500, now);
+    // Not subscribed
+    (void)TELEMETRY_SET_I8(&data, TELEMETRY_ID_RX_SNR, 10, now);
+    TEST_ASSERT_EQ(encode(BUF_SIZE, now), 3 + 5);
+    TEST_ASSERT_EQ(encode(BUF_SIZE, now), 0);
+
+    // Setting the same value again is not a change
+    now += MILLIS_TO_MICROS(10);
+    (void)TELEMETRY_SET_U16(&data, TELEMETRY_ID_BAT_VOLTAGE, 1200, now);
+    TEST_ASSERT_EQ(encode(BUF_SIZE, now), 0);
+
+    now += MILLIS_TO_MICROS(10);
+    (void)TELEMETRY_SET_I32(&data, TELEMETRY_ID_ALTITUDE, 501, now);
+    TEST_ASSERT_EQ(encode(BUF_SIZE, now), 5);
+    TEST_ASSERT_EQ(buf[0], TELEMETRY_ID_ALTITUDE);
+    TEST_ASSERT_EQ(buf[1], 501 & 0xff);
+    TEST_ASSERT_EQ(buf[2], 501 >> 8);
+
+    // A new client gets every value again
+    telemetry_stream_reset(&stream);
+    TEST_ASSERT_EQ(encode(BUF_SIZE, now), 3 + 5);
+}
+
+static void test_interval(void)
+{
+    const uint8_t subs[] = {
+        TELEMETRY_ID_ALTITUDE, 5, // 50ms
+        TELEMETRY_ID_BAT_VOLTAGE, 0,
+    };
+    setup(subs, sizeof(subs));
+    time_micros_t now = SECS_TO_MICROS(1);
+    (void)TELEMETRY_SET_I32(&data, TELEMETRY_ID_ALTITUDE, 100, now);
+    TEST_ASSERT_EQ(encode(BUF_SIZE, now), 5);
+
+    // Changes before the interval are held back, the ones without an
+    // interval are not
+    now += MILLIS_TO_MICROS(10);
+    (void)TELEMETRY_SET_I32(&data, TELEMETRY_ID_ALTITUDE, 101, now);
+    (void)TELEMETRY_SET_U16(&data, TELEMETRY_ID_BAT_VOLTAGE, 1200, now);
+    TEST_ASSERT_EQ(encode(BUF_SIZE, now), 3);
+    TEST_ASSERT_EQ(buf[0], TELEMETRY_ID_BAT_VOLTAGE);
+    now += MILLIS_TO_MICROS(20);
+    (void)TELEMETRY_SET_I32(&data, TELEMETRY_ID_ALTITUDE, 102, now);
+    TEST_ASSERT_EQ(encode(BUF_SIZE, now), 0);
+    now = SECS_TO_MICROS(1) + MILLIS_TO_MICROS(49);
+    TEST_ASSERT_EQ(encode(BUF_SIZE, now), 0);
+
+    // Only the latest value is sent
+    now = SECS_TO_MICROS(1) + MILLIS_TO_MICROS(50);
+    TEST_ASSERT_EQ(encode(BUF_SIZE, now), 5);
+    TEST_ASSERT_EQ(buf[0], TELEMETRY_ID_ALTITUDE);
+    TEST_ASSERT_EQ(buf[1], 102);
+
+    // No change, nothing is sent after the interval either
+    now += MILLIS_TO_MICROS(100);
+    TEST_ASSERT_EQ(encode(BUF_SIZE, now), 0);
+}
+
+static void test_full_buffer(void)
+{
+    const uint8_t subs[] = {TELEMETRY_STREAM_ALL_IDS, 0};
+    setup(subs, sizeof(subs));
+    time_micros_t now = SECS_TO_MICROS(1);
+    (void)TELEMETRY_SET_U16(&data, TELEMETRY_ID_BAT_VOLTAGE, 1, now);
+    (void)TELEMETRY_SET_U16(&data, TELEMETRY_ID_AVG_CELL_VOLTAGE, 2, now);
+    (void)TELEMETRY_SET_U16(&data, TELEMETRY_ID_HEADING, 3, now);
+
+    // Records are never split, the rest are sent in the next calls
+    TEST_ASSERT_EQ(encode(5, now), 3);
+    TEST_ASSERT_EQ(buf[0], TELEMETRY_ID_BAT_VOLTAGE);
+    TEST_ASSERT_EQ(buf[3], 0xee);
+    TEST_ASSERT_EQ(encode(5, now), 3);
+    TEST_ASSERT_EQ(buf[0], TELEMETRY_ID_AVG_CELL_VOLTAGE);
+    TEST_ASSERT_EQ(encode(5, now), 3);
+    TEST_ASSERT_EQ(buf[0], TELEMETRY_ID_HEADING);
+    TEST_ASSERT_EQ(encode(5, now), 0);
+}
+
+static void test_long_string_truncated(void)
+{
+    const uint8_t subs[] = {TELEMETRY_ID_FLIGHT_MODE_NAME, 0, TELEMETRY_ID_TX_LINK_QUALITY, 0};
+    setup(subs, sizeof(subs));
+    time_micros_t now = SECS_TO_MICROS(1);
+    (void)TELEMETRY_SET_I8(&data, TELEMETRY_ID_TX_LINK_QUALITY, 100, now);
+    (void)TELEMETRY_SET_STR(&data, TELEMETRY_ID_FLIGHT_MODE_NAME, "ANGLE AIRMODE", now);
+
+    // Doesn't fit after the other record, goes in the next buffer
+    // truncated to the buffer size.
+    TEST_ASSERT_EQ(encode(8, now), 2);
+    TEST_ASSERT_EQ(buf[0], TELEMETRY_ID_TX_LINK_QUALITY);
+    TEST_ASSERT_EQ(encode(8, now), 8);
+    TEST_ASSERT_EQ(buf[0], TELEMETRY_ID_FLIGHT_MODE_NAME);
+    TEST_ASSERT_EQ(buf[1], 6);
+    TEST_ASSERT(memcmp(&buf[2], "ANGLE ", 6) == 0);
+    TEST_ASSERT_EQ(encode(8, now), 0);
+}
+
+static void test_configure(void)
+{
+    const uint8_t subs[] = {TELEMETRY_ID_BAT_VOLTAGE, 0};
+    setup(subs, sizeof(subs));
+    time_micros_t now = SECS_TO_MICROS(1);
+    (void)TELEMETRY_SET_U16(&data, TELEMETRY_ID_BAT_VOLTAGE, 1, now);
+    (void)TELEMETRY_SET_I8(&data, TELEMETRY_ID_RX_SNR, 2, now);
+
+    // Invalid configurations leave the subscriptions untouched
+    const uint8_t odd[] = {TELEMETRY_ID_RX_SNR, 0, TELEMETRY_ID_ALTITUDE};
+    TEST_ASSERT(!telemetry_stream_configure(&stream, odd, sizeof(odd)));
+    const uint8_t unknown[] = {TELEMETRY_ID_RX_SNR, 0, TELEMETRY_DOWNLINK_COUNT, 0};
+    TEST_ASSERT(!telemetry_stream_configure(&stream, unknown, sizeof(unknown)));
+    TEST_ASSERT_EQ(encode(BUF_SIZE, now), 3);
+    TEST_ASSERT_EQ(buf[0], TELEMETRY_ID_BAT_VOLTAGE);
+
+    // Replaces the previous ones
+    const uint8_t other[] = {TELEMETRY_ID_RX_SNR, 0};
+    TEST_ASSERT(telemetry_stream_configure(&stream, other, sizeof(other)));
+    TEST_ASSERT_EQ(encode(BUF_SIZE, now), 2);
+    TEST_ASSERT_EQ(buf[0], TELEMETRY_ID_RX_SNR);
+
+    // An empty list stops the stream
+    TEST_ASSERT(telemetry_stream_configure(&stream, NULL, 0));
+    TEST_ASSERT(!telemetry_stream_has_subscriptions(&stream));
+    (void)TELEMETRY_SET_I8(&data, TELEMETRY_ID_RX_SNR, 3, now);
+    TEST_ASSERT_EQ(encode(BUF_SIZE, now), 0);
+}
+
+int main(void)
+{
+    TEST_RUN(test_record_format);
+    TEST_RUN(test_only_changes_are_sent);
+    TEST_RUN(test_interval);
+    TEST_RUN(test_full_buffer);
+    TEST_RUN(test_long_string_truncated);
+    TEST_RUN(test_configure);
+    return 0;
+}
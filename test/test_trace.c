@@ -0,0 +1,181 @@
+#include <stdint.h>
+#include <string.h>
+
+#include "util/time.h"
+#include "util/trace.h"
+
+#include "host.h"
+#include "test.h"
+
+// Feeds tracepoints at known times using the virtual clock and checks
+// the per stage histograms decoded by trace_update(). The decoder state
+// is global, so each test compares against the histograms it started with.
+
+static time_micros_t now;
+
+static void trace_at(trace_point_e point, time_micros_t at)
+{
+    TEST_ASSERT(at >= now);
+    now = at;
+    host_clock_set_virtual(now);
+    trace_record(point);
+}
+
+static void histograms_get(trace_histogram_t *h)
+{
+    for (int ii = 0; ii < TRACE_POINT_COUNT; ii++)
+    {
+        trace_get_histogram(ii, &h[ii]);
+    }
+}
+
+static void test_stage_deltas(void)
+{
+    trace_histogram_t before[TRACE_POINT_COUNT];
+    trace_histogram_t after[TRACE_POINT_COUNT];
+    histograms_get(before);
+
+    time_micros_t t = now + 1000;
+    trace_at(TRACE_POINT_LORA_DIO0, t);
+    trace_at(TRACE_POINT_LORA_CALLBACK, t + 30);
+    trace_at(TRACE_POINT_AIR_DECODED, t + 130);
+    trace_at(TRACE_POINT_CHANNELS_UPDATED, t + 131);
+    trace_at(TRACE_POINT_OUTPUT_FRAME, t + 2131);
+    trace_update();
+    histograms_get(after);
+
+    // DIO0 starts a packet, so it never has a delta
+    TEST_ASSERT_EQ(after[TRACE_POINT_LORA_DIO0].count, 0);
+    static const struct
+    {
+        trace_point_e point;
+        uint32_t delta;
+        unsigned bucket;
+    } stages[] = {
+        {TRACE_POINT_LORA_CALLBACK, 30, 4},
+        {TRACE_POINT_AIR_DECODED, 100, 6},
+        {TRACE_POINT_CHANNELS_UPDATED, 1, 0},
+        {TRACE_POINT_OUTPUT_FRAME, 2000, 10},
+    };
+    for (unsigned ii = 0; ii < sizeof(stages) / sizeof(stages[0]); ii++)
+    {
+        const trace_histogram_t *b = &before[stages[ii].point];
+        const trace_histogram_t *a = &after[stages[ii].point];
+        TEST_ASSERT_EQ(a->count, b->count + 1);
+        TEST_ASSERT_EQ(a->sum, b->sum + stages[ii].delta);
+        TEST_ASSERT_EQ(a->buckets[stages[ii].bucket], b->buckets[stages[ii].bucket] + 1);
+        TEST_ASSERT_EQ(a->min, stages[ii].delta);
+        TEST_ASSERT_EQ(a->max, stages[ii].delta);
+    }
+}
+
+static void test_timestamp_wraps(void)
+{
+    trace_histogram_t before[TRACE_POINT_COUNT];
+    trace_histogram_t after[TRACE_POINT_COUNT];
+    histograms_get(before);
+
+    // Bits above the timestamp must not leak into the point and the
+    // delta is taken modulo the timestamp bits.
+    time_micros_t wrap = ((now >> 28) + 3) << 28;
+    trace_at(TRACE_POINT_LORA_DIO0, wrap - 5);
+    trace_at(TRACE_POINT_LORA_CALLBACK, wrap + 10);
+    // Larger than the last bucket
+    trace_at(TRACE_POINT_AIR_DECODED, wrap + 10 + (1 << 20));
+    trace_update();
+    histograms_get(after);
+
+    const trace_histogram_t *cb = &after[TRACE_POINT_LORA_CALLBACK];
+    TEST_ASSERT_EQ(cb->count, before[TRACE_POINT_LORA_CALLBACK].count + 1);
+    TEST_ASSERT_EQ(cb->sum, before[TRACE_POINT_LORA_CALLBACK].sum + 15);
+    TEST_ASSERT_EQ(cb->buckets[3], before[TRACE_POINT_LORA_CALLBACK].buckets[3] + 1);
+    const trace_histogram_t *dec = &after[TRACE_POINT_AIR_DECODED];
+    TEST_ASSERT_EQ(dec->count, before[TRACE_POINT_AIR_DECODED].count + 1);
+    TEST_ASSERT_EQ(dec->max, 1 << 20);
+    TEST_ASSERT_EQ(dec->buckets[TRACE_HISTOGRAM_BUCKETS - 1],
+                   before[TRACE_POINT_AIR_DECODED].buckets[TRACE_HISTOGRAM_BUCKETS - 1] + 1);
+    TEST_ASSERT_EQ(after[TRACE_POINT_LORA_DIO0].count, 0);
+}
+
+static void test_out_of_order_stages(void)
+{
+    trace_histogram_t before[TRACE_POINT_COUNT];
+    trace_histogram_t after[TRACE_POINT_COUNT];
+    histograms_get(before);
+
+    time_micros_t t = now + 1000;
+    // Output frame without a new packet
+    trace_at(TRACE_POINT_OUTPUT_FRAME, t);
+    // Skipped stage, then the rest of the packet doesn't count
+    trace_at(TRACE_POINT_LORA_DIO0, t + 100);
+    trace_at(TRACE_POINT_AIR_DECODED, t + 200);
+    trace_at(TRACE_POINT_CHANNELS_UPDATED, t + 300);
+    // A new packet resets the sequence
+    trace_at(TRACE_POINT_LORA_DIO0, t + 1000);
+    trace_at(TRACE_POINT_LORA_CALLBACK, t + 1040);
+    trace_update();
+    histograms_get(after);
+
+    TEST_ASSERT_EQ(after[TRACE_POINT_OUTPUT_FRAME].count, before[TRACE_POINT_OUTPUT_FRAME].count);
+    TEST_ASSERT_EQ(after[TRACE_POINT_AIR_DECODED].count, before[TRACE_POINT_AIR_DECODED].count);
+    TEST_ASSERT_EQ(after[TRACE_POINT_CHANNELS_UPDATED].count, before[TRACE_POINT_CHANNELS_UPDATED].count);
+    TEST_ASSERT_EQ(after[TRACE_POINT_LORA_CALLBACK].count, before[TRACE_POINT_LORA_CALLBACK].count + 1);
+    TEST_ASSERT_EQ(after[TRACE_POINT_LORA_CALLBACK].sum, before[TRACE_POINT_LORA_CALLBACK].sum + 40);
+}
+
+static void test_ring_overflow(void)
+{
+    trace_histogram_t before;
+    trace_histogram_t after;
+    // A packet in progress when the ring wraps must be dropped
+    trace_at(TRACE_POINT_LORA_DIO0, now + 1000);
+    trace_update();
+    trace_get_histogram(TRACE_POINT_LORA_CALLBACK, &before);
+    unsigned overflows = trace_get_overflows();
+
+    // Two entries per packet plus a trailing DIO0, 5 entries more
+    // than the ring holds. The oldest entry left in the ring is the
+    // CALLBACK of a packet whose DIO0 was overwritten.
+    unsigned packets = TRACE_RING_SIZE / 2 + 2;
+    for (unsigned ii = 0; ii < packets; ii++)
+    {
+        trace_at(TRACE_POINT_LORA_DIO0, now + 1000);
+        trace_at(TRACE_POINT_LORA_CALLBACK, now + 20);
+    }
+    trace_at(TRACE_POINT_LORA_DIO0, now + 1000);
+    trace_update();
+    trace_get_histogram(TRACE_POINT_LORA_CALLBACK, &after);
+
+    TEST_ASSERT_EQ(trace_get_overflows(), overflows + 1);
+    // Only the complete packets still in the ring are decoded
+    TEST_ASSERT_EQ(after.count, before.count + TRACE_RING_SIZE / 2 - 1);
+    TEST_ASSERT_EQ(after.sum, before.sum + 20 * (TRACE_RING_SIZE / 2 - 1));
+
+    // Nothing new, nothing decoded
+    trace_update();
+    trace_get_histogram(TRACE_POINT_LORA_CALLBACK, &before);
+    TEST_ASSERT_EQ(before.count, after.count);
+    TEST_ASSERT_EQ(trace_get_overflows(), overflows + 1);
+}
+
+static void test_print(void)
+{
+    // The first update schedules the print, the next one past the
+    // interval prints the histograms.
+    host_clock_set_virtual(now += SECS_TO_MICROS(20));
+    trace_update();
+    host_clock_set_virtual(now += SECS_TO_MICROS(20));
+    trace_update();
+}
+
+int main(void)
+{
+    now = SECS_TO_MICROS(1);
+    host_clock_set_virtual(now);
+    TEST_RUN(test_stage_deltas);
+    TEST_RUN(test_timestamp_wraps);
+    TEST_RUN(test_out_of_order_stages);
+    TEST_RUN(test_ring_overflow);
+    TEST_RUN(test_print);
+    return 0;
+}